@@ -0,0 +1,142 @@
+#include "arena.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every allocation is aligned for any type
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+struct ArenaChunk {
+    ArenaChunk* next;
+    size_t used;
+    size_t capacity;
+    _Alignas(max_align_t) unsigned char data[];
+};
+
+void init_arena(Arena* arena, size_t chunk_size) {
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size == 0 ? ARENA_CHUNK_SIZE : chunk_size;
+    arena->chunk_count = 0;
+    arena->allocated = 0;
+    arena->out_of_memory = 0;
+}
+
+static ArenaChunk* add_chunk(Arena* arena, size_t size) {
+    size_t capacity = size > arena->chunk_size ? size : arena->chunk_size;
+    ArenaChunk* chunk = capacity <= SIZE_MAX - sizeof(ArenaChunk) ? mem_alloc(sizeof(ArenaChunk) + capacity) : NULL;
+    if (chunk == NULL) {
+        arena->out_of_memory = 1;
+        return NULL;
+    }
+
+    chunk->next = arena->chunks;
+    chunk->used = 0;
+    chunk->capacity = capacity;
+    arena->chunks = chunk;
+    arena->chunk_count++;
+    return chunk;
+}
+
+// Returns uninitialized memory for the given number of bytes, or NULL if it
+// does not fit in memory
+void* arena_alloc(Arena* arena, size_t size) {
+    if (size > SIZE_MAX - ARENA_ALIGNMENT) {
+        arena->out_of_memory = 1;
+        return NULL;
+    }
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaChunk* chunk = arena->chunks;
+    if (chunk == NULL || chunk->capacity - chunk->used < size) {
+        chunk = add_chunk(arena, size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+
+    void* memory = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+    return memory;
+}
+
+void* arena_copy(Arena* arena, const void* data, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    void* copy = arena_alloc(arena, size);
+    if (copy != NULL) {
+        memcpy(copy, data, size);
+    }
+    return copy;
+}
+
+ArenaMark arena_mark(const Arena* arena) {
+    ArenaMark mark;
+    mark.chunk = arena->chunks;
+    mark.used = arena->chunks != NULL ? arena->chunks->used : 0;
+    mark.allocated = arena->allocated;
+    return mark;
+}
+
+// Releases everything allocated since the mark was taken
+void arena_rewind(Arena* arena, ArenaMark mark) {
+    while (arena->chunks != mark.chunk) {
+        ArenaChunk* next = arena->chunks->next;
+        mem_free(arena->chunks);
+        arena->chunks = next;
+        arena->chunk_count--;
+    }
+
+    if (arena->chunks != NULL) {
+        arena->chunks->used = mark.used;
+    }
+    arena->allocated = mark.allocated;
+}
+
+// Moves every chunk of the other arena into this one, leaving the other empty
+// Used to gather trees built in separate arenas (one per thread) under a single
+// owner. The chunks go behind the current chunk, so allocation carries on
+// where it was.
+void arena_adopt(Arena* arena, Arena* other) {
+    arena->out_of_memory |= other->out_of_memory;
+    other->out_of_memory = 0;
+    if (other->chunks == NULL) {
+        return;
+    }
+
+    ArenaChunk* last = other->chunks;
+    while (last->next != NULL) {
+        last = last->next;
+    }
+
+    if (arena->chunks == NULL) {
+        arena->chunks = other->chunks;
+    } else {
+        last->next = arena->chunks->next;
+        arena->chunks->next = other->chunks;
+    }
+
+    arena->chunk_count += other->chunk_count;
+    arena->allocated += other->allocated;
+
+    other->chunks = NULL;
+    other->chunk_count = 0;
+    other->allocated = 0;
+}
+
+void free_arena(Arena* arena) {
+    ArenaChunk* chunk = arena->chunks;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        mem_free(chunk);
+        chunk = next;
+    }
+
+    arena->chunks = NULL;
+    arena->chunk_count = 0;
+    arena->allocated = 0;
+    arena->out_of_memory = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Default size of an arena chunk, larger allocations get a chunk of their own
+#define ARENA_CHUNK_SIZE 65536
+
+// Forward declaration of the chunks backing an arena
+typedef struct ArenaChunk ArenaChunk;
+
+// Structure to hold a bump pointer arena
+// Allocations are carved out of large chunks and are never freed on their own,
+// the whole arena is released at once by free_arena. An allocation that does
+// not fit in memory returns NULL and marks the arena, so code that builds a
+// whole tree out of it can check once at the end instead of after every node.
+typedef struct {
+    ArenaChunk* chunks; // Current chunk first
+    size_t chunk_size;
+    size_t chunk_count;
+    size_t allocated;   // Bytes handed out
+    int out_of_memory;  // Set once an allocation failed, until free_arena
+} Arena;
+
+// Position in an arena, everything allocated after it can be released with arena_rewind
+// This is what scratch allocations (for instance while parsing a single function) use.
+typedef struct {
+    ArenaChunk* chunk;
+    size_t used;
+    size_t allocated;
+} ArenaMark;
+
+// Function declarations
+void init_arena(Arena* arena, size_t chunk_size);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_copy(Arena* arena, const void* data, size_t size);
+ArenaMark arena_mark(const Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+void arena_adopt(Arena* arena, Arena* other);
+void free_arena(Arena* arena);
+
+#endif // ARENA_H
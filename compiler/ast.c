@@ -1,9 +1,13 @@
 #include "ast.h"
 #include "utils.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+// Nodes created since the start, atomic since items are parsed on several threads
+static atomic_size_t node_count = 0;
+
 char* binary_op_to_str(BinaryOperator op) {
     switch (op) {
         case BIN_ADD: return "+";
@@ -48,419 +52,558 @@ char* unary_op_to_str(UnaryOperator op) {
     }
 }
 
-ASTNode* create_variable_def_node(const char* name, const char* type, ASTNode* initializer) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_VARIABLE_DEF;
-    node->variable_def.name = strdup_c(name);
-    node->variable_def.type = strdup_c(type);
+// Returns a node of the given type, or NULL if it does not fit in memory, in
+// which case the arena is marked and every create function returns NULL
+static ASTNode* allocate_node(Arena* arena, ASTNodeType type) {
+    ASTNode* node = arena_alloc(arena, sizeof(ASTNode));
+    if (node == NULL) {
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&node_count, 1, memory_order_relaxed);
+    node->type = type;
+    return node;
+}
+
+// Returns how many nodes were created so far
+size_t ast_node_count() {
+    return atomic_load(&node_count);
+}
+
+ASTNode* create_variable_def_node(Arena* arena, Symbol name, Symbol type, ASTNode* initializer) {
+    ASTNode* node = allocate_node(arena, AST_VARIABLE_DEF);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->variable_def.name = name;
+    node->variable_def.type = type;
     node->variable_def.initializer = initializer;
     return node;
 }
 
-ASTNode* create_variable_assignment_node(const char* name, ASTNode* value) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_VARIABLE_ASSIGNMENT;
-    node->variable_assignment.name = strdup_c(name);
+ASTNode* create_variable_assignment_node(Arena* arena, Symbol name, ASTNode* value) {
+    ASTNode* node = allocate_node(arena, AST_VARIABLE_ASSIGNMENT);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->variable_assignment.name = name;
     node->variable_assignment.value = value;
+    node->variable_assignment.declaration = NO_DECLARATION;
     return node;
 }
 
-ASTNode* create_literal_node(const char* value) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_LITERAL;
-    node->literal.value = strdup_c(value);
+ASTNode* create_literal_node(Arena* arena, LiteralKind kind, Symbol value) {
+    ASTNode* node = allocate_node(arena, AST_LITERAL);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->literal.kind = kind;
+    node->literal.value = value;
+
+    // Number literals were already parsed by the lexer
+    const NumberValue* number = kind == LITERAL_NUMBER ? number_value(value) : NULL;
+    if (number != NULL) {
+        node->literal.number = *number;
+    } else {
+        memset(&node->literal.number, 0, sizeof(NumberValue));
+    }
     return node;
 }
 
-ASTNode* create_reference_node(const char* name) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_REFERENCE;
-    node->reference.name = strdup_c(name);
+ASTNode* create_reference_node(Arena* arena, Symbol name) {
+    ASTNode* node = allocate_node(arena, AST_REFERENCE);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->reference.name = name;
     node->reference.child = NULL;
+    node->reference.declaration = NO_DECLARATION;
     return node;
 }
 
-ASTNode* create_binary_op_node(BinaryOperator op, ASTNode* left, ASTNode* right) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_BINARY_OP;
+ASTNode* create_binary_op_node(Arena* arena, BinaryOperator op, ASTNode* left, ASTNode* right) {
+    ASTNode* node = allocate_node(arena, AST_BINARY_OP);
+    if (node == NULL) {
+        return NULL;
+    }
     node->binary_op.op = op;
     node->binary_op.left = left;
     node->binary_op.right = right;
     return node;
 }
 
-ASTNode* create_unary_op_node(UnaryOperator op, ASTNode* operand) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_UNARY_OP;
+ASTNode* create_unary_op_node(Arena* arena, UnaryOperator op, ASTNode* operand) {
+    ASTNode* node = allocate_node(arena, AST_UNARY_OP);
+    if (node == NULL) {
+        return NULL;
+    }
     node->unary_op.op = op;
     node->unary_op.operand = operand;
     return node;
 }
 
-ASTNode* create_function_call_node(const char* name, ASTNode** args, size_t arg_count) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_FUNCTION_CALL;
-    node->function_call.name = strdup_c(name);
+ASTNode* create_function_call_node(Arena* arena, Symbol name, ASTNode** args, size_t arg_count) {
+    ASTNode* node = allocate_node(arena, AST_FUNCTION_CALL);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->function_call.name = name;
     node->function_call.args = args;
     node->function_call.arg_count = arg_count;
+    node->function_call.declaration = NO_DECLARATION;
     return node;
 }
 
-ASTNode* create_function_def_node(const char* name, int is_public, char** param_names, char** param_types, size_t param_count, char* return_type, ASTNode* body) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_FUNCTION_DEF;
-    node->function_def.name = strdup_c(name);
+ASTNode* create_function_def_node(Arena* arena, Symbol name, int is_public, Symbol* param_names, Symbol* param_types, size_t param_count, Symbol return_type, ASTNode* body) {
+    ASTNode* node = allocate_node(arena, AST_FUNCTION_DEF);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->function_def.name = name;
     node->function_def.is_public = is_public;
     node->function_def.param_names = param_names;
     node->function_def.param_types = param_types;
     node->function_def.param_count = param_count;
     node->function_def.return_type = return_type;
     node->function_def.body = body;
+    node->function_def.body_start = 0;
+    node->function_def.body_end = 0;
     return node;
 }
 
-ASTNode* create_block_node(ASTNode** statements, size_t statement_count) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_BLOCK;
+ASTNode* create_block_node(Arena* arena, ASTNode** statements, size_t statement_count) {
+    ASTNode* node = allocate_node(arena, AST_BLOCK);
+    if (node == NULL) {
+        return NULL;
+    }
     node->block.statements = statements;
     node->block.statement_count = statement_count;
     return node;
 }
 
-ASTNode* create_if_node(ASTNode* condition, ASTNode* then_branch, ASTNode* else_branch) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_IF;
+ASTNode* create_if_node(Arena* arena, ASTNode* condition, ASTNode* then_branch, ASTNode* else_branch) {
+    ASTNode* node = allocate_node(arena, AST_IF);
+    if (node == NULL) {
+        return NULL;
+    }
     node->if_statement.condition = condition;
     node->if_statement.then_branch = then_branch;
     node->if_statement.else_branch = else_branch;
     return node;
 }
 
-ASTNode* create_while_node(ASTNode* condition, ASTNode* body) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_WHILE;
+ASTNode* create_while_node(Arena* arena, ASTNode* condition, ASTNode* body) {
+    ASTNode* node = allocate_node(arena, AST_WHILE);
+    if (node == NULL) {
+        return NULL;
+    }
     node->while_loop.condition = condition;
     node->while_loop.body = body;
     return node;
 }
 
-ASTNode* create_return_node(ASTNode* value) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_RETURN;
+ASTNode* create_return_node(Arena* arena, ASTNode* value) {
+    ASTNode* node = allocate_node(arena, AST_RETURN);
+    if (node == NULL) {
+        return NULL;
+    }
     node->return_statement.value = value;
     return node;
 }
 
-ASTNode* create_defer_node(ASTNode* value) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_DEFER;
+ASTNode* create_defer_node(Arena* arena, ASTNode* value) {
+    ASTNode* node = allocate_node(arena, AST_DEFER);
+    if (node == NULL) {
+        return NULL;
+    }
     node->defer_statement.value = value;
     return node;
 }
 
-ASTNode* create_assignment_node(const char* name, ASTNode* value) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_ASSIGNMENT;
-    node->assignment.name = strdup_c(name);
+ASTNode* create_assignment_node(Arena* arena, Symbol name, ASTNode* value) {
+    ASTNode* node = allocate_node(arena, AST_ASSIGNMENT);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->assignment.name = name;
     node->assignment.value = value;
+    node->assignment.declaration = NO_DECLARATION;
     return node;
 }
 
-ASTNode* create_type_decl_node(const char* name, const char* type) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_TYPE_DECL;
-    node->type_decl.name = strdup_c(name);
-    node->type_decl.type = strdup_c(type);
+ASTNode* create_type_decl_node(Arena* arena, Symbol name, Symbol type) {
+    ASTNode* node = allocate_node(arena, AST_TYPE_DECL);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->type_decl.name = name;
+    node->type_decl.type = type;
     return node;
 }
 
-ASTNode* create_struct_def_node(const char* name, char** field_names, char** field_types, size_t field_count) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_STRUCT_DEF;
-    node->struct_def.name = strdup_c(name);
+ASTNode* create_struct_def_node(Arena* arena, Symbol name, Symbol* field_names, Symbol* field_types, size_t field_count) {
+    ASTNode* node = allocate_node(arena, AST_STRUCT_DEF);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->struct_def.name = name;
     node->struct_def.field_names = field_names;
     node->struct_def.field_types = field_types;
     node->struct_def.field_count = field_count;
     return node;
 }
 
-ASTNode* create_struct_access_node(ASTNode* struct_node, const char* field_name) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_STRUCT_ACCESS;
+ASTNode* create_struct_access_node(Arena* arena, ASTNode* struct_node, Symbol field_name) {
+    ASTNode* node = allocate_node(arena, AST_STRUCT_ACCESS);
+    if (node == NULL) {
+        return NULL;
+    }
     node->struct_access.struct_expr = struct_node;
-    node->struct_access.member_name = strdup_c(field_name);
+    node->struct_access.member_name = field_name;
     return node;
 }
 
-ASTNode* create_cast_node(const char* type, ASTNode* value) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_CAST;
-    node->cast.target_type = strdup_c(type);
+ASTNode* create_cast_node(Arena* arena, Symbol type, ASTNode* value) {
+    ASTNode* node = allocate_node(arena, AST_CAST);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->cast.target_type = type;
     node->cast.expr = value;
     return node;
 }
 
-ASTNode* create_array_def_node(const char* name, const char* type, ASTNode* initializer) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_ARRAY_DEF;
-    node->array_def.name = strdup_c(name);
-    node->array_def.type = strdup_c(type);
+ASTNode* create_array_def_node(Arena* arena, Symbol name, Symbol type, ASTNode* initializer) {
+    ASTNode* node = allocate_node(arena, AST_ARRAY_DEF);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->array_def.name = name;
+    node->array_def.type = type;
     node->array_def.initializer = initializer;
     return node;
 }
 
-ASTNode* create_array_access_node(const char* reference, ASTNode* index) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_ARRAY_ACCESS;
-    node->array_access.reference = strdup_c(reference);
+ASTNode* create_array_access_node(Arena* arena, Symbol reference, ASTNode* index) {
+    ASTNode* node = allocate_node(arena, AST_ARRAY_ACCESS);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->array_access.reference = reference;
     node->array_access.index = index;
     node->array_access.child = NULL;
+    node->array_access.declaration = NO_DECLARATION;
     return node;
 }
 
-ASTNode* create_array_assignment_node(const char* reference, ASTNode* index, ASTNode* value) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_ARRAY_ASSIGNMENT;
-    node->array_assignment.reference = strdup_c(reference);
+ASTNode* create_array_assignment_node(Arena* arena, Symbol reference, ASTNode* index, ASTNode* value) {
+    ASTNode* node = allocate_node(arena, AST_ARRAY_ASSIGNMENT);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->array_assignment.reference = reference;
     node->array_assignment.index = index;
     node->array_assignment.value = value;
+    node->array_assignment.declaration = NO_DECLARATION;
     return node;
 }
 
-ASTNode* create_literal_array_node(ASTNode** values, size_t value_count) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_LITERAL_ARRAY;
+ASTNode* create_literal_array_node(Arena* arena, ASTNode** values, size_t value_count) {
+    ASTNode* node = allocate_node(arena, AST_LITERAL_ARRAY);
+    if (node == NULL) {
+        return NULL;
+    }
     node->literal_array.values = values;
     node->literal_array.value_count = value_count;
     return node;
 }
 
-void free_ast_node(ASTNode* node) {
-    if (node == NULL) {
+const char* ast_node_type_to_str(ASTNodeType type) {
+    switch (type) {
+        case AST_VARIABLE_DEF: return "Variable Def";
+        case AST_VARIABLE_ASSIGNMENT: return "Variable Assignment";
+        case AST_LITERAL: return "Literal";
+        case AST_REFERENCE: return "Reference";
+        case AST_BINARY_OP: return "Binary Op";
+        case AST_UNARY_OP: return "Unary Op";
+        case AST_FUNCTION_CALL: return "Function Call";
+        case AST_FUNCTION_DEF: return "Function Def";
+        case AST_BLOCK: return "Block";
+        case AST_IF: return "If";
+        case AST_WHILE: return "While";
+        case AST_RETURN: return "Return";
+        case AST_DEFER: return "Defer";
+        case AST_ASSIGNMENT: return "Assignment";
+        case AST_TYPE_DECL: return "Type Decl";
+        case AST_STRUCT_DEF: return "Struct Def";
+        case AST_STRUCT_ACCESS: return "Struct Access";
+        case AST_CAST: return "Cast";
+        case AST_ARRAY_DEF: return "Array Def";
+        case AST_ARRAY_ACCESS: return "Array Access";
+        case AST_ARRAY_ASSIGNMENT: return "Array Assignment";
+        case AST_LITERAL_ARRAY: return "Literal Array";
+        default: return "Invalid";
+    }
+}
+
+void init_ast_dump(ASTDump* dump, Writer* writer, DumpFormat format) {
+    dump->writer = writer;
+    dump->format = format;
+    dump->next_id = 0;
+}
+
+// Starts the line of a node and returns its id, the id of its children's parent
+// In the text format the node is indented, in the JSON format it refers to its
+// parent by id instead.
+size_t begin_dump_node(ASTDump* dump, ASTNodeType type, size_t indent, size_t parent) {
+    Writer* writer = dump->writer;
+    size_t id = dump->next_id++;
+    if (dump->format == DUMP_JSON) {
+        write_cstr(writer, "{\"id\":");
+        write_uint(writer, id);
+        write_cstr(writer, ",\"parent\":");
+        if (parent == DUMP_NO_PARENT) {
+            write_cstr(writer, "null");
+        } else {
+            write_uint(writer, parent);
+        }
+        write_cstr(writer, ",\"node\":\"");
+        write_cstr(writer, ast_node_type_to_str(type));
+        write_char(writer, '"');
+        return id;
+    }
+
+    write_padding(writer, indent);
+    if (type >= AST_NODE_TYPE_COUNT) {
+        write_cstr(writer, "Unknown node type");
+        return id;
+    }
+    write_cstr(writer, ast_node_type_to_str(type));
+    write_char(writer, ':');
+    return id;
+}
+
+// Writes a field of the node, the text format only shows the value
+void dump_string(ASTDump* dump, const char* key, const char* text, size_t length) {
+    Writer* writer = dump->writer;
+    if (dump->format == DUMP_JSON) {
+        write_bytes(writer, ",\"", 2);
+        write_cstr(writer, key);
+        write_bytes(writer, "\":", 2);
+        write_json_string(writer, text, length);
+    } else {
+        write_char(writer, ' ');
+        write_bytes(writer, text, length);
+    }
+}
+
+void dump_symbol(ASTDump* dump, const char* key, Symbol symbol) {
+    dump_string(dump, key, symbol_str(symbol), symbol_len(symbol));
+}
+
+// Writes the kind and value of a literal, the text format only shows the value
+void dump_literal(ASTDump* dump, LiteralKind kind, Symbol value) {
+    if (dump->format == DUMP_JSON) {
+        write_cstr(dump->writer, kind == LITERAL_STRING ? ",\"literal\":\"string\"" : ",\"literal\":\"number\"");
+    }
+    dump_symbol(dump, "value", value);
+}
+
+void dump_function_signature(ASTDump* dump, int is_public, Symbol return_type) {
+    Writer* writer = dump->writer;
+    if (dump->format == DUMP_JSON) {
+        write_cstr(writer, is_public ? ",\"public\":true" : ",\"public\":false");
+        dump_symbol(dump, "return_type", return_type);
+    } else {
+        write_cstr(writer, " (pub: ");
+        write_int(writer, is_public);
+        write_char(writer, ')');
+    }
+}
+
+// Writes the parameters or fields of a definition
+// The text format puts each on a line of its own below the node, with the type
+// if with_types is set. The JSON format always has both in an array of objects.
+void dump_symbol_pairs(ASTDump* dump, const char* key, const Symbol* names, const Symbol* types, size_t count, size_t indent, int with_types) {
+    Writer* writer = dump->writer;
+    if (dump->format == DUMP_JSON) {
+        write_bytes(writer, ",\"", 2);
+        write_cstr(writer, key);
+        write_bytes(writer, "\":[", 3);
+        for (size_t i = 0; i < count; i++) {
+            write_cstr(writer, i == 0 ? "{\"name\":" : ",{\"name\":");
+            write_json_string(writer, symbol_str(names[i]), symbol_len(names[i]));
+            write_cstr(writer, ",\"type\":");
+            write_json_string(writer, symbol_str(types[i]), symbol_len(types[i]));
+            write_char(writer, '}');
+        }
+        write_char(writer, ']');
         return;
     }
 
-    switch (node->type) {
-        case AST_VARIABLE_DEF:
-            free(node->variable_def.name);
-            free(node->variable_def.type);
-            free_ast_node(node->variable_def.initializer);
-            break;
-        case AST_VARIABLE_ASSIGNMENT:
-            free(node->variable_assignment.name);
-            free_ast_node(node->variable_assignment.value);
-            break;
-        case AST_LITERAL:
-            free(node->literal.value);
-            break;
-        case AST_REFERENCE:
-            free(node->reference.name);
-            free_ast_node(node->reference.child);
-            break;
-        case AST_BINARY_OP:
-            free_ast_node(node->binary_op.left);
-            free_ast_node(node->binary_op.right);
-            break;
-        case AST_UNARY_OP:
-            free_ast_node(node->unary_op.operand);
-            break;
-        case AST_FUNCTION_CALL:
-            free(node->function_call.name);
-            for (size_t i = 0; i < node->function_call.arg_count; i++) {
-                free_ast_node(node->function_call.args[i]);
-            }
-            free(node->function_call.args);
-            break;
-        case AST_FUNCTION_DEF:
-            free(node->function_def.name);
-            for (size_t i = 0; i < node->function_def.param_count; i++) {
-                free(node->function_def.param_names[i]);
-            }
-            free(node->function_def.param_names);
-            free_ast_node(node->function_def.body);
-            break;
-        case AST_BLOCK:
-            for (size_t i = 0; i < node->block.statement_count; i++) {
-                free_ast_node(node->block.statements[i]);
-            }
-            free(node->block.statements);
-            break;
-        case AST_IF:
-            free_ast_node(node->if_statement.condition);
-            free_ast_node(node->if_statement.then_branch);
-            free_ast_node(node->if_statement.else_branch);
-            break;
-        case AST_WHILE:
-            free_ast_node(node->while_loop.condition);
-            free_ast_node(node->while_loop.body);
-            break;
-        case AST_RETURN:
-            free_ast_node(node->return_statement.value);
-            break;
-        case AST_DEFER:
-            free_ast_node(node->defer_statement.value);
-            break;
-        case AST_ASSIGNMENT:
-            free(node->assignment.name);
-            free_ast_node(node->assignment.value);
-            break;
-        case AST_TYPE_DECL:
-            free(node->type_decl.name);
-            free(node->type_decl.type);
-            break;
-        case AST_STRUCT_DEF:
-            free(node->struct_def.name);
-            for (size_t i = 0; i < node->struct_def.field_count; i++) {
-                free(node->struct_def.field_names[i]);
-                free(node->struct_def.field_types[i]);
-            }
-            free(node->struct_def.field_names);
-            free(node->struct_def.field_types);
-            break;
-        case AST_STRUCT_ACCESS:
-            free_ast_node(node->struct_access.struct_expr);
-            free(node->struct_access.member_name);
-            break;
-        case AST_CAST:
-            free(node->cast.target_type);
-            free_ast_node(node->cast.expr);
-            break;
-        case AST_ARRAY_DEF:
-            free(node->array_def.name);
-            free(node->array_def.type);
-            free_ast_node(node->array_def.initializer);
-            break;
-        case AST_ARRAY_ACCESS:
-            free(node->array_access.reference);
-            free_ast_node(node->array_access.index);
-            free_ast_node(node->array_access.child);
-            break;
-        case AST_ARRAY_ASSIGNMENT:
-            free(node->array_assignment.reference);
-            free_ast_node(node->array_assignment.index);
-            free_ast_node(node->array_assignment.value);
-            break;
-        case AST_LITERAL_ARRAY:
-            for (size_t i = 0; i < node->literal_array.value_count; i++) {
-                free_ast_node(node->literal_array.values[i]);
-            }
-            free(node->literal_array.values);
-            break;
-        default:
-            break;
+    // Every line but the last one is ended here, end_dump_node ends the last one
+    for (size_t i = 0; i < count; i++) {
+        write_char(writer, '\n');
+        write_padding(writer, indent + 2);
+        write_cstr(writer, with_types ? "Field: " : "Param: ");
+        write_bytes(writer, symbol_str(names[i]), symbol_len(names[i]));
+        if (with_types) {
+            write_char(writer, ' ');
+            write_bytes(writer, symbol_str(types[i]), symbol_len(types[i]));
+        }
     }
 }
 
-void print_ast_node(ASTNode* node, size_t indent) {
+void end_dump_node(ASTDump* dump) {
+    if (dump->format == DUMP_JSON) {
+        write_bytes(dump->writer, "}\n", 2);
+    } else {
+        write_char(dump->writer, '\n');
+    }
+}
+
+// Writes the node and its children in pre-order, one line per node
+void write_ast_node(ASTDump* dump, ASTNode* node, size_t indent, size_t parent) {
     if (node == NULL) {
         return;
     }
 
+    size_t id = begin_dump_node(dump, node->type, indent, parent);
+    indent += 2;
     switch (node->type) {
         case AST_VARIABLE_DEF:
-            printf("%*sVariable Def: %s %s\n", (int)indent, "", node->variable_def.name, node->variable_def.type);
-            print_ast_node(node->variable_def.initializer, indent + 2);
+            dump_symbol(dump, "name", node->variable_def.name);
+            dump_symbol(dump, "type", node->variable_def.type);
+            end_dump_node(dump);
+            write_ast_node(dump, node->variable_def.initializer, indent, id);
             break;
         case AST_VARIABLE_ASSIGNMENT:
-            printf("%*sVariable Assignment: %s\n", (int)indent, "", node->variable_assignment.name);
-            print_ast_node(node->variable_assignment.value, indent + 2);
+            dump_symbol(dump, "name", node->variable_assignment.name);
+            end_dump_node(dump);
+            write_ast_node(dump, node->variable_assignment.value, indent, id);
             break;
         case AST_LITERAL:
-            printf("%*sLiteral: %s\n", (int)indent, "", node->literal.value);
+            dump_literal(dump, node->literal.kind, node->literal.value);
+            end_dump_node(dump);
             break;
         case AST_REFERENCE:
-            printf("%*sReference: %s\n", (int)indent, "", node->reference.name);
-            print_ast_node(node->reference.child, indent + 2);
-            break;
-        case AST_BINARY_OP:
-            printf("%*sBinary Op: %s\n", (int)indent, "", binary_op_to_str(node->binary_op.op));
-            print_ast_node(node->binary_op.left, indent + 2);
-            print_ast_node(node->binary_op.right, indent + 2);
-            break;
-        case AST_UNARY_OP:
-            printf("%*sUnary Op: %s\n", (int)indent, "", unary_op_to_str(node->unary_op.op));
-            print_ast_node(node->unary_op.operand, indent + 2);
-            break;
+            dump_symbol(dump, "name", node->reference.name);
+            end_dump_node(dump);
+            write_ast_node(dump, node->reference.child, indent, id);
+            break;
+        case AST_BINARY_OP: {
+            const char* op = binary_op_to_str(node->binary_op.op);
+            dump_string(dump, "op", op, strlen(op));
+            end_dump_node(dump);
+            write_ast_node(dump, node->binary_op.left, indent, id);
+            write_ast_node(dump, node->binary_op.right, indent, id);
+            break;
+        }
+        case AST_UNARY_OP: {
+            const char* op = unary_op_to_str(node->unary_op.op);
+            dump_string(dump, "op", op, strlen(op));
+            end_dump_node(dump);
+            write_ast_node(dump, node->unary_op.operand, indent, id);
+            break;
+        }
         case AST_FUNCTION_CALL:
-            printf("%*sFunction Call: %s\n", (int)indent, "", node->function_call.name);
+            dump_symbol(dump, "name", node->function_call.name);
+            end_dump_node(dump);
             for (size_t i = 0; i < node->function_call.arg_count; i++) {
-                print_ast_node(node->function_call.args[i], indent + 2);
+                write_ast_node(dump, node->function_call.args[i], indent, id);
             }
             break;
         case AST_FUNCTION_DEF:
-            printf("%*sFunction Def: %s (pub: %d)\n", (int)indent, "", node->function_def.name, node->function_def.is_public);
-            for (size_t i = 0; i < node->function_def.param_count; i++) {
-                printf("%*sParam: %s\n", (int)indent + 2, "", node->function_def.param_names[i]);
-            }
-            print_ast_node(node->function_def.body, indent + 2);
+            dump_symbol(dump, "name", node->function_def.name);
+            dump_function_signature(dump, node->function_def.is_public, node->function_def.return_type);
+            dump_symbol_pairs(dump, "params", node->function_def.param_names, node->function_def.param_types, node->function_def.param_count, indent - 2, 0);
+            end_dump_node(dump);
+            write_ast_node(dump, node->function_def.body, indent, id);
             break;
         case AST_BLOCK:
-            printf("%*sBlock:\n", (int)indent, "");
+            end_dump_node(dump);
             for (size_t i = 0; i < node->block.statement_count; i++) {
-                print_ast_node(node->block.statements[i], indent + 2);
+                write_ast_node(dump, node->block.statements[i], indent, id);
             }
             break;
         case AST_IF:
-            printf("%*sIf:\n", (int)indent, "");
-            print_ast_node(node->if_statement.condition, indent + 2);
-            print_ast_node(node->if_statement.then_branch, indent + 2);
-            print_ast_node(node->if_statement.else_branch, indent + 2);
+            end_dump_node(dump);
+            write_ast_node(dump, node->if_statement.condition, indent, id);
+            write_ast_node(dump, node->if_statement.then_branch, indent, id);
+            write_ast_node(dump, node->if_statement.else_branch, indent, id);
             break;
         case AST_WHILE:
-            printf("%*sWhile:\n", (int)indent, "");
-            print_ast_node(node->while_loop.condition, indent + 2);
-            print_ast_node(node->while_loop.body, indent + 2);
+            end_dump_node(dump);
+            write_ast_node(dump, node->while_loop.condition, indent, id);
+            write_ast_node(dump, node->while_loop.body, indent, id);
             break;
         case AST_RETURN:
-            printf("%*sReturn:\n", (int)indent, "");
-            print_ast_node(node->return_statement.value, indent + 2);
+            end_dump_node(dump);
+            write_ast_node(dump, node->return_statement.value, indent, id);
             break;
         case AST_DEFER:
-            printf("%*sDefer:\n", (int)indent, "");
-            print_ast_node(node->defer_statement.value, indent + 2);
+            end_dump_node(dump);
+            write_ast_node(dump, node->defer_statement.value, indent, id);
             break;
         case AST_ASSIGNMENT:
-            printf("%*sAssignment: %s\n", (int)indent, "", node->assignment.name);
-            print_ast_node(node->assignment.value, indent + 2);
+            dump_symbol(dump, "name", node->assignment.name);
+            end_dump_node(dump);
+            write_ast_node(dump, node->assignment.value, indent, id);
             break;
         case AST_TYPE_DECL:
-            printf("%*sType Decl: %s %s\n", (int)indent, "", node->type_decl.name, node->type_decl.type);
+            dump_symbol(dump, "name", node->type_decl.name);
+            dump_symbol(dump, "type", node->type_decl.type);
+            end_dump_node(dump);
             break;
         case AST_STRUCT_DEF:
-            printf("%*sStruct Def: %s\n", (int)indent, "", node->struct_def.name);
-            for (size_t i = 0; i < node->struct_def.field_count; i++) {
-                printf("%*sField: %s %s\n", (int)indent + 2, "", node->struct_def.field_names[i], node->struct_def.field_types[i]);
-            }
+            dump_symbol(dump, "name", node->struct_def.name);
+            dump_symbol_pairs(dump, "fields", node->struct_def.field_names, node->struct_def.field_types, node->struct_def.field_count, indent - 2, 1);
+            end_dump_node(dump);
             break;
         case AST_STRUCT_ACCESS:
-            printf("%*sStruct Access: %s\n", (int)indent, "", node->struct_access.member_name);
-            print_ast_node(node->struct_access.struct_expr, indent + 2);
+            dump_symbol(dump, "member", node->struct_access.member_name);
+            end_dump_node(dump);
+            write_ast_node(dump, node->struct_access.struct_expr, indent, id);
             break;
         case AST_CAST:
-            printf("%*sCast: %s\n", (int)indent, "", node->cast.target_type);
-            print_ast_node(node->cast.expr, indent + 2);
+            dump_symbol(dump, "type", node->cast.target_type);
+            end_dump_node(dump);
+            write_ast_node(dump, node->cast.expr, indent, id);
             break;
         case AST_ARRAY_DEF:
-            printf("%*sArray Def: %s %s\n", (int)indent, "", node->array_def.name, node->array_def.type);
-            print_ast_node(node->array_def.initializer, indent + 2);
+            dump_symbol(dump, "name", node->array_def.name);
+            dump_symbol(dump, "type", node->array_def.type);
+            end_dump_node(dump);
+            write_ast_node(dump, node->array_def.initializer, indent, id);
             break;
         case AST_ARRAY_ACCESS:
-            printf("%*sArray Access: %s\n", (int)indent, "", node->array_access.reference);
-            print_ast_node(node->array_access.index, indent + 2);
+            dump_symbol(dump, "name", node->array_access.reference);
+            end_dump_node(dump);
+            write_ast_node(dump, node->array_access.index, indent, id);
             break;
         case AST_ARRAY_ASSIGNMENT:
-            printf("%*sArray Assignment: %s\n", (int)indent, "", node->array_assignment.reference);
-            print_ast_node(node->array_assignment.index, indent + 2);
-            print_ast_node(node->array_assignment.value, indent + 2);
+            dump_symbol(dump, "name", node->array_assignment.reference);
+            end_dump_node(dump);
+            write_ast_node(dump, node->array_assignment.index, indent, id);
+            write_ast_node(dump, node->array_assignment.value, indent, id);
             break;
         case AST_LITERAL_ARRAY:
-            printf("%*sLiteral Array:\n", (int)indent, "");
+            end_dump_node(dump);
             for (size_t i = 0; i < node->literal_array.value_count; i++) {
-                print_ast_node(node->literal_array.values[i], indent + 2);
+                write_ast_node(dump, node->literal_array.values[i], indent, id);
             }
             break;
         default:
-            printf("%*sUnknown node type\n", (int)indent, "");
+            end_dump_node(dump);
             break;
     }
 }
+
+void print_ast_node(ASTNode* node, size_t indent) {
+    Writer writer;
+    ASTDump dump;
+    init_writer(&writer, stdout);
+    init_ast_dump(&dump, &writer, DUMP_TEXT);
+    write_ast_node(&dump, node, indent, DUMP_NO_PARENT);
+    flush_writer(&writer);
+    free_writer(&writer);
+}
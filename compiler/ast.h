@@ -1,7 +1,12 @@
 #ifndef AST_H
 #define AST_H
 
+#include "arena.h"
+#include "intern.h"
+#include "number.h"
+#include "writer.h"
 #include <stddef.h>
+#include <stdint.h>
 
 // Enum to represent the type of an AST node
 typedef enum {
@@ -26,10 +31,17 @@ typedef enum {
     AST_ARRAY_DEF,    // Array literal
     AST_ARRAY_ACCESS, // Array indexing (e.g., arr[3])
     AST_ARRAY_ASSIGNMENT, // Array element assignment (e.g., arr[3] = 10)
-    AST_LITERAL_ARRAY // Array of literals
+    AST_LITERAL_ARRAY, // Array of literals
+    AST_NODE_TYPE_COUNT // Number of node types, not a node type
 
 } ASTNodeType;
 
+// Enum to represent the kind of a literal
+typedef enum {
+    LITERAL_NUMBER,
+    LITERAL_STRING
+} LiteralKind;
+
 // Enum to represent binary operators
 typedef enum {
     BIN_ADD,   // +
@@ -53,6 +65,12 @@ typedef enum {
     UNARY_NOT      // !
 } UnaryOperator;
 
+// Declarations are numbered by the name resolution from 1 on, see resolve.h
+typedef uint32_t DeclarationId;
+
+// Marks a name that is not resolved, or not declared anywhere in the tree
+#define NO_DECLARATION 0
+
 // Forward declaration of ASTNode for recursive references
 typedef struct ASTNode ASTNode;
 
@@ -62,26 +80,30 @@ struct ASTNode {
     union {
         // Variable definition (AST_VARIABLE_DEF)
         struct {
-            char* name;       // Variable name
-            char* type;       // Variable type
+            Symbol name;      // Variable name
+            Symbol type;      // Variable type
             ASTNode* initializer;   // Initial value (optional)
         } variable_def;
 
         // Variable assignment (AST_VARIABLE_ASSIGNMENT)
         struct {
-            char* name;       // Variable name
+            Symbol name;      // Variable name
             ASTNode* value;   // Assigned value
+            DeclarationId declaration; // Of the name, set by resolve_names
         } variable_assignment;
 
         // Literal value (AST_LITERAL)
         struct {
-            char* value; // Literal value as a string
+            LiteralKind kind;   // Kind of the literal
+            Symbol value;       // Literal value as an interned string
+            NumberValue number; // Parsed value of number literals
         } literal;
 
         // Variable reference (AST_VARIABLE)
         struct {
-            char* name;  // Name of the reference
+            Symbol name; // Name of the reference
             ASTNode* child; // Children of the reference (say std.iostream, then iostream is a child of std)
+            DeclarationId declaration; // Of the name at the head of a chain, set by resolve_names
         } reference;
 
         // Binary operation (AST_BINARY_OP)
@@ -99,20 +121,23 @@ struct ASTNode {
 
         // Function call (AST_FUNCTION_CALL)
         struct {
-            char* name;         // Function name
+            Symbol name;        // Function name
             ASTNode** args;     // Arguments
             size_t arg_count;   // Number of arguments
+            DeclarationId declaration; // Of the function at the head of a chain, set by resolve_names
         } function_call;
 
         // Function definition (AST_FUNCTION_DEF)
         struct {
-            char* name;         // Function name
+            Symbol name;        // Function name
             int is_public;      // Public or private
-            char** param_names; // Parameter names
-            char** param_types; // Parameter types
+            Symbol* param_names; // Parameter names
+            Symbol* param_types; // Parameter types
             size_t param_count; // Number of parameters
-            char* return_type; // Return type
-            ASTNode* body;      // Function body
+            Symbol return_type; // Return type
+            ASTNode* body;      // Function body, NULL while it is not parsed yet
+            size_t body_start;  // Tokens of a body that is not parsed yet, from
+            size_t body_end;    // its '{' up to its '}', see parse_function_body
         } function_def;
 
         // Code block (AST_BLOCK)
@@ -146,55 +171,58 @@ struct ASTNode {
 
         // Variable assignment (AST_ASSIGNMENT)
         struct {
-            char* name;       // Variable name
+            Symbol name;      // Variable name
             ASTNode* value;   // Assigned value
+            DeclarationId declaration; // Of the name, set by resolve_names
         } assignment;
 
         // Type declaration (AST_TYPE_DECL)
         struct {
-            char* name;       // Variable name
-            char* type;       // Type name
+            Symbol name;      // Variable name
+            Symbol type;      // Type name
         } type_decl;
 
         // Struct definition (AST_STRUCT_DEF)
         struct {
-            char* name;         // Struct name
-            char** field_names; // Field names
-            char** field_types; // Field types
+            Symbol name;        // Struct name
+            Symbol* field_names; // Field names
+            Symbol* field_types; // Field types
             size_t field_count; // Number of fields
         } struct_def;
 
         // Struct member access (AST_STRUCT_ACCESS)
         struct {
             ASTNode* struct_expr; // Struct expression
-            char* member_name;   // Member name
+            Symbol member_name;  // Member name
         } struct_access;
 
         // Type casting (AST_CAST)
         struct {
             ASTNode* expr;      // Expression to cast
-            char* target_type;  // Target type
+            Symbol target_type; // Target type
         } cast;
 
         // Array definition (AST_ARRAY_DEF)
         struct {
-            char* name;       // Variable name
-            char* type;       // Variable type
+            Symbol name;      // Variable name
+            Symbol type;      // Variable type
             ASTNode* initializer;   // Initial value (optional)
         } array_def;
 
         // Array access (AST_ARRAY_ACCESS)
         struct {
-            char* reference;   // Array variable name
+            Symbol reference;  // Array variable name
             ASTNode* index;    // Index expression
             ASTNode* child;   // Nested array access (optional) (e.g., arr#1#2)
+            DeclarationId declaration; // Of the array at the head of a chain, set by resolve_names
         } array_access;
 
         // Array assignment (AST_ARRAY_ASSIGNMENT)
         struct {
-            char* reference;   // Array variable name
+            Symbol reference;  // Array variable name
             ASTNode* index;    // Index expression
             ASTNode* value;    // Assigned value
+            DeclarationId declaration; // Of the array, set by resolve_names
         } array_assignment;
 
         // Array of literals (AST_LITERAL_ARRAY)
@@ -205,31 +233,58 @@ struct ASTNode {
     };
 };
 
+// Parent of the nodes a dump starts from
+#define DUMP_NO_PARENT SIZE_MAX
+
+// Structure to hold the state of an AST dump
+// The pointer and the compact trees are written through the same functions, so
+// both dumps are the same.
+typedef struct {
+    Writer* writer;
+    DumpFormat format;
+    size_t next_id; // Ids are handed out in pre-order
+} ASTDump;
+
 // Function declarations
-ASTNode* create_variable_def_node(const char* name, const char* type, ASTNode* initializer);
-ASTNode* create_variable_assignment_node(const char* name, ASTNode* value);
-ASTNode* create_literal_node(const char* value);
-ASTNode* create_reference_node(const char* name);
-ASTNode* create_binary_op_node(BinaryOperator op, ASTNode* left, ASTNode* right);
-ASTNode* create_unary_op_node(UnaryOperator op, ASTNode* operand);
-ASTNode* create_function_call_node(const char* name, ASTNode** args, size_t arg_count);
-ASTNode* create_function_def_node(const char* name, int is_public, char** param_names, char** param_types, size_t param_count, char* return_type, ASTNode* body);
-ASTNode* create_block_node(ASTNode** statements, size_t statement_count);
-ASTNode* create_if_node(ASTNode* condition, ASTNode* then_branch, ASTNode* else_branch);
-ASTNode* create_while_node(ASTNode* condition, ASTNode* body);
-ASTNode* create_return_node(ASTNode* value);
-ASTNode* create_defer_node(ASTNode* value);
-ASTNode* create_assignment_node(const char* name, ASTNode* value);
-ASTNode* create_type_decl_node(const char* name, const char* type);
-ASTNode* create_struct_def_node(const char* name, char** field_names, char** field_types, size_t field_count);
-ASTNode* create_struct_access_node(ASTNode* struct_node, const char* field_name);
-ASTNode* create_cast_node(const char* type, ASTNode* value);
-ASTNode* create_array_def_node(const char* name, const char* type, ASTNode* initializers);
-ASTNode* create_array_access_node(const char* reference, ASTNode* index);
-ASTNode* create_array_assignment_node(const char* reference, ASTNode* index, ASTNode* value);
-ASTNode* create_literal_array_node(ASTNode** values, size_t value_count);
-void free_ast_node(ASTNode* node);
+// Nodes are allocated from the arena and live until the arena is freed, single
+// nodes are never freed. The arrays they are given have to live in the same
+// arena, see small_vec_finish.
+ASTNode* create_variable_def_node(Arena* arena, Symbol name, Symbol type, ASTNode* initializer);
+ASTNode* create_variable_assignment_node(Arena* arena, Symbol name, ASTNode* value);
+ASTNode* create_literal_node(Arena* arena, LiteralKind kind, Symbol value);
+ASTNode* create_reference_node(Arena* arena, Symbol name);
+ASTNode* create_binary_op_node(Arena* arena, BinaryOperator op, ASTNode* left, ASTNode* right);
+ASTNode* create_unary_op_node(Arena* arena, UnaryOperator op, ASTNode* operand);
+ASTNode* create_function_call_node(Arena* arena, Symbol name, ASTNode** args, size_t arg_count);
+ASTNode* create_function_def_node(Arena* arena, Symbol name, int is_public, Symbol* param_names, Symbol* param_types, size_t param_count, Symbol return_type, ASTNode* body);
+ASTNode* create_block_node(Arena* arena, ASTNode** statements, size_t statement_count);
+ASTNode* create_if_node(Arena* arena, ASTNode* condition, ASTNode* then_branch, ASTNode* else_branch);
+ASTNode* create_while_node(Arena* arena, ASTNode* condition, ASTNode* body);
+ASTNode* create_return_node(Arena* arena, ASTNode* value);
+ASTNode* create_defer_node(Arena* arena, ASTNode* value);
+ASTNode* create_assignment_node(Arena* arena, Symbol name, ASTNode* value);
+ASTNode* create_type_decl_node(Arena* arena, Symbol name, Symbol type);
+ASTNode* create_struct_def_node(Arena* arena, Symbol name, Symbol* field_names, Symbol* field_types, size_t field_count);
+ASTNode* create_struct_access_node(Arena* arena, ASTNode* struct_node, Symbol field_name);
+ASTNode* create_cast_node(Arena* arena, Symbol type, ASTNode* value);
+ASTNode* create_array_def_node(Arena* arena, Symbol name, Symbol type, ASTNode* initializers);
+ASTNode* create_array_access_node(Arena* arena, Symbol reference, ASTNode* index);
+ASTNode* create_array_assignment_node(Arena* arena, Symbol reference, ASTNode* index, ASTNode* value);
+ASTNode* create_literal_array_node(Arena* arena, ASTNode** values, size_t value_count);
+const char* ast_node_type_to_str(ASTNodeType type);
+void init_ast_dump(ASTDump* dump, Writer* writer, DumpFormat format);
+size_t begin_dump_node(ASTDump* dump, ASTNodeType type, size_t indent, size_t parent);
+void dump_string(ASTDump* dump, const char* key, const char* text, size_t length);
+void dump_symbol(ASTDump* dump, const char* key, Symbol symbol);
+void dump_literal(ASTDump* dump, LiteralKind kind, Symbol value);
+void dump_function_signature(ASTDump* dump, int is_public, Symbol return_type);
+void dump_symbol_pairs(ASTDump* dump, const char* key, const Symbol* names, const Symbol* types, size_t count, size_t indent, int with_types);
+void end_dump_node(ASTDump* dump);
+void write_ast_node(ASTDump* dump, ASTNode* node, size_t indent, size_t parent);
 void print_ast_node(ASTNode* node, size_t indent);
+size_t ast_node_count();
 BinaryOperator str_to_binary_op(const char* str);
+char* binary_op_to_str(BinaryOperator op);
+char* unary_op_to_str(UnaryOperator op);
 
 #endif // AST_H
@@ -0,0 +1,1098 @@
+#include "compact_ast.h"
+#include "number.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Size of the payload of every kind of node
+static const size_t item_sizes[AST_NODE_TYPE_COUNT] = {
+    [AST_VARIABLE_DEF] = sizeof(CompactVariableDef),
+    [AST_VARIABLE_ASSIGNMENT] = sizeof(CompactAssignment),
+    [AST_LITERAL] = sizeof(CompactLiteral),
+    [AST_REFERENCE] = sizeof(CompactReference),
+    [AST_BINARY_OP] = sizeof(CompactBinaryOp),
+    [AST_UNARY_OP] = sizeof(CompactUnaryOp),
+    [AST_FUNCTION_CALL] = sizeof(CompactFunctionCall),
+    [AST_FUNCTION_DEF] = sizeof(CompactFunctionDef),
+    [AST_BLOCK] = sizeof(CompactBlock),
+    [AST_IF] = sizeof(CompactIf),
+    [AST_WHILE] = sizeof(CompactWhile),
+    [AST_RETURN] = sizeof(CompactValue),
+    [AST_DEFER] = sizeof(CompactValue),
+    [AST_ASSIGNMENT] = sizeof(CompactAssignment),
+    [AST_TYPE_DECL] = sizeof(CompactTypeDecl),
+    [AST_STRUCT_DEF] = sizeof(CompactStructDef),
+    [AST_STRUCT_ACCESS] = sizeof(CompactMember),
+    [AST_CAST] = sizeof(CompactMember),
+    [AST_ARRAY_DEF] = sizeof(CompactVariableDef),
+    [AST_ARRAY_ACCESS] = sizeof(CompactArrayAccess),
+    [AST_ARRAY_ASSIGNMENT] = sizeof(CompactArrayAssignment),
+    [AST_LITERAL_ARRAY] = sizeof(CompactBlock),
+};
+
+#define FIELD(kind, type, field) {kind, (uint8_t)offsetof(type, field)}
+
+static const CompactField variable_def_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactVariableDef, name),
+    FIELD(FIELD_SYMBOL, CompactVariableDef, type),
+    FIELD(FIELD_NODE, CompactVariableDef, initializer),
+};
+static const CompactField assignment_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactAssignment, name),
+    FIELD(FIELD_NODE, CompactAssignment, value),
+};
+static const CompactField literal_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactLiteral, value),
+};
+static const CompactField reference_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactReference, name),
+    FIELD(FIELD_NODE, CompactReference, child),
+};
+static const CompactField binary_op_fields[] = {
+    FIELD(FIELD_NODE, CompactBinaryOp, left),
+    FIELD(FIELD_NODE, CompactBinaryOp, right),
+};
+static const CompactField unary_op_fields[] = {
+    FIELD(FIELD_NODE, CompactUnaryOp, operand),
+};
+static const CompactField function_call_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactFunctionCall, name),
+    FIELD(FIELD_CHILDREN, CompactFunctionCall, args),
+};
+static const CompactField function_def_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactFunctionDef, name),
+    FIELD(FIELD_SYMBOL, CompactFunctionDef, return_type),
+    FIELD(FIELD_SYMBOLS, CompactFunctionDef, params),
+    FIELD(FIELD_NODE, CompactFunctionDef, body),
+};
+static const CompactField block_fields[] = {
+    FIELD(FIELD_CHILDREN, CompactBlock, statements),
+};
+static const CompactField if_fields[] = {
+    FIELD(FIELD_NODE, CompactIf, condition),
+    FIELD(FIELD_NODE, CompactIf, then_branch),
+    FIELD(FIELD_NODE, CompactIf, else_branch),
+};
+static const CompactField while_fields[] = {
+    FIELD(FIELD_NODE, CompactWhile, condition),
+    FIELD(FIELD_NODE, CompactWhile, body),
+};
+static const CompactField value_fields[] = {
+    FIELD(FIELD_NODE, CompactValue, value),
+};
+static const CompactField type_decl_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactTypeDecl, name),
+    FIELD(FIELD_SYMBOL, CompactTypeDecl, type),
+};
+static const CompactField struct_def_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactStructDef, name),
+    FIELD(FIELD_SYMBOLS, CompactStructDef, fields),
+};
+static const CompactField member_fields[] = {
+    FIELD(FIELD_NODE, CompactMember, expr),
+    FIELD(FIELD_SYMBOL, CompactMember, name),
+};
+static const CompactField array_access_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactArrayAccess, reference),
+    FIELD(FIELD_NODE, CompactArrayAccess, index),
+    FIELD(FIELD_NODE, CompactArrayAccess, child),
+};
+static const CompactField array_assignment_fields[] = {
+    FIELD(FIELD_SYMBOL, CompactArrayAssignment, reference),
+    FIELD(FIELD_NODE, CompactArrayAssignment, index),
+    FIELD(FIELD_NODE, CompactArrayAssignment, value),
+};
+
+#define FIELDS(fields) {fields, sizeof(fields) / sizeof(fields[0])}
+
+// Fields of every kind of payload that refer to symbols, nodes or ranges
+static const struct {
+    const CompactField* fields;
+    size_t count;
+} kind_fields[AST_NODE_TYPE_COUNT] = {
+    [AST_VARIABLE_DEF] = FIELDS(variable_def_fields),
+    [AST_VARIABLE_ASSIGNMENT] = FIELDS(assignment_fields),
+    [AST_LITERAL] = FIELDS(literal_fields),
+    [AST_REFERENCE] = FIELDS(reference_fields),
+    [AST_BINARY_OP] = FIELDS(binary_op_fields),
+    [AST_UNARY_OP] = FIELDS(unary_op_fields),
+    [AST_FUNCTION_CALL] = FIELDS(function_call_fields),
+    [AST_FUNCTION_DEF] = FIELDS(function_def_fields),
+    [AST_BLOCK] = FIELDS(block_fields),
+    [AST_IF] = FIELDS(if_fields),
+    [AST_WHILE] = FIELDS(while_fields),
+    [AST_RETURN] = FIELDS(value_fields),
+    [AST_DEFER] = FIELDS(value_fields),
+    [AST_ASSIGNMENT] = FIELDS(assignment_fields),
+    [AST_TYPE_DECL] = FIELDS(type_decl_fields),
+    [AST_STRUCT_DEF] = FIELDS(struct_def_fields),
+    [AST_STRUCT_ACCESS] = FIELDS(member_fields),
+    [AST_CAST] = FIELDS(member_fields),
+    [AST_ARRAY_DEF] = FIELDS(variable_def_fields),
+    [AST_ARRAY_ACCESS] = FIELDS(array_access_fields),
+    [AST_ARRAY_ASSIGNMENT] = FIELDS(array_assignment_fields),
+    [AST_LITERAL_ARRAY] = FIELDS(block_fields),
+};
+
+// Capacity an array grows to once it is full, 0 if it cannot grow
+static uint32_t next_capacity(uint32_t capacity) {
+    if (capacity == 0) {
+        return 64;
+    }
+    if (capacity == UINT32_MAX) {
+        return 0;
+    }
+    return capacity > UINT32_MAX / 2 ? UINT32_MAX : capacity * 2;
+}
+
+// Returns the array grown to the capacity, or NULL with the tree marked, in
+// which case the array is left as it was
+static void* resize_array(CompactAST* ast, void* items, uint32_t capacity, size_t item_size) {
+    void* resized = capacity == 0 ? NULL : mem_realloc(items, (size_t)capacity * item_size);
+    if (resized == NULL) {
+        ast->out_of_memory = 1;
+    }
+    return resized;
+}
+
+// Appends an entry to the per node arrays
+static NodeId add_node_entry(CompactAST* ast, ASTNodeType type, uint32_t index) {
+    if (ast->node_count == ast->node_capacity) {
+        uint32_t capacity = next_capacity(ast->node_capacity);
+        uint8_t* tags = resize_array(ast, ast->tags, capacity, sizeof(uint8_t));
+        if (tags == NULL) {
+            return NODE_NONE;
+        }
+        ast->tags = tags;
+        uint32_t* indices = resize_array(ast, ast->indices, capacity, sizeof(uint32_t));
+        if (indices == NULL) {
+            return NODE_NONE;
+        }
+        ast->indices = indices;
+        ast->node_capacity = capacity;
+    }
+
+    NodeId id = ast->node_count++;
+    ast->tags[id] = (uint8_t)type;
+    ast->indices[id] = index;
+    return id;
+}
+
+void init_compact_ast(CompactAST* ast) {
+    memset(ast, 0, sizeof(CompactAST));
+
+    // Reserve node 0 for NODE_NONE
+    add_node_entry(ast, AST_NODE_TYPE_COUNT, 0);
+}
+
+void free_compact_ast(CompactAST* ast) {
+    // The arrays of a view belong to the module file
+    if (ast->strings.data != NULL) {
+        mem_free(ast->strings.interned);
+        memset(ast, 0, sizeof(CompactAST));
+        return;
+    }
+
+    mem_free(ast->tags);
+    mem_free(ast->indices);
+    for (size_t i = 0; i < AST_NODE_TYPE_COUNT; i++) {
+        mem_free(ast->kinds[i].items);
+        mem_free(ast->kinds[i].nodes);
+    }
+    mem_free(ast->children);
+    mem_free(ast->symbols);
+    memset(ast, 0, sizeof(CompactAST));
+}
+
+// Appends a node of the given kind, returns its zeroed payload, or NULL once
+// the tree is out of memory
+static void* add_node(CompactAST* ast, ASTNodeType type, NodeId* id) {
+    if (ast->out_of_memory) {
+        return NULL;
+    }
+
+    CompactKind* kind = &ast->kinds[type];
+    if (kind->count == kind->capacity) {
+        uint32_t capacity = next_capacity(kind->capacity);
+        void* items = resize_array(ast, kind->items, capacity, item_sizes[type]);
+        if (items == NULL) {
+            return NULL;
+        }
+        kind->items = items;
+        NodeId* nodes = resize_array(ast, kind->nodes, capacity, sizeof(NodeId));
+        if (nodes == NULL) {
+            return NULL;
+        }
+        kind->nodes = nodes;
+        kind->capacity = capacity;
+    }
+
+    *id = add_node_entry(ast, type, kind->count);
+    if (*id == NODE_NONE) {
+        return NULL;
+    }
+    kind->nodes[kind->count] = *id;
+
+    void* item = (char*)kind->items + (size_t)kind->count++ * item_sizes[type];
+    memset(item, 0, item_sizes[type]);
+    return item;
+}
+
+// A list that does not fit marks the tree, so the node it belongs to is not added
+static NodeRange add_children(CompactAST* ast, const NodeId* children, size_t count) {
+    NodeRange range = {ast->child_count, (uint32_t)count};
+    for (size_t i = 0; i < count && !ast->out_of_memory; i++) {
+        if (ast->child_count == ast->child_capacity) {
+            uint32_t capacity = next_capacity(ast->child_capacity);
+            NodeId* grown = resize_array(ast, ast->children, capacity, sizeof(NodeId));
+            if (grown == NULL) {
+                break;
+            }
+            ast->children = grown;
+            ast->child_capacity = capacity;
+        }
+        ast->children[ast->child_count++] = children[i];
+    }
+    return range;
+}
+
+// Adds the names followed by the types, as used by parameters and fields
+static NodeRange add_symbol_pairs(CompactAST* ast, const Symbol* names, const Symbol* types, size_t count) {
+    NodeRange range = {ast->symbol_count, (uint32_t)count};
+    for (size_t i = 0; i < 2 * count && !ast->out_of_memory; i++) {
+        if (ast->symbol_count == ast->symbol_capacity) {
+            uint32_t capacity = next_capacity(ast->symbol_capacity);
+            Symbol* grown = resize_array(ast, ast->symbols, capacity, sizeof(Symbol));
+            if (grown == NULL) {
+                break;
+            }
+            ast->symbols = grown;
+            ast->symbol_capacity = capacity;
+        }
+        ast->symbols[ast->symbol_count++] = i < count ? names[i] : types[i - count];
+    }
+    return range;
+}
+
+ASTNodeType compact_node_type(const CompactAST* ast, NodeId node) {
+    if (node == NODE_NONE || node >= ast->node_count) {
+        return AST_NODE_TYPE_COUNT;
+    }
+    return (ASTNodeType)ast->tags[node];
+}
+
+const void* compact_node_data(const CompactAST* ast, NodeId node) {
+    ASTNodeType type = compact_node_type(ast, node);
+    if (type == AST_NODE_TYPE_COUNT) {
+        return NULL;
+    }
+    return (const char*)ast->kinds[type].items + (size_t)ast->indices[node] * item_sizes[type];
+}
+
+// Returns the contiguous payloads of all nodes of one kind, in creation order
+// The node ids belonging to them are found in kinds[type].nodes.
+const void* compact_kind_items(const CompactAST* ast, ASTNodeType type, size_t* count) {
+    if (type >= AST_NODE_TYPE_COUNT) {
+        *count = 0;
+        return NULL;
+    }
+    *count = ast->kinds[type].count;
+    return ast->kinds[type].items;
+}
+
+size_t compact_item_size(ASTNodeType type) {
+    return type < AST_NODE_TYPE_COUNT ? item_sizes[type] : 0;
+}
+
+// Returns the fields of a kind of payload that refer to symbols, nodes or ranges
+// Everything else in a payload is plain data.
+const CompactField* compact_fields(ASTNodeType type, size_t* count) {
+    if (type >= AST_NODE_TYPE_COUNT) {
+        *count = 0;
+        return NULL;
+    }
+    *count = kind_fields[type].count;
+    return kind_fields[type].fields;
+}
+
+const NodeId* compact_children(const CompactAST* ast, NodeRange range) {
+    return range.count == 0 ? NULL : &ast->children[range.start];
+}
+
+// Parameter and field ranges cover count names followed by count types
+const Symbol* compact_symbols(const CompactAST* ast, NodeRange range) {
+    return range.count == 0 ? NULL : &ast->symbols[range.start];
+}
+
+// Returns the interned symbol of a symbol stored in the tree
+// Symbols of a tree built in memory are interned already, those of a view are
+// interned the first time they are asked for and remembered from then on, so a
+// view is only used by one thread at a time.
+Symbol compact_symbol(const CompactAST* ast, Symbol symbol) {
+    const CompactStrings* strings = &ast->strings;
+    if (strings->data == NULL || symbol == SYMBOL_NONE) {
+        return symbol;
+    }
+    if (symbol > strings->count) {
+        return SYMBOL_NONE;
+    }
+
+    Symbol* interned = &strings->interned[symbol - 1];
+    if (*interned == SYMBOL_NONE) {
+        size_t length;
+        const char* text = compact_symbol_str(ast, symbol, &length);
+        *interned = intern_string(text, length);
+    }
+    return *interned;
+}
+
+// Returns the text of a symbol stored in the tree without interning it, NUL
+// terminated
+const char* compact_symbol_str(const CompactAST* ast, Symbol symbol, size_t* length) {
+    const CompactStrings* strings = &ast->strings;
+    if (strings->data == NULL) {
+        *length = symbol_len(symbol);
+        return symbol_str(symbol);
+    }
+    if (symbol == SYMBOL_NONE || symbol > strings->count) {
+        *length = 0;
+        return NULL;
+    }
+
+    uint32_t start = strings->offsets[symbol - 1];
+    *length = strings->offsets[symbol] - start - 1;
+    return strings->data + start;
+}
+
+// Returns the name and type pairs of a range as interned symbols
+// Those of a view are translated into a copy the caller frees with mem_free.
+// Returns NULL if they do not fit in memory.
+static const Symbol* interned_symbols(const CompactAST* ast, NodeRange range, Symbol** copy) {
+    *copy = NULL;
+    const Symbol* symbols = compact_symbols(ast, range);
+    if (ast->strings.data == NULL || symbols == NULL) {
+        return symbols;
+    }
+
+    *copy = mem_alloc(2 * (size_t)range.count * sizeof(Symbol));
+    if (*copy == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < 2 * (size_t)range.count; i++) {
+        (*copy)[i] = compact_symbol(ast, symbols[i]);
+        if ((*copy)[i] == SYMBOL_NONE && symbols[i] != SYMBOL_NONE) {
+            return NULL;
+        }
+    }
+    return *copy;
+}
+
+NodeId add_variable_def_node(CompactAST* ast, Symbol name, Symbol type, NodeId initializer) {
+    NodeId id;
+    CompactVariableDef* node = add_node(ast, AST_VARIABLE_DEF, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->type = type;
+    node->initializer = initializer;
+    return id;
+}
+
+NodeId add_variable_assignment_node(CompactAST* ast, Symbol name, NodeId value) {
+    NodeId id;
+    CompactAssignment* node = add_node(ast, AST_VARIABLE_ASSIGNMENT, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->value = value;
+    return id;
+}
+
+NodeId add_literal_node(CompactAST* ast, LiteralKind kind, Symbol value) {
+    NodeId id;
+    CompactLiteral* node = add_node(ast, AST_LITERAL, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->value = value;
+    node->kind = kind;
+    return id;
+}
+
+NodeId add_reference_node(CompactAST* ast, Symbol name, NodeId child) {
+    NodeId id;
+    CompactReference* node = add_node(ast, AST_REFERENCE, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->child = child;
+    return id;
+}
+
+NodeId add_binary_op_node(CompactAST* ast, BinaryOperator op, NodeId left, NodeId right) {
+    NodeId id;
+    CompactBinaryOp* node = add_node(ast, AST_BINARY_OP, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->op = op;
+    node->left = left;
+    node->right = right;
+    return id;
+}
+
+NodeId add_unary_op_node(CompactAST* ast, UnaryOperator op, NodeId operand) {
+    NodeId id;
+    CompactUnaryOp* node = add_node(ast, AST_UNARY_OP, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->op = op;
+    node->operand = operand;
+    return id;
+}
+
+NodeId add_function_call_node(CompactAST* ast, Symbol name, const NodeId* args, size_t arg_count) {
+    NodeRange range = add_children(ast, args, arg_count);
+    NodeId id;
+    CompactFunctionCall* node = add_node(ast, AST_FUNCTION_CALL, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->args = range;
+    return id;
+}
+
+NodeId add_function_def_node(CompactAST* ast, Symbol name, int is_public, const Symbol* param_names, const Symbol* param_types, size_t param_count, Symbol return_type, NodeId body) {
+    NodeRange range = add_symbol_pairs(ast, param_names, param_types, param_count);
+    NodeId id;
+    CompactFunctionDef* node = add_node(ast, AST_FUNCTION_DEF, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->return_type = return_type;
+    node->params = range;
+    node->body = body;
+    node->is_public = (uint32_t)is_public;
+    return id;
+}
+
+NodeId add_block_node(CompactAST* ast, const NodeId* statements, size_t statement_count) {
+    NodeRange range = add_children(ast, statements, statement_count);
+    NodeId id;
+    CompactBlock* node = add_node(ast, AST_BLOCK, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->statements = range;
+    return id;
+}
+
+NodeId add_if_node(CompactAST* ast, NodeId condition, NodeId then_branch, NodeId else_branch) {
+    NodeId id;
+    CompactIf* node = add_node(ast, AST_IF, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->condition = condition;
+    node->then_branch = then_branch;
+    node->else_branch = else_branch;
+    return id;
+}
+
+NodeId add_while_node(CompactAST* ast, NodeId condition, NodeId body) {
+    NodeId id;
+    CompactWhile* node = add_node(ast, AST_WHILE, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->condition = condition;
+    node->body = body;
+    return id;
+}
+
+NodeId add_return_node(CompactAST* ast, NodeId value) {
+    NodeId id;
+    CompactValue* node = add_node(ast, AST_RETURN, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->value = value;
+    return id;
+}
+
+NodeId add_defer_node(CompactAST* ast, NodeId value) {
+    NodeId id;
+    CompactValue* node = add_node(ast, AST_DEFER, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->value = value;
+    return id;
+}
+
+NodeId add_assignment_node(CompactAST* ast, Symbol name, NodeId value) {
+    NodeId id;
+    CompactAssignment* node = add_node(ast, AST_ASSIGNMENT, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->value = value;
+    return id;
+}
+
+NodeId add_type_decl_node(CompactAST* ast, Symbol name, Symbol type) {
+    NodeId id;
+    CompactTypeDecl* node = add_node(ast, AST_TYPE_DECL, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->type = type;
+    return id;
+}
+
+NodeId add_struct_def_node(CompactAST* ast, Symbol name, const Symbol* field_names, const Symbol* field_types, size_t field_count) {
+    NodeRange range = add_symbol_pairs(ast, field_names, field_types, field_count);
+    NodeId id;
+    CompactStructDef* node = add_node(ast, AST_STRUCT_DEF, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->fields = range;
+    return id;
+}
+
+NodeId add_struct_access_node(CompactAST* ast, NodeId struct_node, Symbol field_name) {
+    NodeId id;
+    CompactMember* node = add_node(ast, AST_STRUCT_ACCESS, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->expr = struct_node;
+    node->name = field_name;
+    return id;
+}
+
+NodeId add_cast_node(CompactAST* ast, Symbol type, NodeId value) {
+    NodeId id;
+    CompactMember* node = add_node(ast, AST_CAST, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->expr = value;
+    node->name = type;
+    return id;
+}
+
+NodeId add_array_def_node(CompactAST* ast, Symbol name, Symbol type, NodeId initializer) {
+    NodeId id;
+    CompactVariableDef* node = add_node(ast, AST_ARRAY_DEF, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->name = name;
+    node->type = type;
+    node->initializer = initializer;
+    return id;
+}
+
+NodeId add_array_access_node(CompactAST* ast, Symbol reference, NodeId index, NodeId child) {
+    NodeId id;
+    CompactArrayAccess* node = add_node(ast, AST_ARRAY_ACCESS, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->reference = reference;
+    node->index = index;
+    node->child = child;
+    return id;
+}
+
+NodeId add_array_assignment_node(CompactAST* ast, Symbol reference, NodeId index, NodeId value) {
+    NodeId id;
+    CompactArrayAssignment* node = add_node(ast, AST_ARRAY_ASSIGNMENT, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->reference = reference;
+    node->index = index;
+    node->value = value;
+    return id;
+}
+
+NodeId add_literal_array_node(CompactAST* ast, const NodeId* values, size_t value_count) {
+    NodeRange range = add_children(ast, values, value_count);
+    NodeId id;
+    CompactBlock* node = add_node(ast, AST_LITERAL_ARRAY, &id);
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+    node->statements = range;
+    return id;
+}
+
+// Converts a list of pointer nodes, the ids are gathered in a temporary array
+// since the children of a node are only added once all of them are built
+static NodeId* compact_node_list(CompactAST* ast, ASTNode** nodes, size_t count) {
+    if (count == 0) {
+        return NULL;
+    }
+
+    NodeId* ids = mem_alloc(count * sizeof(NodeId));
+    if (ids == NULL) {
+        ast->out_of_memory = 1;
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        ids[i] = compact_ast_node(ast, nodes[i]);
+    }
+    return ids;
+}
+
+// Builds the compact equivalent of a pointer AST, children first
+// Returns NODE_NONE with the tree marked if it does not fit in memory.
+NodeId compact_ast_node(CompactAST* ast, const ASTNode* node) {
+    if (node == NULL) {
+        return NODE_NONE;
+    }
+
+    NodeId* ids;
+    NodeId id;
+    switch (node->type) {
+        case AST_VARIABLE_DEF:
+            return add_variable_def_node(ast, node->variable_def.name, node->variable_def.type, compact_ast_node(ast, node->variable_def.initializer));
+        case AST_VARIABLE_ASSIGNMENT:
+            return add_variable_assignment_node(ast, node->variable_assignment.name, compact_ast_node(ast, node->variable_assignment.value));
+        case AST_LITERAL:
+            return add_literal_node(ast, node->literal.kind, node->literal.value);
+        case AST_REFERENCE:
+            return add_reference_node(ast, node->reference.name, compact_ast_node(ast, node->reference.child));
+        case AST_BINARY_OP: {
+            NodeId left = compact_ast_node(ast, node->binary_op.left);
+            NodeId right = compact_ast_node(ast, node->binary_op.right);
+            return add_binary_op_node(ast, node->binary_op.op, left, right);
+        }
+        case AST_UNARY_OP:
+            return add_unary_op_node(ast, node->unary_op.op, compact_ast_node(ast, node->unary_op.operand));
+        case AST_FUNCTION_CALL:
+            ids = compact_node_list(ast, node->function_call.args, node->function_call.arg_count);
+            id = add_function_call_node(ast, node->function_call.name, ids, node->function_call.arg_count);
+            mem_free(ids);
+            return id;
+        case AST_FUNCTION_DEF:
+            return add_function_def_node(ast, node->function_def.name, node->function_def.is_public, node->function_def.param_names, node->function_def.param_types, node->function_def.param_count, node->function_def.return_type, compact_ast_node(ast, node->function_def.body));
+        case AST_BLOCK:
+            ids = compact_node_list(ast, node->block.statements, node->block.statement_count);
+            id = add_block_node(ast, ids, node->block.statement_count);
+            mem_free(ids);
+            return id;
+        case AST_IF: {
+            NodeId condition = compact_ast_node(ast, node->if_statement.condition);
+            NodeId then_branch = compact_ast_node(ast, node->if_statement.then_branch);
+            NodeId else_branch = compact_ast_node(ast, node->if_statement.else_branch);
+            return add_if_node(ast, condition, then_branch, else_branch);
+        }
+        case AST_WHILE: {
+            NodeId condition = compact_ast_node(ast, node->while_loop.condition);
+            NodeId body = compact_ast_node(ast, node->while_loop.body);
+            return add_while_node(ast, condition, body);
+        }
+        case AST_RETURN:
+            return add_return_node(ast, compact_ast_node(ast, node->return_statement.value));
+        case AST_DEFER:
+            return add_defer_node(ast, compact_ast_node(ast, node->defer_statement.value));
+        case AST_ASSIGNMENT:
+            return add_assignment_node(ast, node->assignment.name, compact_ast_node(ast, node->assignment.value));
+        case AST_TYPE_DECL:
+            return add_type_decl_node(ast, node->type_decl.name, node->type_decl.type);
+        case AST_STRUCT_DEF:
+            return add_struct_def_node(ast, node->struct_def.name, node->struct_def.field_names, node->struct_def.field_types, node->struct_def.field_count);
+        case AST_STRUCT_ACCESS:
+            return add_struct_access_node(ast, compact_ast_node(ast, node->struct_access.struct_expr), node->struct_access.member_name);
+        case AST_CAST:
+            return add_cast_node(ast, node->cast.target_type, compact_ast_node(ast, node->cast.expr));
+        case AST_ARRAY_DEF:
+            return add_array_def_node(ast, node->array_def.name, node->array_def.type, compact_ast_node(ast, node->array_def.initializer));
+        case AST_ARRAY_ACCESS: {
+            NodeId index = compact_ast_node(ast, node->array_access.index);
+            NodeId child = compact_ast_node(ast, node->array_access.child);
+            return add_array_access_node(ast, node->array_access.reference, index, child);
+        }
+        case AST_ARRAY_ASSIGNMENT: {
+            NodeId index = compact_ast_node(ast, node->array_assignment.index);
+            NodeId value = compact_ast_node(ast, node->array_assignment.value);
+            return add_array_assignment_node(ast, node->array_assignment.reference, index, value);
+        }
+        case AST_LITERAL_ARRAY:
+            ids = compact_node_list(ast, node->literal_array.values, node->literal_array.value_count);
+            id = add_literal_array_node(ast, ids, node->literal_array.value_count);
+            mem_free(ids);
+            return id;
+        default:
+            return NODE_NONE;
+    }
+}
+
+// Returns the interned symbol of a symbol of the tree being expanded, one that
+// cannot be interned for lack of memory marks the arena like a node would
+static Symbol expand_symbol(Arena* arena, const CompactAST* ast, Symbol symbol) {
+    Symbol interned = compact_symbol(ast, symbol);
+    if (interned == SYMBOL_NONE && symbol != SYMBOL_NONE && symbol <= ast->strings.count) {
+        arena->out_of_memory = 1;
+    }
+    return interned;
+}
+
+// Copies a range of name and type pairs into the arena, the names come first
+static Symbol* expand_symbol_pairs(const CompactAST* ast, NodeRange range, Arena* arena) {
+    Symbol* pairs = arena_copy(arena, compact_symbols(ast, range), 2 * range.count * sizeof(Symbol));
+    for (size_t i = 0; pairs != NULL && ast->strings.data != NULL && i < 2 * (size_t)range.count; i++) {
+        pairs[i] = expand_symbol(arena, ast, pairs[i]);
+    }
+    return pairs;
+}
+
+// Expands a range of children into an arena array of pointer nodes
+static ASTNode** expand_node_list(const CompactAST* ast, NodeRange range, Arena* arena) {
+    if (range.count == 0) {
+        return NULL;
+    }
+
+    const NodeId* ids = compact_children(ast, range);
+    ASTNode** nodes = arena_alloc(arena, range.count * sizeof(ASTNode*));
+    for (uint32_t i = 0; nodes != NULL && i < range.count; i++) {
+        nodes[i] = expand_compact_node(ast, ids[i], arena);
+    }
+    return nodes;
+}
+
+// Builds the pointer AST of a compact node in the arena, the inverse of
+// compact_ast_node
+// Whatever does not fit in memory is left NULL and marks the arena, so the
+// caller checks arena->out_of_memory before using the tree.
+ASTNode* expand_compact_node(const CompactAST* ast, NodeId node, Arena* arena) {
+    if (node == NODE_NONE) {
+        return NULL;
+    }
+
+    const void* data = compact_node_data(ast, node);
+    switch (compact_node_type(ast, node)) {
+        case AST_VARIABLE_DEF: {
+            const CompactVariableDef* def = data;
+            return create_variable_def_node(arena, expand_symbol(arena, ast, def->name), expand_symbol(arena, ast, def->type), expand_compact_node(ast, def->initializer, arena));
+        }
+        case AST_VARIABLE_ASSIGNMENT: {
+            const CompactAssignment* assignment = data;
+            return create_variable_assignment_node(arena, expand_symbol(arena, ast, assignment->name), expand_compact_node(ast, assignment->value, arena));
+        }
+        case AST_LITERAL: {
+            const CompactLiteral* literal = data;
+            Symbol value = expand_symbol(arena, ast, literal->value);
+            // Numbers of a view are parsed once they are expanded
+            if (ast->strings.data != NULL && literal->kind == LITERAL_NUMBER && value != SYMBOL_NONE &&
+                intern_number(symbol_str(value), symbol_len(value)) == SYMBOL_NONE) {
+                arena->out_of_memory = 1;
+            }
+            return create_literal_node(arena, (LiteralKind)literal->kind, value);
+        }
+        case AST_REFERENCE: {
+            const CompactReference* reference = data;
+            ASTNode* expanded = create_reference_node(arena, expand_symbol(arena, ast, reference->name));
+            if (expanded == NULL) {
+                return NULL;
+            }
+            expanded->reference.child = expand_compact_node(ast, reference->child, arena);
+            return expanded;
+        }
+        case AST_BINARY_OP: {
+            const CompactBinaryOp* binary_op = data;
+            ASTNode* left = expand_compact_node(ast, binary_op->left, arena);
+            ASTNode* right = expand_compact_node(ast, binary_op->right, arena);
+            return create_binary_op_node(arena, (BinaryOperator)binary_op->op, left, right);
+        }
+        case AST_UNARY_OP: {
+            const CompactUnaryOp* unary_op = data;
+            return create_unary_op_node(arena, (UnaryOperator)unary_op->op, expand_compact_node(ast, unary_op->operand, arena));
+        }
+        case AST_FUNCTION_CALL: {
+            const CompactFunctionCall* call = data;
+            return create_function_call_node(arena, expand_symbol(arena, ast, call->name), expand_node_list(ast, call->args, arena), call->args.count);
+        }
+        case AST_FUNCTION_DEF: {
+            const CompactFunctionDef* def = data;
+            uint32_t param_count = def->params.count;
+            Symbol* params = expand_symbol_pairs(ast, def->params, arena);
+            ASTNode* body = expand_compact_node(ast, def->body, arena);
+            return create_function_def_node(arena, expand_symbol(arena, ast, def->name), (int)def->is_public, params, params != NULL ? params + param_count : NULL, param_count, expand_symbol(arena, ast, def->return_type), body);
+        }
+        case AST_BLOCK: {
+            const CompactBlock* block = data;
+            return create_block_node(arena, expand_node_list(ast, block->statements, arena), block->statements.count);
+        }
+        case AST_IF: {
+            const CompactIf* if_statement = data;
+            ASTNode* condition = expand_compact_node(ast, if_statement->condition, arena);
+            ASTNode* then_branch = expand_compact_node(ast, if_statement->then_branch, arena);
+            ASTNode* else_branch = expand_compact_node(ast, if_statement->else_branch, arena);
+            return create_if_node(arena, condition, then_branch, else_branch);
+        }
+        case AST_WHILE: {
+            const CompactWhile* while_loop = data;
+            ASTNode* condition = expand_compact_node(ast, while_loop->condition, arena);
+            return create_while_node(arena, condition, expand_compact_node(ast, while_loop->body, arena));
+        }
+        case AST_RETURN: {
+            const CompactValue* value = data;
+            return create_return_node(arena, expand_compact_node(ast, value->value, arena));
+        }
+        case AST_DEFER: {
+            const CompactValue* value = data;
+            return create_defer_node(arena, expand_compact_node(ast, value->value, arena));
+        }
+        case AST_ASSIGNMENT: {
+            const CompactAssignment* assignment = data;
+            return create_assignment_node(arena, expand_symbol(arena, ast, assignment->name), expand_compact_node(ast, assignment->value, arena));
+        }
+        case AST_TYPE_DECL: {
+            const CompactTypeDecl* type_decl = data;
+            return create_type_decl_node(arena, expand_symbol(arena, ast, type_decl->name), expand_symbol(arena, ast, type_decl->type));
+        }
+        case AST_STRUCT_DEF: {
+            const CompactStructDef* def = data;
+            uint32_t field_count = def->fields.count;
+            Symbol* fields = expand_symbol_pairs(ast, def->fields, arena);
+            return create_struct_def_node(arena, expand_symbol(arena, ast, def->name), fields, fields != NULL ? fields + field_count : NULL, field_count);
+        }
+        case AST_STRUCT_ACCESS: {
+            const CompactMember* member = data;
+            return create_struct_access_node(arena, expand_compact_node(ast, member->expr, arena), expand_symbol(arena, ast, member->name));
+        }
+        case AST_CAST: {
+            const CompactMember* member = data;
+            return create_cast_node(arena, expand_symbol(arena, ast, member->name), expand_compact_node(ast, member->expr, arena));
+        }
+        case AST_ARRAY_DEF: {
+            const CompactVariableDef* def = data;
+            return create_array_def_node(arena, expand_symbol(arena, ast, def->name), expand_symbol(arena, ast, def->type), expand_compact_node(ast, def->initializer, arena));
+        }
+        case AST_ARRAY_ACCESS: {
+            const CompactArrayAccess* access = data;
+            ASTNode* expanded = create_array_access_node(arena, expand_symbol(arena, ast, access->reference), expand_compact_node(ast, access->index, arena));
+            if (expanded == NULL) {
+                return NULL;
+            }
+            expanded->array_access.child = expand_compact_node(ast, access->child, arena);
+            return expanded;
+        }
+        case AST_ARRAY_ASSIGNMENT: {
+            const CompactArrayAssignment* assignment = data;
+            ASTNode* index = expand_compact_node(ast, assignment->index, arena);
+            ASTNode* value = expand_compact_node(ast, assignment->value, arena);
+            return create_array_assignment_node(arena, expand_symbol(arena, ast, assignment->reference), index, value);
+        }
+        case AST_LITERAL_ARRAY: {
+            const CompactBlock* block = data;
+            return create_literal_array_node(arena, expand_node_list(ast, block->statements, arena), block->statements.count);
+        }
+        default:
+            return NULL;
+    }
+}
+
+// Returns the interned symbol of a symbol of the tree being dumped, one that
+// cannot be interned for lack of memory marks the dump as failed
+static Symbol dump_interned(ASTDump* dump, const CompactAST* ast, Symbol symbol) {
+    Symbol interned = compact_symbol(ast, symbol);
+    if (interned == SYMBOL_NONE && symbol != SYMBOL_NONE && symbol <= ast->strings.count) {
+        dump->writer->failed = 1;
+    }
+    return interned;
+}
+
+// Writes the same dump as write_ast_node, straight from the compact layout
+// A view whose symbols do not fit in memory marks the writer as failed.
+void write_compact_node(ASTDump* dump, const CompactAST* ast, NodeId node, size_t indent, size_t parent) {
+    if (node == NODE_NONE) {
+        return;
+    }
+
+    const void* data = compact_node_data(ast, node);
+    ASTNodeType type = compact_node_type(ast, node);
+    size_t id = begin_dump_node(dump, type, indent, parent);
+    indent += 2;
+    switch (type) {
+        case AST_VARIABLE_DEF:
+        case AST_ARRAY_DEF: {
+            const CompactVariableDef* def = data;
+            dump_symbol(dump, "name", dump_interned(dump, ast, def->name));
+            dump_symbol(dump, "type", dump_interned(dump, ast, def->type));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, def->initializer, indent, id);
+            break;
+        }
+        case AST_VARIABLE_ASSIGNMENT:
+        case AST_ASSIGNMENT: {
+            const CompactAssignment* assignment = data;
+            dump_symbol(dump, "name", dump_interned(dump, ast, assignment->name));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, assignment->value, indent, id);
+            break;
+        }
+        case AST_LITERAL: {
+            const CompactLiteral* literal = data;
+            dump_literal(dump, (LiteralKind)literal->kind, dump_interned(dump, ast, literal->value));
+            end_dump_node(dump);
+            break;
+        }
+        case AST_REFERENCE: {
+            const CompactReference* reference = data;
+            dump_symbol(dump, "name", dump_interned(dump, ast, reference->name));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, reference->child, indent, id);
+            break;
+        }
+        case AST_BINARY_OP: {
+            const CompactBinaryOp* binary_op = data;
+            const char* op = binary_op_to_str((BinaryOperator)binary_op->op);
+            dump_string(dump, "op", op, strlen(op));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, binary_op->left, indent, id);
+            write_compact_node(dump, ast, binary_op->right, indent, id);
+            break;
+        }
+        case AST_UNARY_OP: {
+            const CompactUnaryOp* unary_op = data;
+            const char* op = unary_op_to_str((UnaryOperator)unary_op->op);
+            dump_string(dump, "op", op, strlen(op));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, unary_op->operand, indent, id);
+            break;
+        }
+        case AST_FUNCTION_CALL: {
+            const CompactFunctionCall* call = data;
+            const NodeId* args = compact_children(ast, call->args);
+            dump_symbol(dump, "name", dump_interned(dump, ast, call->name));
+            end_dump_node(dump);
+            for (uint32_t i = 0; i < call->args.count; i++) {
+                write_compact_node(dump, ast, args[i], indent, id);
+            }
+            break;
+        }
+        case AST_FUNCTION_DEF: {
+            const CompactFunctionDef* def = data;
+            Symbol* copy;
+            const Symbol* params = interned_symbols(ast, def->params, &copy);
+            if (params == NULL && def->params.count > 0) {
+                dump->writer->failed = 1;
+            }
+            dump_symbol(dump, "name", dump_interned(dump, ast, def->name));
+            dump_function_signature(dump, (int)def->is_public, dump_interned(dump, ast, def->return_type));
+            dump_symbol_pairs(dump, "params", params, params != NULL ? params + def->params.count : NULL, params != NULL ? def->params.count : 0, indent - 2, 0);
+            mem_free(copy);
+            end_dump_node(dump);
+            write_compact_node(dump, ast, def->body, indent, id);
+            break;
+        }
+        case AST_BLOCK:
+        case AST_LITERAL_ARRAY: {
+            const CompactBlock* block = data;
+            const NodeId* statements = compact_children(ast, block->statements);
+            end_dump_node(dump);
+            for (uint32_t i = 0; i < block->statements.count; i++) {
+                write_compact_node(dump, ast, statements[i], indent, id);
+            }
+            break;
+        }
+        case AST_IF: {
+            const CompactIf* if_statement = data;
+            end_dump_node(dump);
+            write_compact_node(dump, ast, if_statement->condition, indent, id);
+            write_compact_node(dump, ast, if_statement->then_branch, indent, id);
+            write_compact_node(dump, ast, if_statement->else_branch, indent, id);
+            break;
+        }
+        case AST_WHILE: {
+            const CompactWhile* while_loop = data;
+            end_dump_node(dump);
+            write_compact_node(dump, ast, while_loop->condition, indent, id);
+            write_compact_node(dump, ast, while_loop->body, indent, id);
+            break;
+        }
+        case AST_RETURN:
+        case AST_DEFER:
+            end_dump_node(dump);
+            write_compact_node(dump, ast, ((const CompactValue*)data)->value, indent, id);
+            break;
+        case AST_TYPE_DECL: {
+            const CompactTypeDecl* type_decl = data;
+            dump_symbol(dump, "name", dump_interned(dump, ast, type_decl->name));
+            dump_symbol(dump, "type", dump_interned(dump, ast, type_decl->type));
+            end_dump_node(dump);
+            break;
+        }
+        case AST_STRUCT_DEF: {
+            const CompactStructDef* def = data;
+            Symbol* copy;
+            const Symbol* fields = interned_symbols(ast, def->fields, &copy);
+            if (fields == NULL && def->fields.count > 0) {
+                dump->writer->failed = 1;
+            }
+            dump_symbol(dump, "name", dump_interned(dump, ast, def->name));
+            dump_symbol_pairs(dump, "fields", fields, fields != NULL ? fields + def->fields.count : NULL, fields != NULL ? def->fields.count : 0, indent - 2, 1);
+            mem_free(copy);
+            end_dump_node(dump);
+            break;
+        }
+        case AST_STRUCT_ACCESS: {
+            const CompactMember* access = data;
+            dump_symbol(dump, "member", dump_interned(dump, ast, access->name));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, access->expr, indent, id);
+            break;
+        }
+        case AST_CAST: {
+            const CompactMember* cast = data;
+            dump_symbol(dump, "type", dump_interned(dump, ast, cast->name));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, cast->expr, indent, id);
+            break;
+        }
+        case AST_ARRAY_ACCESS: {
+            const CompactArrayAccess* access = data;
+            dump_symbol(dump, "name", dump_interned(dump, ast, access->reference));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, access->index, indent, id);
+            break;
+        }
+        case AST_ARRAY_ASSIGNMENT: {
+            const CompactArrayAssignment* assignment = data;
+            dump_symbol(dump, "name", dump_interned(dump, ast, assignment->reference));
+            end_dump_node(dump);
+            write_compact_node(dump, ast, assignment->index, indent, id);
+            write_compact_node(dump, ast, assignment->value, indent, id);
+            break;
+        }
+        default:
+            end_dump_node(dump);
+            break;
+    }
+}
+
+void print_compact_node(const CompactAST* ast, NodeId node, size_t indent) {
+    Writer writer;
+    ASTDump dump;
+    init_writer(&writer, stdout);
+    init_ast_dump(&dump, &writer, DUMP_TEXT);
+    write_compact_node(&dump, ast, node, indent, DUMP_NO_PARENT);
+    flush_writer(&writer);
+    free_writer(&writer);
+}
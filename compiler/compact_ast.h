@@ -0,0 +1,238 @@
+#ifndef COMPACT_AST_H
+#define COMPACT_AST_H
+
+#include "ast.h"
+#include "intern.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Nodes of the compact AST are identified by a 32-bit index
+typedef uint32_t NodeId;
+
+// Node 0 is never handed out and marks the absence of a node
+#define NODE_NONE 0
+
+// Range of a child list in the shared children (or symbols) array
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} NodeRange;
+
+// Per kind payloads, every kind of node has its own contiguous array of these
+
+// AST_VARIABLE_DEF and AST_ARRAY_DEF
+typedef struct {
+    Symbol name;
+    Symbol type;
+    NodeId initializer;
+} CompactVariableDef;
+
+// AST_VARIABLE_ASSIGNMENT and AST_ASSIGNMENT
+typedef struct {
+    Symbol name;
+    NodeId value;
+} CompactAssignment;
+
+// AST_LITERAL, the value of numbers is found through number_value
+typedef struct {
+    Symbol value;
+    uint32_t kind; // LiteralKind
+} CompactLiteral;
+
+// AST_REFERENCE
+typedef struct {
+    Symbol name;
+    NodeId child;
+} CompactReference;
+
+// AST_BINARY_OP
+typedef struct {
+    uint32_t op; // BinaryOperator
+    NodeId left;
+    NodeId right;
+} CompactBinaryOp;
+
+// AST_UNARY_OP
+typedef struct {
+    uint32_t op; // UnaryOperator
+    NodeId operand;
+} CompactUnaryOp;
+
+// AST_FUNCTION_CALL
+typedef struct {
+    Symbol name;
+    NodeRange args; // Into the children
+} CompactFunctionCall;
+
+// AST_FUNCTION_DEF
+typedef struct {
+    Symbol name;
+    Symbol return_type;
+    NodeRange params; // Into the symbols, the names followed by the types
+    NodeId body;
+    uint32_t is_public;
+} CompactFunctionDef;
+
+// AST_BLOCK and AST_LITERAL_ARRAY
+typedef struct {
+    NodeRange statements; // Into the children
+} CompactBlock;
+
+// AST_IF
+typedef struct {
+    NodeId condition;
+    NodeId then_branch;
+    NodeId else_branch;
+} CompactIf;
+
+// AST_WHILE
+typedef struct {
+    NodeId condition;
+    NodeId body;
+} CompactWhile;
+
+// AST_RETURN and AST_DEFER
+typedef struct {
+    NodeId value;
+} CompactValue;
+
+// AST_TYPE_DECL
+typedef struct {
+    Symbol name;
+    Symbol type;
+} CompactTypeDecl;
+
+// AST_STRUCT_DEF
+typedef struct {
+    Symbol name;
+    NodeRange fields; // Into the symbols, the names followed by the types
+} CompactStructDef;
+
+// AST_STRUCT_ACCESS (member name) and AST_CAST (target type)
+typedef struct {
+    NodeId expr;
+    Symbol name;
+} CompactMember;
+
+// AST_ARRAY_ACCESS
+typedef struct {
+    Symbol reference;
+    NodeId index;
+    NodeId child;
+} CompactArrayAccess;
+
+// AST_ARRAY_ASSIGNMENT
+typedef struct {
+    Symbol reference;
+    NodeId index;
+    NodeId value;
+} CompactArrayAssignment;
+
+// Structure to hold the nodes of one kind
+// items holds the payloads, nodes the id of the node every payload belongs to.
+typedef struct {
+    void* items;
+    NodeId* nodes;
+    uint32_t count;
+    uint32_t capacity;
+} CompactKind;
+
+// Structure to hold the string table of a module file a tree is viewed in
+// The strings follow each other in data, each NUL terminated, local symbol i
+// (1-based) runs from offsets[i - 1] up to the NUL before offsets[i].
+typedef struct {
+    const char* data;        // NULL for a tree built in memory
+    const uint32_t* offsets; // count + 1 offsets, the first one 0
+    uint32_t count;
+    Symbol* interned;        // Interned symbol per local one, SYMBOL_NONE until asked for
+} CompactStrings;
+
+// Structure to hold a compact AST
+// Nodes only store their tag and the index of their payload in the array of
+// their kind (struct of arrays), so a pass over all nodes of one kind walks
+// contiguous memory. Children are referred to by NodeId, child lists are
+// ranges into a single shared array.
+// A tree can also be a view of a module file, see read_module_cache. Its arrays
+// are the sections of the file, which are never grown or freed, so nodes must
+// not be added to it. Its symbols are local to the file and only interned once
+// something asks for them through compact_symbol.
+// Once a node does not fit in memory the tree is marked and every later add
+// returns NODE_NONE, so the builder only checks out_of_memory at the end.
+typedef struct {
+    uint8_t* tags;     // ASTNodeType per node
+    uint32_t* indices; // Index into the kind array per node
+    uint32_t node_count;
+    uint32_t node_capacity;
+
+    CompactKind kinds[AST_NODE_TYPE_COUNT];
+
+    NodeId* children;
+    uint32_t child_count;
+    uint32_t child_capacity;
+
+    Symbol* symbols;
+    uint32_t symbol_count;
+    uint32_t symbol_capacity;
+
+    CompactStrings strings;
+    int out_of_memory; // Set once a node did not fit, the tree is incomplete
+} CompactAST;
+
+// Kinds of the fields of a payload that refer to something else
+typedef enum {
+    FIELD_SYMBOL,   // Symbol
+    FIELD_NODE,     // NodeId, may be NODE_NONE
+    FIELD_CHILDREN, // NodeRange into the children
+    FIELD_SYMBOLS   // NodeRange into the symbols, covering twice its count
+} CompactFieldKind;
+
+// Describes a field of a payload, used to walk payloads without knowing their type
+typedef struct {
+    uint8_t kind;   // CompactFieldKind
+    uint8_t offset; // Offset of the field in the payload
+} CompactField;
+
+// Function declarations
+void init_compact_ast(CompactAST* ast);
+void free_compact_ast(CompactAST* ast);
+
+ASTNodeType compact_node_type(const CompactAST* ast, NodeId node);
+const void* compact_node_data(const CompactAST* ast, NodeId node);
+const void* compact_kind_items(const CompactAST* ast, ASTNodeType type, size_t* count);
+const NodeId* compact_children(const CompactAST* ast, NodeRange range);
+const Symbol* compact_symbols(const CompactAST* ast, NodeRange range);
+Symbol compact_symbol(const CompactAST* ast, Symbol symbol);
+const char* compact_symbol_str(const CompactAST* ast, Symbol symbol, size_t* length);
+size_t compact_item_size(ASTNodeType type);
+const CompactField* compact_fields(ASTNodeType type, size_t* count);
+
+// Children have to be added before their parents, child lists are copied
+NodeId add_variable_def_node(CompactAST* ast, Symbol name, Symbol type, NodeId initializer);
+NodeId add_variable_assignment_node(CompactAST* ast, Symbol name, NodeId value);
+NodeId add_literal_node(CompactAST* ast, LiteralKind kind, Symbol value);
+NodeId add_reference_node(CompactAST* ast, Symbol name, NodeId child);
+NodeId add_binary_op_node(CompactAST* ast, BinaryOperator op, NodeId left, NodeId right);
+NodeId add_unary_op_node(CompactAST* ast, UnaryOperator op, NodeId operand);
+NodeId add_function_call_node(CompactAST* ast, Symbol name, const NodeId* args, size_t arg_count);
+NodeId add_function_def_node(CompactAST* ast, Symbol name, int is_public, const Symbol* param_names, const Symbol* param_types, size_t param_count, Symbol return_type, NodeId body);
+NodeId add_block_node(CompactAST* ast, const NodeId* statements, size_t statement_count);
+NodeId add_if_node(CompactAST* ast, NodeId condition, NodeId then_branch, NodeId else_branch);
+NodeId add_while_node(CompactAST* ast, NodeId condition, NodeId body);
+NodeId add_return_node(CompactAST* ast, NodeId value);
+NodeId add_defer_node(CompactAST* ast, NodeId value);
+NodeId add_assignment_node(CompactAST* ast, Symbol name, NodeId value);
+NodeId add_type_decl_node(CompactAST* ast, Symbol name, Symbol type);
+NodeId add_struct_def_node(CompactAST* ast, Symbol name, const Symbol* field_names, const Symbol* field_types, size_t field_count);
+NodeId add_struct_access_node(CompactAST* ast, NodeId struct_node, Symbol field_name);
+NodeId add_cast_node(CompactAST* ast, Symbol type, NodeId value);
+NodeId add_array_def_node(CompactAST* ast, Symbol name, Symbol type, NodeId initializer);
+NodeId add_array_access_node(CompactAST* ast, Symbol reference, NodeId index, NodeId child);
+NodeId add_array_assignment_node(CompactAST* ast, Symbol reference, NodeId index, NodeId value);
+NodeId add_literal_array_node(CompactAST* ast, const NodeId* values, size_t value_count);
+
+NodeId compact_ast_node(CompactAST* ast, const ASTNode* node);
+ASTNode* expand_compact_node(const CompactAST* ast, NodeId node, Arena* arena);
+void write_compact_node(ASTDump* dump, const CompactAST* ast, NodeId node, size_t indent, size_t parent);
+void print_compact_node(const CompactAST* ast, NodeId node, size_t indent);
+
+#endif // COMPACT_AST_H
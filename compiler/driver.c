@@ -0,0 +1,266 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "driver.h"
+#include "ast.h"
+#include "ngp.h"
+#include "parallel.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Heap a file takes while it is compiled, per byte of its source
+// The token stream and the tree of large inputs come to a little under this.
+#define BYTES_PER_SOURCE_BYTE 40
+
+// Structure to hold an input file and what compiling it gave
+// Every file is compiled in a library context of its own.
+typedef struct {
+    const char* filename;
+    char* output; // Where its module is written, NULL for nowhere
+    NgpContext* context;
+    NgpStatus status;
+    int read_failed; // Not compiled, reported along with the other errors
+    int write_failed;
+} CompileUnit;
+
+// Shared by the tasks compiling the files
+typedef struct {
+    const DriverOptions* options;
+    CompileUnit* units;
+    size_t item_jobs; // Threads each file may use for its own items
+    mtx_t lock;       // Guards in_flight
+    cnd_t released;
+    size_t in_flight; // Estimated bytes of the files being compiled
+} CompileWork;
+
+static void out_of_memory() {
+    fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+    exit(1);
+}
+
+void init_driver_options(DriverOptions* options) {
+    options->output = NULL;
+    options->optimize = 0;
+    options->jobs = 1;
+    options->memory_budget = 0;
+}
+
+// Waits until the file fits in the memory budget next to the files being
+// compiled, a file that does not fit on its own waits until nothing else runs
+static void reserve_memory(CompileWork* work, size_t bytes) {
+    if (work->options->memory_budget == 0) {
+        return;
+    }
+
+    mtx_lock(&work->lock);
+    while (work->in_flight > 0 && work->in_flight + bytes > work->options->memory_budget) {
+        cnd_wait(&work->released, &work->lock);
+    }
+    work->in_flight += bytes;
+    mtx_unlock(&work->lock);
+}
+
+static void release_memory(CompileWork* work, size_t bytes) {
+    if (work->options->memory_budget == 0) {
+        return;
+    }
+
+    mtx_lock(&work->lock);
+    work->in_flight -= bytes;
+    cnd_broadcast(&work->released);
+    mtx_unlock(&work->lock);
+}
+
+// Writes a module to the given path, returns -1 if it cannot be written
+static int write_module(const char* path, const unsigned char* module, size_t size) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    int result = fwrite(module, 1, size, file) == size ? 0 : -1;
+    if (fclose(file) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+// Compiles and writes one file, an error is kept in the context of the unit
+// and reported once all files are done
+static void compile_file_task(void* context, size_t worker, size_t index) {
+    (void)worker;
+    CompileWork* work = context;
+    CompileUnit* unit = &work->units[index];
+    if (unit->read_failed) {
+        return;
+    }
+
+    size_t estimate = ngp_source_size(unit->context, 0) * BYTES_PER_SOURCE_BYTE;
+    reserve_memory(work, estimate);
+
+    ngp_set_optimize(unit->context, work->options->optimize);
+    ngp_set_jobs(unit->context, work->item_jobs);
+    unit->status = ngp_compile(unit->context);
+
+    if (unit->status == NGP_OK && unit->output != NULL) {
+        size_t size;
+        const unsigned char* module = ngp_get_module(unit->context, 0, &size);
+        unit->write_failed = write_module(unit->output, module, size) != 0;
+    }
+
+    release_memory(work, estimate);
+}
+
+// Returns the path of the module of an input in the output directory, its file
+// name with the extension replaced by .ngm
+static char* module_path(const char* directory, const char* filename) {
+    const char* name = strrchr(filename, '/');
+#ifdef _WIN32
+    const char* backslash = strrchr(filename, '\\');
+    if (backslash != NULL && (name == NULL || backslash > name)) {
+        name = backslash;
+    }
+#endif
+    name = name != NULL ? name + 1 : filename;
+
+    const char* extension = strrchr(name, '.');
+    size_t name_length = extension != NULL && extension != name ? (size_t)(extension - name) : strlen(name);
+
+    size_t directory_length = strlen(directory);
+    char* path = mem_alloc(directory_length + name_length + 6);
+    if (path == NULL) {
+        out_of_memory();
+    }
+    memcpy(path, directory, directory_length);
+    path[directory_length] = '/';
+    memcpy(path + directory_length + 1, name, name_length);
+    memcpy(path + directory_length + 1 + name_length, ".ngm", 5);
+    return path;
+}
+
+// Decides where the module of every input goes, a single input is written to
+// the output itself and several into the output directory
+// Returns -1 after reporting it if two inputs would write the same module.
+static int assign_outputs(const char* output, CompileUnit* units, size_t count) {
+    if (count == 1) {
+        units[0].output = strdup_c(output);
+        if (units[0].output == NULL) {
+            out_of_memory();
+        }
+        return 0;
+    }
+
+    // If the directory already exists this fails, and if it cannot be created
+    // the first write reports it
+#ifdef _WIN32
+    _mkdir(output);
+#else
+    mkdir(output, 0777);
+#endif
+
+    for (size_t i = 0; i < count; i++) {
+        units[i].output = module_path(output, units[i].filename);
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(units[i].output, units[j].output) == 0) {
+                fprintf(stderr, "\033[31mError: %s and %s would both be written to %s\n\033[0m", units[j].filename, units[i].filename, units[i].output);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void free_units(CompileUnit* units, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        mem_free(units[i].output);
+        ngp_destroy_context(units[i].context);
+    }
+    mem_free(units);
+}
+
+// Compiles the files independently of each other, up to options->jobs at a time
+// Every file is parsed into a module that is written to options->output. A
+// single file spends the jobs on its own items instead. Returns -1 if any file
+// could not be read, parsed or written, after reporting every error in the
+// order of the inputs.
+int compile_files(const DriverOptions* options, const char** filenames, size_t count, CompilerStats* stats) {
+    begin_phase(stats, PHASE_READ);
+    CompileUnit* units = mem_calloc(count, sizeof(CompileUnit));
+    if (units == NULL) {
+        out_of_memory();
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < count; i++) {
+        units[i].filename = filenames[i];
+        units[i].context = ngp_create_context();
+        if (units[i].context == NULL) {
+            out_of_memory();
+        }
+
+        NgpStatus added = ngp_add_file(units[i].context, filenames[i]);
+        if (added == NGP_ERROR_MEMORY) {
+            out_of_memory();
+        } else if (added != NGP_OK) {
+            units[i].read_failed = 1;
+            continue;
+        }
+        stats->files++;
+        stats->source_bytes += ngp_source_size(units[i].context, 0);
+    }
+    if (options->output != NULL && assign_outputs(options->output, units, count) != 0) {
+        free_units(units, count);
+        return -1;
+    }
+
+    begin_phase(stats, PHASE_PARSE);
+    size_t jobs = options->jobs == 0 ? 1 : options->jobs;
+    CompileWork work;
+    work.options = options;
+    work.units = units;
+    work.item_jobs = count == 1 ? jobs : 1;
+    work.in_flight = 0;
+    mtx_init(&work.lock, mtx_plain);
+    cnd_init(&work.released);
+    run_parallel(count, jobs, compile_file_task, &work);
+    cnd_destroy(&work.released);
+    mtx_destroy(&work.lock);
+
+    for (size_t i = 0; i < count; i++) {
+        if (units[i].read_failed) {
+            fprintf(stderr, "\033[31mError: could not read %s\n\033[0m", units[i].filename);
+            status = -1;
+            continue;
+        }
+
+        stats->tokens += ngp_token_count(units[i].context);
+        for (size_t j = 0; j < ngp_diagnostic_count(units[i].context); j++) {
+            ngp_print_diagnostic(ngp_get_diagnostic(units[i].context, j), stderr);
+        }
+        if (units[i].status == NGP_ERROR_MEMORY) {
+            out_of_memory();
+        } else if (units[i].status != NGP_OK) {
+            status = -1;
+        } else if (units[i].write_failed) {
+            fprintf(stderr, "\033[31mError: could not write %s\n\033[0m", units[i].output);
+            status = -1;
+        }
+    }
+    stats->nodes = ast_node_count();
+
+    free_units(units, count);
+    return status;
+}
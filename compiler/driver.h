@@ -0,0 +1,19 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "stats.h"
+#include <stddef.h>
+
+// Structure to hold how the driver compiles a set of files
+typedef struct {
+    const char* output;   // Module file for a single input, directory for several, NULL to only check
+    int optimize;         // -O level, 1 and up drop the bodies of unreachable functions
+    size_t jobs;          // Files compiled at a time
+    size_t memory_budget; // Bytes the files being compiled may take together, 0 for no limit
+} DriverOptions;
+
+// Function declarations
+void init_driver_options(DriverOptions* options);
+int compile_files(const DriverOptions* options, const char** filenames, size_t count, CompilerStats* stats);
+
+#endif // DRIVER_H
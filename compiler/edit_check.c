@@ -0,0 +1,193 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "lexer.h"
+#include "intern.h"
+#include "number.h"
+#include "source.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks that re-lexing an edit gives the tokens of a full lex
+// Every file given on the command line gets a series of random edits through
+// tokenize_edit. After each one the tokens have to match, field by field and
+// in line and column, those of the edited source lexed from scratch. Run by
+// make check.
+
+#define EDITS_PER_SOURCE 400
+#define MAX_REMOVED_LENGTH 24
+#define MAX_COPIED_LENGTH 24
+
+// Text inserted by the edits, besides pieces of the source itself, picked to
+// split and join tokens of every kind and the lines they are on
+static const char* fragments[] = {
+    "", " ", "\n", "\n\n", "\t", "x", "_9", "fn", "pub ", "struct", "i32", "u8*", " *", "123", "4.5e6",
+    "0x1F", "\"", "\"text\"", "//", "// comment\n", "#", "#[", "]", "#[inline]", "use std;", "use a.b", ";",
+    "{", "}", "(", ")", "<", ">", "::", ":", "=", "!=", "!", ".", ",", "print!", "+", "-",
+};
+
+#define FRAGMENT_COUNT (sizeof(fragments) / sizeof(fragments[0]))
+
+static size_t checked_sources = 0;
+static size_t checked_edits = 0;
+static uint64_t random_state = 0x9E3779B97F4A7C15u;
+
+static void out_of_memory() {
+    fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+    exit(1);
+}
+
+// Returns a pseudo random number below the bound, the same on every run
+static size_t next_random(size_t bound) {
+    random_state = random_state * 6364136223846793005u + 1442695040888963407u;
+    return bound == 0 ? 0 : (size_t)(random_state >> 33) % bound;
+}
+
+// Returns 1 if the tokens agree in every field and in where they are, otherwise
+// prints the first field that differs
+static int compare_token(const char* name, size_t edit, size_t index, const Token* expected, FileId expected_file,
+                         const Token* actual, FileId actual_file) {
+    size_t expected_line, expected_column, actual_line, actual_column;
+    source_location(expected_file, expected->offset, &expected_line, &expected_column);
+    source_location(actual_file, actual->offset, &actual_line, &actual_column);
+
+    const char* field = NULL;
+    if (expected->type != actual->type) {
+        field = "type";
+    } else if (expected->keyword != actual->keyword) {
+        field = "keyword";
+    } else if (actual->file != actual_file) {
+        field = "file";
+    } else if (expected->symbol != actual->symbol) {
+        field = "symbol";
+    } else if (expected->offset != actual->offset) {
+        field = "offset";
+    } else if (expected->length != actual->length) {
+        field = "length";
+    } else if (expected_line != actual_line || expected_column != actual_column) {
+        field = "location";
+    }
+
+    if (field == NULL) {
+        return 1;
+    }
+
+    fprintf(stderr, "\033[31mError: %s: token %zu after edit %zu differs in its %s\n\033[0m", name, index, edit, field);
+    fprintf(stderr, "\tfull lex: %s at %u (%zu:%zu), length %u\n\tedited: %s at %u (%zu:%zu), length %u\n",
+            token_type_to_str(expected->type), expected->offset, expected_line, expected_column, expected->length,
+            token_type_to_str(actual->type), actual->offset, actual_line, actual_column, actual->length);
+    return 0;
+}
+
+// Lexes the current source of the stream from scratch and compares the tokens,
+// returns -1 if they differ
+static int check_stream(const char* name, size_t edit, const TokenStream* stream) {
+    FileId file = add_source_copy(name, stream->source, stream->source_length);
+    if (file == INVALID_FILE_ID) {
+        out_of_memory();
+    }
+
+    TokenStream expected;
+    init_token_stream(&expected);
+    reserve_token_stream(&expected, stream->source_length);
+    tokenize_source(&expected, file);
+
+    int status = 0;
+    if (expected.count != stream->count) {
+        fprintf(stderr, "\033[31mError: %s: %zu tokens after edit %zu, %zu with a full lex\n\033[0m",
+                name, stream->count, edit, expected.count);
+        status = -1;
+    }
+    for (size_t i = 0; status == 0 && i < expected.count; i++) {
+        if (!compare_token(name, edit, i, &expected.tokens[i], file, &stream->tokens[i], stream->file)) {
+            status = -1;
+        }
+    }
+
+    free_tokens(&expected);
+    release_source_file(file);
+    return status;
+}
+
+// Applies random edits to the file one after the other, and checks the tokens
+// after each
+static int check_source(const char* filename) {
+    FileId file = add_source_file(filename);
+    if (file == INVALID_FILE_ID) {
+        fprintf(stderr, "\033[31mError: could not read %s\n\033[0m", filename);
+        return -1;
+    }
+
+    TokenStream stream;
+    init_token_stream(&stream);
+    reserve_token_stream(&stream, get_source_file(file)->buffer.size);
+    tokenize_source(&stream, file);
+
+    // The line index is patched by the edits from here on
+    size_t line, column;
+    source_location(file, 0, &line, &column);
+
+    char* text = mem_alloc(MAX_COPIED_LENGTH);
+    if (text == NULL) {
+        out_of_memory();
+    }
+
+    int status = 0;
+    for (size_t edit = 0; status == 0 && edit < EDITS_PER_SOURCE; edit++) {
+        size_t length = stream.source_length;
+        size_t offset = next_random(length + 1);
+        size_t removed_length = next_random(MAX_REMOVED_LENGTH + 1);
+        if (removed_length > length - offset) {
+            removed_length = length - offset;
+        }
+
+        // Either a fragment, or a piece of the source moved somewhere else
+        size_t text_length;
+        if (next_random(2) == 0 || length == 0) {
+            const char* fragment = fragments[next_random(FRAGMENT_COUNT)];
+            text_length = strlen(fragment);
+            memcpy(text, fragment, text_length);
+        } else {
+            size_t from = next_random(length);
+            text_length = next_random(MAX_COPIED_LENGTH + 1);
+            if (text_length > length - from) {
+                text_length = length - from;
+            }
+            memcpy(text, stream.source + from, text_length);
+        }
+
+        if (tokenize_edit(&stream, offset, removed_length, text, text_length) != 0) {
+            fprintf(stderr, "\033[31mError: %s: edit %zu at %zu was refused\n\033[0m", filename, edit, offset);
+            status = -1;
+            break;
+        }
+        status = check_stream(filename, edit, &stream);
+        checked_edits++;
+    }
+
+    checked_sources++;
+    mem_free(text);
+    free_tokens(&stream);
+    release_source_file(file);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    int status = 0;
+    for (int i = 1; status == 0 && i < argc; i++) {
+        status = check_source(argv[i]);
+    }
+
+    if (status == 0) {
+        printf("Edits agree with a full lex on %zu edits in %zu sources\n", checked_edits, checked_sources);
+    }
+
+    free_source_files();
+    free_numbers();
+    free_interner();
+    return status == 0 ? 0 : 1;
+}
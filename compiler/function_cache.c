@@ -0,0 +1,343 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "function_cache.h"
+#include "compact_ast.h"
+#include "module_cache.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Bumped whenever the way functions are hashed or stored changes
+#define FUNCTION_CACHE_VERSION 2
+
+// A directory name that does not fit in memory fails the first compile as
+// running out of memory
+void init_function_cache(FunctionCache* cache, const char* directory) {
+    cache->directory = strdup_c(directory);
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->write_failed = 0;
+
+    // If the directory already exists this fails, and if it cannot be created
+    // the first write reports it
+#ifdef _WIN32
+    _mkdir(directory);
+#else
+    mkdir(directory, 0777);
+#endif
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    return hash_source(data, size, hash);
+}
+
+// Hashes the text of the symbol, prefixed with its length so that adjacent
+// names cannot run into each other
+static uint64_t hash_symbol(uint64_t hash, Symbol symbol) {
+    uint32_t length = (uint32_t)symbol_len(symbol);
+    hash = hash_bytes(hash, &length, sizeof(length));
+    return hash_bytes(hash, symbol_str(symbol), length);
+}
+
+// Hashes everything a caller depends on: the name, visibility, parameters and
+// return type
+static uint64_t hash_signature(uint64_t hash, const ASTNode* function) {
+    uint32_t is_public = (uint32_t)function->function_def.is_public;
+    uint32_t param_count = (uint32_t)function->function_def.param_count;
+    hash = hash_symbol(hash, function->function_def.name);
+    hash = hash_bytes(hash, &is_public, sizeof(is_public));
+    hash = hash_bytes(hash, &param_count, sizeof(param_count));
+    for (size_t i = 0; i < function->function_def.param_count; i++) {
+        hash = hash_symbol(hash, function->function_def.param_names[i]);
+        hash = hash_symbol(hash, function->function_def.param_types[i]);
+    }
+    return hash_symbol(hash, function->function_def.return_type);
+}
+
+// Returns the structural hash of a function whose body was skimmed
+// The body is hashed token by token, type and text, so whitespace, comments
+// and the position in the file do not matter. Every function the body calls
+// adds its signature, which is all a change to another function can break.
+// functions holds the function definitions of the module.
+uint64_t hash_function(const Parser* parser, const ASTNode* function, const FunctionTable* functions) {
+    uint64_t hash = SOURCE_HASH_SEED;
+    uint32_t version = FUNCTION_CACHE_VERSION;
+    hash = hash_bytes(hash, &version, sizeof(version));
+    hash = hash_signature(hash, function);
+
+    const TokenStream* stream = parser->stream;
+    size_t end = function->function_def.body_end;
+    for (size_t i = function->function_def.body_start; i <= end && i < stream->count; i++) {
+        const Token* token = &stream->tokens[i];
+        if (token->type == T_COMMENT) {
+            continue;
+        }
+
+        hash = hash_bytes(hash, &token->type, sizeof(token->type));
+        hash = hash_bytes(hash, &token->length, sizeof(token->length));
+        hash = hash_bytes(hash, stream->source + token->offset, token->length);
+
+        int is_call = token->type == T_IDENTIFIER && i + 1 <= end && stream->tokens[i + 1].type == T_L_PAREN;
+        const ASTNode* callee = is_call ? find_function(functions, token->symbol) : NULL;
+        if (callee != NULL) {
+            hash = hash_signature(hash, callee);
+        }
+    }
+    return hash;
+}
+
+// Structure to hold a function cache file that was read, and a table to find
+// its functions by hash
+typedef struct {
+    SourceBuffer buffer;
+    Module module;
+    const uint64_t* hashes;
+    const NodeId* functions; // The function of every hash
+    size_t count;
+    uint32_t* slots;         // Index + 1 of the function in every slot, 0 if free
+    size_t slot_count;
+} FunctionFile;
+
+static size_t hash_slot(uint64_t hash, size_t slot_count) {
+    return (size_t)hash & (slot_count - 1);
+}
+
+// Reads the functions stored for a source file, a file that is missing or not
+// valid is read as one without functions
+// The lookup table is allocated from the arena.
+static void read_function_file(FunctionFile* file, const char* path, Arena* arena) {
+    memset(file, 0, sizeof(FunctionFile));
+    if (load_source_file(path, &file->buffer) != 0) {
+        return;
+    }
+
+    const FunctionCacheHeader* header = (const FunctionCacheHeader*)file->buffer.data;
+    size_t size = file->buffer.size;
+    if (size < sizeof(FunctionCacheHeader) || header->magic != FUNCTION_CACHE_MAGIC || header->version != FUNCTION_CACHE_VERSION ||
+        header->function_count > (size - sizeof(FunctionCacheHeader)) / sizeof(uint64_t)) {
+        return;
+    }
+
+    // The module is checked against the hashes it was written with
+    size_t count = (size_t)header->function_count;
+    const uint64_t* hashes = (const uint64_t*)(header + 1);
+    size_t offset = sizeof(FunctionCacheHeader) + count * sizeof(uint64_t);
+    uint64_t module_hash = hash_source((const char*)hashes, count * sizeof(uint64_t), SOURCE_HASH_SEED);
+    if (read_module_buffer((const unsigned char*)file->buffer.data + offset, size - offset, module_hash, &file->module) != 0) {
+        return;
+    }
+
+    const CompactAST* ast = &file->module.ast;
+    if (compact_node_type(ast, file->module.root) != AST_BLOCK) {
+        free_module(&file->module);
+        return;
+    }
+    const CompactBlock* block = compact_node_data(ast, file->module.root);
+    if (block->statements.count != count) {
+        free_module(&file->module);
+        return;
+    }
+
+    file->hashes = hashes;
+    file->functions = compact_children(ast, block->statements);
+    file->count = count;
+    file->slot_count = 16;
+    while (file->slot_count < 2 * count) {
+        file->slot_count *= 2;
+    }
+    file->slots = arena_alloc(arena, file->slot_count * sizeof(uint32_t));
+    if (file->slots == NULL) {
+        // Marks the arena, the caller gives up
+        free_module(&file->module);
+        file->count = 0;
+        return;
+    }
+    memset(file->slots, 0, file->slot_count * sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = hash_slot(hashes[i], file->slot_count);
+        while (file->slots[slot] != 0) {
+            slot = (slot + 1) & (file->slot_count - 1);
+        }
+        file->slots[slot] = (uint32_t)(i + 1);
+    }
+}
+
+static void free_function_file(FunctionFile* file) {
+    free_module(&file->module);
+    free_source_file(&file->buffer);
+}
+
+// Gives the function the body stored under its hash, returns -1 on a miss
+// A body that does not fit in the arena is left NULL and marks the arena.
+static int load_function(const FunctionFile* file, Parser* parser, ASTNode* function, uint64_t hash) {
+    if (file->count == 0) {
+        return -1;
+    }
+
+    size_t slot = hash_slot(hash, file->slot_count);
+    for (; file->slots[slot] != 0; slot = (slot + 1) & (file->slot_count - 1)) {
+        size_t index = file->slots[slot] - 1;
+        if (file->hashes[index] != hash) {
+            continue;
+        }
+
+        // A function with the right hash has the right body, unless the file
+        // was tampered with
+        const CompactAST* ast = &file->module.ast;
+        if (compact_node_type(ast, file->functions[index]) != AST_FUNCTION_DEF) {
+            return -1;
+        }
+        const CompactFunctionDef* def = compact_node_data(ast, file->functions[index]);
+        if (def->body == NODE_NONE || compact_symbol(ast, def->name) != function->function_def.name) {
+            return -1;
+        }
+        function->function_def.body = expand_compact_node(ast, def->body, &parser->arena);
+        return 0;
+    }
+    return -1;
+}
+
+// Writes the functions, which all have their bodies, with their hashes
+// The file is written next to its path and then moved over it, so a reader
+// never sees half of it.
+static int write_function_file(const char* path, ASTNode** functions, const uint64_t* hashes, size_t count) {
+    CompactAST ast;
+    init_compact_ast(&ast);
+    NodeId* ids = mem_alloc((count + 1) * sizeof(NodeId));
+    if (ids == NULL) {
+        free_compact_ast(&ast);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        ids[i] = compact_ast_node(&ast, functions[i]);
+    }
+    NodeId root = add_block_node(&ast, ids, count);
+    mem_free(ids);
+    if (ast.out_of_memory) {
+        free_compact_ast(&ast);
+        return -1;
+    }
+
+    unsigned char* data;
+    size_t size;
+    uint64_t module_hash = hash_source((const char*)hashes, count * sizeof(uint64_t), SOURCE_HASH_SEED);
+    int failed = write_module_buffer(&ast, root, NULL, 0, module_hash, &data, &size) != 0;
+    free_compact_ast(&ast);
+    if (failed) {
+        return -1;
+    }
+
+    size_t temporary_size = strlen(path) + 5;
+    char* temporary = mem_alloc(temporary_size);
+    FILE* file = NULL;
+    if (temporary != NULL) {
+        snprintf(temporary, temporary_size, "%s.tmp", path);
+        file = fopen(temporary, "wb");
+    }
+    if (file != NULL) {
+        FunctionCacheHeader header = {FUNCTION_CACHE_MAGIC, FUNCTION_CACHE_VERSION, count};
+        failed = fwrite(&header, sizeof(header), 1, file) != 1 ||
+                 (count > 0 && fwrite(hashes, sizeof(uint64_t), count, file) != count) ||
+                 fwrite(data, 1, size, file) != size;
+        failed |= fclose(file) != 0;
+
+        // Windows does not move a file over an existing one
+        if (!failed && rename(temporary, path) != 0) {
+            remove(path);
+            failed = rename(temporary, path) != 0;
+        }
+        if (failed) {
+            remove(temporary);
+        }
+    } else {
+        failed = 1;
+    }
+
+    mem_free(temporary);
+    mem_free(data);
+    return failed ? -1 : 0;
+}
+
+// Compiles every top-level function of a parser that skimmed the bodies
+// A function whose hash is found in the cache gets its body from there, any
+// other function is parsed. The functions of the file are stored together in
+// one cache file, which is written again when it does not hold exactly them.
+// The stored artifact is the parsed body, which is all there is to a compiled
+// function so far. A body that fails to parse stops the compile with the error
+// in parser->error.
+void compile_functions(FunctionCache* cache, Parser* parser) {
+    ASTNode* root = parser->ast_root;
+    if (root == NULL) {
+        return;
+    }
+
+    ArenaMark scratch = arena_mark(&parser->scratch);
+    FunctionTable table;
+    int failed = init_function_table(&table, root, &parser->scratch) != 0;
+
+    // The functions whose bodies were skimmed, and their hashes
+    size_t count = 0;
+    ASTNode** functions = arena_alloc(&parser->scratch, (root->block.statement_count + 1) * sizeof(ASTNode*));
+    uint64_t* hashes = arena_alloc(&parser->scratch, (root->block.statement_count + 1) * sizeof(uint64_t));
+    const char* filename = source_filename(parser->stream->file);
+    size_t path_size = cache->directory != NULL ? strlen(cache->directory) + 32 : 0;
+    char* path = path_size != 0 ? arena_alloc(&parser->scratch, path_size) : NULL;
+    if (failed || functions == NULL || hashes == NULL || path == NULL) {
+        // Memory ran out, or the directory of the cache did not fit in it
+        fail_out_of_memory(parser);
+        arena_rewind(&parser->scratch, scratch);
+        return;
+    }
+
+    for (size_t i = 0; i < root->block.statement_count; i++) {
+        ASTNode* function = root->block.statements[i];
+        if (function->type == AST_FUNCTION_DEF && function->function_def.body == NULL && function->function_def.body_end != 0) {
+            hashes[count] = hash_function(parser, function, &table);
+            functions[count++] = function;
+        }
+    }
+
+    uint64_t name_hash = hash_source(filename, strlen(filename), SOURCE_HASH_SEED);
+    snprintf(path, path_size, "%s/%016llx.ngf", cache->directory, (unsigned long long)name_hash);
+
+    FunctionFile file;
+    read_function_file(&file, path, &parser->scratch);
+    size_t misses = 0;
+    for (size_t i = 0; i < count && !parse_failed(parser); i++) {
+        if (load_function(&file, parser, functions[i], hashes[i]) == 0) {
+            cache->hits++;
+        } else {
+            misses++;
+            parse_function_body(parser, functions[i]);
+        }
+    }
+    cache->misses += misses;
+
+    // Functions that were removed or changed are dropped along the way, nothing
+    // is written when a body fails to parse
+    int stale = !parse_failed(parser) && (misses > 0 || file.count != count);
+    free_function_file(&file);
+    if (stale && write_function_file(path, functions, hashes, count) != 0 && !cache->write_failed) {
+        fprintf(stderr, "\033[31mError: could not write %s\n\033[0m", path);
+        cache->write_failed = 1;
+    }
+
+    arena_rewind(&parser->scratch, scratch);
+}
+
+void free_function_cache(FunctionCache* cache) {
+    mem_free(cache->directory);
+    cache->directory = NULL;
+}
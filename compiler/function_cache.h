@@ -0,0 +1,37 @@
+#ifndef FUNCTION_CACHE_H
+#define FUNCTION_CACHE_H
+
+#include "parser.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Identifies function cache files, "NGPF" in a little endian file
+#define FUNCTION_CACHE_MAGIC 0x4650474e
+
+// Structure to hold the header of a function cache file
+// The header is followed by the hash of every function in the file (see
+// hash_function) and then by a module file whose root block holds the
+// functions in the same order.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t function_count;
+} FunctionCacheHeader;
+
+// Structure to hold an on-disk cache of compiled functions
+// The functions of a source file are stored together in one file, named after
+// the hash of the source file name, see compile_functions.
+typedef struct {
+    char* directory;
+    size_t hits;
+    size_t misses;
+    int write_failed; // Reported once, the build goes on without the cache
+} FunctionCache;
+
+// Function declarations
+void init_function_cache(FunctionCache* cache, const char* directory);
+uint64_t hash_function(const Parser* parser, const ASTNode* function, const FunctionTable* functions);
+void compile_functions(FunctionCache* cache, Parser* parser);
+void free_function_cache(FunctionCache* cache);
+
+#endif // FUNCTION_CACHE_H
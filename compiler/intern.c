@@ -0,0 +1,295 @@
+#include "intern.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define INTERN_CHUNK_SIZE 65536
+#define INTERN_FIRST_CHUNK_SIZE 4096
+#define INTERN_INITIAL_SLOTS 64
+
+// The hash table is split into shards by the top bits of the hash, each with
+// its own lock, so that lexers on several threads rarely wait on each other
+#define INTERN_SHARD_BITS 4
+#define INTERN_SHARD_COUNT ((size_t)1 << INTERN_SHARD_BITS)
+
+// Entries are stored in pages that never move, so that they can be read
+// while other threads intern, 2^16 pages of 2^16 entries cover every symbol
+#define INTERN_PAGE_BITS 16
+#define INTERN_PAGE_SIZE ((size_t)1 << INTERN_PAGE_BITS)
+#define INTERN_PAGE_COUNT ((size_t)1 << (32 - INTERN_PAGE_BITS))
+
+// Chunk of the pool holding the interned strings, strings never move once stored
+typedef struct InternChunk {
+    struct InternChunk* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} InternChunk;
+
+typedef struct {
+    const char* text;
+    uint32_t length;
+    uint32_t hash;
+    _Atomic uint32_t data; // Attached by other modules, 0 until set
+} InternEntry;
+
+// Structure to hold one shard of the hash table, and the pool of the strings
+// interned through it
+// slots is an open addressing hash table (linear probing) holding symbols,
+// where SYMBOL_NONE marks an empty slot.
+typedef struct {
+    mtx_t lock;
+    Symbol* slots;
+    size_t slot_count;
+    size_t symbol_count;
+    InternChunk* chunks;
+} InternShard;
+
+// The process wide interner
+// pages holds the entries indexed by symbol, symbols are numbered densely
+// across the shards. Interning takes the lock of one shard, looking up a
+// symbol does not: an entry is filled in under the shard lock before its
+// symbol is handed to anyone.
+static _Atomic(InternEntry*) pages[INTERN_PAGE_COUNT];
+static atomic_size_t entry_count = 0;
+static InternShard shards[INTERN_SHARD_COUNT];
+static once_flag intern_lock_once = ONCE_FLAG_INIT;
+
+static void init_intern_lock() {
+    for (size_t i = 0; i < INTERN_SHARD_COUNT; i++) {
+        mtx_init(&shards[i].lock, mtx_plain);
+    }
+}
+
+static InternEntry* get_entry(Symbol symbol) {
+    InternEntry* page = atomic_load_explicit(&pages[symbol >> INTERN_PAGE_BITS], memory_order_acquire);
+    return &page[symbol & (INTERN_PAGE_SIZE - 1)];
+}
+
+// Returns the entry of the symbol, or NULL if it was not handed out yet
+static InternEntry* find_entry(Symbol symbol) {
+    if (symbol == SYMBOL_NONE || symbol >= atomic_load_explicit(&entry_count, memory_order_acquire) ||
+        atomic_load_explicit(&pages[symbol >> INTERN_PAGE_BITS], memory_order_acquire) == NULL) {
+        return NULL;
+    }
+    return get_entry(symbol);
+}
+
+// FNV-1a
+static uint32_t hash_string(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Copies the string into the pool of the shard, called with its lock held
+// The chunks of a shard start small and double, most shards only see a few
+// hundred names. Returns NULL if the string does not fit in memory.
+static const char* store_string(InternShard* shard, const char* text, size_t length) {
+    InternChunk* chunks = shard->chunks;
+    if (chunks == NULL || chunks->capacity - chunks->used < length + 1) {
+        size_t capacity = chunks == NULL ? INTERN_FIRST_CHUNK_SIZE : chunks->capacity * 2;
+        if (capacity > INTERN_CHUNK_SIZE) {
+            capacity = INTERN_CHUNK_SIZE;
+        }
+        if (capacity < length + 1) {
+            capacity = length + 1;
+        }
+
+        InternChunk* chunk = length < UINT32_MAX ? mem_alloc(sizeof(InternChunk) + capacity) : NULL;
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        shard->chunks = chunks = chunk;
+    }
+
+    char* copy = chunks->data + chunks->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    chunks->used += length + 1;
+    return copy;
+}
+
+// Doubles the hash table of the shard and reinserts every symbol, returns -1
+// and leaves the table as it was if the larger one does not fit in memory
+static int grow_slots(InternShard* shard) {
+    size_t new_count = shard->slot_count == 0 ? INTERN_INITIAL_SLOTS : shard->slot_count * 2;
+    Symbol* new_slots = mem_calloc(new_count, sizeof(Symbol));
+    if (new_slots == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < shard->slot_count; i++) {
+        Symbol symbol = shard->slots[i];
+        if (symbol == SYMBOL_NONE) {
+            continue;
+        }
+
+        size_t slot = get_entry(symbol)->hash & (new_count - 1);
+        while (new_slots[slot] != SYMBOL_NONE) {
+            slot = (slot + 1) & (new_count - 1);
+        }
+        new_slots[slot] = symbol;
+    }
+
+    mem_free(shard->slots);
+    shard->slots = new_slots;
+    shard->slot_count = new_count;
+    return 0;
+}
+
+// Returns a new symbol, the page holding its entry is allocated by whichever
+// thread gets there first
+// Returns SYMBOL_NONE once the symbols run out or the page does not fit in
+// memory. The number is lost then, its entry is never filled in.
+static Symbol new_symbol() {
+    // Entry 0 is reserved for SYMBOL_NONE
+    size_t expected = 0;
+    atomic_compare_exchange_strong(&entry_count, &expected, 1);
+
+    size_t count = atomic_fetch_add(&entry_count, 1);
+    if (count >= UINT32_MAX) {
+        atomic_fetch_sub(&entry_count, 1);
+        return SYMBOL_NONE;
+    }
+
+    Symbol symbol = (Symbol)count;
+    _Atomic(InternEntry*)* page = &pages[symbol >> INTERN_PAGE_BITS];
+    if (atomic_load_explicit(page, memory_order_acquire) == NULL) {
+        InternEntry* entries = mem_calloc(INTERN_PAGE_SIZE, sizeof(InternEntry));
+        if (entries == NULL) {
+            return SYMBOL_NONE;
+        }
+
+        InternEntry* installed = NULL;
+        if (!atomic_compare_exchange_strong(page, &installed, entries)) {
+            mem_free(entries);
+        }
+    }
+    return symbol;
+}
+
+// Returns the symbol of the text, interning it the first time it is seen
+// Safe to call from several threads at once, only the shard of the hash is
+// locked. Returns SYMBOL_NONE if a new symbol does not fit in memory, which
+// every caller treats as running out of memory.
+Symbol intern_string(const char* text, size_t length) {
+    call_once(&intern_lock_once, init_intern_lock);
+
+    uint32_t hash = hash_string(text, length);
+    InternShard* shard = &shards[hash >> (32 - INTERN_SHARD_BITS)];
+    mtx_lock(&shard->lock);
+
+    // Keep the load factor at or below one half
+    if ((shard->symbol_count + 1) * 2 > shard->slot_count && grow_slots(shard) != 0) {
+        mtx_unlock(&shard->lock);
+        return SYMBOL_NONE;
+    }
+
+    size_t slot = hash & (shard->slot_count - 1);
+    while (shard->slots[slot] != SYMBOL_NONE) {
+        InternEntry* entry = get_entry(shard->slots[slot]);
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            Symbol symbol = shard->slots[slot];
+            mtx_unlock(&shard->lock);
+            return symbol;
+        }
+        slot = (slot + 1) & (shard->slot_count - 1);
+    }
+
+    // The string may stay behind in the pool if the symbol cannot be had
+    const char* copy = store_string(shard, text, length);
+    Symbol symbol = copy != NULL ? new_symbol() : SYMBOL_NONE;
+    if (symbol == SYMBOL_NONE) {
+        mtx_unlock(&shard->lock);
+        return SYMBOL_NONE;
+    }
+
+    InternEntry* entry = get_entry(symbol);
+    entry->text = copy;
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
+    atomic_init(&entry->data, 0);
+    shard->slots[slot] = symbol;
+    shard->symbol_count++;
+    mtx_unlock(&shard->lock);
+    return symbol;
+}
+
+Symbol intern_cstr(const char* text) {
+    return intern_string(text, strlen(text));
+}
+
+// Returns the null terminated text of the symbol, SYMBOL_NONE gives ""
+const char* symbol_str(Symbol symbol) {
+    InternEntry* entry = find_entry(symbol);
+    if (entry == NULL) {
+        return "";
+    }
+    return entry->text;
+}
+
+size_t symbol_len(Symbol symbol) {
+    InternEntry* entry = find_entry(symbol);
+    if (entry == NULL) {
+        return 0;
+    }
+    return entry->length;
+}
+
+// Every symbol can carry a 32-bit value for other modules, for instance the
+// index of the parsed value of a numeric literal
+// The value is published with release semantics, whatever it refers to has to
+// be written before it is set.
+uint32_t symbol_data(Symbol symbol) {
+    InternEntry* entry = find_entry(symbol);
+    if (entry == NULL) {
+        return 0;
+    }
+    return atomic_load_explicit(&entry->data, memory_order_acquire);
+}
+
+void set_symbol_data(Symbol symbol, uint32_t data) {
+    InternEntry* entry = find_entry(symbol);
+    if (entry == NULL) {
+        return;
+    }
+    atomic_store_explicit(&entry->data, data, memory_order_release);
+}
+
+size_t symbol_count() {
+    size_t count = atomic_load_explicit(&entry_count, memory_order_acquire);
+    return count == 0 ? 0 : count - 1;
+}
+
+void free_interner() {
+    for (size_t i = 0; i < INTERN_SHARD_COUNT; i++) {
+        InternShard* shard = &shards[i];
+        InternChunk* chunk = shard->chunks;
+        while (chunk != NULL) {
+            InternChunk* next = chunk->next;
+            mem_free(chunk);
+            chunk = next;
+        }
+
+        mem_free(shard->slots);
+        shard->slots = NULL;
+        shard->slot_count = 0;
+        shard->symbol_count = 0;
+        shard->chunks = NULL;
+    }
+
+    for (size_t i = 0; i < INTERN_PAGE_COUNT && atomic_load(&pages[i]) != NULL; i++) {
+        mem_free(atomic_load(&pages[i]));
+        atomic_store(&pages[i], NULL);
+    }
+    atomic_store(&entry_count, 0);
+}
@@ -0,0 +1,24 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned strings are identified by a stable 32-bit symbol
+// Equal strings always get the same symbol, so names can be compared as integers.
+typedef uint32_t Symbol;
+
+// Symbol 0 is never handed out and marks the absence of a name
+#define SYMBOL_NONE 0
+
+// Function declarations
+Symbol intern_string(const char* text, size_t length);
+Symbol intern_cstr(const char* text);
+const char* symbol_str(Symbol symbol);
+size_t symbol_len(Symbol symbol);
+uint32_t symbol_data(Symbol symbol);
+void set_symbol_data(Symbol symbol, uint32_t data);
+size_t symbol_count();
+void free_interner();
+
+#endif // INTERN_H
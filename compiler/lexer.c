@@ -1,5 +1,9 @@
 #include "lexer.h"
 #include "utils.h"
+#include "source.h"
+#include "scan.h"
+#include "intern.h"
+#include "number.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,330 +50,806 @@ const char* token_type_to_str(TokenType type) {
     }
 }
 
-Token* make_token(TokenType type, const char* value, size_t line, size_t column, const char* filename) {
-    Token* token = (Token*)malloc(sizeof(Token));
-    token->type = type;
-    token->value = _strdup(value);
-    token->line = line;
-    token->column = column;
-    token->filename = _strdup(filename);
-    return token;
+const char* keyword_to_str(Keyword keyword) {
+    switch (keyword) {
+        case KW_PUB: return "pub";
+        case KW_FN: return "fn";
+        case KW_RETURN: return "return";
+        case KW_IF: return "if";
+        case KW_ELIF: return "elif";
+        case KW_ELSE: return "else";
+        case KW_DEFER: return "defer";
+        case KW_TEST: return "test";
+        case KW_USE: return "use";
+        case KW_STRUCT: return "struct";
+        default: return "Invalid";
+    }
 }
 
-void free_token(Token* token) {
-    if (token) {
-        free(token->value);
-        free(token->filename);
-        free(token);
+const char* primitive_type_to_str(PrimitiveType type) {
+    switch (type) {
+        case TYPE_U8: return "u8";
+        case TYPE_U16: return "u16";
+        case TYPE_U32: return "u32";
+        case TYPE_U64: return "u64";
+        case TYPE_U128: return "u128";
+        case TYPE_I8: return "i8";
+        case TYPE_I16: return "i16";
+        case TYPE_I32: return "i32";
+        case TYPE_I64: return "i64";
+        case TYPE_I128: return "i128";
+        case TYPE_F32: return "f32";
+        case TYPE_F64: return "f64";
+        case TYPE_BOOL: return "bool";
+        default: return "Invalid";
     }
 }
 
-void free_tokens(Token** tokens, size_t token_count) {
-    for (size_t i = 0; i < token_count; i++) {
-        free_token(tokens[i]);
+static const char* pointer_type_to_str(PrimitiveType type) {
+    switch (type) {
+        case TYPE_U8: return "u8*";
+        case TYPE_U16: return "u16*";
+        case TYPE_U32: return "u32*";
+        case TYPE_U64: return "u64*";
+        case TYPE_U128: return "u128*";
+        case TYPE_I8: return "i8*";
+        case TYPE_I16: return "i16*";
+        case TYPE_I32: return "i32*";
+        case TYPE_I64: return "i64*";
+        case TYPE_I128: return "i128*";
+        case TYPE_F32: return "f32*";
+        case TYPE_F64: return "f64*";
+        case TYPE_BOOL: return "bool*";
+        default: return "Invalid";
     }
-    free(tokens);
 }
 
-void add_token(Token*** tokens, size_t* token_count, TokenType type, const char* value, size_t line, size_t column, const char* filename) {
-    Token* token = make_token(type, value, line, column, filename);
-    *tokens = (Token**)realloc(*tokens, (*token_count + 1) * sizeof(Token*));
-    (*tokens)[*token_count] = token;
-    (*token_count)++;
+// Returns 1 if the text of the given length equals the word
+#define MATCHES(text, length, word) \
+    ((length) == sizeof(word) - 1 && memcmp((text), (word), sizeof(word) - 1) == 0)
+
+// Classifies an identifier as a keyword or primitive type in constant time
+// Dispatches on the length and the first character, after which at most two
+// candidates remain to be compared. Nothing is allocated, and the text does
+// not have to be null terminated.
+static void classify_identifier(const char* text, size_t length, Keyword* keyword, PrimitiveType* primitive) {
+    *keyword = KW_NONE;
+    *primitive = TYPE_NONE;
+
+    switch (length) {
+        case 2:
+            switch (text[0]) {
+                case 'f': if (text[1] == 'n') *keyword = KW_FN; break;
+                case 'i':
+                    if (text[1] == 'f') *keyword = KW_IF;
+                    else if (text[1] == '8') *primitive = TYPE_I8;
+                    break;
+                case 'u': if (text[1] == '8') *primitive = TYPE_U8; break;
+            }
+            break;
+        case 3:
+            switch (text[0]) {
+                case 'p': if (MATCHES(text, length, "pub")) *keyword = KW_PUB; break;
+                case 'u':
+                    if (MATCHES(text, length, "use")) *keyword = KW_USE;
+                    else if (MATCHES(text, length, "u16")) *primitive = TYPE_U16;
+                    else if (MATCHES(text, length, "u32")) *primitive = TYPE_U32;
+                    else if (MATCHES(text, length, "u64")) *primitive = TYPE_U64;
+                    break;
+                case 'i':
+                    if (MATCHES(text, length, "i16")) *primitive = TYPE_I16;
+                    else if (MATCHES(text, length, "i32")) *primitive = TYPE_I32;
+                    else if (MATCHES(text, length, "i64")) *primitive = TYPE_I64;
+                    break;
+                case 'f':
+                    if (MATCHES(text, length, "f32")) *primitive = TYPE_F32;
+                    else if (MATCHES(text, length, "f64")) *primitive = TYPE_F64;
+                    break;
+            }
+            break;
+        case 4:
+            switch (text[0]) {
+                case 'e':
+                    if (MATCHES(text, length, "elif")) *keyword = KW_ELIF;
+                    else if (MATCHES(text, length, "else")) *keyword = KW_ELSE;
+                    break;
+                case 't': if (MATCHES(text, length, "test")) *keyword = KW_TEST; break;
+                case 'u': if (MATCHES(text, length, "u128")) *primitive = TYPE_U128; break;
+                case 'i': if (MATCHES(text, length, "i128")) *primitive = TYPE_I128; break;
+                case 'b': if (MATCHES(text, length, "bool")) *primitive = TYPE_BOOL; break;
+            }
+            break;
+        case 5:
+            if (MATCHES(text, length, "defer")) *keyword = KW_DEFER;
+            break;
+        case 6:
+            if (MATCHES(text, length, "return")) *keyword = KW_RETURN;
+            else if (MATCHES(text, length, "struct")) *keyword = KW_STRUCT;
+            break;
+    }
+}
+
+void init_token_stream(TokenStream* stream) {
+    stream->tokens = NULL;
+    stream->count = 0;
+    stream->capacity = 0;
+    stream->file = INVALID_FILE_ID;
+    stream->source = NULL;
+    stream->source_length = 0;
+    stream->out_of_memory = 0;
+}
+
+// Grows the token array to hold at least the given number of tokens, returns
+// -1 and leaves the array as it was if that does not fit in memory
+static int grow_tokens(TokenStream* stream, size_t capacity) {
+    if (capacity <= stream->capacity) {
+        return 0;
+    }
+
+    Token* tokens = capacity <= SIZE_MAX / sizeof(Token) ? (Token*)mem_realloc(stream->tokens, capacity * sizeof(Token)) : NULL;
+    if (tokens == NULL) {
+        return -1;
+    }
+
+    stream->tokens = tokens;
+    stream->capacity = capacity;
+    return 0;
+}
+
+// Reserves room for the tokens of a source of the given size
+// On average a token takes up well over 4 bytes of source, so the array should
+// not have to grow. The reservation is only a hint, if it does not fit the
+// array grows as the tokens come.
+void reserve_token_stream(TokenStream* stream, size_t source_size) {
+    grow_tokens(stream, stream->count + source_size / 4 + 16);
 }
 
-void print_token_table_header() {
-    printf("\n|-%.*s-|-%.*s-|-%.*s-|-%.*s-|-%.*s-|\n",
-           TYPE_WIDTH, "---------------",
-           VALUE_WIDTH, "--------------------",
-           LINE_WIDTH, "------",
-           COL_WIDTH, "------",
-           FILENAME_WIDTH, "--------------------");
+// Frees the tokens, the source itself stays in the file table
+void free_tokens(TokenStream* stream) {
+    mem_free(stream->tokens);
+    init_token_stream(stream);
+}
 
-    printf("| %-*s | %-*s | %-*s | %-*s | %-*s |\n",
-           TYPE_WIDTH, "TYPE",
-           VALUE_WIDTH, "VALUE",
-           LINE_WIDTH, "LINE",
-           COL_WIDTH, "COL",
-           FILENAME_WIDTH, "FILENAME");
+// Adds a token spanning the given range of the source, tokenize_range made
+// room for it
+static Token* add_token(TokenStream* stream, TokenType type, size_t offset, size_t length) {
+    Token* token = &stream->tokens[stream->count++];
+    token->type = (uint8_t)type;
+    token->keyword = KW_NONE;
+    token->file = stream->file;
+    token->symbol = SYMBOL_NONE;
+    token->offset = (uint32_t)offset;
+    token->length = (uint32_t)length;
+    return token;
+}
 
-    printf("|-%.*s-|-%.*s-|-%.*s-|-%.*s-|-%.*s-|\n",
-           TYPE_WIDTH, "---------------",
-           VALUE_WIDTH, "--------------------",
-           LINE_WIDTH, "------",
-           COL_WIDTH, "------",
-           FILENAME_WIDTH, "--------------------");
+// Stores the interned value of a token, SYMBOL_NONE means the value did not fit
+// in memory and ends the lexing
+static void set_token_symbol(TokenStream* stream, Token* token, Symbol symbol) {
+    token->symbol = symbol;
+    if (symbol == SYMBOL_NONE) {
+        stream->out_of_memory = 1;
+    }
 }
 
-void print_token(Token* token) {
-    printf("| %-*s | %-*s | %-*zu | %-*zu | %-*s |\n",
-           TYPE_WIDTH, token_type_to_str(token->type),
-           VALUE_WIDTH, token->value,
-           LINE_WIDTH, token->line,
-           COL_WIDTH, token->column,
-           FILENAME_WIDTH, token->filename);
+// Adds a token spanning the given range of the source, and interns its text
+// so repeated names share a single copy and carry the same symbol
+static Token* add_token_symbol(TokenStream* stream, TokenType type, size_t offset, size_t length) {
+    Token* token = add_token(stream, type, offset, length);
+    set_token_symbol(stream, token, intern_string(stream->source + offset, length));
+    return token;
 }
 
-void print_token_table_footer() {
-    printf("|-%.*s-|-%.*s-|-%.*s-|-%.*s-|-%.*s-|\n",
-           TYPE_WIDTH, "---------------",
-           VALUE_WIDTH, "--------------------",
-           LINE_WIDTH, "------",
-           COL_WIDTH, "------",
-           FILENAME_WIDTH, "--------------------");
+// Returns the length of the numeric literal at the start of the text
+// The identifier scan picks up digits, separators, prefixes, hex digits and the
+// suffix in one go. A trailing name is lexed as part of the literal, so 12abc
+// becomes a single invalid literal rather than a number followed by a name.
+static size_t scan_number(const char* text, size_t length) {
+    size_t i = scan_identifier(text, length);
+    if (i >= 2 && text[0] == '0' && strchr("xXoObB", text[1]) != NULL) {
+        return i;
+    }
+
+    // Fraction, only when a digit follows so member access on a literal still works
+    if (i + 1 < length && text[i] == '.' && isdigit((unsigned char)text[i + 1])) {
+        i++;
+        i += scan_identifier(text + i, length - i);
+    }
+
+    // Signed exponent, the scan above stopped at the sign
+    if (i >= 2 && i + 1 < length && (text[i] == '+' || text[i] == '-') && (text[i - 1] == 'e' || text[i - 1] == 'E') &&
+        isdigit((unsigned char)text[i - 2]) && isdigit((unsigned char)text[i + 1])) {
+        i++;
+        i += scan_identifier(text + i, length - i);
+    }
+
+    return i;
 }
 
-void print_tokens(Token** tokens, size_t token_count, TokenType* token_type) {
-    print_token_table_header();
+// Returns 1 if the character at the given position is escaped by a backslash,
+// which is the case when it is preceded by an odd number of them
+static int is_escaped(const char* src, size_t start, size_t position) {
+    size_t backslashes = 0;
+    while (position > start && src[position - 1] == '\\') {
+        backslashes++;
+        position--;
+    }
+    return backslashes % 2 == 1;
+}
 
-    for (size_t i = 0; i < token_count; i++) {
-        if (token_type != NULL && tokens[i]->type != *token_type) {
+// Interns the value of a string literal with its escape sequences processed
+// This is the only token value that does not exist verbatim in the source.
+// Returns SYMBOL_NONE if the value does not fit in memory.
+static Symbol intern_escaped_string(const char* text, size_t length) {
+    char* value = mem_alloc(length + 1);
+    if (value == NULL) {
+        return SYMBOL_NONE;
+    }
+
+    size_t value_length = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] != '\\' || i + 1 == length) {
+            value[value_length++] = text[i];
             continue;
         }
 
-        // if (tokens[i]->type == T_COMMENT) {
-        //     continue;
-        // }
+        i++;
+        switch (text[i]) {
+            case 'n': value[value_length++] = '\n'; break;
+            case 't': value[value_length++] = '\t'; break;
+            case 'r': value[value_length++] = '\r'; break;
+            case '0': value[value_length++] = '\0'; break;
+            case '\\': value[value_length++] = '\\'; break;
+            case '"': value[value_length++] = '"'; break;
+            case '\'': value[value_length++] = '\''; break;
+            default:
+                // Unknown escape sequences are kept as they are
+                value[value_length++] = '\\';
+                value[value_length++] = text[i];
+                break;
+        }
+    }
+
+    Symbol symbol = intern_string(value, value_length);
+    mem_free(value);
+    return symbol;
+}
+
+// Returns the text of the token in the source, note that it is NOT null terminated
+const char* token_text(const Token* token) {
+    const SourceFile* file = get_source_file(token->file);
+    return file->buffer.data + token->offset;
+}
 
-        print_token(tokens[i]);
+static void write_token_table_rule(Writer* writer) {
+    static const char dashes[] = "--------------------";
+    const size_t widths[] = {TYPE_WIDTH, VALUE_WIDTH, LINE_WIDTH, COL_WIDTH, FILENAME_WIDTH};
+    write_char(writer, '|');
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        write_char(writer, '-');
+        write_bytes(writer, dashes, widths[i]);
+        write_bytes(writer, "-|", 2);
     }
+    write_char(writer, '\n');
+}
 
-    print_token_table_footer();
+static void write_token_table_header(Writer* writer) {
+    write_char(writer, '\n');
+    write_token_table_rule(writer);
+    write_bytes(writer, "| ", 2);
+    write_padded(writer, "TYPE", 4, TYPE_WIDTH);
+    write_bytes(writer, " | ", 3);
+    write_padded(writer, "VALUE", 5, VALUE_WIDTH);
+    write_bytes(writer, " | ", 3);
+    write_padded(writer, "LINE", 4, LINE_WIDTH);
+    write_bytes(writer, " | ", 3);
+    write_padded(writer, "COL", 3, COL_WIDTH);
+    write_bytes(writer, " | ", 3);
+    write_padded(writer, "FILENAME", 8, FILENAME_WIDTH);
+    write_bytes(writer, " |\n", 3);
+    write_token_table_rule(writer);
 }
 
-void tokenize_line(const char* line, size_t line_number, const char* filename, Token*** buffer, size_t* token_count) {
-    if (line == NULL || filename == NULL) {
-        printf("Line or filename is NULL\n");
+static void write_token(Writer* writer, const Token* token, DumpFormat format) {
+    // Interned values are printed as such, so types and strings show their
+    // normalized value rather than the source text
+    const char* value = token_text(token);
+    size_t value_length = token->length;
+    if (token->symbol != SYMBOL_NONE) {
+        value = symbol_str(token->symbol);
+        value_length = symbol_len(token->symbol);
+    }
+
+    size_t line, column;
+    source_location(token->file, token->offset, &line, &column);
+    const char* type = token_type_to_str(token->type);
+    const char* filename = source_filename(token->file);
+
+    if (format == DUMP_JSON) {
+        write_cstr(writer, "{\"type\":");
+        write_json_string(writer, type, strlen(type));
+        write_cstr(writer, ",\"value\":");
+        write_json_string(writer, value, value_length);
+        write_cstr(writer, ",\"line\":");
+        write_uint(writer, line);
+        write_cstr(writer, ",\"column\":");
+        write_uint(writer, column);
+        write_cstr(writer, ",\"file\":");
+        write_json_string(writer, filename, strlen(filename));
+        write_bytes(writer, "}\n", 2);
         return;
     }
 
-    if (*buffer == NULL) {
-        *buffer = (Token**)malloc(sizeof(Token*));
-        *token_count = 0;
+    // The table ends the value at a null byte, the JSON format escapes it
+    const char* null_byte = memchr(value, '\0', value_length);
+    if (null_byte != NULL) {
+        value_length = (size_t)(null_byte - value);
     }
 
-    size_t len = strlen(line);
-    size_t column = 1;
+    write_bytes(writer, "| ", 2);
+    write_padded(writer, type, strlen(type), TYPE_WIDTH);
+    write_bytes(writer, " | ", 3);
+    write_padded(writer, value, value_length, VALUE_WIDTH);
+    write_bytes(writer, " | ", 3);
+    write_padded_uint(writer, line, LINE_WIDTH);
+    write_bytes(writer, " | ", 3);
+    write_padded_uint(writer, column, COL_WIDTH);
+    write_bytes(writer, " | ", 3);
+    write_padded(writer, filename, strlen(filename), FILENAME_WIDTH);
+    write_bytes(writer, " |\n", 3);
+}
+
+// Writes the tokens of the stream, only those of type token_type if it is not NULL
+// The text format is a table, the JSON format one object per token.
+void write_tokens(Writer* writer, const TokenStream* stream, TokenType* token_type, DumpFormat format) {
+    if (format == DUMP_TEXT) {
+        write_token_table_header(writer);
+    }
+
+    for (size_t i = 0; i < stream->count; i++) {
+        if (token_type != NULL && stream->tokens[i].type != *token_type) {
+            continue;
+        }
+
+        // if (stream->tokens[i].type == T_COMMENT) {
+        //     continue;
+        // }
+
+        write_token(writer, &stream->tokens[i], format);
+    }
+
+    if (format == DUMP_TEXT) {
+        write_token_table_rule(writer);
+    }
+}
+
+void print_tokens(const TokenStream* stream, TokenType* token_type) {
+    Writer writer;
+    init_writer(&writer, stdout);
+    write_tokens(&writer, stream, token_type, DUMP_TEXT);
+    flush_writer(&writer);
+    free_writer(&writer);
+}
+
+// Tokenizes the source of the stream from start up to end in a single pass
+// Tokens only record their offset, line and column are recovered from the file
+// table when needed. Lexing stops early once the stream holds limit tokens, the
+// returned offset is where it has to resume. Running out of memory marks the
+// stream and skips the rest of the range.
+static size_t tokenize_range(TokenStream* stream, size_t start_offset, size_t end, size_t limit) {
+    const char* src = stream->source;
+
+    for (size_t i = start_offset; i < end; i++) {
+        // Every iteration adds at most one token, the room for it is made here
+        if (stream->count >= limit) {
+            return i;
+        }
+        if (stream->count == stream->capacity &&
+            grow_tokens(stream, stream->capacity < 16 ? 16 : stream->capacity * 2) != 0) {
+            stream->out_of_memory = 1;
+        }
+        if (stream->out_of_memory) {
+            return end;
+        }
 
-    for (size_t i = 0; i < len; i++) {
-        column++;
-        if (isspace(line[i])) {
+        if (src[i] == '\n') {
+            continue;
+        }
+
+        if (isspace((unsigned char)src[i])) {
+            i += scan_inline_space(src + i, end - i);
+            i--;
             continue;
         }
 
         // Handle double colon
-        if (line[i] == ':' && i + 1 < len && line[i + 1] == ':') {
-            add_token(buffer, token_count, T_DOUBLE_COLON, "::", line_number, column, filename);
+        if (src[i] == ':' && i + 1 < end && src[i + 1] == ':') {
+            add_token(stream, T_DOUBLE_COLON, i, 2);
             i++;  // Skip the second colon
             continue;
-        } else if (line[i] == '"') {
+        } else if (src[i] == '"') {
             size_t start = i;
             i++;
-            while (i < len && line[i] != '"') {
-                i++;
-            }
-
-            if (i >= len) {
+            while (1) {
+                i += scan_string(src + i, end - i);
+                if (i < end && src[i] == '"' && is_escaped(src, start + 1, i)) {
+                    i++;
+                    continue;
+                }
                 break;
             }
 
-            char* string = strndup(line + start + 1, i - start - 1);
-            if (string == NULL) {
-                continue;
-            }
-
-            add_token(buffer, token_count, T_STRING, string, line_number, column, filename);
-            free(string);
-        } else if (isalpha(line[i])) {
-            size_t start = i;
-            while (i < len && (isalnum(line[i]) || line[i] == '_')) {
-                i++;
-            }
-            char* identifier = strndup(line + start, i - start);
-            if (identifier == NULL) {
+            // Unterminated string, drop the rest of the line
+            if (i >= end || src[i] == '\n') {
+                i--;
                 continue;
             }
 
-            // Check if this is a type and followed by a pointer
-            int is_type = (
-                strcmp(identifier, "u8") == 0 ||
-                strcmp(identifier, "u16") == 0 ||
-                strcmp(identifier, "u32") == 0 ||
-                strcmp(identifier, "u64") == 0 ||
-                strcmp(identifier, "u128") == 0 ||
-                strcmp(identifier, "i8") == 0 ||
-                strcmp(identifier, "i16") == 0 ||
-                strcmp(identifier, "i32") == 0 ||
-                strcmp(identifier, "i64") == 0 ||
-                strcmp(identifier, "i128") == 0 ||
-                strcmp(identifier, "f32") == 0 ||
-                strcmp(identifier, "f64") == 0 ||
-                strcmp(identifier, "bool") == 0
-            );
-
-            // Look ahead for pointer symbol
-            size_t next_pos = i;
-            while (next_pos < len && isspace(line[next_pos])) {
-                next_pos++;
-            }
-
-            if (is_type && next_pos < len && line[next_pos] == '*') {
-                char* pointer_type = (char*)malloc(strlen(identifier) + 2);
-                sprintf(pointer_type, "%s*", identifier);
-                add_token(buffer, token_count, T_POINTER_TYPE, pointer_type, line_number, column, filename);
-                free(pointer_type);
-                i = next_pos;
-            } else if (strcmp(identifier, "pub") == 0 ||
-                      strcmp(identifier, "fn") == 0 ||
-                      strcmp(identifier, "return") == 0 ||
-                      strcmp(identifier, "if") == 0 ||
-                      strcmp(identifier, "else") == 0 ||
-                      strcmp(identifier, "elif") == 0 ||
-                      strcmp(identifier, "defer") == 0 ||
-                      strcmp(identifier, "test") == 0) {
-                add_token(buffer, token_count, T_KEYWORD, identifier, line_number, column, filename);
-            } else if (is_type) {
-                add_token(buffer, token_count, T_TYPE, identifier, line_number, column, filename);
+            // The token spans the quotes as well, its value is the contents
+            // with escape sequences processed
+            Token* token = add_token(stream, T_STRING, start, i + 1 - start);
+            if (memchr(src + start + 1, '\\', i - start - 1) != NULL) {
+                set_token_symbol(stream, token, intern_escaped_string(src + start + 1, i - start - 1));
             } else {
+                set_token_symbol(stream, token, intern_string(src + start + 1, i - start - 1));
+            }
+        } else if (isalpha((unsigned char)src[i])) {
+            size_t start = i;
+            i += scan_identifier(src + i, end - i);
+
+            Keyword keyword;
+            PrimitiveType primitive;
+            classify_identifier(src + start, i - start, &keyword, &primitive);
+
+            // Look ahead for pointer symbol, without crossing into the next line
+            size_t next_pos = i + scan_inline_space(src + i, end - i);
+
+            if (primitive != TYPE_NONE && next_pos < end && src[next_pos] == '*') {
+                Token* token = add_token(stream, T_POINTER_TYPE, start, next_pos + 1 - start);
+                token->primitive = primitive;
+                set_token_symbol(stream, token, intern_cstr(pointer_type_to_str(primitive)));
+                i = next_pos + 1; // Skip past the '*'
+            } else if (primitive != TYPE_NONE) {
+                Token* token = add_token(stream, T_TYPE, start, i - start);
+                token->primitive = primitive;
+                set_token_symbol(stream, token, intern_cstr(primitive_type_to_str(primitive)));
+            } else if (keyword == KW_USE) {
                 // If it starts with import read until ; and add as a single token
-                if (strcmp(identifier, "use") == 0) {
-                    size_t start = i;
-                    while (i < len && line[i] != ';') {
-                        i++;
-                    }
-
-                    char* import = strndup(line + start + 1, i - start - 1); // Skip the space and the ';'
-                    if (import == NULL) {
-                        continue;
-                    }
+                size_t import_start = next_pos;
+                i = import_start;
+                while (i < end && src[i] != ';' && src[i] != '\n') {
                     i++;
+                }
 
-                    add_token(buffer, token_count, T_IMPORT, import, line_number, column, filename);
-                    free(import);
-                } else {
-                    // Check if the next character is a exclamation mark
-                    // if so this is a macro call
-                    if (next_pos < len && line[next_pos] == '!') {
-                        char* macro_call = (char*)malloc(strlen(identifier) + 2);
-                        sprintf(macro_call, "%s!", identifier);
-                        add_token(buffer, token_count, T_MACRO_CALL, macro_call, line_number, column, filename);
-                        free(macro_call);
-                        i++;
-                    } else {
-                        add_token(buffer, token_count, T_IDENTIFIER, identifier, line_number, column, filename);
-                    }
+                // The token spans the keyword as well, its value is the path
+                Token* token = add_token(stream, T_IMPORT, start, i - start);
+                set_token_symbol(stream, token, intern_string(src + import_start, i - import_start));
+
+                // Skip past the ';', an unterminated import ends at the end of the line
+                if (i < end && src[i] == ';') {
+                    i++;
                 }
+            } else if (keyword != KW_NONE) {
+                Token* token = add_token(stream, T_KEYWORD, start, i - start);
+                token->keyword = keyword;
+            } else if (i < end && src[i] == '!' && !(i + 1 < end && src[i + 1] == '=')) {
+                // If the next character is a exclamation mark this is a macro call
+                // (but not when it starts a !=)
+                i++; // Skip past the '!'
+                add_token_symbol(stream, T_MACRO_CALL, start, i - start);
+            } else {
+                add_token_symbol(stream, T_IDENTIFIER, start, i - start);
             }
 
-            free(identifier);
             i--;
-        } else if (isdigit(line[i])) {
+        } else if (isdigit((unsigned char)src[i])) {
             size_t start = i;
-            while (i < len && isdigit(line[i])) {
-                i++;
-            }
+            i += scan_number(src + i, end - i);
 
-            char* number = strndup(line + start, i - start);
-            if (number == NULL) {
-                i--;
-                continue;
-            }
-
-            add_token(buffer, token_count, T_NUMBER, number, line_number, column, filename);
-            free(number);
+            // The value is parsed once per distinct literal, see number_value
+            Token* token = add_token(stream, T_NUMBER, start, i - start);
+            set_token_symbol(stream, token, intern_number(src + start, i - start));
             i--;
-        } else if (line[i] == '=') {
-            if (i + 1 < len && line[i + 1] == '=') {
-                add_token(buffer, token_count, T_EQUAL_SIGN, "==", line_number, column, filename);
+        } else if (src[i] == '=') {
+            if (i + 1 < end && src[i + 1] == '=') {
+                add_token(stream, T_EQUAL_SIGN, i, 2);
                 i++;
             } else {
-                add_token(buffer, token_count, T_OPERATOR, "=", line_number, column, filename);
+                add_token(stream, T_OPERATOR, i, 1);
             }
-        } else if (line[i] == '!') {
-            if (i + 1 < len && line[i + 1] == '=') {
-                add_token(buffer, token_count, T_NOT_EQUAL_SIGN, "!=", line_number, column, filename);
+        } else if (src[i] == '!') {
+            if (i + 1 < end && src[i + 1] == '=') {
+                add_token(stream, T_NOT_EQUAL_SIGN, i, 2);
                 i++;
             } else {
-                add_token(buffer, token_count, T_EXCLAMATION_MARK, "!", line_number, column, filename);
+                add_token(stream, T_EXCLAMATION_MARK, i, 1);
             }
         }
 
-        else if (strchr("+-*/", line[i])) {
-            if (line[i] == '/' && i + 1 < len && line[i + 1] == '/') {
+        else if ((src[i] == '&' || src[i] == '|') && i + 1 < end && src[i + 1] == src[i]) {
+            add_token_symbol(stream, T_OPERATOR, i, 2);
+            i++;
+        } else if ((src[i] == '<' || src[i] == '>') && i + 1 < end && src[i + 1] == '=') {
+            add_token_symbol(stream, T_OPERATOR, i, 2);
+            i++;
+        } else if (src[i] == '+' || src[i] == '-' || src[i] == '*' || src[i] == '/' || src[i] == '%') {
+            if (src[i] == '/' && i + 1 < end && src[i + 1] == '/') {
                 // size_t start = i;
-                while (i < len && line[i] != '\n') {
-                    i++;
-                }
+                i += scan_line(src + i, end - i);
 
                 // Add comments
-                // char* comment = strndup(line + start, i - start);
+                // char* comment = strndup(src + start, i - start);
                 // if (comment == NULL) {
                 //     i--;
                 //     continue;
                 // }
 
-                // add_token(buffer, token_count, T_COMMENT, comment, line_number, column, filename);
-                // free(comment);
+                // add_token(stream, T_COMMENT, comment);
+                // mem_free(comment);
 
                 i--;
             } else {
-                char operator[2] = {line[i], '\0'};
-                add_token(buffer, token_count, T_OPERATOR, operator, line_number, column, filename);
+                add_token_symbol(stream, T_OPERATOR, i, 1);
             }
-        } else if (line[i] == '(') {
-            add_token(buffer, token_count, T_L_PAREN, "(", line_number, column, filename);
-        } else if (line[i] == ')') {
-            add_token(buffer, token_count, T_R_PAREN, ")", line_number, column, filename);
-        } else if (line[i] == '{') {
-            add_token(buffer, token_count, T_L_BRACE, "{", line_number, column, filename);
-        } else if (line[i] == '}') {
-            add_token(buffer, token_count, T_R_BRACE, "}", line_number, column, filename);
-        } else if (line[i] == '[') {
-            add_token(buffer, token_count, T_L_BRACKET, "[", line_number, column, filename);
-        } else if (line[i] == ']') {
-            add_token(buffer, token_count, T_R_BRACKET, "]", line_number, column, filename);
-        } else if (line[i] == ';') {
-            add_token(buffer, token_count, T_SEMICOLON, ";", line_number, column, filename);
-        } else if (line[i] == ',') {
-            add_token(buffer, token_count, T_COMMA, ",", line_number, column, filename);
-        } else if (line[i] == '<') {
-            add_token(buffer, token_count, T_L_ANGLE_BRACKET, "<", line_number, column, filename);
-        } else if (line[i] == '>') {
-            add_token(buffer, token_count, T_R_ANGLE_BRACKET, ">", line_number, column, filename);
-        } else if (line[i] == '.') {
-            add_token(buffer, token_count, T_DOT, ".", line_number, column, filename);
-        } else if (line[i] == ':') {
-            add_token(buffer, token_count, T_COLON, ":", line_number, column, filename);
-        } else if (line[i] == '#') {
+        } else if (src[i] == '(') {
+            add_token(stream, T_L_PAREN, i, 1);
+        } else if (src[i] == ')') {
+            add_token(stream, T_R_PAREN, i, 1);
+        } else if (src[i] == '{') {
+            add_token(stream, T_L_BRACE, i, 1);
+        } else if (src[i] == '}') {
+            add_token(stream, T_R_BRACE, i, 1);
+        } else if (src[i] == '[') {
+            add_token(stream, T_L_BRACKET, i, 1);
+        } else if (src[i] == ']') {
+            add_token(stream, T_R_BRACKET, i, 1);
+        } else if (src[i] == ';') {
+            add_token(stream, T_SEMICOLON, i, 1);
+        } else if (src[i] == ',') {
+            add_token(stream, T_COMMA, i, 1);
+        } else if (src[i] == '<') {
+            add_token(stream, T_L_ANGLE_BRACKET, i, 1);
+        } else if (src[i] == '>') {
+            add_token(stream, T_R_ANGLE_BRACKET, i, 1);
+        } else if (src[i] == '.') {
+            add_token(stream, T_DOT, i, 1);
+        } else if (src[i] == ':') {
+            add_token(stream, T_COLON, i, 1);
+        } else if (src[i] == '#') {
             // If the next token is a [ this is an annotation, in that case we need to
             // read until the next ] and add as a single token
             // Otherwise this is a hash sign
 
+            size_t hash = i;
             size_t next_pos = i + 1;
-            while (next_pos < len && isspace(line[next_pos])) {
-                next_pos++;
-            }
+            next_pos += scan_inline_space(src + next_pos, end - next_pos);
 
-            if (next_pos < len && line[next_pos] == '[') {
-                size_t start = i;
-                while (i < len && line[i] != ']') {
+            if (next_pos < end && src[next_pos] == '[') {
+                size_t start = next_pos + 1;
+                i = start;
+                while (i < end && src[i] != ']' && src[i] != '\n') {
                     i++;
                 }
 
-                char* annotation = strndup(line + start + 2, i - start - 2);
-                if (annotation == NULL) {
-                    continue;
+                // An unterminated annotation ends at the end of the line
+                size_t annotation_end = i;
+                if (i >= end || src[i] == '\n') {
+                    i--;
                 }
-                i++;
 
-                add_token(buffer, token_count, T_ANNOTATION, annotation, line_number, column, filename);
-                free(annotation);
+                // The token spans from the '#' up to and including the ']',
+                // its value is the contents
+                Token* token = add_token(stream, T_ANNOTATION, hash, i + 1 - hash);
+                set_token_symbol(stream, token, intern_string(src + start, annotation_end - start));
             } else {
-                add_token(buffer, token_count, T_HASH_SIGN, "#", line_number, column, filename);
+                add_token(stream, T_HASH_SIGN, i, 1);
             }
         } else {
-            char unknown[2] = {line[i], '\0'};
-            add_token(buffer, token_count, T_UNKNOWN, unknown, line_number, column, filename);
+            add_token_symbol(stream, T_UNKNOWN, i, 1);
         }
     }
+
+    return end;
+}
+
+// Points the stream at the source of the given file
+static void bind_source(TokenStream* stream, FileId file) {
+    const SourceFile* source = get_source_file(file);
+
+    init_scan_kernels();
+
+    stream->file = file;
+    stream->source = source->buffer.data;
+    stream->source_length = source->buffer.size;
+}
+
+// Tokenizes the file with the given id from the file table in one go
+void tokenize_source(TokenStream* stream, FileId file) {
+    bind_source(stream, file);
+    tokenize_range(stream, 0, stream->source_length, SIZE_MAX);
+}
+
+// Tokenizes an entire in-memory source buffer
+// The buffer does not have to be null terminated, it is added to the file table
+// without a copy, so it has to outlive the table since the tokens refer to it.
+// Returns -1 without tokenizing anything if there is no input or filename, or if
+// the buffer is too large for the file table, and -1 if the tokens do not fit
+// in memory.
+int tokenize(const char* input, size_t length, const char* filename, TokenStream* stream) {
+    if (input == NULL || filename == NULL) {
+        return -1;
+    }
+
+    FileId file = add_source_buffer(filename, input, length);
+    if (file == INVALID_FILE_ID) {
+        return -1;
+    }
+
+    tokenize_source(stream, file);
+    return stream->out_of_memory ? -1 : 0;
+}
+
+// Tokenizes the single line of the stream's source starting at the given offset
+// Returns the offset of the next line, or the same offset if the stream has no
+// source.
+size_t tokenize_line(TokenStream* stream, size_t offset) {
+    if (stream->source == NULL) {
+        return offset;
+    }
+
+    init_scan_kernels();
+
+    size_t end = offset + scan_line(stream->source + offset, stream->source_length - offset);
+    if (end < stream->source_length) {
+        end++; // Include the '\n'
+    }
+
+    tokenize_range(stream, offset, end, SIZE_MAX);
+    return end;
+}
+
+// Loads the file into the file table and tokenizes it in one go, "-" reads from stdin
+// The file table keeps the source alive after the stream is freed.
+int tokenize_file(const char* filename, TokenStream* stream) {
+    FileId file = add_source_file(filename);
+    if (file == INVALID_FILE_ID) {
+        return -1;
+    }
+
+    reserve_token_stream(stream, get_source_file(file)->buffer.size);
+    tokenize_source(stream, file);
+    return stream->out_of_memory ? -1 : 0;
+}
+
+// Returns the index of the first token that starts at or after the offset
+static size_t find_token(const TokenStream* stream, size_t offset) {
+    size_t low = 0;
+    size_t high = stream->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (stream->tokens[middle].offset < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Applies an edit to the source of the stream and updates its tokens, replacing
+// removed_length bytes at offset with the given text
+// Tokens never span more than one line, so only the lines touched by the edit
+// are lexed again. The tokens after them are kept and only have their offsets
+// shifted. Returns -1 if the edit is out of range, and -1 with the stream
+// marked if the new tokens do not fit in memory, the source is edited then but
+// the tokens are not.
+int tokenize_edit(TokenStream* stream, size_t offset, size_t removed_length, const char* text, size_t text_length) {
+    const char* src = stream->source;
+    size_t length = stream->source_length;
+    if (src == NULL || offset > length || removed_length > length - offset) {
+        return -1;
+    }
+
+    // Widen the edit to the lines it touches
+    size_t line_start = offset;
+    while (line_start > 0 && src[line_start - 1] != '\n') {
+        line_start--;
+    }
+
+    size_t line_end = offset + removed_length;
+    line_end += scan_line(src + line_end, length - line_end);
+    if (line_end < length) {
+        line_end++; // Include the '\n'
+    }
+
+    // The tokens [first, last) belong to the old lines
+    size_t first = find_token(stream, line_start);
+    size_t last = find_token(stream, line_end);
+
+    if (edit_source_file(stream->file, offset, removed_length, text, text_length) != 0) {
+        return -1;
+    }
+    bind_source(stream, stream->file);
+
+    // Lex the new lines on their own, then splice them in
+    TokenStream lines;
+    init_token_stream(&lines);
+    bind_source(&lines, stream->file);
+    tokenize_range(&lines, line_start, line_end - removed_length + text_length, SIZE_MAX);
+
+    size_t count = stream->count - (last - first) + lines.count;
+    if (lines.out_of_memory || grow_tokens(stream, count) != 0) {
+        stream->out_of_memory = 1;
+        free_tokens(&lines);
+        return -1;
+    }
+    if (stream->count > last) {
+        memmove(&stream->tokens[first + lines.count], &stream->tokens[last], (stream->count - last) * sizeof(Token));
+    }
+    if (lines.count > 0) {
+        memcpy(&stream->tokens[first], lines.tokens, lines.count * sizeof(Token));
+    }
+
+    for (size_t i = first + lines.count; i < count; i++) {
+        stream->tokens[i].offset = (uint32_t)(stream->tokens[i].offset - removed_length + text_length);
+    }
+
+    stream->count = count;
+    free_tokens(&lines);
+    return 0;
+}
+
+// Prepares a lexer that produces the tokens of the given file on demand
+// Running out of memory ends the tokens early, with the batch marked.
+void init_lexer(Lexer* lexer, FileId file) {
+    init_token_stream(&lexer->batch);
+    if (grow_tokens(&lexer->batch, LEXER_BATCH_SIZE) != 0) {
+        lexer->batch.out_of_memory = 1;
+    }
+    bind_source(&lexer->batch, file);
+    lexer->next = 0;
+    lexer->position = 0;
+}
+
+// Loads the file into the file table and prepares a lexer for it
+int open_lexer(Lexer* lexer, const char* filename) {
+    FileId file = add_source_file(filename);
+    if (file == INVALID_FILE_ID) {
+        return -1;
+    }
+
+    init_lexer(lexer, file);
+    return 0;
+}
+
+// Copies the next token into the given token
+// Returns 1 if there was one, and 0 at the end of the input. Lexing also ends
+// once a batch runs out of memory, none of its tokens are handed out then and
+// the batch is marked.
+int lex_next_token(Lexer* lexer, Token* token) {
+    TokenStream* batch = &lexer->batch;
+
+    // Lex the next batch once the current one is used up, a batch can come
+    // back empty when the rest of the source is whitespace or comments
+    while (lexer->next == batch->count) {
+        if (lexer->position >= batch->source_length) {
+            return 0;
+        }
+
+        batch->count = 0;
+        lexer->next = 0;
+        lexer->position = tokenize_range(batch, lexer->position, batch->source_length, LEXER_BATCH_SIZE);
+    }
+    if (batch->out_of_memory) {
+        return 0;
+    }
+
+    *token = batch->tokens[lexer->next++];
+    return 1;
+}
+
+void free_lexer(Lexer* lexer) {
+    free_tokens(&lexer->batch);
+    lexer->next = 0;
+    lexer->position = 0;
 }
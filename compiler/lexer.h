@@ -1,6 +1,12 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "intern.h"
+#include "source.h"
+#include "writer.h"
+#include <stddef.h>
+#include <stdint.h>
+
 // Token types
 typedef enum {
     T_KEYWORD,
@@ -34,21 +40,103 @@ typedef enum {
     T_UNKNOWN
 } TokenType;
 
+// Keywords, carried by T_KEYWORD tokens
+typedef enum {
+    KW_NONE,
+    KW_PUB,
+    KW_FN,
+    KW_RETURN,
+    KW_IF,
+    KW_ELIF,
+    KW_ELSE,
+    KW_DEFER,
+    KW_TEST,
+    KW_USE,
+    KW_STRUCT
+} Keyword;
+
+// Primitive types, carried by T_TYPE and T_POINTER_TYPE tokens
+typedef enum {
+    TYPE_NONE,
+    TYPE_U8,
+    TYPE_U16,
+    TYPE_U32,
+    TYPE_U64,
+    TYPE_U128,
+    TYPE_I8,
+    TYPE_I16,
+    TYPE_I32,
+    TYPE_I64,
+    TYPE_I128,
+    TYPE_F32,
+    TYPE_F64,
+    TYPE_BOOL
+} PrimitiveType;
+
 const char* token_type_to_str(TokenType type);
+const char* keyword_to_str(Keyword keyword);
+const char* primitive_type_to_str(PrimitiveType type);
 
 // Structure to hold token information
+// Tokens are packed into 16 bytes, the location is only stored as a file id and
+// a byte offset, line and column are looked up through source_location.
 typedef struct {
-    TokenType type;
-    char* value;
-    size_t line;
-    size_t column;
-    char* filename;
+    uint8_t type; // TokenType
+    union {
+        uint8_t keyword;   // Keyword, T_KEYWORD
+        uint8_t primitive; // PrimitiveType, T_TYPE and T_POINTER_TYPE
+    };
+    FileId file;     // File the token belongs to
+    Symbol symbol;   // Interned value of names, types and literals
+    uint32_t offset; // Start of the token in the source
+    uint32_t length; // Length of the token in the source
 } Token;
 
+_Static_assert(sizeof(Token) == 16, "Token should stay 16 bytes");
+
+// Structure to hold a stream of tokens
+// Tokens are stored by value in a single contiguous array that grows geometrically.
+// They refer to their text by offset and length into the source, which is kept
+// alive by the file table. Lexing stops at the first token that does not fit
+// in memory, the stream is marked then and its tokens are incomplete.
+typedef struct {
+    Token* tokens;
+    size_t count;
+    size_t capacity;
+    FileId file;
+    const char* source;
+    size_t source_length;
+    int out_of_memory;
+} TokenStream;
+
+// Number of tokens an on-demand lexer produces at a time
+#define LEXER_BATCH_SIZE 64
+
+// Structure to hold the state of an on-demand lexer
+// Tokens are lexed in small batches as they are pulled, so only a bounded
+// number of them is resident no matter how large the file is.
+typedef struct {
+    TokenStream batch;
+    size_t next;     // Next token of the batch to hand out
+    size_t position; // Offset in the source at which lexing resumes
+} Lexer;
+
 // Function declarations
-Token** tokenize(const char* input_str, size_t* token_count);
-void tokenize_line(const char* line, size_t line_number, const char* filename, Token*** buffer, size_t* token_count);
-void print_tokens(Token** tokens, size_t token_count, TokenType* token_type);
-void free_tokens(Token** tokens, size_t token_count);
+void init_token_stream(TokenStream* stream);
+void reserve_token_stream(TokenStream* stream, size_t source_size);
+int tokenize(const char* input, size_t length, const char* filename, TokenStream* stream);
+int tokenize_file(const char* filename, TokenStream* stream);
+void tokenize_source(TokenStream* stream, FileId file);
+size_t tokenize_line(TokenStream* stream, size_t offset);
+int tokenize_edit(TokenStream* stream, size_t offset, size_t removed_length, const char* text, size_t text_length);
+const char* token_text(const Token* token);
+void write_tokens(Writer* writer, const TokenStream* stream, TokenType* token_type, DumpFormat format);
+void print_tokens(const TokenStream* stream, TokenType* token_type);
+void free_tokens(TokenStream* stream);
+
+void init_lexer(Lexer* lexer, FileId file);
+int open_lexer(Lexer* lexer, const char* filename);
+int lex_next_token(Lexer* lexer, Token* token);
+void free_lexer(Lexer* lexer);
 
 #endif // LEXER_H
@@ -0,0 +1,834 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "loader.h"
+#include "parallel.h"
+#include "scan.h"
+#include "smallvec.h"
+#include "utils.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// The Windows CRT only has the mode masks
+#ifndef S_ISDIR
+#define S_ISDIR(mode) (((mode) & _S_IFMT) == _S_IFDIR)
+#endif
+#ifndef S_ISREG
+#define S_ISREG(mode) (((mode) & _S_IFMT) == _S_IFREG)
+#endif
+
+#define LOADER_ARENA_CHUNK_SIZE 4096
+
+// Visit states of the cycle check
+enum {
+    MODULE_UNVISITED,
+    MODULE_VISITING,
+    MODULE_VISITED
+};
+
+void init_module_graph(ModuleGraph* graph, size_t jobs) {
+    graph->modules = NULL;
+    graph->count = 0;
+    graph->capacity = 0;
+    graph->search_paths = NULL;
+    graph->search_path_count = 0;
+    graph->wave_count = 0;
+    graph->jobs = jobs == 0 ? 1 : jobs;
+    graph->store = NULL;
+    graph->cache_directory = NULL;
+    init_arena(&graph->arena, LOADER_ARENA_CHUNK_SIZE);
+    graph->out_of_memory = 0;
+    memset(&graph->error, 0, sizeof(ParseError));
+}
+
+// Takes over the path, a path that is NULL or does not fit marks the graph
+static void insert_search_path(ModuleGraph* graph, size_t index, char* path) {
+    char** grown = path == NULL ? NULL : mem_realloc(graph->search_paths, (graph->search_path_count + 1) * sizeof(char*));
+    if (grown == NULL) {
+        mem_free(path);
+        graph->out_of_memory = 1;
+        return;
+    }
+
+    memmove(&grown[index + 1], &grown[index], (graph->search_path_count - index) * sizeof(char*));
+    grown[index] = path;
+    graph->search_paths = grown;
+    graph->search_path_count++;
+}
+
+// Adds a directory import paths are resolved against
+// The directory of the root file is always searched first, and its library
+// directory last. Running out of memory here fails the next load.
+void add_search_path(ModuleGraph* graph, const char* path) {
+    insert_search_path(graph, graph->search_path_count, strdup_c(path));
+}
+
+// Returns the index of the new module, or SIZE_MAX with the graph marked if it
+// does not fit in memory
+static size_t add_module(ModuleGraph* graph, Symbol name, char* path, FileId file) {
+    if (graph->count == graph->capacity) {
+        size_t capacity = graph->capacity == 0 ? 16 : graph->capacity * 2;
+        ModuleUnit* grown = mem_realloc(graph->modules, capacity * sizeof(ModuleUnit));
+        if (grown == NULL) {
+            graph->out_of_memory = 1;
+            return SIZE_MAX;
+        }
+        graph->modules = grown;
+        graph->capacity = capacity;
+    }
+
+    ModuleUnit* module = &graph->modules[graph->count];
+    module->name = name;
+    module->path = path;
+    module->file = file;
+    module->imports = NULL;
+    module->import_count = 0;
+    module->wave = 0;
+    module->mark = MODULE_UNVISITED;
+    init_token_stream(&module->tokens);
+    module->parser = NULL;
+    module->stored = 0;
+    memset(&module->stamp, 0, sizeof(FileStamp));
+    module->hash = 0;
+    module->cached = 0;
+    memset(&module->cache, 0, sizeof(Module));
+    module->expanded = NULL;
+    return graph->count++;
+}
+
+void init_module_store(ModuleStore* store) {
+    store->modules = NULL;
+    store->count = 0;
+    store->capacity = 0;
+    store->load = 0;
+    store->hits = 0;
+    store->misses = 0;
+}
+
+static void free_stored_module(StoredModule* module) {
+    free_parser(module->parser);
+    free_tokens(&module->tokens);
+    release_source_file(module->file);
+    mem_free(module->path);
+    mem_free(module);
+}
+
+void free_module_store(ModuleStore* store) {
+    for (size_t i = 0; i < store->count; i++) {
+        free_stored_module(store->modules[i]);
+    }
+    mem_free(store->modules);
+    init_module_store(store);
+}
+
+static StoredModule* get_stored_module(const ModuleStore* store, const char* path) {
+    for (size_t i = 0; i < store->count; i++) {
+        if (strcmp(store->modules[i]->path, path) == 0) {
+            return store->modules[i];
+        }
+    }
+    return NULL;
+}
+
+static uint64_t hash_file(FileId file) {
+    const SourceBuffer* source = &get_source_file(file)->buffer;
+    return hash_source(source->data, source->size, SOURCE_HASH_SEED);
+}
+
+// Reads a file into the file table, stamped with how it looked right before
+static FileId read_stamped_file(const char* path, FileStamp* stamp) {
+    struct stat info;
+    stamp->read = time(NULL);
+    if (stat(path, &info) == 0) {
+        stamp->modified = info.st_mtime;
+        stamp->size = (long long)info.st_size;
+    } else {
+        stamp->modified = 0;
+        stamp->size = -1;
+    }
+    return add_source_file(path);
+}
+
+// Returns the stored module of a file if it still holds what was parsed
+// A file with the size and modification time it was read with is taken as is,
+// unless it was modified in the second it was read. Otherwise the file is read
+// again and compared by hash, and a stale module is dropped. Returns NULL with
+// the file read into *file, INVALID_FILE_ID if it cannot be read, when the
+// module has to be parsed.
+static StoredModule* find_stored_module(ModuleStore* store, const char* path, FileId* file, FileStamp* stamp) {
+    StoredModule* module = get_stored_module(store, path);
+
+    // The modules handed to a load are in use, they are only checked once
+    if (module != NULL && module->load == store->load) {
+        return module;
+    }
+
+    struct stat info;
+    if (module != NULL && stat(path, &info) == 0 && info.st_mtime == module->stamp.modified &&
+        (long long)info.st_size == module->stamp.size && module->stamp.modified < module->stamp.read) {
+        module->load = store->load;
+        return module;
+    }
+
+    *file = read_stamped_file(path, stamp);
+    if (module == NULL) {
+        return NULL;
+    }
+
+    if (*file != INVALID_FILE_ID && hash_file(*file) == module->hash) {
+        release_source_file(*file);
+        *file = INVALID_FILE_ID;
+        module->stamp = *stamp;
+        module->load = store->load;
+        return module;
+    }
+
+    for (size_t i = 0; i < store->count; i++) {
+        if (store->modules[i] == module) {
+            store->modules[i] = store->modules[--store->count];
+            break;
+        }
+    }
+    free_stored_module(module);
+    return NULL;
+}
+
+// Adds the module of a source file, its tokens and tree come from the store
+// when the file did not change since they were stored
+// Returns -1 if the file cannot be read, or with the graph marked if the module
+// does not fit in memory.
+static int add_file_module(ModuleGraph* graph, Symbol name, char* path, size_t* index) {
+    FileStamp stamp = {0};
+    FileId file = INVALID_FILE_ID;
+    StoredModule* stored = NULL;
+    if (graph->store != NULL) {
+        stored = find_stored_module(graph->store, path, &file, &stamp);
+    } else {
+        file = add_source_file(path);
+    }
+    if (stored == NULL && file == INVALID_FILE_ID) {
+        return -1;
+    }
+
+    *index = add_module(graph, name, path, stored != NULL ? stored->file : file);
+    if (*index == SIZE_MAX) {
+        if (stored == NULL) {
+            release_source_file(file);
+        }
+        return -1;
+    }
+    ModuleUnit* module = &graph->modules[*index];
+    module->stamp = stamp;
+    if (stored != NULL) {
+        module->tokens = stored->tokens;
+        module->parser = stored->parser;
+        module->stored = 1;
+        graph->store->hits++;
+    }
+    return 0;
+}
+
+// Hands the modules that parsed to the store, which keeps them once the graph
+// is freed
+// Storing stops when the store does not fit in memory, the modules left over
+// are freed with the graph and parsed again by the next load.
+static void store_modules(ModuleGraph* graph) {
+    ModuleStore* store = graph->store;
+    for (size_t i = 0; i < graph->count; i++) {
+        ModuleUnit* module = &graph->modules[i];
+        if (module->stored || module->parser == NULL || module->parser->error.has_error) {
+            continue;
+        }
+
+        // The root file can also be imported under a name, it is stored once
+        if (get_stored_module(store, module->path) != NULL) {
+            continue;
+        }
+
+        if (store->count == store->capacity) {
+            size_t capacity = store->capacity == 0 ? 16 : store->capacity * 2;
+            StoredModule** grown = mem_realloc(store->modules, capacity * sizeof(StoredModule*));
+            if (grown == NULL) {
+                return;
+            }
+            store->modules = grown;
+            store->capacity = capacity;
+        }
+
+        StoredModule* stored = mem_alloc(sizeof(StoredModule));
+        if (stored == NULL || (stored->path = strdup_c(module->path)) == NULL) {
+            mem_free(stored);
+            return;
+        }
+        stored->stamp = module->stamp;
+        stored->hash = hash_file(module->file);
+        stored->load = store->load;
+        stored->file = module->file;
+        stored->tokens = module->tokens;
+        stored->parser = module->parser;
+        stored->parser->stream = &stored->tokens;
+        store->modules[store->count++] = stored;
+
+        module->stored = 1;
+        store->misses++;
+    }
+}
+
+static int is_directory(const char* path) {
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static int is_file(const char* path) {
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// Turns an import path such as std.iostream.print into std/iostream/print
+// Returns NULL if a part of the path is not an identifier, or with the graph
+// marked if the path does not fit in memory.
+static char* import_to_path(ModuleGraph* graph, const char* name) {
+    size_t length = strlen(name);
+    char* path = mem_alloc(length + 1);
+    if (path == NULL) {
+        graph->out_of_memory = 1;
+        return NULL;
+    }
+
+    size_t part_length = 0;
+    for (size_t i = 0; i <= length; i++) {
+        char c = name[i];
+        if (c == '.' || c == '\0') {
+            if (part_length == 0) {
+                mem_free(path);
+                return NULL;
+            }
+            path[i] = c == '.' ? '/' : '\0';
+            part_length = 0;
+        } else if (isalnum((unsigned char)c) || c == '_') {
+            if (part_length == 0 && isdigit((unsigned char)c)) {
+                mem_free(path);
+                return NULL;
+            }
+            path[i] = c;
+            part_length++;
+        } else {
+            mem_free(path);
+            return NULL;
+        }
+    }
+    return path;
+}
+
+// Returns NULL if the path does not fit in memory
+static char* join_path(const char* directory, const char* name, const char* extension) {
+    size_t length = strlen(directory) + 1 + strlen(name) + strlen(extension) + 1;
+    char* path = mem_alloc(length);
+    if (path == NULL) {
+        return NULL;
+    }
+    snprintf(path, length, "%s/%s%s", directory, name, extension);
+    return path;
+}
+
+// Returns the path of the module file cached for a source with the hash
+static char* cache_path(const ModuleGraph* graph, uint64_t hash) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+    return join_path(graph->cache_directory, name, ".ngm");
+}
+
+// Keeps an error at an import as the error of the load, in the format of the
+// parser
+static void import_error(ModuleGraph* graph, FileId file, uint32_t offset, const char* format, const char* name) {
+    ParseError* failure = &graph->error;
+    failure->has_error = 1;
+    failure->at_end = 0;
+    failure->file = file;
+    failure->offset = offset;
+    snprintf(failure->message, sizeof(failure->message), format, name);
+}
+
+// Returns the module for the import path, loading it the first time it is seen
+// Value is that of the import token, which is at offset in the file. The path
+// is tried against every search path in order, as a file first and then as a
+// directory. Returns -1 if it cannot be resolved, only keeping the error if the
+// graph is not out of memory.
+static int resolve_import(ModuleGraph* graph, Symbol value, FileId file, uint32_t offset, size_t* index) {
+    // The value of an import runs up to the ';', so it can carry trailing spaces
+    const char* text = symbol_str(value);
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char)text[length - 1])) {
+        length--;
+    }
+    Symbol name = intern_string(text, length);
+    if (name == SYMBOL_NONE) {
+        graph->out_of_memory = 1;
+        return -1;
+    }
+
+    for (size_t i = 0; i < graph->count; i++) {
+        if (graph->modules[i].name == name) {
+            *index = i;
+            return 0;
+        }
+    }
+
+    char* relative = import_to_path(graph, symbol_str(name));
+    if (relative == NULL) {
+        if (!graph->out_of_memory) {
+            import_error(graph, file, offset, "Invalid module path %s", symbol_str(name));
+        }
+        return -1;
+    }
+
+    for (size_t i = 0; i < graph->search_path_count; i++) {
+        char* path = join_path(graph->search_paths[i], relative, ".ngc");
+        if (path == NULL) {
+            graph->out_of_memory = 1;
+            break;
+        }
+        if (is_file(path)) {
+            if (add_file_module(graph, name, path, index) != 0) {
+                if (!graph->out_of_memory) {
+                    import_error(graph, file, offset, "Could not read module %s", symbol_str(name));
+                }
+                mem_free(path);
+                mem_free(relative);
+                return -1;
+            }
+            mem_free(relative);
+            return 0;
+        }
+        mem_free(path);
+
+        path = join_path(graph->search_paths[i], relative, "");
+        if (path == NULL) {
+            graph->out_of_memory = 1;
+            break;
+        }
+        if (is_directory(path)) {
+            *index = add_module(graph, name, path, INVALID_FILE_ID);
+            mem_free(relative);
+            if (*index == SIZE_MAX) {
+                mem_free(path);
+                return -1;
+            }
+            return 0;
+        }
+        mem_free(path);
+    }
+
+    mem_free(relative);
+    if (graph->out_of_memory) {
+        return -1;
+    }
+    import_error(graph, file, offset, "Could not find module %s", symbol_str(name));
+    return -1;
+}
+
+// Shared by the tasks lexing a level, the graph does not grow while they run
+typedef struct {
+    ModuleGraph* graph;
+    size_t start; // First module of the level
+} LexLevel;
+
+static void lex_module_task(void* context, size_t worker, size_t index) {
+    (void)worker;
+    LexLevel* level = context;
+    ModuleUnit* module = &level->graph->modules[level->start + index];
+    if (module->file == INVALID_FILE_ID || module->stored) {
+        return;
+    }
+
+    // A module cached for the same source is neither lexed nor parsed
+    const SourceBuffer* source = &get_source_file(module->file)->buffer;
+    if (level->graph->cache_directory != NULL) {
+        module->hash = hash_source(source->data, source->size, SOURCE_HASH_SEED);
+        // Without the memory for the path the module is lexed instead
+        char* path = cache_path(level->graph, module->hash);
+        module->cached = path != NULL && read_module_cache(path, module->hash, &module->cache) == 0;
+        mem_free(path);
+        if (module->cached) {
+            return;
+        }
+    }
+
+    reserve_token_stream(&module->tokens, source->size);
+    tokenize_source(&module->tokens, module->file);
+}
+
+// Lexes the modules level by level from the root, the modules of a level are
+// lexed in parallel and their imports make up the next level
+// Files are only added to the file table in between levels, while no lexer runs.
+// Returns -1 if an import cannot be resolved or memory runs out.
+static int discover_modules(ModuleGraph* graph) {
+    size_t level_start = 0;
+    while (level_start < graph->count) {
+        size_t level_end = graph->count;
+        LexLevel level = {graph, level_start};
+        run_parallel(level_end - level_start, graph->jobs, lex_module_task, &level);
+
+        for (size_t i = level_start; i < level_end; i++) {
+            SmallVec imports;
+            init_small_vec(&imports, sizeof(size_t));
+
+            // The imports of a cached module are in its file, those of the
+            // others among their tokens. Resolving an import can move the
+            // modules, but neither of these.
+            ModuleImport* found = NULL;
+            const ModuleImport* module_imports = graph->modules[i].cache.imports;
+            size_t import_count = graph->modules[i].cache.import_count;
+            if (!graph->modules[i].cached) {
+                found = find_module_imports(&graph->modules[i].tokens, &import_count);
+                if (import_count == SIZE_MAX || graph->modules[i].tokens.out_of_memory) {
+                    graph->out_of_memory = 1;
+                    mem_free(found);
+                    return -1;
+                }
+                module_imports = found;
+            }
+
+            FileId file = graph->modules[i].file;
+            for (size_t j = 0; j < import_count; j++) {
+                Symbol value = compact_symbol(&graph->modules[i].cache.ast, module_imports[j].name);
+                if (value == SYMBOL_NONE) {
+                    graph->out_of_memory = 1;
+                }
+                size_t index;
+                int failed = graph->out_of_memory || resolve_import(graph, value, file, module_imports[j].offset, &index) != 0;
+                if (!failed && small_vec_push(&imports, &index) != 0) {
+                    graph->out_of_memory = 1;
+                    failed = 1;
+                }
+                if (failed) {
+                    free_small_vec(&imports);
+                    mem_free(found);
+                    return -1;
+                }
+            }
+            mem_free(found);
+
+            ModuleUnit* module = &graph->modules[i];
+            module->import_count = imports.count;
+            module->imports = small_vec_finish(&imports, &graph->arena);
+            if (graph->arena.out_of_memory) {
+                graph->out_of_memory = 1;
+                return -1;
+            }
+        }
+
+        level_start = level_end;
+    }
+    return 0;
+}
+
+// Orders the modules by depth first search, a module lands in the wave after
+// the last of its imports
+// Returns -1 with the cycle as the error of the load if modules import each
+// other, or with the graph marked if memory runs out.
+static int order_module(ModuleGraph* graph, size_t index, SmallVec* path) {
+    ModuleUnit* module = &graph->modules[index];
+    if (module->mark == MODULE_VISITED) {
+        return 0;
+    }
+
+    if (module->mark == MODULE_VISITING) {
+        // The cycle is the part of the path from the earlier visit on
+        size_t* visiting = small_vec_items(path);
+        size_t start = 0;
+        while (visiting[start] != index) {
+            start++;
+        }
+
+        // The error is in no source of its own, a long cycle is cut short
+        graph->error.has_error = 1;
+        graph->error.file = INVALID_FILE_ID;
+        char* message = graph->error.message;
+        size_t size = sizeof(graph->error.message);
+        size_t length = (size_t)snprintf(message, size, "import cycle ");
+        for (size_t i = start; i < path->count && length < size; i++) {
+            length += (size_t)snprintf(message + length, size - length, "%s -> ", symbol_str(graph->modules[visiting[i]].name));
+        }
+        if (length < size) {
+            snprintf(message + length, size - length, "%s", symbol_str(module->name));
+        }
+        return -1;
+    }
+
+    module->mark = MODULE_VISITING;
+    if (small_vec_push(path, &index) != 0) {
+        graph->out_of_memory = 1;
+        return -1;
+    }
+
+    size_t wave = 0;
+    for (size_t i = 0; i < module->import_count; i++) {
+        size_t import = module->imports[i];
+        if (order_module(graph, import, path) != 0) {
+            return -1;
+        }
+        if (graph->modules[import].wave + 1 > wave) {
+            wave = graph->modules[import].wave + 1;
+        }
+    }
+
+    small_vec_pop(path, &index);
+    module->mark = MODULE_VISITED;
+    module->wave = wave;
+    if (wave + 1 > graph->wave_count) {
+        graph->wave_count = wave + 1;
+    }
+    return 0;
+}
+
+// Shared by the tasks parsing a wave
+typedef struct {
+    ModuleGraph* graph;
+    size_t* modules; // Indices of the modules of the wave
+    size_t jobs;     // Threads each module may use for its own items
+} ParseWave;
+
+// Writes the module file of a module that parsed into the cache directory
+// A module file is only an optimization, one that does not fit in memory is
+// not written.
+static void cache_module(const ModuleGraph* graph, ModuleUnit* module) {
+    size_t import_count;
+    ModuleImport* imports = find_module_imports(&module->tokens, &import_count);
+    if (import_count == SIZE_MAX) {
+        return;
+    }
+
+    CompactAST ast;
+    init_compact_ast(&ast);
+    NodeId root = compact_ast_node(&ast, module->parser->ast_root);
+    char* path = cache_path(graph, module->hash);
+    if (path != NULL && !ast.out_of_memory && write_module_cache(path, &ast, root, imports, import_count, module->hash) != 0) {
+        fprintf(stderr, "\033[31mError: could not write %s\n\033[0m", path);
+    }
+    mem_free(path);
+    free_compact_ast(&ast);
+    mem_free(imports);
+}
+
+// Parses one module, an error is kept in its parser and reported once the
+// whole wave is done
+// A module without a parser did not fit in memory.
+static void parse_module_task(void* context, size_t worker, size_t index) {
+    (void)worker;
+    ParseWave* wave = context;
+    ModuleUnit* module = &wave->graph->modules[wave->modules[index]];
+
+    Parser* parser = create_parser(&module->tokens);
+    module->parser = parser;
+    if (parser == NULL) {
+        return;
+    }
+
+    run_parser_parallel(parser, wave->jobs);
+
+    if (!parser->error.has_error && wave->graph->cache_directory != NULL) {
+        cache_module(wave->graph, module);
+    }
+}
+
+// Parses the modules wave by wave, the modules of a wave do not depend on each
+// other and are parsed in parallel
+// Nothing checks a module against its imports yet, the waves are the order in
+// which that has to happen. Returns -1 with the first error in module order as
+// the error of the load if a module fails to parse, running out of memory only
+// marks the graph.
+static int parse_modules(ModuleGraph* graph) {
+    for (size_t wave = 0; wave < graph->wave_count; wave++) {
+        SmallVec members;
+        init_small_vec(&members, sizeof(size_t));
+        for (size_t i = 0; i < graph->count; i++) {
+            const ModuleUnit* module = &graph->modules[i];
+            if (module->wave == wave && module->file != INVALID_FILE_ID && !module->stored && !module->cached &&
+                small_vec_push(&members, &i) != 0) {
+                graph->out_of_memory = 1;
+                free_small_vec(&members);
+                return -1;
+            }
+        }
+
+        // A wave of one module spends the threads on its items instead
+        ParseWave work = {graph, small_vec_items(&members), members.count == 1 ? graph->jobs : 1};
+        run_parallel(members.count, graph->jobs, parse_module_task, &work);
+
+        for (size_t i = 0; i < members.count; i++) {
+            Parser* parser = graph->modules[work.modules[i]].parser;
+            if (parser != NULL && !parser->error.has_error) {
+                continue;
+            }
+
+            if (parser == NULL || parser->error.out_of_memory) {
+                graph->out_of_memory = 1;
+            } else {
+                // An error at the end of the input still needs to say which
+                // module ended
+                graph->error = parser->error;
+                graph->error.file = graph->modules[work.modules[i]].file;
+            }
+            free_small_vec(&members);
+            return -1;
+        }
+        free_small_vec(&members);
+    }
+    return 0;
+}
+
+// Returns the directory of a file name, "." when it has none
+static char* parent_directory(const char* filename) {
+    const char* end = strrchr(filename, '/');
+#ifdef _WIN32
+    const char* backslash = strrchr(filename, '\\');
+    if (backslash != NULL && (end == NULL || backslash > end)) {
+        end = backslash;
+    }
+#endif
+    if (end == NULL) {
+        return strdup_c(".");
+    }
+    if (end == filename) {
+        return strdup_c("/");
+    }
+    return strndup(filename, (size_t)(end - filename));
+}
+
+// Loads the root file and every module it imports, directly or not
+// Import paths are resolved against the directory of the root file, the added
+// search paths and then the library directory next to the root file. The
+// modules are lexed and parsed on up to graph->jobs threads. Returns -1 with
+// the error kept in graph->error if a module cannot be read or found, the
+// imports form a cycle or a module fails to parse, or with the graph marked if
+// memory runs out, see report_load_error. With a store, modules whose files
+// did not change are taken from it and the modules that parsed are kept in it.
+// With a cache directory, modules whose file is cached are read from there
+// instead of being lexed and parsed, and the modules that parsed are written
+// there. Only a module file that cannot be written is reported on the spot.
+int load_program(ModuleGraph* graph, const char* filename) {
+    if (graph->out_of_memory) {
+        return -1;
+    }
+    if (graph->store != NULL) {
+        graph->store->load++;
+    }
+
+    Symbol name = intern_cstr(filename);
+    char* path = strdup_c(filename);
+    size_t index;
+    if (name == SYMBOL_NONE || path == NULL) {
+        mem_free(path);
+        graph->out_of_memory = 1;
+        return -1;
+    }
+    if (add_file_module(graph, name, path, &index) != 0) {
+        if (!graph->out_of_memory) {
+            graph->error.has_error = 1;
+            graph->error.file = INVALID_FILE_ID;
+            snprintf(graph->error.message, sizeof(graph->error.message), "could not read %s", filename);
+        }
+        mem_free(path);
+        return -1;
+    }
+
+    char* root = parent_directory(filename);
+    insert_search_path(graph, graph->search_path_count, root == NULL ? NULL : join_path(root, "library", ""));
+    insert_search_path(graph, 0, root);
+    if (graph->out_of_memory) {
+        return -1;
+    }
+
+    // The scan kernels are picked once, before any lexer runs
+    init_scan_kernels();
+
+    if (discover_modules(graph) != 0) {
+        return -1;
+    }
+
+    SmallVec visiting;
+    init_small_vec(&visiting, sizeof(size_t));
+    for (size_t i = 0; i < graph->count; i++) {
+        if (order_module(graph, i, &visiting) != 0) {
+            free_small_vec(&visiting);
+            return -1;
+        }
+    }
+    free_small_vec(&visiting);
+
+    int status = parse_modules(graph);
+    if (graph->store != NULL) {
+        store_modules(graph);
+    }
+    return status;
+}
+
+// Prints the error a load failed with, running out of memory is reported like
+// any other error
+void report_load_error(const ModuleGraph* graph) {
+    if (graph->out_of_memory) {
+        fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+    } else if (graph->error.has_error) {
+        report_parse_error(&graph->error);
+    }
+}
+
+// Returns the tree of a module, NULL for a directory or a module that did not
+// parse
+// A cached module is expanded into the graph arena the first time it is asked
+// for, one that does not fit in memory is NULL and marks the graph.
+ASTNode* module_tree(ModuleGraph* graph, size_t index) {
+    ModuleUnit* module = &graph->modules[index];
+    if (module->parser != NULL) {
+        return module->parser->ast_root;
+    }
+    if (module->cached && module->expanded == NULL && !graph->out_of_memory) {
+        module->expanded = expand_compact_node(&module->cache.ast, module->cache.root, &graph->arena);
+        if (graph->arena.out_of_memory) {
+            module->expanded = NULL;
+            graph->out_of_memory = 1;
+        }
+    }
+    return module->expanded;
+}
+
+void free_module_graph(ModuleGraph* graph) {
+    for (size_t i = 0; i < graph->count; i++) {
+        ModuleUnit* module = &graph->modules[i];
+        if (!module->stored) {
+            if (module->parser != NULL) {
+                free_parser(module->parser);
+            }
+            free_tokens(&module->tokens);
+            free_module(&module->cache);
+
+            // A store outlives the graph, so the files it does not keep go now
+            if (graph->store != NULL && module->file != INVALID_FILE_ID) {
+                release_source_file(module->file);
+            }
+        }
+        mem_free(module->path);
+    }
+    for (size_t i = 0; i < graph->search_path_count; i++) {
+        mem_free(graph->search_paths[i]);
+    }
+
+    mem_free(graph->modules);
+    mem_free(graph->search_paths);
+    free_arena(&graph->arena);
+    graph->modules = NULL;
+    graph->count = 0;
+    graph->capacity = 0;
+    graph->search_paths = NULL;
+    graph->search_path_count = 0;
+    graph->wave_count = 0;
+}
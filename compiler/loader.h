@@ -0,0 +1,92 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "arena.h"
+#include "intern.h"
+#include "lexer.h"
+#include "module_cache.h"
+#include "parser.h"
+#include "source.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Structure to hold what a file looked like when it was read
+typedef struct {
+    time_t modified;
+    long long size;
+    time_t read; // A change in the second the file was read may not show in modified
+} FileStamp;
+
+// Structure to hold a module of the program
+// A module is either a source file, or a directory which only groups the
+// modules below it and has no code of its own (use std; names one).
+typedef struct {
+    Symbol name;     // Import path such as std.iostream.print, the file name for the root
+    char* path;      // File or directory the import path resolved to
+    FileId file;     // INVALID_FILE_ID for a directory
+    size_t* imports; // Indices of the imported modules, allocated from the graph arena
+    size_t import_count;
+    size_t wave;     // Only depends on modules of earlier waves
+    int mark;        // Visit state of the cycle check
+    TokenStream tokens;
+    Parser* parser;  // NULL until parsed, for directories and cached modules
+    int stored;      // The file, tokens and parser belong to the module store
+    FileStamp stamp; // Only taken for a module store
+    uint64_t hash;   // Hash of the file, only taken for a module cache
+    int cached;      // Read from the module cache instead of lexed and parsed
+    Module cache;
+    ASTNode* expanded; // Tree of a cached module once it is asked for
+} ModuleUnit;
+
+// Structure to hold a parsed module kept across loads, with what its file
+// looked like when it was parsed
+typedef struct {
+    char* path;
+    FileStamp stamp;
+    uint64_t hash;   // Hash of the contents that were parsed
+    size_t load;     // Last load the module was handed to
+    FileId file;
+    TokenStream tokens;
+    Parser* parser;
+} StoredModule;
+
+// Structure to hold the modules a long running compiler keeps parsed between
+// loads of programs, a module is parsed again once its file changes
+typedef struct {
+    StoredModule** modules;
+    size_t count;
+    size_t capacity;
+    size_t load;     // Loads done with the store
+    size_t hits;     // Modules the loads took from the store
+    size_t misses;   // Modules the loads lexed and parsed
+} ModuleStore;
+
+// Structure to hold the modules of a program and the imports between them
+// Module 0 is the root file, the others are in the order they were found.
+typedef struct {
+    ModuleUnit* modules;
+    size_t count;
+    size_t capacity;
+    char** search_paths; // Directories import paths are resolved against, in order
+    size_t search_path_count;
+    size_t wave_count;
+    size_t jobs;
+    ModuleStore* store; // Where parsed modules are kept across loads, NULL for nowhere
+    const char* cache_directory; // Where module files are kept by hash of their source, NULL for nowhere
+    Arena arena;
+    int out_of_memory;  // Set once memory ran out, the load fails
+    ParseError error;   // The error the load stopped at, see report_load_error
+} ModuleGraph;
+
+// Function declarations
+void init_module_graph(ModuleGraph* graph, size_t jobs);
+void add_search_path(ModuleGraph* graph, const char* path);
+int load_program(ModuleGraph* graph, const char* filename);
+void report_load_error(const ModuleGraph* graph);
+ASTNode* module_tree(ModuleGraph* graph, size_t index);
+void free_module_graph(ModuleGraph* graph);
+void init_module_store(ModuleStore* store);
+void free_module_store(ModuleStore* store);
+
+#endif // LOADER_H
@@ -3,52 +3,546 @@
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#include "compact_ast.h"
+#include "driver.h"
+#include "function_cache.h"
 #include "lexer.h"
+#include "loader.h"
+#include "module_cache.h"
 #include "parser.h"
+#include "resolve.h"
+#include "scan.h"
+#include "server.h"
+#include "stats.h"
+#include "intern.h"
+#include "number.h"
+#include "utils.h"
+#include "writer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void handle_file_read(const char* filename, Token*** tokens, size_t* token_count) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
+// Prints the time report and writes the JSON stats, as requested
+// Returns -1 if the JSON file could not be written.
+static int report_stats(const CompilerStats* stats, int time_report, const char* stats_json) {
+    if (time_report) {
+        print_time_report(stats, stderr);
+    }
+
+    if (stats_json == NULL) {
+        return 0;
+    }
+
+    FILE* out = strcmp(stats_json, "-") == 0 ? stdout : fopen(stats_json, "w");
+    if (out == NULL) {
+        fprintf(stderr, "\033[31mError: could not write %s\n\033[0m", stats_json);
+        return -1;
+    }
+    write_stats_json(stats, out);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+// Writes the line a module starts with in the --modules output
+static void write_module_header(Writer* out, const ModuleUnit* unit, DumpFormat format) {
+    const char* name = symbol_str(unit->name);
+    if (format == DUMP_JSON) {
+        write_cstr(out, "{\"module\":");
+        write_json_string(out, name, strlen(name));
+        write_cstr(out, ",\"path\":");
+        write_json_string(out, unit->path, strlen(unit->path));
+        write_cstr(out, ",\"wave\":");
+        write_uint(out, unit->wave);
+        write_bytes(out, "}\n", 2);
         return;
     }
 
-    char buffer[1024];
-    int line_number = 1;
+    write_cstr(out, "Module ");
+    write_cstr(out, name);
+    write_cstr(out, " (");
+    write_cstr(out, unit->path);
+    write_cstr(out, "), wave ");
+    write_uint(out, unit->wave);
+    write_char(out, '\n');
+}
 
-    while (fgets(buffer, sizeof(buffer), file)) {
-        // Remove trailing newline if present
-        size_t len = strlen(buffer);
-        if (len > 0 && buffer[len-1] == '\n') {
-            buffer[len-1] = '\0';
+// Flushes and frees the dump buffer, returns 1 if the output could not be written
+static int finish_output(Writer* out) {
+    int failed = flush_writer(out) != 0;
+    free_writer(out);
+    if (failed) {
+        fprintf(stderr, "\033[31mError: could not write the output\n\033[0m");
+    }
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    // NGP_SCAN=scalar|sse2|avx2 forces the scan kernels used by the lexer, the token
+    // stream has to be identical for every level
+    const char* scan_level = getenv("NGP_SCAN");
+    if (scan_level != NULL) {
+        if (strcmp(scan_level, "scalar") == 0) {
+            set_scan_level(SCAN_SCALAR);
+        } else if (strcmp(scan_level, "sse2") == 0) {
+            set_scan_level(SCAN_SSE2);
+        } else if (strcmp(scan_level, "avx2") == 0) {
+            set_scan_level(SCAN_AVX2);
         }
+    }
 
-        tokenize_line(buffer, line_number, filename, tokens, token_count);
-        line_number++;
+    // Every argument that is not an option is a source file, the example by
+    // default and "-" for stdin. Several files, or -o, compile each file into a
+    // module of its own.
+    // -o PATH                 module of a single file, or directory for several
+    // -j N                    threads for the items of a file, the files or the modules
+    // -O N                    with N of 1 and up, only parses the bodies --lazy parses
+    // --memory-budget MB      holds files back while the ones compiling take more
+    // --dump-tokens           lexes the whole file up front and writes the tokens
+    // --dump-ast              writes the AST
+    // --dump-format text|json tables and trees, or one JSON object per line
+    // --alloc-stats           prints how many heap allocations were made
+    // --compact               dumps the AST through its struct of arrays layout
+    // --lazy                  only parses the bodies reachable from main and pub fns
+    // --module-cache PATH     loads the module from PATH, or parses and writes it there,
+    //                         with --modules PATH is a directory of every module
+    // --function-cache DIR    reuses the function bodies that did not change from DIR
+    // --time-report           prints the time and memory of every phase to stderr
+    // --stats-json PATH       writes the same numbers as JSON, "-" for stdout
+    // --modules               loads the imported modules in dependency order
+    // -L DIR                  adds a directory to resolve imports against
+    // --resolve               resolves every name used to its declaration
+    // --server SOCKET         serves --modules compiles on a Unix socket
+    // --connect SOCKET        has the server compile the file, --stop stops it
+    const char* program = argv[0];
+    const char* filename = "example.ngc";
+    size_t input_count = 0;
+    const char* output = NULL;
+    int optimize = 0;
+    size_t memory_budget = 0;
+    int dump_tokens = 0;
+    int dump_ast = 0;
+    DumpFormat dump_format = DUMP_TEXT;
+    int alloc_stats = 0;
+    int compact = 0;
+    size_t jobs = 1;
+    int lazy = 0;
+    const char* module_cache = NULL;
+    const char* function_cache = NULL;
+    int modules = 0;
+    int resolve = 0;
+    int time_report = 0;
+    const char* stats_json = NULL;
+    const char* server_socket = NULL;
+    const char* connect_socket = NULL;
+    int stop = 0;
+    ModuleGraph graph;
+    init_module_graph(&graph, 1);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump-tokens") == 0) {
+            dump_tokens = 1;
+        } else if (strcmp(argv[i], "--dump-ast") == 0) {
+            dump_ast = 1;
+        } else if (strcmp(argv[i], "--dump-format") == 0 && i + 1 < argc) {
+            const char* format = argv[++i];
+            if (strcmp(format, "text") == 0) {
+                dump_format = DUMP_TEXT;
+            } else if (strcmp(format, "json") == 0) {
+                dump_format = DUMP_JSON;
+            } else {
+                fprintf(stderr, "\033[31mError: unknown dump format %s\n\033[0m", format);
+                free_module_graph(&graph);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            alloc_stats = 1;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compact = 1;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = 1;
+        } else if (strcmp(argv[i], "--module-cache") == 0 && i + 1 < argc) {
+            module_cache = argv[++i];
+        } else if (strcmp(argv[i], "--function-cache") == 0 && i + 1 < argc) {
+            function_cache = argv[++i];
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            time_report = 1;
+        } else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            stats_json = argv[++i];
+        } else if (strcmp(argv[i], "--modules") == 0) {
+            modules = 1;
+        } else if (strcmp(argv[i], "--resolve") == 0) {
+            resolve = 1;
+        } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+            add_search_path(&graph, argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strncmp(argv[i], "-O", 2) == 0 && argv[i][2] != '\0') {
+            optimize = atoi(argv[i] + 2);
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            server_socket = argv[++i];
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connect_socket = argv[++i];
+        } else if (strcmp(argv[i], "--stop") == 0) {
+            stop = 1;
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            memory_budget = strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "\033[31mError: unknown option %s, or it is missing its value\n\033[0m", argv[i]);
+            fprintf(stderr, "Usage: %s [options] [file ...]\n", program);
+            free_module_graph(&graph);
+            return 1;
+        } else {
+            // The inputs are gathered at the front of argv, past the arguments
+            // that were already read
+            argv[input_count++] = argv[i];
+            filename = argv[i];
+        }
     }
 
-    fclose(file);
-}
+    if (server_socket != NULL || connect_socket != NULL) {
+        int status;
+        if (server_socket != NULL) {
+            ServerOptions options;
+            init_server_options(&options);
+            options.socket_path = server_socket;
+            options.search_paths = graph.search_paths;
+            options.search_path_count = graph.search_path_count;
+            options.jobs = jobs == 0 ? 1 : jobs;
+            status = run_server(&options) == 0 ? 0 : 1;
+        } else if (stop) {
+            status = request_stop(connect_socket) == 0 ? 0 : 1;
+        } else {
+            status = request_compile(connect_socket, filename, graph.search_paths, graph.search_path_count, time_report) == 0 ? 0 : 1;
+        }
+
+        free_module_graph(&graph);
+        free_source_files();
+        free_numbers();
+        free_interner();
+        return status;
+    }
+
+    if (input_count > 1 || output != NULL) {
+        free_module_graph(&graph);
+        if (dump_tokens || dump_ast || compact || module_cache != NULL || function_cache != NULL || modules || resolve) {
+            fprintf(stderr, "\033[31mError: the dump, cache, module and resolve options take a single file without -o\n\033[0m");
+            return 1;
+        }
 
-int main() {
-    Token** buffer = NULL;
-    size_t token_count;
+        DriverOptions options;
+        init_driver_options(&options);
+        options.output = output;
+        options.optimize = optimize;
+        options.jobs = jobs;
+        options.memory_budget = memory_budget;
 
-    // Handle file reading and lexer
-    handle_file_read("example.ngc", &buffer, &token_count);
-    print_tokens(buffer, token_count, NULL);
+        const char** inputs = (const char**)argv;
+        if (input_count == 0) {
+            inputs[input_count++] = filename;
+        }
+
+        CompilerStats stats;
+        init_compiler_stats(&stats);
+        int status = compile_files(&options, inputs, input_count, &stats) == 0 ? 0 : 1;
+
+        begin_phase(&stats, PHASE_FREE);
+        free_source_files();
+        free_numbers();
+        free_interner();
+        end_phase(&stats);
+
+        if (alloc_stats) {
+            AllocationStats allocation = get_allocation_stats();
+            printf("Allocations: %zu, reallocations: %zu, frees: %zu\n", allocation.allocations, allocation.reallocations, allocation.frees);
+        }
+        if (report_stats(&stats, time_report, stats_json) != 0) {
+            status = 1;
+        }
+        return status;
+    }
+
+    // Unreachable bodies are dropped the way --lazy does it
+    if (optimize > 0) {
+        lazy = 1;
+    }
+
+    CompilerStats stats;
+    init_compiler_stats(&stats);
+
+    // Dumps go through one buffer, it is flushed before anything else is printed
+    Writer out;
+    init_writer(&out, stdout);
+    ASTDump dump;
+    init_ast_dump(&dump, &out, dump_format);
 
-    // Pass the tokens to the parser
-    Parser* parser = create_parser(buffer, token_count);
-    run_parser(parser);
+    if (modules) {
+        // Modules are read, lexed and parsed as they are found, that is all
+        // counted as the parse
+        begin_phase(&stats, PHASE_PARSE);
+        graph.jobs = jobs == 0 ? 1 : jobs;
 
-    print_ast_node(parser->ast_root, 2);
+        // The module cache of a program is a directory, one file per module
+        graph.cache_directory = module_cache;
+        int status = load_program(&graph, filename) == 0 ? 0 : 1;
+        if (status != 0) {
+            report_load_error(&graph);
+        }
+        for (size_t i = 0; i < graph.count; i++) {
+            const SourceFile* source = get_source_file(graph.modules[i].file);
+            stats.files += source != NULL;
+            stats.source_bytes += source != NULL ? source->buffer.size : 0;
+            stats.tokens += graph.modules[i].tokens.count;
+        }
+        stats.nodes = ast_node_count();
+
+        // Every module is resolved on its own, names from imports are left
+        // unresolved for now
+        NameTable names;
+        init_name_table(&names);
+        if (resolve && status == 0) {
+            begin_phase(&stats, PHASE_RESOLVE);
+            for (size_t i = 0; status == 0 && i < graph.count; i++) {
+                ASTNode* tree = module_tree(&graph, i);
+                if (graph.out_of_memory || (tree != NULL && resolve_names(&names, tree) != 0)) {
+                    fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+                    status = 1;
+                }
+            }
+        }
+
+        begin_phase(&stats, PHASE_PRINT);
+
+        // Every module comes after the ones it imports
+        for (size_t wave = 0; status == 0 && wave < graph.wave_count; wave++) {
+            for (size_t i = 0; i < graph.count; i++) {
+                ModuleUnit* unit = &graph.modules[i];
+                if (unit->wave != wave) {
+                    continue;
+                }
+
+                write_module_header(&out, unit, dump_format);
+                if (dump_ast && unit->cached) {
+                    write_compact_node(&dump, &unit->cache.ast, unit->cache.root, 2, DUMP_NO_PARENT);
+                } else if (dump_ast && unit->parser != NULL) {
+                    write_ast_node(&dump, unit->parser->ast_root, 2, DUMP_NO_PARENT);
+                }
+            }
+        }
+        status |= finish_output(&out);
+
+        if (resolve && status == 0) {
+            printf("Names: %zu declarations in %zu scopes, %zu uses resolved, %zu unresolved\n",
+                   names.declaration_count, names.scope_count, names.resolved, names.unresolved);
+        }
+
+        begin_phase(&stats, PHASE_FREE);
+        free_name_table(&names);
+        free_module_graph(&graph);
+        free_source_files();
+        free_numbers();
+        free_interner();
+        end_phase(&stats);
+
+        if (alloc_stats) {
+            AllocationStats allocation = get_allocation_stats();
+            printf("Allocations: %zu, reallocations: %zu, frees: %zu\n", allocation.allocations, allocation.reallocations, allocation.frees);
+        }
+        if (report_stats(&stats, time_report, stats_json) != 0) {
+            status = 1;
+        }
+        return status;
+    }
+    free_module_graph(&graph);
+
+    begin_phase(&stats, PHASE_READ);
+    FileId file = add_source_file(filename);
+    if (file == INVALID_FILE_ID) {
+        fprintf(stderr, "\033[31mError: could not read %s\n\033[0m", filename);
+        free_writer(&out);
+        return 1;
+    }
+    stats.files = 1;
+    stats.source_bytes = get_source_file(file)->buffer.size;
+
+    // A module written for the same source replaces lexing and parsing altogether,
+    // modules are always written with every body parsed
+    uint64_t source_hash = 0;
+    Module module;
+    int cached = 0;
+    if (module_cache != NULL) {
+        begin_phase(&stats, PHASE_CACHE);
+        const SourceBuffer* source = &get_source_file(file)->buffer;
+        source_hash = hash_source(source->data, source->size, SOURCE_HASH_SEED);
+        cached = read_module_cache(module_cache, source_hash, &module) == 0;
+        lazy = 0;
+    }
+
+    // Bodies are only parsed when they are not in the function cache
+    if (function_cache != NULL) {
+        lazy = 1;
+    }
+
+    TokenStream tokens;
+    init_token_stream(&tokens);
+    // Skimmed bodies are parsed from the token stream later on
+    if (!cached && (dump_tokens || jobs > 1 || lazy)) {
+        begin_phase(&stats, PHASE_LEX);
+        reserve_token_stream(&tokens, get_source_file(file)->buffer.size);
+        tokenize_source(&tokens, file);
+    }
+    if (dump_tokens) {
+        begin_phase(&stats, PHASE_PRINT);
+        write_tokens(&out, &tokens, NULL, dump_format);
+
+        // The tokens are out even if parsing fails
+        flush_writer(&out);
+    }
+
+    // The parser pulls the tokens from the lexer as it goes, unless the items
+    // are parsed in parallel or the bodies lazily
+    Lexer lexer;
+    init_lexer(&lexer, file);
+
+    Parser* parser = NULL;
+    NameTable names;
+    init_name_table(&names);
+    size_t function_hits = 0;
+    size_t function_misses = 0;
+    int out_of_memory = 0;
+    if (cached) {
+        begin_phase(&stats, PHASE_PRINT);
+        if (dump_ast) {
+            write_compact_node(&dump, &module.ast, module.root, 2, DUMP_NO_PARENT);
+        }
+        stats.nodes = module.ast.node_count - 1; // Without NODE_NONE
+        free_module(&module);
+    } else {
+        begin_phase(&stats, PHASE_PARSE);
+        if (jobs > 1 || lazy) {
+            parser = create_parser(&tokens);
+            stats.tokens = tokens.count;
+            if (parser != NULL) {
+                parser->lazy_bodies = lazy;
+                run_parser_parallel(parser, jobs);
+
+                begin_phase(&stats, PHASE_BODIES);
+                if (function_cache != NULL) {
+                    FunctionCache cache;
+                    init_function_cache(&cache, function_cache);
+                    compile_functions(&cache, parser);
+                    function_hits = cache.hits;
+                    function_misses = cache.misses;
+                    free_function_cache(&cache);
+                } else if (lazy) {
+                    parse_needed_bodies(parser);
+                }
+            }
+        } else {
+            parser = create_parser_from_lexer(&lexer);
+            if (parser != NULL) {
+                run_parser(parser);
+                stats.tokens = parser->token_count;
+            }
+        }
+
+        // A syntax error ends the program, without the dump or the statistics,
+        // and so does running out of memory
+        if (parser == NULL || parser->error.has_error) {
+            if (parser == NULL) {
+                fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+            } else {
+                report_parse_error(&parser->error);
+                free_parser(parser);
+            }
+            free_writer(&out);
+            free_lexer(&lexer);
+            free_tokens(&tokens);
+            free_source_files();
+            free_numbers();
+            free_interner();
+            return 1;
+        }
+        stats.nodes = ast_node_count();
+
+        if (resolve) {
+            begin_phase(&stats, PHASE_RESOLVE);
+            out_of_memory = resolve_names(&names, parser->ast_root) != 0;
+        }
+
+        // Running out of memory is reported once everything is freed, nothing
+        // is written from a tree that is incomplete
+        if (!out_of_memory && ((dump_ast && compact) || module_cache != NULL)) {
+            begin_phase(&stats, module_cache != NULL ? PHASE_CACHE : PHASE_PRINT);
+            CompactAST ast;
+            init_compact_ast(&ast);
+            NodeId root = compact_ast_node(&ast, parser->ast_root);
+            out_of_memory = ast.out_of_memory;
+            if (!out_of_memory && module_cache != NULL && write_module_cache(module_cache, &ast, root, NULL, 0, source_hash) != 0) {
+                fprintf(stderr, "\033[31mError: could not write %s\n\033[0m", module_cache);
+            }
+
+            begin_phase(&stats, PHASE_PRINT);
+            if (!out_of_memory && dump_ast && compact) {
+                write_compact_node(&dump, &ast, root, 2, DUMP_NO_PARENT);
+            } else if (!out_of_memory && dump_ast) {
+                write_ast_node(&dump, parser->ast_root, 2, DUMP_NO_PARENT);
+            }
+            free_compact_ast(&ast);
+        } else if (!out_of_memory && dump_ast) {
+            begin_phase(&stats, PHASE_PRINT);
+            write_ast_node(&dump, parser->ast_root, 2, DUMP_NO_PARENT);
+        }
+    }
+
+    int status = finish_output(&out);
+    size_t arena_bytes = parser != NULL ? parser->arena.allocated : 0;
+    size_t arena_chunks = parser != NULL ? parser->arena.chunk_count : 0;
+
+    size_t declaration_count = names.declaration_count;
+    size_t scope_count = names.scope_count;
+    size_t names_resolved = names.resolved;
+    size_t names_unresolved = names.unresolved;
 
     // Free everything
-    free_parser(parser);
-    free_tokens(buffer, token_count);
+    begin_phase(&stats, PHASE_FREE);
+    free_name_table(&names);
+    if (parser != NULL) {
+        free_parser(parser);
+    }
+    free_lexer(&lexer);
+    free_tokens(&tokens);
+    free_source_files();
+    free_numbers();
+    free_interner();
+    end_phase(&stats);
 
-    return 0;
+    // Like a syntax error, without the statistics
+    if (out_of_memory) {
+        fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+        return 1;
+    }
+
+    if (function_cache != NULL && !cached) {
+        printf("Function cache: %zu hits, %zu misses\n", function_hits, function_misses);
+    }
+
+    // A module from the module cache has no tree to resolve
+    if (resolve && !cached) {
+        printf("Names: %zu declarations in %zu scopes, %zu uses resolved, %zu unresolved\n",
+               declaration_count, scope_count, names_resolved, names_unresolved);
+    }
+
+    if (alloc_stats) {
+        AllocationStats allocation = get_allocation_stats();
+        printf("Allocations: %zu, reallocations: %zu, frees: %zu\n", allocation.allocations, allocation.reallocations, allocation.frees);
+        printf("AST arena: %zu bytes in %zu chunks\n", arena_bytes, arena_chunks);
+    }
+
+    if (report_stats(&stats, time_report, stats_json) != 0) {
+        status = 1;
+    }
+    return status;
 }
@@ -0,0 +1,556 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "module_cache.h"
+#include "intern.h"
+#include "number.h"
+#include "smallvec.h"
+#include "source.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FNV-1a over the bytes, pass the result back in to hash several sources
+uint64_t hash_source(const char* data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Returns the imports among the tokens, for write_module_cache
+// The array is freed with mem_free, NULL if there are no imports. Sets *count
+// to SIZE_MAX if it could not be allocated.
+ModuleImport* find_module_imports(const TokenStream* stream, size_t* count) {
+    SmallVec imports;
+    init_small_vec(&imports, sizeof(ModuleImport));
+    for (size_t i = 0; i < stream->count; i++) {
+        if (stream->tokens[i].type != T_IMPORT) {
+            continue;
+        }
+        ModuleImport import = {stream->tokens[i].symbol, stream->tokens[i].offset};
+        if (small_vec_push(&imports, &import) != 0) {
+            free_small_vec(&imports);
+            *count = SIZE_MAX;
+            return NULL;
+        }
+    }
+
+    *count = imports.count;
+    if (imports.count == 0) {
+        free_small_vec(&imports);
+        return NULL;
+    }
+    ModuleImport* copy = mem_alloc(imports.count * sizeof(ModuleImport));
+    if (copy == NULL) {
+        *count = SIZE_MAX;
+    } else {
+        memcpy(copy, small_vec_items(&imports), imports.count * sizeof(ModuleImport));
+    }
+    free_small_vec(&imports);
+    return copy;
+}
+
+// Structure to hold the state of writing a module
+// Symbols are renumbered in order of first use, so the file only carries the
+// strings the module actually refers to. The local numbers are found through
+// an open addressing table keyed by the interned symbol.
+typedef struct {
+    FILE* file;        // NULL when the module is written to data instead
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+    Symbol* keys;      // Interned symbol of every slot, SYMBOL_NONE if free
+    uint32_t* local;   // Local symbol of every slot
+    size_t slot_count;
+    Symbol* strings;   // Interned symbol per local symbol - 1
+    uint32_t string_count;
+    uint32_t string_capacity;
+    int failed;
+} ModuleWriter;
+
+static size_t symbol_slot(Symbol symbol, size_t slot_count) {
+    return (size_t)(symbol * 2654435761u) & (slot_count - 1);
+}
+
+// Doubles the table, every symbol keeps its local number
+static int grow_local_table(ModuleWriter* writer) {
+    size_t slot_count = writer->slot_count == 0 ? 256 : writer->slot_count * 2;
+    Symbol* keys = mem_calloc(slot_count, sizeof(Symbol));
+    uint32_t* local = mem_alloc(slot_count * sizeof(uint32_t));
+    Symbol* strings = mem_realloc(writer->strings, slot_count / 2 * sizeof(Symbol));
+    if (keys == NULL || local == NULL || strings == NULL) {
+        mem_free(keys);
+        mem_free(local);
+        if (strings != NULL) {
+            writer->strings = strings;
+        }
+        return -1;
+    }
+
+    for (size_t i = 0; i < writer->slot_count; i++) {
+        if (writer->keys[i] == SYMBOL_NONE) {
+            continue;
+        }
+        size_t slot = symbol_slot(writer->keys[i], slot_count);
+        while (keys[slot] != SYMBOL_NONE) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        keys[slot] = writer->keys[i];
+        local[slot] = writer->local[i];
+    }
+
+    mem_free(writer->keys);
+    mem_free(writer->local);
+    writer->keys = keys;
+    writer->local = local;
+    writer->slot_count = slot_count;
+    writer->strings = strings;
+    writer->string_capacity = (uint32_t)(slot_count / 2);
+    return 0;
+}
+
+static uint32_t localize(ModuleWriter* writer, Symbol symbol) {
+    if (symbol == SYMBOL_NONE) {
+        return 0;
+    }
+
+    // At most half of the slots are taken
+    if (writer->string_count == writer->string_capacity && grow_local_table(writer) != 0) {
+        writer->failed = 1;
+        return 0;
+    }
+
+    size_t slot = symbol_slot(symbol, writer->slot_count);
+    while (writer->keys[slot] != SYMBOL_NONE) {
+        if (writer->keys[slot] == symbol) {
+            return writer->local[slot];
+        }
+        slot = (slot + 1) & (writer->slot_count - 1);
+    }
+
+    writer->strings[writer->string_count++] = symbol;
+    writer->keys[slot] = symbol;
+    writer->local[slot] = writer->string_count;
+    return writer->string_count;
+}
+
+static void write_module_bytes(ModuleWriter* writer, const void* data, size_t size) {
+    if (size == 0 || writer->failed) {
+        return;
+    }
+
+    if (writer->file != NULL) {
+        if (fwrite(data, 1, size, writer->file) != size) {
+            writer->failed = 1;
+        }
+        writer->size += size;
+        return;
+    }
+
+    if (writer->size + size > writer->capacity) {
+        size_t capacity = writer->capacity == 0 ? 4096 : writer->capacity;
+        while (capacity < writer->size + size) {
+            capacity *= 2;
+        }
+        unsigned char* grown = mem_realloc(writer->data, capacity);
+        if (grown == NULL) {
+            writer->failed = 1;
+            return;
+        }
+        writer->data = grown;
+        writer->capacity = capacity;
+    }
+    memcpy(writer->data + writer->size, data, size);
+    writer->size += size;
+}
+
+// Writes a section, padded to start at a multiple of MODULE_SECTION_ALIGNMENT
+static void write_module_section(ModuleWriter* writer, const void* data, size_t size) {
+    static const unsigned char padding[MODULE_SECTION_ALIGNMENT] = {0};
+    size_t misalignment = writer->size % MODULE_SECTION_ALIGNMENT;
+    if (misalignment != 0) {
+        write_module_bytes(writer, padding, MODULE_SECTION_ALIGNMENT - misalignment);
+    }
+    write_module_bytes(writer, data, size);
+}
+
+// Returns a copy of the payloads of one kind with their symbols made local
+static unsigned char* localize_items(ModuleWriter* writer, const CompactAST* ast, ASTNodeType type) {
+    size_t count;
+    const unsigned char* items = compact_kind_items(ast, type, &count);
+    size_t item_size = compact_item_size(type);
+    if (count == 0) {
+        return NULL;
+    }
+
+    unsigned char* copy = mem_alloc(count * item_size);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, items, count * item_size);
+
+    size_t field_count;
+    const CompactField* fields = compact_fields(type, &field_count);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < field_count; j++) {
+            if (fields[j].kind == FIELD_SYMBOL) {
+                Symbol* symbol = (Symbol*)(copy + i * item_size + fields[j].offset);
+                *symbol = localize(writer, compact_symbol(ast, *symbol));
+            }
+        }
+    }
+    return copy;
+}
+
+// Writes the module to the given path, or to writer->data if path is NULL
+// Root is the node the module starts at, its public functions are listed as
+// exports so importers can find them without walking the tree. The tree may be
+// a view of another module file.
+static int write_module(ModuleWriter* writer, const char* path, const CompactAST* ast, NodeId root,
+                        const ModuleImport* imports, size_t import_count, uint64_t source_hash) {
+    unsigned char* items[AST_NODE_TYPE_COUNT] = {0};
+    Symbol* symbols = ast->symbol_count > 0 ? mem_alloc(ast->symbol_count * sizeof(Symbol)) : NULL;
+    ModuleImport* local_imports = import_count > 0 ? mem_alloc(import_count * sizeof(ModuleImport)) : NULL;
+    uint32_t* offsets = NULL;
+
+    int result = -1;
+    if ((ast->symbol_count > 0 && symbols == NULL) || (import_count > 0 && local_imports == NULL)) {
+        goto cleanup;
+    }
+
+    // Symbols are renumbered up front, the string table comes first in the file
+    for (size_t type = 0; type < AST_NODE_TYPE_COUNT; type++) {
+        items[type] = localize_items(writer, ast, (ASTNodeType)type);
+        if (ast->kinds[type].count > 0 && items[type] == NULL) {
+            goto cleanup;
+        }
+    }
+    for (uint32_t i = 0; i < ast->symbol_count; i++) {
+        symbols[i] = localize(writer, compact_symbol(ast, ast->symbols[i]));
+    }
+    for (size_t i = 0; i < import_count; i++) {
+        local_imports[i].name = localize(writer, imports[i].name);
+        local_imports[i].offset = imports[i].offset;
+    }
+    if (writer->failed) {
+        goto cleanup;
+    }
+
+    // String i runs up to the NUL before offsets[i + 1]
+    offsets = mem_alloc(((size_t)writer->string_count + 1) * sizeof(uint32_t));
+    if (offsets == NULL) {
+        goto cleanup;
+    }
+    offsets[0] = 0;
+    for (uint32_t i = 0; i < writer->string_count; i++) {
+        offsets[i + 1] = offsets[i] + (uint32_t)symbol_len(writer->strings[i]) + 1;
+    }
+
+    // Exports are the public function definitions
+    SmallVec exports;
+    init_small_vec(&exports, sizeof(NodeId));
+    size_t function_count;
+    const CompactFunctionDef* functions = compact_kind_items(ast, AST_FUNCTION_DEF, &function_count);
+    for (size_t i = 0; i < function_count; i++) {
+        if (functions[i].is_public && small_vec_push(&exports, &ast->kinds[AST_FUNCTION_DEF].nodes[i]) != 0) {
+            free_small_vec(&exports);
+            goto cleanup;
+        }
+    }
+
+    ModuleCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MODULE_CACHE_MAGIC;
+    header.version = MODULE_CACHE_VERSION;
+    header.source_hash = source_hash;
+    header.root = root;
+    header.string_count = writer->string_count;
+    header.string_bytes = offsets[writer->string_count];
+    header.node_count = ast->node_count;
+    header.child_count = ast->child_count;
+    header.symbol_count = ast->symbol_count;
+    header.export_count = (uint32_t)exports.count;
+    header.import_count = (uint32_t)import_count;
+    for (size_t type = 0; type < AST_NODE_TYPE_COUNT; type++) {
+        header.kind_counts[type] = ast->kinds[type].count;
+    }
+
+    if (path != NULL) {
+        writer->file = fopen(path, "wb");
+        if (writer->file == NULL) {
+            free_small_vec(&exports);
+            goto cleanup;
+        }
+    }
+
+    write_module_section(writer, &header, sizeof(header));
+    write_module_section(writer, offsets, ((size_t)writer->string_count + 1) * sizeof(uint32_t));
+    write_module_section(writer, NULL, 0);
+    for (uint32_t i = 0; i < writer->string_count; i++) {
+        write_module_bytes(writer, symbol_str(writer->strings[i]), symbol_len(writer->strings[i]) + 1);
+    }
+    write_module_section(writer, ast->tags, ast->node_count * sizeof(uint8_t));
+    write_module_section(writer, ast->indices, ast->node_count * sizeof(uint32_t));
+    for (size_t type = 0; type < AST_NODE_TYPE_COUNT; type++) {
+        write_module_section(writer, items[type], ast->kinds[type].count * compact_item_size((ASTNodeType)type));
+        write_module_section(writer, ast->kinds[type].nodes, ast->kinds[type].count * sizeof(NodeId));
+    }
+    write_module_section(writer, ast->children, ast->child_count * sizeof(NodeId));
+    write_module_section(writer, symbols, ast->symbol_count * sizeof(Symbol));
+    write_module_section(writer, small_vec_items(&exports), exports.count * sizeof(NodeId));
+    write_module_section(writer, local_imports, import_count * sizeof(ModuleImport));
+    free_small_vec(&exports);
+
+    if (writer->file != NULL && fclose(writer->file) != 0) {
+        writer->failed = 1;
+    }
+    result = writer->failed ? -1 : 0;
+
+cleanup:
+    for (size_t type = 0; type < AST_NODE_TYPE_COUNT; type++) {
+        mem_free(items[type]);
+    }
+    mem_free(symbols);
+    mem_free(local_imports);
+    mem_free(offsets);
+    mem_free(writer->keys);
+    mem_free(writer->local);
+    mem_free(writer->strings);
+    return result;
+}
+
+// Writes the module to the given path, returns -1 if it could not be written
+int write_module_cache(const char* path, const CompactAST* ast, NodeId root, const ModuleImport* imports, size_t import_count, uint64_t source_hash) {
+    ModuleWriter writer = {0};
+    return write_module(&writer, path, ast, root, imports, import_count, source_hash);
+}
+
+// Writes the module into a heap buffer in the same format as a cache file
+// The buffer is freed with mem_free. Returns -1 if it could not be allocated.
+int write_module_buffer(const CompactAST* ast, NodeId root, const ModuleImport* imports, size_t import_count, uint64_t source_hash,
+                        unsigned char** data, size_t* size) {
+    ModuleWriter writer = {0};
+    if (write_module(&writer, NULL, ast, root, imports, import_count, source_hash) != 0) {
+        mem_free(writer.data);
+        return -1;
+    }
+    *data = writer.data;
+    *size = writer.size;
+    return 0;
+}
+
+// Structure to hold the state of reading a module
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+    int failed;
+} ModuleReader;
+
+// Returns the next section of the file, which holds count items of the given
+// size, or NULL with reader->failed set if the file is too short
+static void* take_section(ModuleReader* reader, size_t count, size_t size) {
+    size_t misalignment = reader->offset % MODULE_SECTION_ALIGNMENT;
+    if (misalignment != 0) {
+        reader->offset += MODULE_SECTION_ALIGNMENT - misalignment;
+    }
+    if (reader->failed || reader->offset > reader->size || (size != 0 && count > (reader->size - reader->offset) / size)) {
+        reader->failed = 1;
+        return NULL;
+    }
+
+    // The map is read only, the tree promises not to write through it
+    void* data = (void*)(reader->data + reader->offset);
+    reader->offset += count * size;
+    return data;
+}
+
+// Returns 1 if the local symbol is in the string table of the file
+static int is_local_symbol(const CompactAST* ast, Symbol symbol) {
+    return symbol <= ast->strings.count;
+}
+
+// Checks every reference in the tree
+// Nothing that is read from the file is trusted, a corrupt file is rejected
+// instead of producing a tree that cannot be walked. Children are always added
+// before their parents, so every node may only refer to lower ids, which also
+// rules out cycles.
+static int check_module(const Module* module) {
+    const CompactAST* ast = &module->ast;
+    const CompactStrings* strings = &ast->strings;
+
+    if (strings->offsets[0] != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < strings->count; i++) {
+        uint32_t end = strings->offsets[i + 1];
+        if (end <= strings->offsets[i] || end > strings->offsets[strings->count] || strings->data[end - 1] != '\0') {
+            return -1;
+        }
+    }
+
+    for (uint32_t node = 1; node < ast->node_count; node++) {
+        if (ast->tags[node] >= AST_NODE_TYPE_COUNT || ast->indices[node] >= ast->kinds[ast->tags[node]].count) {
+            return -1;
+        }
+    }
+
+    for (size_t type = 0; type < AST_NODE_TYPE_COUNT; type++) {
+        const CompactKind* kind = &ast->kinds[type];
+        size_t item_size = compact_item_size((ASTNodeType)type);
+        size_t field_count;
+        const CompactField* fields = compact_fields((ASTNodeType)type, &field_count);
+
+        for (uint32_t i = 0; i < kind->count; i++) {
+            NodeId owner = kind->nodes[i];
+            if (owner == NODE_NONE || owner >= ast->node_count || ast->tags[owner] != type || ast->indices[owner] != i) {
+                return -1;
+            }
+
+            const unsigned char* item = (const unsigned char*)kind->items + i * item_size;
+            for (size_t j = 0; j < field_count; j++) {
+                const void* field = item + fields[j].offset;
+                NodeRange range;
+                switch (fields[j].kind) {
+                    case FIELD_SYMBOL:
+                        if (!is_local_symbol(ast, *(const Symbol*)field)) {
+                            return -1;
+                        }
+                        break;
+                    case FIELD_NODE:
+                        if (*(const NodeId*)field >= owner) {
+                            return -1;
+                        }
+                        break;
+                    case FIELD_CHILDREN:
+                        memcpy(&range, field, sizeof(range));
+                        if (range.start > ast->child_count || range.count > ast->child_count - range.start) {
+                            return -1;
+                        }
+                        for (uint32_t k = 0; k < range.count; k++) {
+                            if (ast->children[range.start + k] >= owner) {
+                                return -1;
+                            }
+                        }
+                        break;
+                    case FIELD_SYMBOLS:
+                        memcpy(&range, field, sizeof(range));
+                        if (range.start > ast->symbol_count || range.count > (ast->symbol_count - range.start) / 2) {
+                            return -1;
+                        }
+                        break;
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < ast->symbol_count; i++) {
+        if (!is_local_symbol(ast, ast->symbols[i])) {
+            return -1;
+        }
+    }
+
+    if (module->root >= ast->node_count) {
+        return -1;
+    }
+    for (size_t i = 0; i < module->export_count; i++) {
+        if (compact_node_type(ast, module->exports[i]) != AST_FUNCTION_DEF) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < module->import_count; i++) {
+        if (module->imports[i].name == SYMBOL_NONE || !is_local_symbol(ast, module->imports[i].name)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Sets the module up as a view of the data, which stays owned by the caller
+// The data has to be aligned to MODULE_SECTION_ALIGNMENT, as mapped files and
+// heap buffers are. Returns -1 if it is not, if it was written for other
+// sources (the hash differs) or is not a valid module.
+int read_module_buffer(const unsigned char* data, size_t size, uint64_t source_hash, Module* module) {
+    memset(module, 0, sizeof(Module));
+    if ((uintptr_t)data % MODULE_SECTION_ALIGNMENT != 0) {
+        return -1;
+    }
+
+    ModuleReader reader = {data, size, 0, 0};
+    const ModuleCacheHeader* header = take_section(&reader, 1, sizeof(ModuleCacheHeader));
+    if (header == NULL || header->magic != MODULE_CACHE_MAGIC || header->version != MODULE_CACHE_VERSION ||
+        header->source_hash != source_hash || header->node_count == 0 || header->string_count == UINT32_MAX) {
+        return -1;
+    }
+
+    CompactAST* ast = &module->ast;
+    ast->strings.offsets = take_section(&reader, (size_t)header->string_count + 1, sizeof(uint32_t));
+    ast->strings.data = take_section(&reader, header->string_bytes, 1);
+    ast->strings.count = header->string_count;
+
+    ast->tags = take_section(&reader, header->node_count, sizeof(uint8_t));
+    ast->indices = take_section(&reader, header->node_count, sizeof(uint32_t));
+    ast->node_count = ast->node_capacity = header->node_count;
+
+    for (size_t type = 0; type < AST_NODE_TYPE_COUNT; type++) {
+        CompactKind* kind = &ast->kinds[type];
+        kind->items = take_section(&reader, header->kind_counts[type], compact_item_size((ASTNodeType)type));
+        kind->nodes = take_section(&reader, header->kind_counts[type], sizeof(NodeId));
+        kind->count = kind->capacity = header->kind_counts[type];
+    }
+
+    ast->children = take_section(&reader, header->child_count, sizeof(NodeId));
+    ast->child_count = ast->child_capacity = header->child_count;
+    ast->symbols = take_section(&reader, header->symbol_count, sizeof(Symbol));
+    ast->symbol_count = ast->symbol_capacity = header->symbol_count;
+
+    module->root = header->root;
+    module->exports = take_section(&reader, header->export_count, sizeof(NodeId));
+    module->export_count = header->export_count;
+    module->imports = take_section(&reader, header->import_count, sizeof(ModuleImport));
+    module->import_count = header->import_count;
+
+    // A file that is longer than its header says was not written by us either
+    if (reader.failed || reader.offset != reader.size || ast->strings.offsets[header->string_count] > header->string_bytes ||
+        check_module(module) != 0) {
+        memset(module, 0, sizeof(Module));
+        return -1;
+    }
+
+    // Symbols are only interned once they are asked for, see compact_symbol
+    ast->strings.interned = mem_calloc((size_t)header->string_count + 1, sizeof(Symbol));
+    if (ast->strings.interned == NULL) {
+        memset(module, 0, sizeof(Module));
+        return -1;
+    }
+    return 0;
+}
+
+// Loads a module written by write_module_cache
+// The file is mapped and stays mapped until the module is freed, the tree is a
+// view of it. Returns -1 if the file does not exist or read_module_buffer
+// rejects it.
+int read_module_cache(const char* path, uint64_t source_hash, Module* module) {
+    SourceBuffer buffer;
+    if (load_source_file(path, &buffer) != 0) {
+        memset(module, 0, sizeof(Module));
+        return -1;
+    }
+
+    if (read_module_buffer((const unsigned char*)buffer.data, buffer.size, source_hash, module) != 0) {
+        free_source_file(&buffer);
+        return -1;
+    }
+    module->file = buffer;
+    return 0;
+}
+
+void free_module(Module* module) {
+    free_compact_ast(&module->ast);
+    free_source_file(&module->file);
+    memset(module, 0, sizeof(Module));
+}
@@ -0,0 +1,73 @@
+#ifndef MODULE_CACHE_H
+#define MODULE_CACHE_H
+
+#include "compact_ast.h"
+#include "lexer.h"
+#include "source.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Identifies module cache files, "NGPM" in a little endian file
+#define MODULE_CACHE_MAGIC 0x4d50474e
+
+// Bumped whenever the layout of the file or of any compact payload changes
+#define MODULE_CACHE_VERSION 2
+
+// Every section of a module file starts at a multiple of this many bytes, so
+// its arrays can be used in place
+#define MODULE_SECTION_ALIGNMENT 8
+
+// Starting value of a source hash, see hash_source
+#define SOURCE_HASH_SEED 0xcbf29ce484222325ULL
+
+// Structure to hold the header of a module cache file
+// The header is followed by, in this order, the string offsets and the string
+// bytes, the tags and kind indices of the nodes, the payloads and node ids of
+// every kind, the children, the symbols, the exports and the imports, each
+// section aligned to MODULE_SECTION_ALIGNMENT. Symbols in the file are local,
+// 1-based indices into its strings, see CompactStrings.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash; // Hash of the sources the module was parsed from
+    uint32_t root;
+    uint32_t string_count;
+    uint32_t string_bytes;
+    uint32_t node_count;
+    uint32_t child_count;
+    uint32_t symbol_count;
+    uint32_t export_count;
+    uint32_t import_count;
+    uint32_t kind_counts[AST_NODE_TYPE_COUNT];
+} ModuleCacheHeader;
+
+// Structure to hold an import of a module, so its imports are known without
+// lexing it again
+typedef struct {
+    Symbol name;     // Value of the import token, local in a module file
+    uint32_t offset; // Where the import is in the source, for errors
+} ModuleImport;
+
+// Structure to hold a module read from a cache file
+// Nothing is copied out of the file, the tree is a view of it (see CompactAST)
+// and the exports and imports point into it as well.
+typedef struct {
+    CompactAST ast;
+    NodeId root;
+    const NodeId* exports; // The public function definitions
+    size_t export_count;
+    const ModuleImport* imports;
+    size_t import_count;
+    SourceBuffer file;     // The mapped file, empty for a module read from a buffer
+} Module;
+
+// Function declarations
+uint64_t hash_source(const char* data, size_t size, uint64_t hash);
+ModuleImport* find_module_imports(const TokenStream* stream, size_t* count);
+int write_module_cache(const char* path, const CompactAST* ast, NodeId root, const ModuleImport* imports, size_t import_count, uint64_t source_hash);
+int write_module_buffer(const CompactAST* ast, NodeId root, const ModuleImport* imports, size_t import_count, uint64_t source_hash, unsigned char** data, size_t* size);
+int read_module_cache(const char* path, uint64_t source_hash, Module* module);
+int read_module_buffer(const unsigned char* data, size_t size, uint64_t source_hash, Module* module);
+void free_module(Module* module);
+
+#endif // MODULE_CACHE_H
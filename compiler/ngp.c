@@ -0,0 +1,443 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "ngp.h"
+#include "ast.h"
+#include "compact_ast.h"
+#include "intern.h"
+#include "lexer.h"
+#include "loader.h"
+#include "module_cache.h"
+#include "number.h"
+#include "parallel.h"
+#include "parser.h"
+#include "scan.h"
+#include "source.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Structure to hold a source of a context and what compiling it gave
+typedef struct {
+    FileId file;
+    ParseError error;
+    int out_of_memory;
+    size_t tokens;
+    unsigned char* module; // NULL until compiled without errors
+    size_t module_size;
+} NgpSource;
+
+struct NgpContext {
+    int optimize;
+    size_t jobs;
+    NgpSource* sources;
+    size_t source_count;
+    size_t source_capacity;
+    NgpDiagnostic* diagnostics;
+    size_t diagnostic_count;
+    char** search_paths; // Searched by the program compiles, in order
+    size_t search_path_count;
+    NgpProgramStats program;
+};
+
+struct NgpStore {
+    ModuleStore modules;
+};
+
+static once_flag library_once = ONCE_FLAG_INIT;
+static mtx_t library_lock;
+static size_t library_users = 0; // Live contexts, guarded by library_lock
+
+// Picks the scan kernels once for every context, a level set by the embedder
+// before is kept
+static void init_library() {
+    mtx_init(&library_lock, mtx_plain);
+    init_scan_kernels();
+}
+
+static void acquire_library() {
+    mtx_lock(&library_lock);
+    library_users++;
+    mtx_unlock(&library_lock);
+}
+
+// Frees the symbols, numbers and files shared by the contexts once the last
+// context is gone, they start out empty again with the next one
+static void release_library() {
+    mtx_lock(&library_lock);
+    if (--library_users == 0) {
+        free_source_files();
+        free_numbers();
+        free_interner();
+    }
+    mtx_unlock(&library_lock);
+}
+
+NgpContext* ngp_create_context() {
+    call_once(&library_once, init_library);
+
+    NgpContext* context = mem_calloc(1, sizeof(NgpContext));
+    if (context == NULL) {
+        return NULL;
+    }
+    context->jobs = 1;
+    acquire_library();
+    return context;
+}
+
+// From level 1 on only the function bodies reachable from main and the public
+// functions are parsed, the others are left out of the modules
+void ngp_set_optimize(NgpContext* context, int level) {
+    context->optimize = level;
+}
+
+// Sets the threads a compile may use, the sources are compiled side by side
+// and a single source spends them on its own items
+void ngp_set_jobs(NgpContext* context, size_t jobs) {
+    context->jobs = jobs == 0 ? 1 : jobs;
+}
+
+static NgpStatus add_file(NgpContext* context, FileId file) {
+    if (file == INVALID_FILE_ID) {
+        return NGP_ERROR_READ;
+    }
+
+    if (context->source_count == context->source_capacity) {
+        size_t capacity = context->source_capacity == 0 ? 4 : context->source_capacity * 2;
+        NgpSource* grown = mem_realloc(context->sources, capacity * sizeof(NgpSource));
+        if (grown == NULL) {
+            release_source_file(file);
+            return NGP_ERROR_MEMORY;
+        }
+        context->sources = grown;
+        context->source_capacity = capacity;
+    }
+
+    NgpSource* source = &context->sources[context->source_count++];
+    memset(source, 0, sizeof(NgpSource));
+    source->file = file;
+    return NGP_OK;
+}
+
+// Adds a source held in memory, the data is copied and the name is what the
+// diagnostics refer to it by
+NgpStatus ngp_add_source(NgpContext* context, const char* name, const char* data, size_t size) {
+    return add_file(context, add_source_copy(name, data, size));
+}
+
+NgpStatus ngp_add_file(NgpContext* context, const char* path) {
+    return add_file(context, add_source_file(path));
+}
+
+// Stamps the module with the hash of its source like a module cache entry
+// Modules missing unreachable bodies are stamped differently, so they are never
+// taken for complete ones.
+static uint64_t module_hash(const SourceFile* file, int optimize) {
+    uint64_t hash = hash_source(file->buffer.data, file->buffer.size, SOURCE_HASH_SEED);
+    if (optimize > 0) {
+        hash = hash_source((const char*)&optimize, sizeof(optimize), hash);
+    }
+    return hash;
+}
+
+// Lexes and parses one source into its module, every source has a token
+// stream, parser and arena of its own
+// A parse error is kept in the source, running out of memory is not an error of
+// the source and only marks it.
+static void compile_source_task(void* data, size_t worker, size_t index) {
+    (void)worker;
+    NgpContext* context = data;
+    NgpSource* source = &context->sources[index];
+    const SourceFile* file = get_source_file(source->file);
+
+    TokenStream tokens;
+    init_token_stream(&tokens);
+    reserve_token_stream(&tokens, file->buffer.size);
+    tokenize_source(&tokens, source->file);
+    source->tokens = tokens.count;
+
+    Parser* parser = create_parser(&tokens);
+    if (parser == NULL) {
+        source->out_of_memory = 1;
+        free_tokens(&tokens);
+        return;
+    }
+    parser->lazy_bodies = context->optimize > 0;
+
+    run_parser_parallel(parser, context->source_count == 1 ? context->jobs : 1);
+    if (parser->lazy_bodies) {
+        parse_needed_bodies(parser);
+    }
+    source->error = parser->error;
+
+    if (source->error.out_of_memory) {
+        source->out_of_memory = 1;
+        source->error.has_error = 0;
+    } else if (source->error.at_end) {
+        // An error at the end of the input still needs to say which source ended
+        source->error.file = source->file;
+    }
+
+    if (!source->error.has_error && !source->out_of_memory) {
+        CompactAST ast;
+        init_compact_ast(&ast);
+        NodeId root = compact_ast_node(&ast, parser->ast_root);
+        uint64_t hash = module_hash(file, context->optimize);
+        size_t import_count;
+        ModuleImport* imports = find_module_imports(&tokens, &import_count);
+        if (ast.out_of_memory || import_count == SIZE_MAX ||
+            write_module_buffer(&ast, root, imports, import_count, hash, &source->module, &source->module_size) != 0) {
+            source->out_of_memory = 1;
+        }
+        mem_free(imports);
+        free_compact_ast(&ast);
+    }
+
+    free_parser(parser);
+    free_tokens(&tokens);
+}
+
+static void clear_results(NgpContext* context) {
+    for (size_t i = 0; i < context->source_count; i++) {
+        mem_free(context->sources[i].module);
+        context->sources[i].module = NULL;
+        context->sources[i].module_size = 0;
+        context->sources[i].out_of_memory = 0;
+    }
+
+    for (size_t i = 0; i < context->diagnostic_count; i++) {
+        mem_free((char*)context->diagnostics[i].filename);
+        mem_free((char*)context->diagnostics[i].message);
+    }
+    mem_free(context->diagnostics);
+    context->diagnostics = NULL;
+    context->diagnostic_count = 0;
+    memset(&context->program, 0, sizeof(NgpProgramStats));
+}
+
+// Turns the error of a source into a diagnostic, the location is resolved here
+// so the diagnostic does not depend on the file table
+static int add_diagnostic(NgpContext* context, NgpDiagnostic* diagnostic, const ParseError* error) {
+    diagnostic->filename = NULL;
+    diagnostic->line = 0;
+    diagnostic->column = 0;
+    if (error->file != INVALID_FILE_ID) {
+        if (!error->at_end) {
+            source_location(error->file, error->offset, &diagnostic->line, &diagnostic->column);
+        }
+        diagnostic->filename = strdup_c(source_filename(error->file));
+    }
+    diagnostic->message = strdup_c(error->message);
+    if ((error->file != INVALID_FILE_ID && diagnostic->filename == NULL) || diagnostic->message == NULL) {
+        mem_free((char*)diagnostic->filename);
+        mem_free((char*)diagnostic->message);
+        return -1;
+    }
+    context->diagnostic_count++;
+    return 0;
+}
+
+// Compiles every source of the context into a module
+// Any earlier results are dropped first. Returns NGP_ERROR_SOURCE if a source
+// has errors, every error is a diagnostic, in the order the sources were added.
+NgpStatus ngp_compile(NgpContext* context) {
+    clear_results(context);
+
+    run_parallel(context->source_count, context->jobs, compile_source_task, context);
+
+    size_t error_count = 0;
+    int out_of_memory = 0;
+    for (size_t i = 0; i < context->source_count; i++) {
+        error_count += context->sources[i].error.has_error;
+        out_of_memory |= context->sources[i].out_of_memory;
+    }
+
+    if (error_count > 0) {
+        context->diagnostics = mem_alloc(error_count * sizeof(NgpDiagnostic));
+        if (context->diagnostics == NULL) {
+            return NGP_ERROR_MEMORY;
+        }
+        for (size_t i = 0; i < context->source_count; i++) {
+            const ParseError* error = &context->sources[i].error;
+            if (error->has_error && add_diagnostic(context, &context->diagnostics[context->diagnostic_count], error) != 0) {
+                return NGP_ERROR_MEMORY;
+            }
+        }
+        return NGP_ERROR_SOURCE;
+    }
+    return out_of_memory ? NGP_ERROR_MEMORY : NGP_OK;
+}
+
+size_t ngp_source_count(const NgpContext* context) {
+    return context->source_count;
+}
+
+// Returns the bytes of a source, 0 for an index past the last one
+size_t ngp_source_size(const NgpContext* context, size_t source) {
+    if (source >= context->source_count) {
+        return 0;
+    }
+    return get_source_file(context->sources[source].file)->buffer.size;
+}
+
+// Returns the tokens the last compile lexed over every source
+size_t ngp_token_count(const NgpContext* context) {
+    size_t count = 0;
+    for (size_t i = 0; i < context->source_count; i++) {
+        count += context->sources[i].tokens;
+    }
+    return count;
+}
+
+size_t ngp_diagnostic_count(const NgpContext* context) {
+    return context->diagnostic_count;
+}
+
+const NgpDiagnostic* ngp_get_diagnostic(const NgpContext* context, size_t index) {
+    return index < context->diagnostic_count ? &context->diagnostics[index] : NULL;
+}
+
+// Prints the diagnostic the way the compiler reports errors
+void ngp_print_diagnostic(const NgpDiagnostic* diagnostic, FILE* out) {
+    if (diagnostic->filename == NULL) {
+        fprintf(out, "\033[31mError: %s\n\033[0m", diagnostic->message);
+    } else if (diagnostic->line != 0) {
+        fprintf(out, "\033[31mError: %s:%zu:%zu\n\t %s.\n\033[0m",
+                diagnostic->filename, diagnostic->line, diagnostic->column,
+                diagnostic->message);
+    } else {
+        fprintf(out, "\033[31mError: %s: %s at end of input.\n\033[0m", diagnostic->filename, diagnostic->message);
+    }
+}
+
+// Returns the module the source compiled into, in the module cache format
+// The module belongs to the context, it is NULL if the source did not compile.
+const unsigned char* ngp_get_module(const NgpContext* context, size_t source, size_t* size) {
+    if (source >= context->source_count || context->sources[source].module == NULL) {
+        *size = 0;
+        return NULL;
+    }
+    *size = context->sources[source].module_size;
+    return context->sources[source].module;
+}
+
+// Frees the context with its results, and hands its sources back to the file table
+void ngp_destroy_context(NgpContext* context) {
+    if (context == NULL) {
+        return;
+    }
+
+    clear_results(context);
+    for (size_t i = 0; i < context->source_count; i++) {
+        release_source_file(context->sources[i].file);
+    }
+    mem_free(context->sources);
+    for (size_t i = 0; i < context->search_path_count; i++) {
+        mem_free(context->search_paths[i]);
+    }
+    mem_free(context->search_paths);
+    mem_free(context);
+    release_library();
+}
+
+// Adds a directory the imports of a program are resolved against, after the
+// ones added before
+NgpStatus ngp_add_search_path(NgpContext* context, const char* path) {
+    char* copy = strdup_c(path);
+    char** grown = copy == NULL ? NULL : mem_realloc(context->search_paths, (context->search_path_count + 1) * sizeof(char*));
+    if (grown == NULL) {
+        mem_free(copy);
+        return NGP_ERROR_MEMORY;
+    }
+    grown[context->search_path_count++] = copy;
+    context->search_paths = grown;
+    return NGP_OK;
+}
+
+// Parses the file and every module it imports, the way --modules does
+// Imports are resolved against the directory of the file, the added search
+// paths and then the library directory next to the file. With a store, modules
+// whose files did not change since an earlier compile are taken from it and
+// the ones that parsed are kept in it. Any earlier results are dropped first.
+// Returns NGP_ERROR_SOURCE with the error as the only diagnostic if the file or
+// a module cannot be read, found or parsed, or the imports form a cycle. A
+// program is only checked, it gives no modules.
+NgpStatus ngp_compile_program(NgpContext* context, const char* filename, NgpStore* store) {
+    clear_results(context);
+
+    // Without a store the modules go into one for this compile only, freeing
+    // it hands their files back to the file table
+    ModuleStore scratch;
+    init_module_store(&scratch);
+    ModuleGraph graph;
+    init_module_graph(&graph, context->jobs);
+    graph.store = store != NULL ? &store->modules : &scratch;
+    for (size_t i = 0; i < context->search_path_count; i++) {
+        add_search_path(&graph, context->search_paths[i]);
+    }
+
+    size_t hits = graph.store->hits;
+    size_t misses = graph.store->misses;
+    int failed = load_program(&graph, filename) != 0;
+
+    NgpProgramStats* stats = &context->program;
+    for (size_t i = 0; i < graph.count; i++) {
+        const SourceFile* source = get_source_file(graph.modules[i].file);
+        stats->files += source != NULL;
+        stats->bytes += source != NULL ? source->buffer.size : 0;
+        stats->tokens += graph.modules[i].tokens.count;
+    }
+    stats->reused = graph.store->hits - hits;
+    stats->parsed = graph.store->misses - misses;
+
+    NgpStatus status = NGP_OK;
+    if (graph.out_of_memory) {
+        status = NGP_ERROR_MEMORY;
+    } else if (failed) {
+        context->diagnostics = mem_alloc(sizeof(NgpDiagnostic));
+        if (context->diagnostics == NULL || add_diagnostic(context, &context->diagnostics[0], &graph.error) != 0) {
+            status = NGP_ERROR_MEMORY;
+        } else {
+            status = NGP_ERROR_SOURCE;
+        }
+    }
+
+    free_module_graph(&graph);
+    free_module_store(&scratch);
+    return status;
+}
+
+// Returns the modules the last program compile loaded and what they took
+const NgpProgramStats* ngp_program_stats(const NgpContext* context) {
+    return &context->program;
+}
+
+// Creates an empty store, which holds on to the shared tables like a context
+NgpStore* ngp_create_store() {
+    call_once(&library_once, init_library);
+
+    NgpStore* store = mem_alloc(sizeof(NgpStore));
+    if (store == NULL) {
+        return NULL;
+    }
+    init_module_store(&store->modules);
+    acquire_library();
+    return store;
+}
+
+// Returns the modules the store keeps parsed
+size_t ngp_store_size(const NgpStore* store) {
+    return store->modules.count;
+}
+
+void ngp_destroy_store(NgpStore* store) {
+    if (store == NULL) {
+        return;
+    }
+
+    free_module_store(&store->modules);
+    mem_free(store);
+    release_library();
+}
@@ -0,0 +1,74 @@
+#ifndef NGP_H
+#define NGP_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// The compiler as a library, libngp
+// A context holds the sources of one compile, the diagnostics and the modules
+// it produced. It can also compile a program, a file and the modules it
+// imports, with a store keeping them parsed for the next program compile. A
+// context is used by one thread at a time, any number of them can compile at
+// once. No call ends the process or prints on its own, running
+// out of memory anywhere in a compile is returned as NGP_ERROR_MEMORY.
+// The interned names, the parsed number literals and the file table are not
+// per context but shared by every context of the process, which is what lets
+// the sources of a compile be parsed on several threads without copying names
+// between them. They only grow while any context is alive and are freed when
+// the last one is destroyed, so an embedder that compiles for a long time
+// destroys its contexts now and then rather than keeping one for good. A store
+// holds them the same way. The scan kernels are picked once per process.
+
+typedef enum {
+    NGP_OK,
+    NGP_ERROR_SOURCE, // The sources have errors, see the diagnostics
+    NGP_ERROR_READ,   // A file could not be read, or the file table is full
+    NGP_ERROR_MEMORY  // Memory ran out, the context can be compiled again
+} NgpStatus;
+
+// Structure to hold an error found in a source
+typedef struct {
+    const char* filename; // NULL for an error in no source, such as an import cycle
+    size_t line;   // 1-based, 0 for an error at the end of the input
+    size_t column;
+    const char* message;
+} NgpDiagnostic;
+
+// Structure to hold what compiling a program took
+typedef struct {
+    size_t files;  // Source files of the modules
+    size_t bytes;  // Their size
+    size_t tokens;
+    size_t reused; // Modules taken from the store
+    size_t parsed; // Modules parsed and kept in the store
+} NgpProgramStats;
+
+typedef struct NgpContext NgpContext;
+
+// Modules kept parsed across program compiles, used by one context at a time
+typedef struct NgpStore NgpStore;
+
+// Function declarations
+NgpContext* ngp_create_context();
+void ngp_set_optimize(NgpContext* context, int level);
+void ngp_set_jobs(NgpContext* context, size_t jobs);
+NgpStatus ngp_add_source(NgpContext* context, const char* name, const char* data, size_t size);
+NgpStatus ngp_add_file(NgpContext* context, const char* path);
+NgpStatus ngp_compile(NgpContext* context);
+size_t ngp_source_count(const NgpContext* context);
+size_t ngp_source_size(const NgpContext* context, size_t source);
+size_t ngp_token_count(const NgpContext* context);
+size_t ngp_diagnostic_count(const NgpContext* context);
+const NgpDiagnostic* ngp_get_diagnostic(const NgpContext* context, size_t index);
+void ngp_print_diagnostic(const NgpDiagnostic* diagnostic, FILE* out);
+const unsigned char* ngp_get_module(const NgpContext* context, size_t source, size_t* size);
+void ngp_destroy_context(NgpContext* context);
+
+NgpStatus ngp_add_search_path(NgpContext* context, const char* path);
+NgpStatus ngp_compile_program(NgpContext* context, const char* filename, NgpStore* store);
+const NgpProgramStats* ngp_program_stats(const NgpContext* context);
+NgpStore* ngp_create_store();
+size_t ngp_store_size(const NgpStore* store);
+void ngp_destroy_store(NgpStore* store);
+
+#endif // NGP_H
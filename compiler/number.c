@@ -0,0 +1,251 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "number.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Literals up to this length are parsed without allocating
+#define NUMBER_BUFFER_SIZE 128
+
+// Values are stored in pages that never move, like the entries of the interner
+#define NUMBER_PAGE_BITS 16
+#define NUMBER_PAGE_SIZE ((size_t)1 << NUMBER_PAGE_BITS)
+#define NUMBER_PAGE_COUNT ((size_t)1 << (32 - NUMBER_PAGE_BITS))
+
+// The parsed values of all numeric literals, the interned text of a literal
+// carries its index + 1 as symbol data
+// Adding a value takes the lock, the symbol data is only set once the value is
+// written, so number_value needs none.
+static NumberValue* number_pages[NUMBER_PAGE_COUNT];
+static size_t number_count = 0;
+static mtx_t number_lock;
+static once_flag number_lock_once = ONCE_FLAG_INIT;
+
+// Suffixes a literal can carry
+static const struct {
+    const char* name;
+    PrimitiveType type;
+} suffixes[] = {
+    {"u8", TYPE_U8}, {"u16", TYPE_U16}, {"u32", TYPE_U32}, {"u64", TYPE_U64}, {"u128", TYPE_U128},
+    {"i8", TYPE_I8}, {"i16", TYPE_I16}, {"i32", TYPE_I32}, {"i64", TYPE_I64}, {"i128", TYPE_I128},
+    {"f32", TYPE_F32}, {"f64", TYPE_F64},
+};
+
+static int parse_suffix(const char* text, size_t length, PrimitiveType* type) {
+    *type = TYPE_NONE;
+    if (length == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        if (strlen(suffixes[i].name) == length && memcmp(suffixes[i].name, text, length) == 0) {
+            *type = suffixes[i].type;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 16;
+}
+
+// Accumulates the digits into a 128-bit value held as four 32-bit limbs
+// Returns -1 if the value does not fit.
+static int parse_integer(const char* digits, size_t length, unsigned base, NumberValue* value) {
+    uint32_t limbs[4] = {0, 0, 0, 0};
+
+    for (size_t i = 0; i < length; i++) {
+        uint64_t carry = (uint64_t)digit_value(digits[i]);
+        for (int limb = 0; limb < 4; limb++) {
+            uint64_t product = (uint64_t)limbs[limb] * base + carry;
+            limbs[limb] = (uint32_t)product;
+            carry = product >> 32;
+        }
+        if (carry != 0) {
+            return -1;
+        }
+    }
+
+    value->integer.low = (uint64_t)limbs[1] << 32 | limbs[0];
+    value->integer.high = (uint64_t)limbs[3] << 32 | limbs[2];
+    return 0;
+}
+
+static size_t count_digits(const char* text, size_t length, unsigned base) {
+    size_t i = 0;
+    while (i < length && (unsigned)digit_value(text[i]) < base) {
+        i++;
+    }
+    return i;
+}
+
+// Parses the numeric literal in text, which is the whole lexeme as produced by
+// the lexer: a decimal, 0x, 0o or 0b number with optional '_' separators, an
+// optional fraction and exponent (decimal only) and an optional type suffix.
+// Returns -1 and sets the kind to NUMBER_INVALID if the literal is malformed.
+int parse_number(const char* text, size_t length, NumberValue* value) {
+    value->kind = NUMBER_INVALID;
+    value->suffix = TYPE_NONE;
+    value->integer.low = 0;
+    value->integer.high = 0;
+
+    // Drop the separators, the first character is always a digit
+    char buffer[NUMBER_BUFFER_SIZE];
+    char* digits = length < sizeof(buffer) ? buffer : mem_alloc(length + 1);
+    if (digits == NULL) {
+        return -1;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] != '_') {
+            digits[count++] = text[i];
+        }
+    }
+    digits[count] = '\0';
+
+    unsigned base = 10;
+    size_t start = 0;
+    if (count > 2 && digits[0] == '0') {
+        switch (digits[1]) {
+            case 'x': case 'X': base = 16; start = 2; break;
+            case 'o': case 'O': base = 8; start = 2; break;
+            case 'b': case 'B': base = 2; start = 2; break;
+        }
+    }
+
+    size_t end = start + count_digits(digits + start, count - start, base);
+    int is_float = 0;
+
+    if (base == 10) {
+        // Fraction
+        if (end + 1 < count && digits[end] == '.' && digits[end + 1] >= '0' && digits[end + 1] <= '9') {
+            end = end + 1 + count_digits(digits + end + 1, count - end - 1, 10);
+            is_float = 1;
+        }
+
+        // Exponent
+        if (end < count && (digits[end] == 'e' || digits[end] == 'E')) {
+            size_t exponent = end + 1;
+            if (exponent < count && (digits[exponent] == '+' || digits[exponent] == '-')) {
+                exponent++;
+            }
+
+            size_t exponent_digits = count_digits(digits + exponent, count - exponent, 10);
+            if (exponent_digits > 0) {
+                end = exponent + exponent_digits;
+                is_float = 1;
+            }
+        }
+    }
+
+    PrimitiveType suffix;
+    int result = -1;
+    if (end > start && parse_suffix(digits + end, count - end, &suffix) == 0) {
+        int float_suffix = suffix == TYPE_F32 || suffix == TYPE_F64;
+        value->suffix = suffix;
+
+        if (is_float || float_suffix) {
+            // A fraction or exponent cannot have an integer suffix, and hex,
+            // octal and binary literals are always integers
+            if (base == 10 && (suffix == TYPE_NONE || float_suffix)) {
+                digits[end] = '\0';
+                value->kind = NUMBER_FLOAT;
+                value->real = strtod(digits, NULL);
+                result = 0;
+            }
+        } else if (parse_integer(digits + start, end - start, base, value) == 0) {
+            value->kind = NUMBER_INTEGER;
+            result = 0;
+        }
+    }
+
+    if (result != 0) {
+        value->kind = NUMBER_INVALID;
+    }
+
+    if (digits != buffer) {
+        mem_free(digits);
+    }
+    return result;
+}
+
+static void init_number_lock() {
+    mtx_init(&number_lock, mtx_plain);
+}
+
+static NumberValue* get_number(size_t index) {
+    return &number_pages[index >> NUMBER_PAGE_BITS][index & (NUMBER_PAGE_SIZE - 1)];
+}
+
+// Interns the text of a numeric literal, the value is parsed only the first
+// time a literal is seen, after that it is looked up through number_value
+// Safe to call from several threads at once. Returns SYMBOL_NONE if the
+// literal does not fit in memory.
+Symbol intern_number(const char* text, size_t length) {
+    Symbol symbol = intern_string(text, length);
+    if (symbol == SYMBOL_NONE || symbol_data(symbol) != 0) {
+        return symbol;
+    }
+
+    call_once(&number_lock_once, init_number_lock);
+    mtx_lock(&number_lock);
+
+    // Another thread may have added it in the meantime
+    if (symbol_data(symbol) != 0) {
+        mtx_unlock(&number_lock);
+        return symbol;
+    }
+
+    // The index + 1 has to fit the symbol data
+    NumberValue** page = number_count < UINT32_MAX ? &number_pages[number_count >> NUMBER_PAGE_BITS] : NULL;
+    if (page != NULL && *page == NULL) {
+        *page = mem_alloc(NUMBER_PAGE_SIZE * sizeof(NumberValue));
+    }
+    if (page == NULL || *page == NULL) {
+        mtx_unlock(&number_lock);
+        return SYMBOL_NONE;
+    }
+
+    parse_number(text, length, get_number(number_count));
+    number_count++;
+    set_symbol_data(symbol, (uint32_t)number_count);
+    mtx_unlock(&number_lock);
+    return symbol;
+}
+
+// Returns the parsed value of a literal interned by intern_number, or NULL
+// Note that a string literal with the same text shares the symbol.
+const NumberValue* number_value(Symbol symbol) {
+    uint32_t index = symbol_data(symbol);
+    if (index == 0) {
+        return NULL;
+    }
+    return get_number(index - 1);
+}
+
+const char* number_kind_to_str(NumberKind kind) {
+    switch (kind) {
+        case NUMBER_INVALID: return "Invalid";
+        case NUMBER_INTEGER: return "Integer";
+        case NUMBER_FLOAT: return "Float";
+        default: return "Invalid";
+    }
+}
+
+void free_numbers() {
+    for (size_t i = 0; i < NUMBER_PAGE_COUNT && number_pages[i] != NULL; i++) {
+        mem_free(number_pages[i]);
+        number_pages[i] = NULL;
+    }
+    number_count = 0;
+}
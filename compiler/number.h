@@ -0,0 +1,38 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include "intern.h"
+#include "lexer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Kinds of numeric literals
+typedef enum {
+    NUMBER_INVALID, // Malformed, unknown suffix or too large for 128 bits
+    NUMBER_INTEGER,
+    NUMBER_FLOAT
+} NumberKind;
+
+// Structure to hold the parsed value of a numeric literal
+// Literals never carry a sign (a minus is an operator), so integers are kept
+// as unsigned 128-bit values split into two halves.
+typedef struct {
+    NumberKind kind;
+    PrimitiveType suffix; // TYPE_NONE when the literal has no suffix
+    union {
+        struct {
+            uint64_t low;
+            uint64_t high;
+        } integer;     // NUMBER_INTEGER
+        double real;   // NUMBER_FLOAT
+    };
+} NumberValue;
+
+// Function declarations
+int parse_number(const char* text, size_t length, NumberValue* value);
+Symbol intern_number(const char* text, size_t length);
+const NumberValue* number_value(Symbol symbol);
+const char* number_kind_to_str(NumberKind kind);
+void free_numbers();
+
+#endif // NUMBER_H
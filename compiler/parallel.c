@@ -0,0 +1,75 @@
+#include "parallel.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+// Structure to hold a thread taking indices
+typedef struct {
+    ParallelTask task;
+    void* context;
+    size_t worker;
+    size_t count;
+    atomic_size_t* next;
+} ParallelWorker;
+
+static int parallel_worker(void* data) {
+    ParallelWorker* worker = data;
+    while (1) {
+        size_t index = atomic_fetch_add(worker->next, 1);
+        if (index >= worker->count) {
+            break;
+        }
+        worker->task(worker->context, worker->worker, index);
+    }
+    return 0;
+}
+
+// Runs the task for every index in [0, count) on up to jobs threads
+// Indices are handed out one at a time from a shared counter, so uneven tasks
+// balance out. The calling thread is worker 0, if a thread cannot be started
+// the others take over its share. Returns once every task has finished.
+void run_parallel(size_t count, size_t jobs, ParallelTask task, void* context) {
+    size_t thread_count = jobs < count ? jobs : count;
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            task(context, 0, i);
+        }
+        return;
+    }
+
+    ParallelWorker* workers = mem_calloc(thread_count, sizeof(ParallelWorker));
+    thrd_t* threads = mem_calloc(thread_count, sizeof(thrd_t));
+    int* started = mem_calloc(thread_count, sizeof(int));
+    if (workers == NULL || threads == NULL || started == NULL) {
+        mem_free(workers);
+        mem_free(threads);
+        mem_free(started);
+        for (size_t i = 0; i < count; i++) {
+            task(context, 0, i);
+        }
+        return;
+    }
+
+    atomic_size_t next = 0;
+    for (size_t i = 0; i < thread_count; i++) {
+        workers[i].task = task;
+        workers[i].context = context;
+        workers[i].worker = i;
+        workers[i].count = count;
+        workers[i].next = &next;
+    }
+
+    for (size_t i = 1; i < thread_count; i++) {
+        started[i] = thrd_create(&threads[i], parallel_worker, &workers[i]) == thrd_success;
+    }
+    parallel_worker(&workers[0]);
+    for (size_t i = 1; i < thread_count; i++) {
+        if (started[i]) {
+            thrd_join(threads[i], NULL);
+        }
+    }
+
+    mem_free(workers);
+    mem_free(threads);
+    mem_free(started);
+}
@@ -0,0 +1,13 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+// Work run for every index, worker identifies the thread running it (0 to
+// jobs - 1) so that tasks can keep state per thread
+typedef void (*ParallelTask)(void* context, size_t worker, size_t index);
+
+// Function declarations
+void run_parallel(size_t count, size_t jobs, ParallelTask task, void* context);
+
+#endif // PARALLEL_H
@@ -6,6 +6,9 @@
 
 #include "parser.h"
 #include "ast.h"
+#include "number.h"
+#include "parallel.h"
+#include "smallvec.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,281 +18,529 @@ typedef struct {
     char* type;
 } Parameter;
 
-Parser* create_parser(Token** tokens, size_t token_count) {
-    Parser* parser = malloc(sizeof(Parser));
-    parser->tokens = tokens;
-    parser->token_count = token_count;
+// Creates a parser for a fully lexed token stream, or returns NULL if it does
+// not fit in memory
+// A stream that ran out of memory fails to parse with that error.
+Parser* create_parser(TokenStream* stream) {
+    Parser* parser = mem_alloc(sizeof(Parser));
+    if (parser == NULL) {
+        return NULL;
+    }
+    parser->stream = stream;
+    parser->lexer = NULL;
+    parser->tokens = stream->tokens;
+    parser->token_count = stream->count;
     parser->current = 0;
+    parser->end_of_input = 1;
     parser->ast_root = NULL;
+    parser->error.has_error = 0;
+    parser->error.out_of_memory = 0;
+    parser->lazy_bodies = 0;
+    init_arena(&parser->arena, 0);
+    init_arena(&parser->scratch, 0);
+    if (stream->out_of_memory) {
+        parser->error.has_error = 1;
+        parser->error.out_of_memory = 1;
+    }
+    return parser;
+}
+
+// Creates a parser that lexes its tokens on demand, or returns NULL if it does
+// not fit in memory
+Parser* create_parser_from_lexer(Lexer* lexer) {
+    Parser* parser = mem_alloc(sizeof(Parser));
+    if (parser == NULL) {
+        return NULL;
+    }
+    parser->stream = NULL;
+    parser->lexer = lexer;
+    parser->tokens = parser->window;
+    parser->token_count = 0;
+    parser->current = 0;
+    parser->end_of_input = 0;
+    parser->ast_root = NULL;
+    parser->error.has_error = 0;
+    parser->error.out_of_memory = 0;
+    parser->lazy_bodies = 0;
+    init_arena(&parser->arena, 0);
+    init_arena(&parser->scratch, 0);
     return parser;
 }
 
 void free_parser(Parser* parser) {
     // NOTE: Tokens should be freed seperately
     // see lexer.h free_tokens function
-    free_ast_node(parser->ast_root);
-    free(parser);
+    // The whole tree lives in the arena
+    free_arena(&parser->arena);
+    free_arena(&parser->scratch);
+    mem_free(parser);
+}
+
+// Records an error at the token, or at the end of the input for NULL
+// Parsing stops at the first error: every parse function returns once one is
+// recorded, and an error raised on the way out does not replace it.
+static void fail_at(Parser* parser, const Token* token, const char* message) {
+    ParseError* failure = &parser->error;
+    if (failure->has_error) {
+        return;
+    }
+    failure->has_error = 1;
+    failure->out_of_memory = 0;
+    failure->at_end = token == NULL;
+    failure->file = token != NULL ? token->file : INVALID_FILE_ID;
+    failure->offset = token != NULL ? token->offset : 0;
+    snprintf(failure->message, sizeof(failure->message), "%s", message);
+}
+
+// Records that the tokens or the tree did not fit in memory, unless there is
+// an error already
+void fail_out_of_memory(Parser* parser) {
+    ParseError* failure = &parser->error;
+    if (failure->has_error) {
+        return;
+    }
+    failure->has_error = 1;
+    failure->out_of_memory = 1;
+}
+
+// Returns 1 once parsing has to stop
+// Nodes that did not fit in memory come back as NULL and mark the arena, that
+// is only turned into the error here, so this is checked before the nodes are
+// used.
+int parse_failed(Parser* parser) {
+    if (parser->arena.out_of_memory || parser->scratch.out_of_memory) {
+        fail_out_of_memory(parser);
+    }
+    return parser->error.has_error;
+}
+
+// Returns the token at the given index, or NULL past the end of the input
+Token* get_token(Parser* parser, size_t index) {
+    // Pull tokens from the lexer until the index is covered
+    while (index >= parser->token_count && !parser->end_of_input) {
+        Token* slot = &parser->window[parser->token_count & (PARSER_WINDOW_SIZE - 1)];
+        if (lex_next_token(parser->lexer, slot)) {
+            parser->token_count++;
+        } else {
+            parser->end_of_input = 1;
+        }
+    }
+
+    // The lexer stops early when it runs out of memory
+    if (index >= parser->token_count && parser->lexer != NULL && parser->lexer->batch.out_of_memory) {
+        fail_out_of_memory(parser);
+        return NULL;
+    }
+
+    if (index >= parser->token_count) return NULL;
+    if (parser->lexer == NULL) return &parser->tokens[index];
+
+    if (parser->token_count - index > PARSER_WINDOW_SIZE) {
+        // The token is gone, so the error points at the newest one instead
+        char message[64];
+        snprintf(message, sizeof(message), "Token %zu is no longer in the parser window", index);
+        fail_at(parser, &parser->window[(parser->token_count - 1) & (PARSER_WINDOW_SIZE - 1)], message);
+        return NULL;
+    }
+    return &parser->window[index & (PARSER_WINDOW_SIZE - 1)];
 }
 
 Token* current_token(Parser* parser) {
-    if (parser->current >= parser->token_count) return NULL;
-    return parser->tokens[parser->current];
+    return get_token(parser, parser->current);
 }
 
-void error(Parser* parser, const char* message) {
-    Token* token = current_token(parser);
-    if (token) {
+// Prints a parse error with its location
+void report_parse_error(const ParseError* error) {
+    if (error->out_of_memory) {
+        fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+    } else if (!error->at_end && error->file == INVALID_FILE_ID) {
+        fprintf(stderr, "\033[31mError: %s\n\033[0m", error->message);
+    } else if (!error->at_end) {
+        // Locations are only resolved once a diagnostic is actually reported
+        size_t line, column;
+        source_location(error->file, error->offset, &line, &column);
         fprintf(stderr, "\033[31mError: %s:%zu:%zu\n\t %s.\n\033[0m",
-                token->filename, token->line, token->column,
-                message);
+                source_filename(error->file), line, column,
+                error->message);
+    } else if (error->file != INVALID_FILE_ID) {
+        fprintf(stderr, "\033[31mError: %s: %s at end of input.\n\033[0m", source_filename(error->file), error->message);
     } else {
-        fprintf(stderr, "\033[31mError: %s at end of input.\n\033[0m", message);
+        fprintf(stderr, "\033[31mError: %s at end of input.\n\033[0m", error->message);
     }
-    exit(1);
 }
 
+void error(Parser* parser, const char* message) {
+    fail_at(parser, current_token(parser), message);
+}
+
+// Reports an error that ends with the text of the given token
+void error_with_token(Parser* parser, const char* message, Token* token) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s%.*s", message, (int)token->length, token_text(token));
+    error(parser, buffer);
+}
+
+// Returns 1 if the text of the token equals the given text
+int token_equals(Token* token, const char* text) {
+    size_t length = strlen(text);
+    return token->length == length && memcmp(token_text(token), text, length) == 0;
+}
+
+// Moves onto the next token and returns it, or records an error and returns
+// NULL at the end of the input
 Token* next_token(Parser* parser) {
-    if (parser->current + 1 >= parser->token_count) {
+    Token* token = get_token(parser, parser->current + 1);
+    if (token == NULL) {
         error(parser, "Unexpected end of input");
-    };
+        return NULL;
+    }
     parser->current++;
-    return parser->tokens[parser->current];
+    return token;
 }
 
+// Returns the next token without moving onto it, or records an error and
+// returns NULL at the end of the input
 Token* peak_token(Parser* parser) {
-    if (parser->current + 1 >= parser->token_count) {
+    Token* token = get_token(parser, parser->current + 1);
+    if (token == NULL) {
         error(parser, "Unexpected end of input");
-    };
-    return parser->tokens[parser->current + 1];
+    }
+    return token;
 }
 
-// This function parses a reference
-// Note that the function must be called PRIOR to
-// moving the parser's cursor to the identifier that marks the beginning
-// of a reference sequence.
-// A reference serves as anything that represents a declaration of a variable in response to
-// a implicit or explicit type declaration. (Thus variable assignments, return statements, param assignments, defer statements, etc.)
-ASTNode* parse_reference(Parser* parser, int is_tracking_function_args) {
-    ASTNode* buffer = NULL;
-    char* last_ref_name = NULL;
-
-    while (1) {
-        Token* next = next_token(parser);
-
-        if (is_tracking_function_args == 1) {
-            if (next->type == T_COMMA || next->type == T_R_PAREN) {
-                return buffer;
-            }
+// Creates the literal node for a number or string token
+// Numbers were already parsed by the lexer, malformed ones are reported here.
+ASTNode* parse_literal(Parser* parser, Token* token) {
+    if (token->type == T_NUMBER) {
+        const NumberValue* number = number_value(token->symbol);
+        if (number == NULL || number->kind == NUMBER_INVALID) {
+            error_with_token(parser, "Invalid number literal ", token);
+            return NULL;
         }
+        return create_literal_node(&parser->arena, LITERAL_NUMBER, token->symbol);
+    }
 
-        // If the next token is a ; we know we are done processing
-        if (next->type == T_L_PAREN) {
-            ASTNode** args = NULL;
-            size_t arg_count = 0;
+    return create_literal_node(&parser->arena, LITERAL_STRING, token->symbol);
+}
 
-            while (1) {
-                Token* next = peak_token(parser);
-                if (peak_token(parser)->type == T_COMMA) {
-                    parser->current++;
-                    continue;
-                } else {
-                    // Parse the argument
-                    ASTNode* arg = parse_reference(parser, 1);
-                    args = realloc(args, sizeof(ASTNode*) * (arg_count + 1));
-                    if (args == NULL) {
-                        error(parser, "Out of memory");
-                    }
 
-                    args[arg_count] = arg;
-                    arg_count++;
+// Binary operators, in the token they are written as, with their precedence
+// Higher binds tighter, every level is left associative.
+typedef struct {
+    TokenType type;
+    const char* text; // Only checked for T_OPERATOR tokens
+    BinaryOperator op;
+    int precedence;
+} BinaryOperatorInfo;
+
+static const BinaryOperatorInfo binary_operators[] = {
+    {T_OPERATOR, "||", BIN_OR, 1},
+    {T_OPERATOR, "&&", BIN_AND, 2},
+    {T_EQUAL_SIGN, NULL, BIN_EQ, 3},
+    {T_NOT_EQUAL_SIGN, NULL, BIN_NEQ, 3},
+    {T_L_ANGLE_BRACKET, NULL, BIN_LT, 4},
+    {T_R_ANGLE_BRACKET, NULL, BIN_GT, 4},
+    {T_OPERATOR, "<=", BIN_LE, 4},
+    {T_OPERATOR, ">=", BIN_GE, 4},
+    {T_OPERATOR, "+", BIN_ADD, 5},
+    {T_OPERATOR, "-", BIN_SUB, 5},
+    {T_OPERATOR, "*", BIN_MUL, 6},
+    {T_OPERATOR, "/", BIN_DIV, 6},
+    {T_OPERATOR, "%", BIN_MOD, 6},
+};
+
+// Returns the precedence of the binary operator the token stands for, or 0
+// if it is not one
+static int binary_precedence(Token* token, BinaryOperator* op) {
+    for (size_t i = 0; i < sizeof(binary_operators) / sizeof(binary_operators[0]); i++) {
+        const BinaryOperatorInfo* info = &binary_operators[i];
+        if (token->type == info->type && (info->text == NULL || token_equals(token, info->text))) {
+            *op = info->op;
+            return info->precedence;
+        }
+    }
+    return 0;
+}
 
-                    // Check current token
-                    if (current_token(parser)->type == T_R_PAREN) {
-                        // We don't skip past the current token ) because the next iteration of
-                        // the loop in will get the next_token
-                        break;
-                    }
-                }
-            }
+ASTNode* parse_reference(Parser* parser, int is_tracking_function_args);
+static ASTNode* parse_expression(Parser* parser, int min_precedence);
 
-            if (buffer == NULL) {
-                buffer = create_function_call_node(last_ref_name, args, arg_count);
-            } else {
-                ASTNode* current = buffer; // Create a temporary buffer
-                while (current->reference.child != NULL) {
-                    current = current->reference.child;
+// Parses the arguments of a call, the cursor is on the '(' and is left on the ')'
+static void parse_arguments(Parser* parser, ASTNode*** args, size_t* arg_count) {
+    SmallVec list;
+    init_scratch_vec(&list, sizeof(ASTNode*), &parser->scratch);
 
-                    // If the current child is NULL we need to add the new child to the current child
-                    if (current == NULL) {
-                        current->reference.child = create_function_call_node(last_ref_name, args, arg_count);
-                        break;
-                    }
-                }
+    Token* next = peak_token(parser);
+    if (next == NULL) {
+        return;
+    }
+    if (next->type == T_R_PAREN) {
+        parser->current++;
+    } else {
+        while (1) {
+            ASTNode* arg = parse_reference(parser, 1);
+            if (parse_failed(parser)) {
+                return;
             }
-        } else if (next->type == T_DOT) {
-            continue;
-        } else if (next->type == T_IDENTIFIER) {
-            if (buffer == NULL) {
-                buffer = create_reference_node(next->value);
-                last_ref_name = next->value;
-            } else {
-                // We know for a matter of fact that this is a reference to some earlier reference
-                ASTNode* current = buffer; // Create a temporary buffer
-                while (current->reference.child != NULL) {
-                    current = current->reference.child;
-
-                    // If the current child is NULL we need to add the new child to the current child
-                    if (current == NULL) {
-                        current->reference.child = create_reference_node(next->value);
-                        last_ref_name = next->value;
-                        break;
-                    }
-                }
+            if (small_vec_push(&list, &arg) != 0) {
+                fail_out_of_memory(parser);
+                return;
             }
-        } else if (next->type == T_HASH_SIGN) {
-            // This is an array reference
-            Token* index = next_token(parser);
-            if (index->type != T_NUMBER) {
-                error(parser, "Expected number after '#' in array reference");
+
+            // parse_reference stops on the ',' or ')' that ended the argument
+            if (current_token(parser)->type == T_R_PAREN) {
+                break;
             }
+        }
+    }
 
-            ASTNode* index_value_node = create_literal_node(index->value);
+    *arg_count = list.count;
+    *args = small_vec_finish(&list, &parser->arena);
+}
 
-            if (buffer == NULL) {
-                // Since the buffer is still NULL this must be the first reference
-                // thus ref_name is the name of the array
-                buffer = create_array_access_node(last_ref_name, index_value_node);
-            } else {
-                // In this case the array is the child of some other reference
-                ASTNode* current = buffer; // Create a temporary buffer
-                while (current->reference.child != NULL) {
-                    current = current->reference.child;
-                    if (current == NULL) {
-                        // We must deal with double array access (some_array#1#0)
-                        // However, AST_ARRAY_ACCESS has a child field so we
-                        // can add the anonymous array access to that as a child
-                        // In other cases where this for instance would be a struct we just add
-                        // this to a actual reference node
-                        buffer->reference.child = create_array_access_node(last_ref_name, index_value_node);
-                        break;
-                    }
-                }
+// Parses an array initializer [1, 2, 3], the cursor is on the '['
+static ASTNode* parse_literal_array(Parser* parser) {
+    SmallVec array_values;
+    init_scratch_vec(&array_values, sizeof(ASTNode*), &parser->scratch);
+
+    while (1) {
+        Token* array_value = next_token(parser);
+        if (array_value == NULL) {
+            return NULL;
+        }
+        if (array_value->type == T_NUMBER || array_value->type == T_STRING) {
+            ASTNode* literal = parse_literal(parser, array_value);
+            if (parse_failed(parser)) {
+                return NULL;
             }
+            if (small_vec_push(&array_values, &literal) != 0) {
+                fail_out_of_memory(parser);
+                return NULL;
+            }
+        } else if (array_value->type == T_COMMA) {
+            continue;
+        } else if (array_value->type == T_R_BRACKET) {
+            break;
+        } else {
+            error_with_token(parser, "Expected number or ']' in array initializer, got ", array_value);
+            return NULL;
         }
-        else if (next->type == T_OPERATOR) {
-            // Handle binary operation
-            char* operator = next->value;
+    }
 
-            // Parse the right-hand side reference
-            ASTNode* right = parse_reference(parser, 0);
-            if (right == NULL) {
-                error(parser, "Expected a valid right-hand side after operator");
-            }
+    size_t array_value_count = array_values.count;
+    ASTNode** values = small_vec_finish(&array_values, &parser->arena);
+    return create_literal_array_node(&parser->arena, values, array_value_count);
+}
 
-            // Create a binary operation node
-            ASTNode* binary_op = create_binary_op_node(str_to_binary_op(operator), buffer, right);
-            // We return here, partly because the parsing of the right hand sided already caused
-            // the cursor to move to the ;
+// Parses a chain such as std.iostream.println(x) or some_array#1#0, the cursor is
+// on the first identifier
+// Every element becomes the child of the one before it. The chain is built
+// through a pointer to the child slot of its last element, so appending is
+// constant time no matter how long the chain gets.
+static ASTNode* parse_reference_chain(Parser* parser) {
+    ASTNode* head = NULL;
+    ASTNode** tail = &head;
 
-            // Compensate for the cursor
-            parser->current--;
-            buffer = binary_op;
+    while (1) {
+        Token* name_token = current_token(parser);
+        if (name_token == NULL) {
+            error(parser, "Unexpected end of input");
+            return NULL;
+        }
+        if (name_token->type != T_IDENTIFIER) {
+            error_with_token(parser, "Expected identifier in reference, got ", name_token);
+            return NULL;
+        }
+        Symbol name = name_token->symbol;
 
-            // return binary_op;
+        Token* next = peak_token(parser);
+        if (next == NULL) {
+            return NULL;
         }
-        else if (next->type == T_NUMBER || next->type == T_STRING) {
-            // This is a literal
-            ASTNode* literal = create_literal_node(next->value);
-            if (buffer == NULL) {
-                buffer = literal;
-            } else {
-                ASTNode* current = buffer; // Create a temporary buffer
-                while (current->reference.child != NULL) {
-                    current = current->reference.child;
+        if (next->type == T_L_PAREN) {
+            // A call ends the chain, its result has no members to refer to
+            parser->current++;
+            ASTNode** args = NULL;
+            size_t arg_count = 0;
+            parse_arguments(parser, &args, &arg_count);
+            if (parse_failed(parser)) {
+                return NULL;
+            }
+            *tail = create_function_call_node(&parser->arena, name, args, arg_count);
+            return head;
+        } else if (next->type == T_HASH_SIGN) {
+            // Array access, repeated for nested arrays (some_array#1#0)
+            while ((next = peak_token(parser)) != NULL && next->type == T_HASH_SIGN) {
+                parser->current++;
+                Token* index = next_token(parser);
+                if (index == NULL) {
+                    return NULL;
+                }
+                if (index->type != T_NUMBER) {
+                    error(parser, "Expected number after '#' in array reference");
+                    return NULL;
+                }
 
-                    // If the current child is NULL we need to add the new child to the current child
-                    if (current == NULL) {
-                        current->reference.child = literal;
-                        break;
-                    }
+                ASTNode* literal = parse_literal(parser, index);
+                if (parse_failed(parser)) {
+                    return NULL;
+                }
+                ASTNode* array_access = create_array_access_node(&parser->arena, name, literal);
+                if (array_access == NULL) {
+                    fail_out_of_memory(parser);
+                    return NULL;
                 }
+                *tail = array_access;
+                tail = &array_access->array_access.child;
             }
+        } else {
+            ASTNode* reference = create_reference_node(&parser->arena, name);
+            if (reference == NULL) {
+                fail_out_of_memory(parser);
+                return NULL;
+            }
+            *tail = reference;
+            tail = &reference->reference.child;
         }
-        else if (next->type == T_L_BRACKET) {
-            // This is an array initializer [1, 2, 3], NOT a type definition
-            ASTNode** array_values = NULL;
-            size_t array_value_count = 0;
 
-            while (1) {
-                Token* array_value = next_token(parser);
-                if (array_value->type == T_NUMBER || array_value->type == T_STRING) {
-                    array_values = realloc(array_values, sizeof(ASTNode*) * (array_value_count + 1));
-                    if (array_values == NULL) {
-                        error(parser, "Out of memory");
-                    }
+        next = peak_token(parser);
+        if (next == NULL) {
+            return NULL;
+        }
+        if (next->type != T_DOT) {
+            return head;
+        }
 
-                    array_values[array_value_count] = create_literal_node(array_value->value);
-                    array_value_count++;
-                } else if (array_value->type == T_COMMA) {
-                    continue;
-                } else if (array_value->type == T_R_BRACKET) {
-                    break;
-                } else {
-                    printf("Token type: %s\n", parser->tokens[parser->current]->value);
-                    error(parser, "Expected number or ']' in array initializer");
-                }
-            }
+        // Skip past the '.' onto the next identifier
+        parser->current += 2;
+    }
+}
 
-            ASTNode* literal_array = create_literal_array_node(array_values, array_value_count);
-            if (buffer == NULL) {
-                buffer = literal_array;
-            } else {
-                ASTNode* current = buffer; // Create a temporary buffer
-                while (current->reference.child != NULL) {
-                    current = current->reference.child;
+// Parses an operand with its prefix operators, the cursor is moved onto its
+// first token and left on its last
+static ASTNode* parse_unary(Parser* parser) {
+    Token* token = next_token(parser);
+    if (token == NULL) {
+        return NULL;
+    }
 
-                    // If the current child is NULL we need to add the new child to the current child
-                    if (current == NULL) {
-                        current->reference.child = literal_array;
-                        break;
-                    }
-                }
-            }
+    if ((token->type == T_OPERATOR && token_equals(token, "-")) || token->type == T_EXCLAMATION_MARK) {
+        UnaryOperator op = token->type == T_EXCLAMATION_MARK ? UNARY_NOT : UNARY_NEGATE;
+        ASTNode* operand = parse_unary(parser);
+        if (parse_failed(parser)) {
+            return NULL;
         }
-        else if (next->type == T_SEMICOLON) {
-            if (buffer == NULL) {
-                error(parser, "A reference or function call is missing");
-            }
-            return buffer;
-        } else {
-            char* message = malloc(strlen("Unexpected token in reference, got ") + strlen(next->value) + 1);
-            if (message == NULL) {
-                error(parser, "Out of memory");
-            }
-            sprintf(message, "Unexpected token in reference, got %s", next->value);
-            error(parser, message);
+        return create_unary_op_node(&parser->arena, op, operand);
+    } else if (token->type == T_NUMBER || token->type == T_STRING) {
+        return parse_literal(parser, token);
+    } else if (token->type == T_IDENTIFIER) {
+        return parse_reference_chain(parser);
+    } else if (token->type == T_L_BRACKET) {
+        return parse_literal_array(parser);
+    } else if (token->type == T_L_PAREN) {
+        ASTNode* expression = parse_expression(parser, 1);
+        if (parse_failed(parser)) {
+            return NULL;
         }
+        Token* close = next_token(parser);
+        if (close == NULL || close->type != T_R_PAREN) {
+            error(parser, "Expected ')' after expression");
+            return NULL;
+        }
+        return expression;
+    } else if (token->type == T_SEMICOLON) {
+        error(parser, "A reference or function call is missing");
+        return NULL;
     }
 
+    error_with_token(parser, "Unexpected token in reference, got ", token);
     return NULL;
 }
 
-void parse_ast_body(Parser* parser, ASTNode*** body_statements, size_t* body_stmt_count) {
+// Parses a binary expression by precedence climbing
+// Operators at the same level are folded into the left operand in a loop, so
+// long chains such as a + b + c + ... are parsed in linear time and only
+// recurse once per precedence level.
+static ASTNode* parse_expression(Parser* parser, int min_precedence) {
+    ASTNode* left = parse_unary(parser);
+
+    while (!parse_failed(parser)) {
+        Token* next = peak_token(parser);
+        if (next == NULL) {
+            return NULL;
+        }
+
+        BinaryOperator op;
+        int precedence = binary_precedence(next, &op);
+        if (precedence == 0 || precedence < min_precedence) {
+            return left;
+        }
+
+        parser->current++;
+        ASTNode* right = parse_expression(parser, precedence + 1);
+        left = create_binary_op_node(&parser->arena, op, left, right);
+    }
+    return NULL;
+}
+
+// Note that the function must be called PRIOR to
+// moving the parser's cursor to the first token of the expression.
+// A reference serves as anything that represents a declaration of a variable in response to
+// a implicit or explicit type declaration. (Thus variable assignments, return statements, param assignments, defer statements, etc.)
+// The cursor is left on the ';' that ends it, or on the ',' or ')' when parsing
+// function arguments.
+ASTNode* parse_reference(Parser* parser, int is_tracking_function_args) {
+    ASTNode* expression = parse_expression(parser, 1);
+    if (parse_failed(parser)) {
+        return NULL;
+    }
+
+    Token* end = next_token(parser);
+    if (end == NULL) {
+        return NULL;
+    }
+    if (is_tracking_function_args == 1) {
+        if (end->type != T_COMMA && end->type != T_R_PAREN) {
+            error_with_token(parser, "Expected ',' or ')' after argument, got ", end);
+            return NULL;
+        }
+    } else if (end->type != T_SEMICOLON) {
+        error_with_token(parser, "Unexpected token in reference, got ", end);
+        return NULL;
+    }
+
+    return expression;
+}
+
+// Appends a statement to the body that is being parsed
+static void add_statement(Parser* parser, SmallVec* statements, ASTNode* statement) {
+    if (small_vec_push(statements, &statement) != 0) {
+        fail_out_of_memory(parser);
+    }
+}
+
+// Parses the statements of a body into the list, the cursor is on the '{'
+void parse_ast_body(Parser* parser, SmallVec* body_statements) {
     // Move past '{'
     parser->current++;
 
-    while (1) {
+    while (!parse_failed(parser)) {
         Token* token = current_token(parser);
+        if (token == NULL) {
+            error(parser, "Expected '}' to close the body");
+            return;
+        }
         if (token->type == T_R_BRACE) {
             break;
         }
 
         if (token->type == T_KEYWORD) {
-            if (strcmp(token->value, "if") == 0) {
+            if (token->keyword == KW_IF) {
                 // Has to be followed by a brace
                 Token* open_brace = next_token(parser);
-                if (open_brace->type != T_L_PAREN) {
+                if (open_brace == NULL || open_brace->type != T_L_PAREN) {
                     error(parser, "Expected '(' after if keyword");
+                    return;
                 }
 
                 // TODO: Read the condition
@@ -297,25 +548,31 @@ void parse_ast_body(Parser* parser, ASTNode*** body_statements, size_t* body_stm
                 // DEBUG: This is a temporary solution
                 while (1) {
                     Token* next = next_token(parser);
+                    if (next == NULL) {
+                        return;
+                    }
                     if (next->type == T_R_PAREN) {
                         break;
                     }
                 }
 
                 Token* open_body_brace = next_token(parser);
-                if (open_body_brace->type != T_L_BRACE) {
+                if (open_body_brace == NULL || open_body_brace->type != T_L_BRACE) {
                     error(parser, "Expected '{' after elif condition");
+                    return;
                 }
 
-                ASTNode** if_body_statements = NULL;
-                size_t if_body_stmt_count = 0;
-
-                parse_ast_body(parser, &if_body_statements, &if_body_stmt_count);
-            } else if (strcmp(token->value, "elif") == 0) {
+                // TODO: Keep the body once conditions are parsed
+                SmallVec if_body_statements;
+                init_scratch_vec(&if_body_statements, sizeof(ASTNode*), &parser->scratch);
+                parse_ast_body(parser, &if_body_statements);
+                free_small_vec(&if_body_statements);
+            } else if (token->keyword == KW_ELIF) {
                 // Has to be followed by a brace
                 Token* open_brace = next_token(parser);
-                if (open_brace->type != T_L_PAREN) {
+                if (open_brace == NULL || open_brace->type != T_L_PAREN) {
                     error(parser, "Expected '(' after elif keyword");
+                    return;
                 }
 
                 // TODO: Read the condition
@@ -323,198 +580,192 @@ void parse_ast_body(Parser* parser, ASTNode*** body_statements, size_t* body_stm
                 // DEBUG: This is a temporary solution
                 while (1) {
                     Token* next = next_token(parser);
+                    if (next == NULL) {
+                        return;
+                    }
                     if (next->type == T_R_PAREN) {
                         break;
                     }
                 }
 
                 Token* open_body_brace = next_token(parser);
-                if (open_body_brace->type != T_L_BRACE) {
+                if (open_body_brace == NULL || open_body_brace->type != T_L_BRACE) {
                     error(parser, "Expected '{' after elif condition");
+                    return;
                 }
 
-                ASTNode** elif_body_statements = NULL;
-                size_t elif_body_stmt_count = 0;
-
-                parse_ast_body(parser, &elif_body_statements, &elif_body_stmt_count);
-            } else if (strcmp(token->value, "else") == 0) {
+                // TODO: Keep the body once conditions are parsed
+                SmallVec elif_body_statements;
+                init_scratch_vec(&elif_body_statements, sizeof(ASTNode*), &parser->scratch);
+                parse_ast_body(parser, &elif_body_statements);
+                free_small_vec(&elif_body_statements);
+            } else if (token->keyword == KW_ELSE) {
                 // Has to be followed by a brace
                 Token* open_brace = next_token(parser);
-                if (open_brace->type != T_L_BRACE) {
+                if (open_brace == NULL || open_brace->type != T_L_BRACE) {
                     error(parser, "Expected '{' after else keyword");
+                    return;
                 }
 
                 Token* open_body_brace = next_token(parser);
-                if (open_body_brace->type != T_L_BRACE) {
+                if (open_body_brace == NULL || open_body_brace->type != T_L_BRACE) {
                     error(parser, "Expected '{' after elif condition");
+                    return;
                 }
 
-                ASTNode** else_body_statements = NULL;
-                size_t else_body_stmt_count = 0;
-
-                parse_ast_body(parser, &else_body_statements, &else_body_stmt_count);
-            } else if (strcmp(token->value, "return") == 0) {
+                // TODO: Keep the body once conditions are parsed
+                SmallVec else_body_statements;
+                init_scratch_vec(&else_body_statements, sizeof(ASTNode*), &parser->scratch);
+                parse_ast_body(parser, &else_body_statements);
+                free_small_vec(&else_body_statements);
+            } else if (token->keyword == KW_RETURN) {
                 ASTNode* ref = parse_reference(parser, 0);
-                ASTNode* return_node = create_return_node(ref);
-
-                *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                if (*body_statements == NULL) {
-                    error(parser, "Out of memory");
+                if (parse_failed(parser)) {
+                    return;
                 }
+                ASTNode* return_node = create_return_node(&parser->arena, ref);
 
-                (*body_statements)[*body_stmt_count] = return_node;
-                (*body_stmt_count)++;
-            } else if (strcmp(token->value, "defer") == 0) {
-                printf("Defer\n");
+                add_statement(parser, body_statements, return_node);
+            } else if (token->keyword == KW_DEFER) {
                 ASTNode* ref = parse_reference(parser, 0);
-                ASTNode* return_node = create_defer_node(ref);
-
-                *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                if (*body_statements == NULL) {
-                    error(parser, "Out of memory");
+                if (parse_failed(parser)) {
+                    return;
                 }
+                ASTNode* return_node = create_defer_node(&parser->arena, ref);
 
-                (*body_statements)[*body_stmt_count] = return_node;
-                (*body_stmt_count)++;
+                add_statement(parser, body_statements, return_node);
             } else {
                 error(parser, "Unexpected keyword in function body");
+                return;
             }
         } else if (token->type == T_TYPE || token->type == T_POINTER_TYPE) {
             // If this is the type then the next is the name
             Token* next = next_token(parser);
-            if (next->type != T_IDENTIFIER) {
+            if (next == NULL || next->type != T_IDENTIFIER) {
                 error(parser, "Expected identifier after type declaration");
+                return;
             }
 
+            // Copy the symbols out, the tokens may not outlive the reference
+            Symbol name = next->symbol;
+            Symbol type = token->symbol;
+
             // Then the next has to be either a semicolon or an equal sign
             Token* equal_or_semicolon = next_token(parser);
-            if (equal_or_semicolon->type == T_OPERATOR && strcmp(equal_or_semicolon->value, "=") == 0) {
+            if (equal_or_semicolon == NULL) {
+                return;
+            }
+            if (equal_or_semicolon->type == T_OPERATOR && token_equals(equal_or_semicolon, "=")) {
                 ASTNode* ref = parse_reference(parser, 0);
                 if (ref == NULL) {
                     error(parser, "Expected reference after type declaration");
+                    return;
                 }
-                ASTNode* variable_def = create_variable_def_node(next->value, token->value, ref);
-
-                *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                if (*body_statements == NULL) {
-                    error(parser, "Out of memory");
-                }
+                ASTNode* variable_def = create_variable_def_node(&parser->arena, name, type, ref);
 
-                // Then we add the variable def to the body
-                (*body_statements)[*body_stmt_count] = variable_def;
-                (*body_stmt_count)++;
+                add_statement(parser, body_statements, variable_def);
             } else if (equal_or_semicolon->type == T_SEMICOLON) {
                 // This is just a type declaration
-                ASTNode* type_decl = create_type_decl_node(next->value, token->value);
+                ASTNode* type_decl = create_type_decl_node(&parser->arena, name, type);
 
-                *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                if (*body_statements == NULL) {
-                    error(parser, "Out of memory");
-                }
-
-                // Then we add the variable def to the body
-                (*body_statements)[*body_stmt_count] = type_decl;
-                (*body_stmt_count)++;
+                add_statement(parser, body_statements, type_decl);
             } else {
                 error(parser, "Expected ';' or '=' after type declaration");
+                return;
             }
 
             // At this point we should have handled the entire type declaration
-            if (current_token(parser)->type != T_SEMICOLON) {
+            Token* end = current_token(parser);
+            if (end == NULL || end->type != T_SEMICOLON) {
                 error(parser, "Expected ';' after type declaration");
+                return;
             }
 
         } else if (token->type == T_L_BRACKET) {
             // If this is the type then the next is the name
             Token* arr_type = next_token(parser);
-            if (arr_type->type != T_TYPE && arr_type->type != T_POINTER_TYPE) {
+            if (arr_type == NULL || (arr_type->type != T_TYPE && arr_type->type != T_POINTER_TYPE)) {
                 error(parser, "Expected identifier after type declaration");
+                return;
             }
 
             Token* close_bracket = next_token(parser);
-            if (close_bracket->type != T_R_BRACKET) {
+            if (close_bracket == NULL || close_bracket->type != T_R_BRACKET) {
                 error(parser, "Expected ']' after array type declaration");
+                return;
             }
 
             Token* next = next_token(parser);
-            if (next->type != T_IDENTIFIER) {
+            if (next == NULL || next->type != T_IDENTIFIER) {
                 error(parser, "Expected identifier after type declaration");
+                return;
             }
 
+            // Copy the symbols out, the tokens may not outlive the reference
+            Symbol name = next->symbol;
+            Symbol type = arr_type->symbol;
+
             // Then the next has to be either a semicolon or an equal sign
             Token* equal_or_semicolon = next_token(parser);
-            if (equal_or_semicolon->type == T_OPERATOR && strcmp(equal_or_semicolon->value, "=") == 0) {
+            if (equal_or_semicolon == NULL) {
+                return;
+            }
+            if (equal_or_semicolon->type == T_OPERATOR && token_equals(equal_or_semicolon, "=")) {
                 // The next one would be some reference
                 ASTNode* ref = parse_reference(parser, 0);
-                ASTNode* variable_def = create_array_def_node(next->value, token->value, ref);
-
-                *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                if (*body_statements == NULL) {
-                    error(parser, "Out of memory");
+                if (parse_failed(parser)) {
+                    return;
                 }
+                ASTNode* variable_def = create_array_def_node(&parser->arena, name, type, ref);
 
-                // Then we add the variable def to the body
-                (*body_statements)[*body_stmt_count] = variable_def;
-                (*body_stmt_count)++;
+                add_statement(parser, body_statements, variable_def);
             } else if (equal_or_semicolon->type == T_SEMICOLON) {
                 // This is just a type declaration
-                ASTNode* type_decl = create_type_decl_node(next->value, token->value);
-
-                *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                if (*body_statements == NULL) {
-                    error(parser, "Out of memory");
-                }
+                ASTNode* type_decl = create_type_decl_node(&parser->arena, name, type);
 
-                // Then we add the variable def to the body
-                (*body_statements)[*body_stmt_count] = type_decl;
-                (*body_stmt_count)++;
+                add_statement(parser, body_statements, type_decl);
             }
         } else if (token->type == T_IDENTIFIER) {
             // If it is an identifier followed by an identifier we know that hte first one is a type
             // otherwise it would be an assignment
+            Symbol first = token->symbol;
             Token* identifier_or_assign = next_token(parser);
+            if (identifier_or_assign == NULL) {
+                return;
+            }
             if (identifier_or_assign->type == T_IDENTIFIER) {
+                // Copy the symbol out, the token may not outlive the reference
+                Symbol name = identifier_or_assign->symbol;
+
                 // Then the next has to be either a semicolon or an equal sign
                 Token* equal_or_semicolon = next_token(parser);
-                if (equal_or_semicolon->type == T_OPERATOR && strcmp(equal_or_semicolon->value, "=") == 0) {
+                if (equal_or_semicolon == NULL) {
+                    return;
+                }
+                if (equal_or_semicolon->type == T_OPERATOR && token_equals(equal_or_semicolon, "=")) {
                     // The next one would be some reference
                     ASTNode* ref = parse_reference(parser, 0);
-                    ASTNode* variable_def = create_variable_def_node(token->value, token->value, ref);
-
-                    *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                    if (*body_statements == NULL) {
-                        error(parser, "Out of memory");
+                    if (parse_failed(parser)) {
+                        return;
                     }
+                    ASTNode* variable_def = create_variable_def_node(&parser->arena, name, first, ref);
 
-                    // Then we add the variable def to the body
-                    (*body_statements)[*body_stmt_count] = variable_def;
-                    (*body_stmt_count)++;
+                    add_statement(parser, body_statements, variable_def);
                 } else if (equal_or_semicolon->type == T_SEMICOLON) {
                     // This is just a type declaration
-                    ASTNode* type_decl = create_type_decl_node(token->value, token->value);
-
-                    *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                    if (*body_statements == NULL) {
-                        error(parser, "Out of memory");
-                    }
+                    ASTNode* type_decl = create_type_decl_node(&parser->arena, name, first);
 
-                    // Then we add the variable def to the body
-                    (*body_statements)[*body_stmt_count] = type_decl;
-                    (*body_stmt_count)++;
+                    add_statement(parser, body_statements, type_decl);
                 }
-            } else if (identifier_or_assign->type == T_OPERATOR && strcmp(identifier_or_assign->value, "=") == 0) {
+            } else if (identifier_or_assign->type == T_OPERATOR && token_equals(identifier_or_assign, "=")) {
                 // This is a variable assignment
                 ASTNode* ref = parse_reference(parser, 0);
-                ASTNode* variable_assignment = create_variable_assignment_node(token->value, ref);
-
-                *body_statements = realloc(*body_statements, sizeof(ASTNode*) * (*body_stmt_count + 1));
-                if (*body_statements == NULL) {
-                    error(parser, "Out of memory");
+                if (parse_failed(parser)) {
+                    return;
                 }
+                ASTNode* variable_assignment = create_variable_assignment_node(&parser->arena, first, ref);
 
-                // Then we add the variable def to the body
-                (*body_statements)[*body_stmt_count] = variable_assignment;
-                (*body_stmt_count)++;
+                add_statement(parser, body_statements, variable_assignment);
             }
         } else if (token->type == T_ANNOTATION) {
             // TODO: Annotate something that is relevant for the next token
@@ -526,94 +777,428 @@ void parse_ast_body(Parser* parser, ASTNode*** body_statements, size_t* body_stm
 }
 
 
+// Parses a body into a block, the cursor is on the '{' and is left on the '}'
+static ASTNode* parse_block(Parser* parser) {
+    SmallVec body_statements;
+    init_scratch_vec(&body_statements, sizeof(ASTNode*), &parser->scratch);
+    parse_ast_body(parser, &body_statements);
+    if (parse_failed(parser)) {
+        return NULL;
+    }
+
+    size_t body_stmt_count = body_statements.count;
+    return create_block_node(&parser->arena, small_vec_finish(&body_statements, &parser->arena), body_stmt_count);
+}
+
+// Moves the cursor from the '{' of a body onto the '}' that closes it
+static void skip_body(Parser* parser) {
+    size_t depth = 0;
+    while (1) {
+        Token* token = current_token(parser);
+        if (token == NULL) {
+            error(parser, "Expected '}' to close the body");
+            return;
+        }
+
+        if (token->type == T_L_BRACE) {
+            depth++;
+        } else if (token->type == T_R_BRACE && --depth == 0) {
+            return;
+        }
+        parser->current++;
+    }
+}
+
+// Parses the body of a function that was skimmed, see Parser.lazy_bodies
+// Returns the body, functions that already have one are left as they are. On
+// an error the function keeps no body and NULL is returned.
+ASTNode* parse_function_body(Parser* parser, ASTNode* function) {
+    if (function->function_def.body != NULL || function->function_def.body_end == 0) {
+        return function->function_def.body;
+    }
+
+    // The body may be anywhere in the stream, the cursor is put back afterwards
+    size_t current = parser->current;
+    size_t token_count = parser->token_count;
+    parser->current = function->function_def.body_start;
+    parser->token_count = function->function_def.body_end + 1;
+
+    ArenaMark scratch = arena_mark(&parser->scratch);
+    function->function_def.body = parse_block(parser);
+    arena_rewind(&parser->scratch, scratch);
+
+    parser->current = current;
+    parser->token_count = token_count;
+    return function->function_def.body;
+}
+
+// Symbols are handed out in order, so they are spread over the slots by a
+// multiplicative hash
+static size_t function_slot(Symbol name, size_t slot_count) {
+    return (size_t)(name * 2654435761u) & (slot_count - 1);
+}
+
+// Fills the table with the function definitions among the top-level items
+// The slots come from the arena, at least twice as many as there are functions,
+// so the table scales with the module and not with every name ever interned.
+// Returns -1 if they do not fit in memory, the table is empty then.
+int init_function_table(FunctionTable* table, ASTNode* root, Arena* arena) {
+    size_t function_count = 0;
+    for (size_t i = 0; root != NULL && i < root->block.statement_count; i++) {
+        function_count += root->block.statements[i]->type == AST_FUNCTION_DEF;
+    }
+
+    table->slot_count = 1;
+    while (table->slot_count < function_count * 2) {
+        table->slot_count *= 2;
+    }
+    table->slots = arena_alloc(arena, table->slot_count * sizeof(ASTNode*));
+    if (table->slots == NULL) {
+        table->slot_count = 0;
+        return -1;
+    }
+    memset(table->slots, 0, table->slot_count * sizeof(ASTNode*));
+
+    for (size_t i = 0; root != NULL && i < root->block.statement_count; i++) {
+        ASTNode* statement = root->block.statements[i];
+        if (statement->type != AST_FUNCTION_DEF) {
+            continue;
+        }
+
+        size_t slot = function_slot(statement->function_def.name, table->slot_count);
+        while (table->slots[slot] != NULL && table->slots[slot]->function_def.name != statement->function_def.name) {
+            slot = (slot + 1) & (table->slot_count - 1);
+        }
+        table->slots[slot] = statement;
+    }
+    return 0;
+}
+
+// Returns the function definition with the name, or NULL if there is none
+ASTNode* find_function(const FunctionTable* table, Symbol name) {
+    if (table->slot_count == 0) {
+        return NULL;
+    }
+    size_t slot = function_slot(name, table->slot_count);
+    while (table->slots[slot] != NULL) {
+        if (table->slots[slot]->function_def.name == name) {
+            return table->slots[slot];
+        }
+        slot = (slot + 1) & (table->slot_count - 1);
+    }
+    return NULL;
+}
+
+// Adds the functions called anywhere in the subtree to the worklist
+static void find_calls(Parser* parser, ASTNode* node, const FunctionTable* functions, SmallVec* worklist) {
+    if (node == NULL) {
+        return;
+    }
+
+    switch (node->type) {
+        case AST_FUNCTION_CALL: {
+            ASTNode* callee = find_function(functions, node->function_call.name);
+            if (callee != NULL && callee->function_def.body == NULL && small_vec_push(worklist, &callee) != 0) {
+                fail_out_of_memory(parser);
+            }
+            for (size_t i = 0; i < node->function_call.arg_count; i++) {
+                find_calls(parser, node->function_call.args[i], functions, worklist);
+            }
+            break;
+        }
+        case AST_VARIABLE_DEF:
+        case AST_ARRAY_DEF:
+            find_calls(parser, node->variable_def.initializer, functions, worklist);
+            break;
+        case AST_VARIABLE_ASSIGNMENT:
+            find_calls(parser, node->variable_assignment.value, functions, worklist);
+            break;
+        case AST_ASSIGNMENT:
+            find_calls(parser, node->assignment.value, functions, worklist);
+            break;
+        case AST_REFERENCE:
+            find_calls(parser, node->reference.child, functions, worklist);
+            break;
+        case AST_BINARY_OP:
+            find_calls(parser, node->binary_op.left, functions, worklist);
+            find_calls(parser, node->binary_op.right, functions, worklist);
+            break;
+        case AST_UNARY_OP:
+            find_calls(parser, node->unary_op.operand, functions, worklist);
+            break;
+        case AST_BLOCK:
+            for (size_t i = 0; i < node->block.statement_count; i++) {
+                find_calls(parser, node->block.statements[i], functions, worklist);
+            }
+            break;
+        case AST_IF:
+            find_calls(parser, node->if_statement.condition, functions, worklist);
+            find_calls(parser, node->if_statement.then_branch, functions, worklist);
+            find_calls(parser, node->if_statement.else_branch, functions, worklist);
+            break;
+        case AST_WHILE:
+            find_calls(parser, node->while_loop.condition, functions, worklist);
+            find_calls(parser, node->while_loop.body, functions, worklist);
+            break;
+        case AST_RETURN:
+            find_calls(parser, node->return_statement.value, functions, worklist);
+            break;
+        case AST_DEFER:
+            find_calls(parser, node->defer_statement.value, functions, worklist);
+            break;
+        case AST_STRUCT_ACCESS:
+            find_calls(parser, node->struct_access.struct_expr, functions, worklist);
+            break;
+        case AST_CAST:
+            find_calls(parser, node->cast.expr, functions, worklist);
+            break;
+        case AST_ARRAY_ACCESS:
+            find_calls(parser, node->array_access.index, functions, worklist);
+            find_calls(parser, node->array_access.child, functions, worklist);
+            break;
+        case AST_ARRAY_ASSIGNMENT:
+            find_calls(parser, node->array_assignment.index, functions, worklist);
+            find_calls(parser, node->array_assignment.value, functions, worklist);
+            break;
+        case AST_LITERAL_ARRAY:
+            for (size_t i = 0; i < node->literal_array.value_count; i++) {
+                find_calls(parser, node->literal_array.values[i], functions, worklist);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Parses the bodies of every function the program can reach after skimming
+// The entry points are main and the public functions, since those can be
+// called from other modules, from there every function they call is followed.
+// Bodies that are never reached are never parsed.
+void parse_needed_bodies(Parser* parser) {
+    ASTNode* root = parser->ast_root;
+    if (root == NULL) {
+        return;
+    }
+
+    Symbol main_name = intern_cstr("main");
+    if (main_name == SYMBOL_NONE) {
+        fail_out_of_memory(parser);
+        return;
+    }
+    ArenaMark scratch = arena_mark(&parser->scratch);
+
+    FunctionTable functions;
+    if (init_function_table(&functions, root, &parser->scratch) != 0) {
+        fail_out_of_memory(parser);
+        arena_rewind(&parser->scratch, scratch);
+        return;
+    }
+
+    SmallVec worklist;
+    init_scratch_vec(&worklist, sizeof(ASTNode*), &parser->scratch);
+
+    for (size_t i = 0; i < root->block.statement_count; i++) {
+        ASTNode* statement = root->block.statements[i];
+        if (statement->type != AST_FUNCTION_DEF) {
+            continue;
+        }
+
+        if (statement->function_def.is_public || statement->function_def.name == main_name) {
+            if (small_vec_push(&worklist, &statement) != 0) {
+                fail_out_of_memory(parser);
+            }
+        }
+    }
+
+    ASTNode* function;
+    while (!parse_failed(parser) && small_vec_pop(&worklist, &function)) {
+        if (function->function_def.body != NULL) {
+            continue;
+        }
+
+        find_calls(parser, parse_function_body(parser, function), &functions, &worklist);
+    }
+
+    free_small_vec(&worklist);
+    arena_rewind(&parser->scratch, scratch);
+}
+
 ASTNode* parse_function(Parser* parser, int is_public) {
     // The next token should be an identifier, namely the name of the function
-    Token* name = next_token(parser);
-    if (name->type != T_IDENTIFIER) {
+    Token* name_token = next_token(parser);
+    if (name_token == NULL || name_token->type != T_IDENTIFIER) {
         error(parser, "Expected identifier after fn keyword");
+        return NULL;
     }
+    Symbol name = name_token->symbol;
 
-    // Set one for the param names and one for the types but set to NULL because we may have none
-    char** param_names = NULL;
-    char** param_types = NULL;
-    size_t param_count = 0;
+    // Set one for the param names and one for the types, both may stay empty
+    SmallVec param_names;
+    SmallVec param_types;
+    init_scratch_vec(&param_names, sizeof(Symbol), &parser->scratch);
+    init_scratch_vec(&param_types, sizeof(Symbol), &parser->scratch);
 
     // Then if the next is < we expect params
     Token* next = next_token(parser);
+    if (next == NULL) {
+        return NULL;
+    }
     if (next->type == T_L_ANGLE_BRACKET) {
-        param_names = malloc(sizeof(char*) * 8);
-        param_types = malloc(sizeof(char*) * 8);
-
         // Loop through the parameters until we get the closing
         while (1) {
             Token* param_type = next_token(parser);
+            if (param_type == NULL) {
+                return NULL;
+            }
             if (param_type->type != T_TYPE) {
                 // Add the used value in the message
-                char* message = malloc(strlen("Expected valid type as return type, got ") + strlen(param_type->value) + 1);
-                if (message == NULL) {
-                    error(parser, "Out of memory");
-                }
-                sprintf(message, "Expected valid type as return type, got %s", param_type->value);
-                error(parser, message);
+                error_with_token(parser, "Expected valid type as return type, got ", param_type);
+                return NULL;
             }
 
             Token* param_name = next_token(parser);
-            if (param_name->type != T_IDENTIFIER) {
+            if (param_name == NULL || param_name->type != T_IDENTIFIER) {
                 error(parser, "Expected identifier as parameter name");
+                return NULL;
             }
 
-            param_names[param_count] = strdup_c(param_name->value);
-            param_types[param_count] = strdup_c(param_type->value);
-            param_count++;
+            if (small_vec_push(&param_names, &param_name->symbol) != 0 ||
+                small_vec_push(&param_types, &param_type->symbol) != 0) {
+                fail_out_of_memory(parser);
+                return NULL;
+            }
 
             Token* comma_or_close = next_token(parser);
+            if (comma_or_close == NULL) {
+                return NULL;
+            }
             if (comma_or_close->type == T_COMMA) {
                 continue;
             } else if (comma_or_close->type == T_R_ANGLE_BRACKET) {
                 break;
             } else {
                 error(parser, "Expected ',' or '>' to add more parameters, or close the parameter list");
+                return NULL;
             }
         }
 
         next = next_token(parser);
+        if (next == NULL) {
+            return NULL;
+        }
     }
 
     if (next->type != T_DOUBLE_COLON) {
-        char* message = malloc(strlen("Expected '::' after function parameters, got ") + strlen(next->value) + 1);
-        if (message == NULL) {
-            error(parser, "Out of memory");
-        }
-        sprintf(message, "Expected '::' after function parameters, got %s", next->value);
-        error(parser, message);
+        error_with_token(parser, "Expected '::' after function parameters, got ", next);
+        return NULL;
     }
 
     // Now we expect the return type
-    Token* return_type = next_token(parser);
-    if (return_type->type != T_TYPE) {
+    Token* return_type_token = next_token(parser);
+    if (return_type_token == NULL) {
+        return NULL;
+    }
+    if (return_type_token->type != T_TYPE) {
         // Add the used value in the message
-        char* message = malloc(strlen("Expected valid type as return type, got ") + strlen(return_type->value) + 1);
-        if (message == NULL) {
-            error(parser, "Out of memory");
-        }
-        sprintf(message, "Expected valid type as return type, got %s", return_type->value);
-        error(parser, message);
+        error_with_token(parser, "Expected valid type as return type, got ", return_type_token);
+        return NULL;
     }
+    Symbol return_type = return_type_token->symbol;
 
     // Now we expect the opening brace
     Token* open_brace = next_token(parser);
-    if (open_brace->type != T_L_BRACE) {
+    if (open_brace == NULL || open_brace->type != T_L_BRACE) {
         error(parser, "Expected '{' after function declaration");
+        return NULL;
     }
 
-    ASTNode** body_statements = NULL;
-    size_t body_stmt_count = 0;
-    parse_ast_body(parser, &body_statements, &body_stmt_count);
+    size_t param_count = param_names.count;
+    Symbol* names = small_vec_finish(&param_names, &parser->arena);
+    Symbol* types = small_vec_finish(&param_types, &parser->arena);
 
-    ASTNode* function_block = create_block_node(body_statements, body_stmt_count);
-    return create_function_def_node(name->value, is_public, param_names, param_types, param_count, return_type->value, function_block);
+    // When skimming only the extent of the body is recorded, it is parsed once
+    // something needs it
+    if (parser->lazy_bodies && parser->stream != NULL) {
+        size_t body_start = parser->current;
+        skip_body(parser);
+        if (parse_failed(parser)) {
+            return NULL;
+        }
 
-    return NULL;
+        ASTNode* function = create_function_def_node(&parser->arena, name, is_public, names, types, param_count, return_type, NULL);
+        if (function == NULL) {
+            fail_out_of_memory(parser);
+            return NULL;
+        }
+        function->function_def.body_start = body_start;
+        function->function_def.body_end = parser->current;
+        return function;
+    }
+
+    ASTNode* body = parse_block(parser);
+    if (parse_failed(parser)) {
+        return NULL;
+    }
+    return create_function_def_node(&parser->arena, name, is_public, names, types, param_count, return_type, body);
+}
+
+// Parses a struct definition, the cursor is on the struct keyword and is left
+// on the closing brace
+ASTNode* parse_struct(Parser* parser) {
+    Token* name_token = next_token(parser);
+    if (name_token == NULL || name_token->type != T_IDENTIFIER) {
+        error(parser, "Expected identifier after struct keyword");
+        return NULL;
+    }
+    Symbol name = name_token->symbol;
+
+    Token* open_brace = next_token(parser);
+    if (open_brace == NULL || open_brace->type != T_L_BRACE) {
+        error(parser, "Expected '{' after struct name");
+        return NULL;
+    }
+
+    SmallVec field_names;
+    SmallVec field_types;
+    init_scratch_vec(&field_names, sizeof(Symbol), &parser->scratch);
+    init_scratch_vec(&field_types, sizeof(Symbol), &parser->scratch);
+
+    while (1) {
+        Token* field_type = next_token(parser);
+        if (field_type == NULL) {
+            return NULL;
+        }
+        if (field_type->type == T_R_BRACE) {
+            break;
+        }
+        if (field_type->type != T_TYPE && field_type->type != T_POINTER_TYPE && field_type->type != T_IDENTIFIER) {
+            error_with_token(parser, "Expected field type, got ", field_type);
+            return NULL;
+        }
+
+        Token* field_name = next_token(parser);
+        if (field_name == NULL || field_name->type != T_IDENTIFIER) {
+            error(parser, "Expected identifier as field name");
+            return NULL;
+        }
+
+        if (small_vec_push(&field_names, &field_name->symbol) != 0 ||
+            small_vec_push(&field_types, &field_type->symbol) != 0) {
+            fail_out_of_memory(parser);
+            return NULL;
+        }
+
+        Token* semicolon = next_token(parser);
+        if (semicolon == NULL || semicolon->type != T_SEMICOLON) {
+            error(parser, "Expected ';' after struct field");
+            return NULL;
+        }
+    }
+
+    size_t field_count = field_names.count;
+    Symbol* names = small_vec_finish(&field_names, &parser->arena);
+    Symbol* types = small_vec_finish(&field_types, &parser->arena);
+    return create_struct_def_node(&parser->arena, name, names, types, field_count);
 }
 
 ASTNode* parse_statement(Parser* parser) {
@@ -622,37 +1207,32 @@ ASTNode* parse_statement(Parser* parser) {
     // If we are importing something
     if (token->type == T_KEYWORD) {
         // If this is pub then we expect a fn keyword next
-        if (strcmp(token->value, "pub") == 0) {
+        if (token->keyword == KW_PUB) {
             // Get the next token
             Token* next = next_token(parser);
-            if (next->type != T_KEYWORD ||
-                strcmp(next->value, "fn") != 0
-            ) {
+            if (next == NULL || next->type != T_KEYWORD || next->keyword != KW_FN) {
                 error(parser, "Expected fn keyword after pub");
+                return NULL;
             }
 
             return parse_function(parser, 1);
         }
-        else if (strcmp(token->value, "fn") == 0) {
+        else if (token->keyword == KW_FN) {
             return parse_function(parser, 0);
         }
-        else if (strcmp(token->value, "struct") == 0) {
-            // TODO: Parse struct definition
+        else if (token->keyword == KW_STRUCT) {
+            return parse_struct(parser);
+        }
+        else {
+            error_with_token(parser, "No support for this keyword: ", token);
             return NULL;
-        } else {
-            char* message = malloc(strlen("No support for this keyword: ") + strlen(token->value) + 1);
-            if (message == NULL) {
-                error(parser, "Out of memory");
-            }
-            sprintf(message, "No support for this keyword: %s", token->value);
-            error(parser, message);
         }
     }
     else {
         // error(parser, "Expected keyword or import statement");
         // parser->current++;
         // print the token
-        // printf("Token: %s\n", parser->tokens[parser->current]->value);
+        // printf("Token: %.*s\n", (int)token->length, token_text(token));
     }
 
     // Move the parser past the last token of the sequence
@@ -661,18 +1241,242 @@ ASTNode* parse_statement(Parser* parser) {
     return NULL;
 }
 
+// Parses the whole input into parser->ast_root
+// Parsing stops at the first error, which is left in parser->error for the
+// caller to report, and no tree is built then.
 void run_parser(Parser* parser) {
-    ASTNode** statements = malloc(sizeof(ASTNode*) * parser->token_count);
-    size_t count = 0;
+    ArenaMark scratch = arena_mark(&parser->scratch);
+
+    // The number of statements is not known up front when lexing on demand
+    SmallVec statements;
+    init_scratch_vec(&statements, sizeof(ASTNode*), &parser->scratch);
 
-    while (parser->current < parser->token_count) {
+    while (!parse_failed(parser) && current_token(parser) != NULL) {
         ASTNode* statement = parse_statement(parser);
         if (statement) {
-            statements[count++] = statement;
+            add_statement(parser, &statements, statement);
+        }
+    }
+
+    if (parse_failed(parser)) {
+        arena_rewind(&parser->scratch, scratch);
+        return;
+    }
+
+    size_t count = statements.count;
+    ASTNode** items = small_vec_finish(&statements, &parser->arena);
+    if (count > 0) {
+        parser->ast_root = create_block_node(&parser->arena, items, count);
+    }
+    arena_rewind(&parser->scratch, scratch);
+}
+
+// Range of tokens parsed as a unit by run_parser_parallel
+// Either a single top-level item or the tokens in between two of them.
+typedef struct {
+    size_t start;
+    size_t end;
+    ASTNode** statements; // Allocated from the arena of the parser that parsed it
+    size_t statement_count;
+    ParseError error;
+} ParseItem;
+
+// Shared by the tasks of run_parser_parallel, every worker thread has a parser
+typedef struct {
+    Parser** parsers;
+    ParseItem* items;
+} ParseWork;
+
+// Returns the end of the item starting at the given token, just past the brace
+// that closes its body, or the end of the stream if it is never closed
+static size_t find_item_end(const TokenStream* stream, size_t start) {
+    size_t depth = 0;
+    for (size_t i = start; i < stream->count; i++) {
+        if (stream->tokens[i].type == T_L_BRACE) {
+            depth++;
+        } else if (stream->tokens[i].type == T_R_BRACE && depth > 0) {
+            if (--depth == 0) {
+                return i + 1;
+            }
         }
     }
+    return stream->count;
+}
+
+// Splits the token stream into items by brace matching
+// Top-level fn, pub fn and struct items do not depend on each other, the
+// tokens between them are kept as items of their own so that they are checked
+// the same way run_parser would. The grammar has no test items yet, a test is
+// left in between items and fails there like it does in run_parser.
+static void find_items(Parser* parser, SmallVec* items) {
+    const TokenStream* stream = parser->stream;
+    size_t gap_start = 0;
+    size_t i = 0;
+
+    while (!parse_failed(parser) && i < stream->count) {
+        const Token* token = &stream->tokens[i];
+        int is_item = token->type == T_KEYWORD &&
+                      (token->keyword == KW_PUB || token->keyword == KW_FN || token->keyword == KW_STRUCT);
+        if (!is_item) {
+            i++;
+            continue;
+        }
+
+        ParseItem item = {0};
+        if (gap_start < i) {
+            item.start = gap_start;
+            item.end = i;
+            if (small_vec_push(items, &item) != 0) {
+                fail_out_of_memory(parser);
+            }
+        }
+
+        item.start = i;
+        item.end = find_item_end(stream, i);
+        if (small_vec_push(items, &item) != 0) {
+            fail_out_of_memory(parser);
+        }
+
+        i = item.end;
+        gap_start = i;
+    }
+
+    if (gap_start < stream->count) {
+        ParseItem item = {0};
+        item.start = gap_start;
+        item.end = stream->count;
+        if (small_vec_push(items, &item) != 0) {
+            fail_out_of_memory(parser);
+        }
+    }
+}
+
+// Parses the statements of a single item
+static void parse_item(Parser* parser, ParseItem* item) {
+    SmallVec statements;
+    init_scratch_vec(&statements, sizeof(ASTNode*), &parser->scratch);
+
+    // Past the end of the item the parser sees the end of the input
+    parser->current = item->start;
+    parser->token_count = item->end;
+
+    while (!parse_failed(parser) && current_token(parser) != NULL) {
+        ASTNode* statement = parse_statement(parser);
+        if (statement) {
+            add_statement(parser, &statements, statement);
+        }
+    }
+
+    item->statement_count = statements.count;
+    item->statements = small_vec_finish(&statements, &parser->arena);
+}
+
+// Parses one item on the parser of the worker, an error only stops the item
+// it occurred in
+static void parse_item_task(void* context, size_t worker, size_t index) {
+    ParseWork* work = context;
+    Parser* parser = work->parsers[worker];
+    ParseItem* item = &work->items[index];
+    ArenaMark scratch = arena_mark(&parser->scratch);
+
+    parse_item(parser, item);
+    if (parse_failed(parser)) {
+        // The parser goes on with the next item of the worker
+        item->error = parser->error;
+        item->statement_count = 0;
+        parser->error.has_error = 0;
+    }
+    arena_rewind(&parser->scratch, scratch);
+}
+
+// Parses a fully lexed token stream with up to the given number of threads
+// The top-level items are parsed concurrently, each thread with a parser and
+// arena of its own, and are then gathered into the top-level block in source
+// order, so the tree is the same as the one run_parser builds. If any item
+// fails the first error in source order is left in parser->error.
+void run_parser_parallel(Parser* parser, size_t jobs) {
+    if (parser->stream == NULL || jobs <= 1) {
+        run_parser(parser);
+        return;
+    }
+
+    ArenaMark scratch = arena_mark(&parser->scratch);
+    SmallVec item_list;
+    init_scratch_vec(&item_list, sizeof(ParseItem), &parser->scratch);
+    find_items(parser, &item_list);
+    if (parse_failed(parser)) {
+        free_small_vec(&item_list);
+        arena_rewind(&parser->scratch, scratch);
+        return;
+    }
+
+    ParseItem* items = small_vec_items(&item_list);
+    size_t item_count = item_list.count;
+    if (item_count < 2) {
+        free_small_vec(&item_list);
+        arena_rewind(&parser->scratch, scratch);
+        run_parser(parser);
+        return;
+    }
+
+    size_t thread_count = jobs < item_count ? jobs : item_count;
+    Parser** parsers = mem_calloc(thread_count, sizeof(Parser*));
+    if (parsers == NULL) {
+        fail_out_of_memory(parser);
+        free_small_vec(&item_list);
+        arena_rewind(&parser->scratch, scratch);
+        return;
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        parsers[i] = create_parser((TokenStream*)parser->stream);
+        if (parsers[i] == NULL) {
+            for (size_t j = 0; j < i; j++) {
+                free_parser(parsers[j]);
+            }
+            mem_free(parsers);
+            fail_out_of_memory(parser);
+            free_small_vec(&item_list);
+            arena_rewind(&parser->scratch, scratch);
+            return;
+        }
+        parsers[i]->lazy_bodies = parser->lazy_bodies;
+    }
+
+    ParseWork work = {parsers, items};
+    run_parallel(item_count, thread_count, parse_item_task, &work);
+
+    SmallVec statements;
+    init_scratch_vec(&statements, sizeof(ASTNode*), &parser->scratch);
+    for (size_t i = 0; i < item_count; i++) {
+        if (items[i].error.has_error) {
+            parser->error = items[i].error;
+            break;
+        }
+
+        for (size_t j = 0; j < items[i].statement_count; j++) {
+            add_statement(parser, &statements, items[i].statements[j]);
+        }
+    }
+
+    // The nodes of every item now belong to this parser
+    for (size_t i = 0; i < thread_count; i++) {
+        arena_adopt(&parser->arena, &parsers[i]->arena);
+        free_parser(parsers[i]);
+    }
+    mem_free(parsers);
+    free_small_vec(&item_list);
+
+    if (parse_failed(parser)) {
+        free_small_vec(&statements);
+        arena_rewind(&parser->scratch, scratch);
+        return;
+    }
 
+    size_t count = statements.count;
+    ASTNode** top_level = small_vec_finish(&statements, &parser->arena);
     if (count > 0) {
-        parser->ast_root = create_block_node(statements, count);
+        parser->ast_root = create_block_node(&parser->arena, top_level, count);
     }
+    parser->current = parser->token_count;
+    arena_rewind(&parser->scratch, scratch);
 }
@@ -4,15 +4,63 @@
 #include "ast.h"
 #include "lexer.h"
 
+// Number of tokens kept around when pulling tokens from a lexer, has to be a
+// power of two. Besides the lookahead this leaves room to step back a token.
+#define PARSER_WINDOW_SIZE 16
+
+// Structure to hold the error a parser stopped at
+// The location is only resolved into a line and column once the error is
+// reported, see report_parse_error. An error that is in no source, such as an
+// import cycle, has no file and is not at the end.
+typedef struct {
+    int has_error;
+    int at_end;        // Hit at the end of the input, the location is unused
+    int out_of_memory; // The tokens or the tree did not fit in memory, nothing else is set
+    FileId file;
+    uint32_t offset;
+    char message[256];
+} ParseError;
+
+// Structure to hold the state of the parser
+// The parser either walks a fully lexed token stream, or pulls tokens from a
+// lexer into a small window. In the latter case a Token* is only valid until
+// PARSER_WINDOW_SIZE more tokens have been read, so values that are needed
+// after parsing a nested construct have to be copied out first.
 typedef struct {
-    Token** tokens;
-    size_t token_count;
+    const TokenStream* stream;
+    Lexer* lexer;
+    Token* tokens;
+    size_t token_count; // Total tokens, or the tokens pulled so far
     size_t current;
+    int end_of_input;
+    Token window[PARSER_WINDOW_SIZE];
+    Arena arena;   // Owns every node of the tree
+    Arena scratch; // Lists while they are built, rewound after every parse
     ASTNode* ast_root;
+    ParseError error; // The first error, parsing stops once it is set
+    int lazy_bodies;  // Only skim function bodies, requires a token stream
 } Parser;
 
-Parser* create_parser(Token** tokens, size_t token_count);
+// Structure to hold the top-level functions of a module by name
+// An open addressing hash table (linear probing) sized for the functions of
+// the module, where NULL marks an empty slot. A name defined twice keeps its
+// last definition.
+typedef struct {
+    ASTNode** slots;
+    size_t slot_count; // Power of two
+} FunctionTable;
+
+Parser* create_parser(TokenStream* stream);
+Parser* create_parser_from_lexer(Lexer* lexer);
 void run_parser(Parser* parser);
+void run_parser_parallel(Parser* parser, size_t jobs);
+void fail_out_of_memory(Parser* parser);
+int parse_failed(Parser* parser);
+void report_parse_error(const ParseError* error);
+ASTNode* parse_function_body(Parser* parser, ASTNode* function);
+void parse_needed_bodies(Parser* parser);
+int init_function_table(FunctionTable* table, ASTNode* root, Arena* arena);
+ASTNode* find_function(const FunctionTable* table, Symbol name);
 void free_parser(Parser* parser);
 
 #endif // PARSER_H
@@ -0,0 +1,344 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "resolve.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SCOPE_INITIAL_SLOTS 8
+
+void init_name_table(NameTable* table) {
+    memset(table, 0, sizeof(NameTable));
+}
+
+const Declaration* get_declaration(const NameTable* table, DeclarationId id) {
+    if (id == NO_DECLARATION || id > table->declaration_count) {
+        return NULL;
+    }
+    return &table->declarations[id - 1];
+}
+
+// Symbols are handed out in order, so they are spread over the slots by a
+// multiplicative hash
+static size_t symbol_slot(Symbol symbol, size_t slot_count) {
+    return (size_t)(symbol * 2654435761u) & (slot_count - 1);
+}
+
+static Symbol slot_name(const NameTable* table, DeclarationId id) {
+    return table->declarations[id - 1].name;
+}
+
+// Doubles the slots of the table and reinserts every declaration, returns -1
+// if they do not fit in memory
+static int grow_scope_table(const NameTable* table, ScopeTable* scope) {
+    size_t new_count = scope->slot_count == 0 ? SCOPE_INITIAL_SLOTS : scope->slot_count * 2;
+    DeclarationId* new_slots = mem_calloc(new_count, sizeof(DeclarationId));
+    if (new_slots == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < scope->slot_count; i++) {
+        DeclarationId id = scope->slots[i];
+        if (id == NO_DECLARATION) {
+            continue;
+        }
+
+        size_t slot = symbol_slot(slot_name(table, id), new_count);
+        while (new_slots[slot] != NO_DECLARATION) {
+            slot = (slot + 1) & (new_count - 1);
+        }
+        new_slots[slot] = id;
+    }
+
+    mem_free(scope->slots);
+    scope->slots = new_slots;
+    scope->slot_count = new_count;
+    return 0;
+}
+
+// Returns the slot of the name in the table, or the empty slot it would go in
+static DeclarationId* find_slot(const NameTable* table, const ScopeTable* scope, Symbol name) {
+    size_t slot = symbol_slot(name, scope->slot_count);
+    while (scope->slots[slot] != NO_DECLARATION && slot_name(table, scope->slots[slot]) != name) {
+        slot = (slot + 1) & (scope->slot_count - 1);
+    }
+    return &scope->slots[slot];
+}
+
+// Opens a scope below the innermost open one, returns -1 with the table marked
+// if it does not fit in memory
+// The table of a closed scope at the same depth is reused, so walking a tree
+// does not allocate per block.
+static int open_scope(NameTable* table, ASTNode* node) {
+    if (table->scope_count == table->scope_capacity) {
+        size_t capacity = table->scope_capacity == 0 ? 64 : table->scope_capacity * 2;
+        Scope* grown = mem_realloc(table->scopes, capacity * sizeof(Scope));
+        if (grown == NULL) {
+            table->out_of_memory = 1;
+            return -1;
+        }
+        table->scopes = grown;
+        table->scope_capacity = capacity;
+    }
+
+    if (table->open_count == table->open_capacity) {
+        size_t capacity = table->open_capacity == 0 ? 16 : table->open_capacity * 2;
+        ScopeTable* grown = mem_realloc(table->open, capacity * sizeof(ScopeTable));
+        if (grown == NULL) {
+            table->out_of_memory = 1;
+            return -1;
+        }
+        memset(&grown[table->open_capacity], 0, (capacity - table->open_capacity) * sizeof(ScopeTable));
+        table->open = grown;
+        table->open_capacity = capacity;
+    }
+
+    Scope* scope = &table->scopes[table->scope_count];
+    scope->parent = table->open_count == 0 ? NO_SCOPE : table->open[table->open_count - 1].scope;
+    scope->node = node;
+    table->open[table->open_count++].scope = (uint32_t)table->scope_count++;
+    return 0;
+}
+
+static void close_scope(NameTable* table) {
+    ScopeTable* scope = &table->open[--table->open_count];
+    if (scope->count > 0) {
+        memset(scope->slots, 0, scope->slot_count * sizeof(DeclarationId));
+        scope->count = 0;
+    }
+}
+
+// Declares the name in the innermost open scope
+// A name declared again in the same scope refers to the later declaration from
+// there on. A name that does not fit in memory marks the table.
+static void declare(NameTable* table, DeclarationKind kind, Symbol name, ASTNode* node, uint32_t parameter) {
+    if (table->declaration_count == table->declaration_capacity) {
+        size_t capacity = table->declaration_capacity == 0 ? 256 : table->declaration_capacity * 2;
+        Declaration* grown = mem_realloc(table->declarations, capacity * sizeof(Declaration));
+        if (grown == NULL) {
+            table->out_of_memory = 1;
+            return;
+        }
+        table->declarations = grown;
+        table->declaration_capacity = capacity;
+    }
+
+    ScopeTable* scope = &table->open[table->open_count - 1];
+    if ((scope->count + 1) * 4 > scope->slot_count * 3 && grow_scope_table(table, scope) != 0) {
+        table->out_of_memory = 1;
+        return;
+    }
+
+    Declaration* declaration = &table->declarations[table->declaration_count++];
+    declaration->kind = kind;
+    declaration->name = name;
+    declaration->node = node;
+    declaration->scope = scope->scope;
+    declaration->parameter = parameter;
+
+    DeclarationId* slot = find_slot(table, scope, name);
+    if (*slot == NO_DECLARATION) {
+        scope->count++;
+    }
+    *slot = (DeclarationId)table->declaration_count;
+}
+
+// Annotates a use of the name with the declaration it refers to, searching from
+// the innermost open scope outwards
+static void resolve_use(NameTable* table, Symbol name, DeclarationId* declaration) {
+    for (size_t i = table->open_count; i > 0; i--) {
+        const ScopeTable* scope = &table->open[i - 1];
+        if (scope->count == 0) {
+            continue;
+        }
+
+        DeclarationId id = *find_slot(table, scope, name);
+        if (id != NO_DECLARATION) {
+            *declaration = id;
+            table->resolved++;
+            return;
+        }
+    }
+
+    *declaration = NO_DECLARATION;
+    table->unresolved++;
+}
+
+static void resolve_node(NameTable* table, ASTNode* node);
+
+// Walks the elements of a chain after its head, their names are members or
+// parts of a module path and are not looked up, their indices and arguments are
+static void resolve_members(NameTable* table, ASTNode* node) {
+    while (node != NULL) {
+        switch (node->type) {
+            case AST_REFERENCE:
+                node = node->reference.child;
+                break;
+            case AST_ARRAY_ACCESS:
+                resolve_node(table, node->array_access.index);
+                node = node->array_access.child;
+                break;
+            case AST_FUNCTION_CALL:
+                for (size_t i = 0; i < node->function_call.arg_count; i++) {
+                    resolve_node(table, node->function_call.args[i]);
+                }
+                return;
+            default:
+                resolve_node(table, node);
+                return;
+        }
+    }
+}
+
+static void resolve_statements(NameTable* table, ASTNode** statements, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        resolve_node(table, statements[i]);
+    }
+}
+
+// Resolves the names used by the node and its children, and declares the names
+// it declares
+// A variable is declared after its initializer, which still sees the names of
+// the scopes around it.
+static void resolve_node(NameTable* table, ASTNode* node) {
+    if (node == NULL || table->out_of_memory) {
+        return;
+    }
+
+    switch (node->type) {
+        case AST_VARIABLE_DEF:
+            resolve_node(table, node->variable_def.initializer);
+            declare(table, DECLARATION_VARIABLE, node->variable_def.name, node, 0);
+            break;
+        case AST_TYPE_DECL:
+            declare(table, DECLARATION_VARIABLE, node->type_decl.name, node, 0);
+            break;
+        case AST_ARRAY_DEF:
+            resolve_node(table, node->array_def.initializer);
+            declare(table, DECLARATION_ARRAY, node->array_def.name, node, 0);
+            break;
+        case AST_VARIABLE_ASSIGNMENT:
+            resolve_use(table, node->variable_assignment.name, &node->variable_assignment.declaration);
+            resolve_node(table, node->variable_assignment.value);
+            break;
+        case AST_ASSIGNMENT:
+            resolve_use(table, node->assignment.name, &node->assignment.declaration);
+            resolve_node(table, node->assignment.value);
+            break;
+        case AST_ARRAY_ASSIGNMENT:
+            resolve_use(table, node->array_assignment.reference, &node->array_assignment.declaration);
+            resolve_node(table, node->array_assignment.index);
+            resolve_node(table, node->array_assignment.value);
+            break;
+        case AST_REFERENCE:
+            resolve_use(table, node->reference.name, &node->reference.declaration);
+            resolve_members(table, node->reference.child);
+            break;
+        case AST_ARRAY_ACCESS:
+            resolve_use(table, node->array_access.reference, &node->array_access.declaration);
+            resolve_node(table, node->array_access.index);
+            resolve_members(table, node->array_access.child);
+            break;
+        case AST_FUNCTION_CALL:
+            resolve_use(table, node->function_call.name, &node->function_call.declaration);
+            resolve_statements(table, node->function_call.args, node->function_call.arg_count);
+            break;
+        case AST_BINARY_OP:
+            resolve_node(table, node->binary_op.left);
+            resolve_node(table, node->binary_op.right);
+            break;
+        case AST_UNARY_OP:
+            resolve_node(table, node->unary_op.operand);
+            break;
+        case AST_FUNCTION_DEF:
+            // The parameters get a scope of their own, the body opens another
+            // one below it. Bodies that are not parsed are left unresolved.
+            if (open_scope(table, node) != 0) {
+                break;
+            }
+            for (size_t i = 0; i < node->function_def.param_count; i++) {
+                declare(table, DECLARATION_PARAMETER, node->function_def.param_names[i], node, (uint32_t)i);
+            }
+            resolve_node(table, node->function_def.body);
+            close_scope(table);
+            break;
+        case AST_BLOCK:
+            if (open_scope(table, node) != 0) {
+                break;
+            }
+            resolve_statements(table, node->block.statements, node->block.statement_count);
+            close_scope(table);
+            break;
+        case AST_IF:
+            resolve_node(table, node->if_statement.condition);
+            resolve_node(table, node->if_statement.then_branch);
+            resolve_node(table, node->if_statement.else_branch);
+            break;
+        case AST_WHILE:
+            resolve_node(table, node->while_loop.condition);
+            resolve_node(table, node->while_loop.body);
+            break;
+        case AST_RETURN:
+            resolve_node(table, node->return_statement.value);
+            break;
+        case AST_DEFER:
+            resolve_node(table, node->defer_statement.value);
+            break;
+        case AST_STRUCT_ACCESS:
+            resolve_node(table, node->struct_access.struct_expr);
+            break;
+        case AST_CAST:
+            resolve_node(table, node->cast.expr);
+            break;
+        case AST_LITERAL_ARRAY:
+            resolve_statements(table, node->literal_array.values, node->literal_array.value_count);
+            break;
+        case AST_LITERAL:
+        case AST_STRUCT_DEF:
+        default:
+            break;
+    }
+}
+
+// Builds the scope tree of a module and annotates every use of a name with its
+// declaration
+// The functions and structs of the module are declared before anything is
+// resolved, so they can be used ahead of their definitions. The table can
+// resolve several modules, each gets a module scope of its own. Returns -1 if
+// the table ran out of memory, the trees are then only partly annotated.
+int resolve_names(NameTable* table, ASTNode* root) {
+    if (root == NULL || table->out_of_memory) {
+        return table->out_of_memory ? -1 : 0;
+    }
+
+    if (open_scope(table, root) != 0) {
+        return -1;
+    }
+    if (root->type == AST_BLOCK) {
+        for (size_t i = 0; i < root->block.statement_count; i++) {
+            ASTNode* item = root->block.statements[i];
+            if (item->type == AST_FUNCTION_DEF) {
+                declare(table, DECLARATION_FUNCTION, item->function_def.name, item, 0);
+            } else if (item->type == AST_STRUCT_DEF) {
+                declare(table, DECLARATION_STRUCT, item->struct_def.name, item, 0);
+            }
+        }
+        resolve_statements(table, root->block.statements, root->block.statement_count);
+    } else {
+        resolve_node(table, root);
+    }
+    close_scope(table);
+    return table->out_of_memory ? -1 : 0;
+}
+
+void free_name_table(NameTable* table) {
+    for (size_t i = 0; i < table->open_capacity; i++) {
+        mem_free(table->open[i].slots);
+    }
+    mem_free(table->open);
+    mem_free(table->scopes);
+    mem_free(table->declarations);
+    init_name_table(table);
+}
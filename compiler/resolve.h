@@ -0,0 +1,72 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include "ast.h"
+#include "intern.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Enum to represent what declared a name
+typedef enum {
+    DECLARATION_FUNCTION,
+    DECLARATION_STRUCT,
+    DECLARATION_PARAMETER,
+    DECLARATION_VARIABLE, // Variable definition or type declaration
+    DECLARATION_ARRAY
+} DeclarationKind;
+
+// Parent of a module scope, the root of its scope tree
+#define NO_SCOPE UINT32_MAX
+
+// Structure to hold a declared name
+typedef struct {
+    DeclarationKind kind;
+    Symbol name;
+    ASTNode* node;      // Declaring node, the function of a parameter
+    uint32_t scope;     // Scope the name is declared in
+    uint32_t parameter; // Index of a parameter in its function
+} Declaration;
+
+// Structure to hold a scope of the scope tree
+// Scopes are numbered in the order they are opened, a module, function or block
+// opens one.
+typedef struct {
+    uint32_t parent;    // NO_SCOPE for a module scope
+    ASTNode* node;      // Root, function or block that opens the scope
+} Scope;
+
+// Structure to hold the names of an open scope
+// An open addressing hash table (linear probing) of declaration ids keyed by
+// their symbols, where NO_DECLARATION marks an empty slot.
+typedef struct {
+    uint32_t scope;
+    DeclarationId* slots;
+    size_t slot_count;  // Power of two, 0 until the first name is declared
+    size_t count;
+} ScopeTable;
+
+// Structure to hold the declarations and scopes name resolution found
+// Every use of a name in the resolved trees is annotated with its declaration
+// id, so later passes never look a name up again.
+typedef struct {
+    Declaration* declarations; // Indexed by declaration id - 1
+    size_t declaration_count;
+    size_t declaration_capacity;
+    Scope* scopes;
+    size_t scope_count;
+    size_t scope_capacity;
+    ScopeTable* open;          // Tables of the open scopes, innermost last
+    size_t open_count;
+    size_t open_capacity;      // Closed tables are kept to be reused
+    size_t resolved;           // Uses annotated with their declaration
+    size_t unresolved;         // Uses of names the trees do not declare, such as imported ones
+    int out_of_memory;         // Set once the table could not grow, the trees are only partly resolved
+} NameTable;
+
+// Function declarations
+void init_name_table(NameTable* table);
+int resolve_names(NameTable* table, ASTNode* root);
+const Declaration* get_declaration(const NameTable* table, DeclarationId id);
+void free_name_table(NameTable* table);
+
+#endif // RESOLVE_H
@@ -0,0 +1,311 @@
+#include "scan.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SCAN_X86
+#endif
+
+#ifdef SCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef size_t (*ScanFunction)(const char* text, size_t length);
+
+// Scalar kernels, also used for the tails that do not fill a full vector
+
+static int is_identifier_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static size_t scalar_identifier(const char* text, size_t length) {
+    size_t i = 0;
+    while (i < length && is_identifier_char(text[i])) {
+        i++;
+    }
+    return i;
+}
+
+static size_t scalar_digits(const char* text, size_t length) {
+    size_t i = 0;
+    while (i < length && text[i] >= '0' && text[i] <= '9') {
+        i++;
+    }
+    return i;
+}
+
+static size_t scalar_inline_space(const char* text, size_t length) {
+    size_t i = 0;
+    while (i < length && (text[i] == ' ' || text[i] == '\t' || text[i] == '\r' || text[i] == '\v' || text[i] == '\f')) {
+        i++;
+    }
+    return i;
+}
+
+static size_t scalar_line(const char* text, size_t length) {
+    size_t i = 0;
+    while (i < length && text[i] != '\n') {
+        i++;
+    }
+    return i;
+}
+
+static size_t scalar_string(const char* text, size_t length) {
+    size_t i = 0;
+    while (i < length && text[i] != '"' && text[i] != '\n') {
+        i++;
+    }
+    return i;
+}
+
+#ifdef SCAN_X86
+
+static unsigned count_trailing_zeros(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// Each mask function sets the bytes that belong to the class to 0xFF
+// Compares are signed, so bytes >= 0x80 never fall inside an ASCII range.
+
+// SSE2 kernels, 16 bytes at a time
+
+static __m128i sse2_range(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+static __m128i sse2_digit_mask(__m128i v) {
+    return sse2_range(v, '0', '9');
+}
+
+static __m128i sse2_identifier_mask(__m128i v) {
+    // Setting 0x20 folds upper case letters onto lower case ones
+    __m128i alpha = sse2_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+    return _mm_or_si128(_mm_or_si128(alpha, sse2_digit_mask(v)), underscore);
+}
+
+static __m128i sse2_inline_space_mask(__m128i v) {
+    // '\t', '\v', '\f' and '\r' are 9 to 13, minus the '\n' in between
+    __m128i control = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), sse2_range(v, '\t', '\r'));
+    return _mm_or_si128(control, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static __m128i sse2_line_mask(__m128i v) {
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+}
+
+static __m128i sse2_string_mask(__m128i v) {
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), sse2_line_mask(v));
+}
+
+// Defines a kernel that stops at the first byte whose class bit differs from
+// `inside`, run kernels stay inside their class and find kernels stay outside of it
+#define DEFINE_SSE2_KERNEL(name, mask_function, inside, scalar)                          \
+    static size_t name(const char* text, size_t length) {                                \
+        size_t i = 0;                                                                     \
+        for (; i + 16 <= length; i += 16) {                                               \
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(text + i));                  \
+            unsigned stop = (unsigned)_mm_movemask_epi8(mask_function(chunk));            \
+            if (inside) {                                                                 \
+                stop = ~stop & 0xFFFFu;                                                   \
+            }                                                                             \
+            if (stop != 0) {                                                              \
+                return i + count_trailing_zeros(stop);                                    \
+            }                                                                             \
+        }                                                                                 \
+        return i + scalar(text + i, length - i);                                          \
+    }
+
+DEFINE_SSE2_KERNEL(sse2_identifier, sse2_identifier_mask, 1, scalar_identifier)
+DEFINE_SSE2_KERNEL(sse2_digits, sse2_digit_mask, 1, scalar_digits)
+DEFINE_SSE2_KERNEL(sse2_inline_space, sse2_inline_space_mask, 1, scalar_inline_space)
+DEFINE_SSE2_KERNEL(sse2_line, sse2_line_mask, 0, scalar_line)
+DEFINE_SSE2_KERNEL(sse2_string, sse2_string_mask, 0, scalar_string)
+
+// AVX2 kernels, 32 bytes at a time
+
+TARGET_AVX2 static __m256i avx2_range(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+TARGET_AVX2 static __m256i avx2_digit_mask(__m256i v) {
+    return avx2_range(v, '0', '9');
+}
+
+TARGET_AVX2 static __m256i avx2_identifier_mask(__m256i v) {
+    __m256i alpha = avx2_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+    __m256i underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+    return _mm256_or_si256(_mm256_or_si256(alpha, avx2_digit_mask(v)), underscore);
+}
+
+TARGET_AVX2 static __m256i avx2_inline_space_mask(__m256i v) {
+    __m256i control = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), avx2_range(v, '\t', '\r'));
+    return _mm256_or_si256(control, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+TARGET_AVX2 static __m256i avx2_line_mask(__m256i v) {
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+}
+
+TARGET_AVX2 static __m256i avx2_string_mask(__m256i v) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), avx2_line_mask(v));
+}
+
+// The remainder of less than 32 bytes is handed to the SSE2 kernel
+#define DEFINE_AVX2_KERNEL(name, mask_function, inside, sse2)                            \
+    TARGET_AVX2 static size_t name(const char* text, size_t length) {                    \
+        size_t i = 0;                                                                     \
+        for (; i + 32 <= length; i += 32) {                                               \
+            __m256i chunk = _mm256_loadu_si256((const __m256i*)(text + i));               \
+            unsigned stop = (unsigned)_mm256_movemask_epi8(mask_function(chunk));         \
+            if (inside) {                                                                 \
+                stop = ~stop;                                                             \
+            }                                                                             \
+            if (stop != 0) {                                                              \
+                return i + count_trailing_zeros(stop);                                    \
+            }                                                                             \
+        }                                                                                 \
+        return i + sse2(text + i, length - i);                                            \
+    }
+
+DEFINE_AVX2_KERNEL(avx2_identifier, avx2_identifier_mask, 1, sse2_identifier)
+DEFINE_AVX2_KERNEL(avx2_digits, avx2_digit_mask, 1, sse2_digits)
+DEFINE_AVX2_KERNEL(avx2_inline_space, avx2_inline_space_mask, 1, sse2_inline_space)
+DEFINE_AVX2_KERNEL(avx2_line, avx2_line_mask, 0, sse2_line)
+DEFINE_AVX2_KERNEL(avx2_string, avx2_string_mask, 0, sse2_string)
+
+#endif // SCAN_X86
+
+// Structure to hold the kernels of one level
+typedef struct {
+    ScanLevel level;
+    ScanFunction identifier;
+    ScanFunction digits;
+    ScanFunction inline_space;
+    ScanFunction line;
+    ScanFunction string;
+} ScanKernels;
+
+static const ScanKernels scalar_kernels = {SCAN_SCALAR, scalar_identifier, scalar_digits, scalar_inline_space, scalar_line, scalar_string};
+#ifdef SCAN_X86
+static const ScanKernels sse2_kernels = {SCAN_SSE2, sse2_identifier, sse2_digits, sse2_inline_space, sse2_line, sse2_string};
+static const ScanKernels avx2_kernels = {SCAN_AVX2, avx2_identifier, avx2_digits, avx2_inline_space, avx2_line, avx2_string};
+#endif
+
+// The kernels in use, scalar until init_scan_kernels picks faster ones
+// Lexers on any thread read them, so a level is switched by swapping the
+// pointer to its set, never by writing the kernels one by one.
+static _Atomic(const ScanKernels*) kernels = &scalar_kernels;
+static atomic_int level_chosen = 0;
+static once_flag kernels_once = ONCE_FLAG_INIT;
+
+// Returns the best level supported by both the CPU and the operating system
+static ScanLevel detect_scan_level() {
+#ifdef SCAN_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    int has_osxsave = (info[2] >> 27) & 1;
+    int has_avx = (info[2] >> 28) & 1;
+
+    // The OS has to save the YMM registers on context switches
+    if (max_leaf >= 7 && has_osxsave && has_avx && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if ((info[1] >> 5) & 1) {
+            return SCAN_AVX2;
+        }
+    }
+    return SCAN_SSE2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SCAN_AVX2;
+    }
+    return SCAN_SSE2;
+#endif
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+// Selects the kernels for the given level, clamped to what the CPU supports
+// Returns the level that is actually in use.
+ScanLevel set_scan_level(ScanLevel level) {
+    ScanLevel supported = detect_scan_level();
+    if (level > supported) {
+        level = supported;
+    }
+
+    const ScanKernels* chosen = &scalar_kernels;
+#ifdef SCAN_X86
+    if (level == SCAN_SSE2) {
+        chosen = &sse2_kernels;
+    } else if (level == SCAN_AVX2) {
+        chosen = &avx2_kernels;
+    }
+#endif
+
+    atomic_store_explicit(&kernels, chosen, memory_order_release);
+    atomic_store(&level_chosen, 1);
+    return level;
+}
+
+static void pick_scan_kernels() {
+    if (!atomic_load(&level_chosen)) {
+        set_scan_level(SCAN_AVX2);
+    }
+}
+
+// Picks the best kernels for this CPU, unless a level was already set
+// Runs once however many threads call it, every lexer calls it before scanning.
+void init_scan_kernels() {
+    call_once(&kernels_once, pick_scan_kernels);
+}
+
+ScanLevel get_scan_level() {
+    return atomic_load_explicit(&kernels, memory_order_acquire)->level;
+}
+
+const char* scan_level_to_str(ScanLevel level) {
+    switch (level) {
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE2: return "sse2";
+        case SCAN_AVX2: return "avx2";
+        default: return "Invalid";
+    }
+}
+
+size_t scan_identifier(const char* text, size_t length) {
+    return atomic_load_explicit(&kernels, memory_order_acquire)->identifier(text, length);
+}
+
+size_t scan_digits(const char* text, size_t length) {
+    return atomic_load_explicit(&kernels, memory_order_acquire)->digits(text, length);
+}
+
+size_t scan_inline_space(const char* text, size_t length) {
+    return atomic_load_explicit(&kernels, memory_order_acquire)->inline_space(text, length);
+}
+
+size_t scan_line(const char* text, size_t length) {
+    return atomic_load_explicit(&kernels, memory_order_acquire)->line(text, length);
+}
+
+size_t scan_string(const char* text, size_t length) {
+    return atomic_load_explicit(&kernels, memory_order_acquire)->string(text, length);
+}
@@ -0,0 +1,27 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Instruction sets the scan kernels can use, in order of preference
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanLevel;
+
+// Function declarations
+// Every scan function returns the length of the run at the start of the
+// buffer, the buffer does not have to be null terminated.
+void init_scan_kernels();
+ScanLevel get_scan_level();
+ScanLevel set_scan_level(ScanLevel level);
+const char* scan_level_to_str(ScanLevel level);
+
+size_t scan_identifier(const char* text, size_t length);  // [A-Za-z0-9_]*
+size_t scan_digits(const char* text, size_t length);      // [0-9]*
+size_t scan_inline_space(const char* text, size_t length); // Whitespace other than '\n'
+size_t scan_line(const char* text, size_t length);        // Up to the next '\n'
+size_t scan_string(const char* text, size_t length);      // Up to the next '"' or '\n'
+
+#endif // SCAN_H
@@ -0,0 +1,291 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "lexer.h"
+#include "scan.h"
+#include "intern.h"
+#include "number.h"
+#include "source.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks that the lexer produces the same tokens at every scan level
+// Every file given on the command line, and generated sources whose runs end
+// on both sides of every vector boundary, are lexed with the scalar kernels and
+// then with every level the CPU supports, both in one go and on demand. The
+// token streams have to match field by field, and on the generated sources so
+// does every scan function from every offset. Run by make check.
+
+// Longest run and widest shift of the generated sources, a few vectors of the
+// widest kernel
+#define MAX_RUN_LENGTH 100
+#define MAX_SHIFT 32
+
+static size_t checked_sources = 0;
+static size_t checked_tokens = 0;
+
+static void out_of_memory() {
+    fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+    exit(1);
+}
+
+// Returns 1 if the tokens agree in every field, otherwise prints the first
+// field that differs
+static int compare_token(FileId file, ScanLevel level, const char* how, size_t index, const Token* expected, const Token* actual) {
+    const char* field = NULL;
+    if (expected->type != actual->type) {
+        field = "type";
+    } else if (expected->keyword != actual->keyword) {
+        field = "keyword";
+    } else if (expected->file != actual->file) {
+        field = "file";
+    } else if (expected->symbol != actual->symbol) {
+        field = "symbol";
+    } else if (expected->offset != actual->offset) {
+        field = "offset";
+    } else if (expected->length != actual->length) {
+        field = "length";
+    }
+
+    if (field == NULL) {
+        return 1;
+    }
+
+    fprintf(stderr, "\033[31mError: %s: token %zu %s with %s differs in its %s\n\033[0m",
+            source_filename(file), index, how, scan_level_to_str(level), field);
+    fprintf(stderr, "\tscalar: %s at %u, length %u\n\t%s: %s at %u, length %u\n",
+            token_type_to_str(expected->type), expected->offset, expected->length, scan_level_to_str(level),
+            token_type_to_str(actual->type), actual->offset, actual->length);
+    return 0;
+}
+
+// Lexes the file at the level both ways and compares the tokens with the scalar
+// ones, returns -1 if they differ
+static int check_level(FileId file, ScanLevel level, const TokenStream* expected) {
+    TokenStream tokens;
+    init_token_stream(&tokens);
+    reserve_token_stream(&tokens, get_source_file(file)->buffer.size);
+    tokenize_source(&tokens, file);
+
+    int status = 0;
+    if (tokens.count != expected->count) {
+        fprintf(stderr, "\033[31mError: %s: %zu tokens with %s, %zu with scalar\n\033[0m",
+                source_filename(file), tokens.count, scan_level_to_str(level), expected->count);
+        status = -1;
+    }
+    for (size_t i = 0; status == 0 && i < tokens.count; i++) {
+        if (!compare_token(file, level, "lexed in one go", i, &expected->tokens[i], &tokens.tokens[i])) {
+            status = -1;
+        }
+    }
+    free_tokens(&tokens);
+
+    Lexer lexer;
+    init_lexer(&lexer, file);
+    Token token;
+    size_t count = 0;
+    while (status == 0 && lex_next_token(&lexer, &token)) {
+        if (count >= expected->count) {
+            fprintf(stderr, "\033[31mError: %s: more tokens lexed on demand with %s than with scalar\n\033[0m",
+                    source_filename(file), scan_level_to_str(level));
+            status = -1;
+        } else if (!compare_token(file, level, "lexed on demand", count, &expected->tokens[count], &token)) {
+            status = -1;
+        }
+        count++;
+    }
+    if (status == 0 && count != expected->count) {
+        fprintf(stderr, "\033[31mError: %s: %zu tokens lexed on demand with %s, %zu with scalar\n\033[0m",
+                source_filename(file), count, scan_level_to_str(level), expected->count);
+        status = -1;
+    }
+    free_lexer(&lexer);
+    return status;
+}
+
+// Checks every supported level against the scalar kernels, returns -1 on the
+// first level that differs
+static int check_source(FileId file) {
+    set_scan_level(SCAN_SCALAR);
+    TokenStream expected;
+    init_token_stream(&expected);
+    reserve_token_stream(&expected, get_source_file(file)->buffer.size);
+    tokenize_source(&expected, file);
+
+    int status = 0;
+    for (ScanLevel level = SCAN_SSE2; status == 0 && level <= SCAN_AVX2; level++) {
+        // Levels the CPU lacks fall back to a lower one that is already checked
+        if (set_scan_level(level) == level) {
+            status = check_level(file, level, &expected);
+        }
+    }
+
+    checked_sources++;
+    checked_tokens += expected.count;
+    free_tokens(&expected);
+    return status;
+}
+
+// Scan functions of scan.h, the lexer loops forever if one stops short of
+// where the scalar one does, so they are compared before any lexing
+typedef size_t (*ScanFunction)(const char* text, size_t length);
+
+static const ScanFunction scan_functions[] = {scan_identifier, scan_digits, scan_inline_space, scan_line, scan_string};
+static const char* scan_function_names[] = {"scan_identifier", "scan_digits", "scan_inline_space", "scan_line", "scan_string"};
+
+#define SCAN_FUNCTION_COUNT (sizeof(scan_functions) / sizeof(scan_functions[0]))
+
+// Runs every scan function from every offset of the buffer at the current
+// level, the results are stored function by function
+static void run_scan_functions(const char* buffer, size_t length, size_t* results) {
+    for (size_t function = 0; function < SCAN_FUNCTION_COUNT; function++) {
+        for (size_t offset = 0; offset < length; offset++) {
+            results[function * length + offset] = scan_functions[function](buffer + offset, length - offset);
+        }
+    }
+}
+
+// Compares the scan functions at every supported level with the scalar ones,
+// returns -1 on the first result that differs
+static int check_scan_functions(const char* name, const char* buffer, size_t length) {
+    size_t* expected = mem_alloc(2 * SCAN_FUNCTION_COUNT * length * sizeof(size_t));
+    if (expected == NULL) {
+        out_of_memory();
+    }
+    size_t* actual = expected + SCAN_FUNCTION_COUNT * length;
+
+    set_scan_level(SCAN_SCALAR);
+    run_scan_functions(buffer, length, expected);
+
+    int status = 0;
+    for (ScanLevel level = SCAN_SSE2; status == 0 && level <= SCAN_AVX2; level++) {
+        if (set_scan_level(level) != level) {
+            continue;
+        }
+
+        run_scan_functions(buffer, length, actual);
+        for (size_t i = 0; i < SCAN_FUNCTION_COUNT * length; i++) {
+            if (actual[i] != expected[i]) {
+                fprintf(stderr, "\033[31mError: %s: %s at offset %zu returns %zu with %s, %zu with scalar\n\033[0m",
+                        name, scan_function_names[i / length], i % length, actual[i], scan_level_to_str(level), expected[i]);
+                status = -1;
+                break;
+            }
+        }
+    }
+
+    mem_free(expected);
+    return status;
+}
+
+// Appends the text the given number of times, cycling through its characters
+static size_t append_run(char* buffer, size_t length, const char* text, size_t count) {
+    size_t text_length = strlen(text);
+    for (size_t i = 0; i < count; i++) {
+        buffer[length++] = text[i % text_length];
+    }
+    return length;
+}
+
+// Checks sources in which a run of every kind the kernels scan starts after
+// shift bytes and is run_length long, and one that ends the buffer
+static int check_generated(size_t run_length, size_t shift) {
+    // Room for the six runs below and the one that ends the buffer
+    char* buffer = mem_alloc(7 * (MAX_SHIFT + MAX_RUN_LENGTH + 4));
+    if (buffer == NULL) {
+        out_of_memory();
+    }
+
+    // An identifier, digits, inline space, a comment, a string and a string the
+    // line ends
+    size_t length = 0;
+    for (int kind = 0; kind < 6; kind++) {
+        length = append_run(buffer, length, " ", shift);
+        switch (kind) {
+            case 0:
+                length = append_run(buffer, length, "a", 1);
+                length = append_run(buffer, length, "b_Z9", run_length);
+                length = append_run(buffer, length, "(", 1);
+                break;
+            case 1:
+                length = append_run(buffer, length, "1", 1);
+                length = append_run(buffer, length, "0123456789", run_length);
+                length = append_run(buffer, length, ";", 1);
+                break;
+            case 2:
+                length = append_run(buffer, length, "x", 1);
+                length = append_run(buffer, length, " \t\r", run_length);
+                length = append_run(buffer, length, "y", 1);
+                break;
+            case 3:
+                length = append_run(buffer, length, "/", 2);
+                length = append_run(buffer, length, "c \"/*", run_length);
+                length = append_run(buffer, length, "\n", 1);
+                break;
+            case 4:
+                length = append_run(buffer, length, "\"", 1);
+                length = append_run(buffer, length, "s \\/", run_length);
+                length = append_run(buffer, length, "\"", 1);
+                break;
+            default:
+                length = append_run(buffer, length, "\"", 1);
+                length = append_run(buffer, length, "s ", run_length);
+                length = append_run(buffer, length, "\n", 1);
+                break;
+        }
+        length = append_run(buffer, length, "\n", 1);
+    }
+
+    // The last run is cut off by the end of the buffer
+    length = append_run(buffer, length, "z", 1);
+    length = append_run(buffer, length, "b_Z9", run_length);
+
+    char name[64];
+    snprintf(name, sizeof(name), "<run of %zu after %zu>", run_length, shift);
+    if (check_scan_functions(name, buffer, length) != 0) {
+        mem_free(buffer);
+        return -1;
+    }
+
+    FileId file = add_source_copy(name, buffer, length);
+    mem_free(buffer);
+    if (file == INVALID_FILE_ID) {
+        out_of_memory();
+    }
+
+    int status = check_source(file);
+    release_source_file(file);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    int status = 0;
+    for (size_t run_length = 0; status == 0 && run_length <= MAX_RUN_LENGTH; run_length++) {
+        for (size_t shift = 0; status == 0 && shift < MAX_SHIFT; shift++) {
+            status = check_generated(run_length, shift);
+        }
+    }
+
+    for (int i = 1; status == 0 && i < argc; i++) {
+        FileId file = add_source_file(argv[i]);
+        if (file == INVALID_FILE_ID) {
+            fprintf(stderr, "\033[31mError: could not read %s\n\033[0m", argv[i]);
+            status = -1;
+            break;
+        }
+        status = check_source(file);
+    }
+
+    if (status == 0) {
+        printf("Scan levels agree on %zu tokens in %zu sources, up to %s\n",
+               checked_tokens, checked_sources, scan_level_to_str(set_scan_level(SCAN_AVX2)));
+    }
+
+    free_source_files();
+    free_numbers();
+    free_interner();
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,428 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "server.h"
+#include "ast.h"
+#include "intern.h"
+#include "ngp.h"
+#include "stats.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Longest request the server reads, a request is a handful of paths
+#define REQUEST_LIMIT (64 * 1024)
+
+// Connections the server lets wait while it compiles
+#define SERVER_BACKLOG 64
+
+// Seconds a client has to send its request and to take the response, one that
+// stalls is dropped so the clients waiting behind it are served
+#define CLIENT_TIMEOUT 10
+
+// Interned names past which the store is dropped after a request, the names
+// are only freed along with it
+#define STORE_SYMBOL_LIMIT (1 << 20)
+
+// A request is one argument per line, ended by an empty line:
+//
+//     -L            adds the directory on the next line to the search paths
+//     --time-report prints the time report of the request
+//     --stop        stops the server once it answered
+//     anything else is the absolute path of the file to compile
+//
+// The response is the errors of the compile, a NUL byte and the exit status in
+// decimal. Requests are served one at a time, each through a library context of
+// its own, and the store keeps the parsed modules in between.
+
+void init_server_options(ServerOptions* options) {
+    options->socket_path = NULL;
+    options->search_paths = NULL;
+    options->search_path_count = 0;
+    options->jobs = 1;
+}
+
+#ifdef _WIN32
+
+int run_server(const ServerOptions* options) {
+    (void)options;
+    fprintf(stderr, "\033[31mError: the compile server needs Unix domain sockets\n\033[0m");
+    return -1;
+}
+
+int request_compile(const char* socket_path, const char* filename, char** search_paths, size_t search_path_count, int time_report) {
+    (void)socket_path;
+    (void)filename;
+    (void)search_paths;
+    (void)search_path_count;
+    (void)time_report;
+    fprintf(stderr, "\033[31mError: the compile server needs Unix domain sockets\n\033[0m");
+    return -1;
+}
+
+#else
+
+// Fills in the address of the socket, returns -1 if the path does not fit
+static int socket_address(const char* path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "\033[31mError: the socket path %s is too long\n\033[0m", path);
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+static int write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+// Reads until the end of the request or the connection, at most limit bytes
+// Returns the bytes read, NUL terminated, or NULL if the connection failed or
+// timed out, with errno set to ENOMEM if the bytes do not fit in memory.
+static char* read_all(int fd, size_t limit, const char* end, size_t* size) {
+    size_t capacity = 4096;
+    char* data = mem_alloc(capacity);
+    if (data == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    *size = 0;
+    for (;;) {
+        if (*size + 1 == capacity) {
+            if (capacity >= limit) {
+                break;
+            }
+            capacity *= 2;
+            char* grown = mem_realloc(data, capacity);
+            if (grown == NULL) {
+                mem_free(data);
+                errno = ENOMEM;
+                return NULL;
+            }
+            data = grown;
+        }
+
+        ssize_t count = read(fd, data + *size, capacity - *size - 1);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            mem_free(data);
+            return NULL;
+        }
+        if (count == 0) {
+            break;
+        }
+        *size += (size_t)count;
+        data[*size] = '\0';
+        if (end != NULL && strstr(data, end) != NULL) {
+            break;
+        }
+    }
+    data[*size] = '\0';
+    return data;
+}
+
+// Ends the response with the exit status and closes the client
+static void finish_response(FILE* out, int status) {
+    fputc('\0', out);
+    fprintf(out, "%d", status);
+    fclose(out);
+}
+
+// Drops the store and with it everything the requests left in the shared
+// tables, the next request starts from empty ones
+static void drop_store(NgpStore** store) {
+    ngp_destroy_store(*store);
+    *store = NULL;
+}
+
+// Compiles the program a request names in a context of its own with the
+// modules of the store, the errors and the time report go to the client
+// Running out of memory fails the request and drops the store, so does a store
+// past STORE_SYMBOL_LIMIT. Closes the client, returns 0 once the server should
+// stop.
+static int serve_request(const ServerOptions* options, NgpStore** store, int client) {
+    FILE* out = fdopen(client, "w");
+    if (out == NULL) {
+        close(client);
+        return 1;
+    }
+
+    // A client that failed or stalled gets no answer, one whose request did not
+    // fit in memory does
+    size_t size;
+    char* request = read_all(client, REQUEST_LIMIT, "\n\n", &size);
+    if (request == NULL && errno == ENOMEM) {
+        fprintf(out, "\033[31mError: out of memory\n\033[0m");
+        finish_response(out, 1);
+        drop_store(store);
+        return 1;
+    }
+    if (request == NULL) {
+        fclose(out);
+        return 1;
+    }
+
+    NgpContext* context = ngp_create_context();
+    if (*store == NULL) {
+        *store = ngp_create_store();
+    }
+    int out_of_memory = context == NULL || *store == NULL;
+    if (context != NULL) {
+        ngp_set_jobs(context, options->jobs);
+    }
+
+    const char* filename = NULL;
+    int time_report = 0;
+    int stop = 0;
+    int search_path_next = 0;
+    for (char* line = request; *line != '\0';) {
+        char* end = strchr(line, '\n');
+        if (end == NULL || end == line) {
+            break;
+        }
+        *end = '\0';
+
+        if (search_path_next) {
+            out_of_memory |= context != NULL && ngp_add_search_path(context, line) != NGP_OK;
+            search_path_next = 0;
+        } else if (strcmp(line, "-L") == 0) {
+            search_path_next = 1;
+        } else if (strcmp(line, "--time-report") == 0) {
+            time_report = 1;
+        } else if (strcmp(line, "--stop") == 0) {
+            stop = 1;
+        } else {
+            filename = line;
+        }
+        line = end + 1;
+    }
+    for (size_t i = 0; context != NULL && i < options->search_path_count; i++) {
+        out_of_memory |= ngp_add_search_path(context, options->search_paths[i]) != NGP_OK;
+    }
+
+    int status = 0;
+    if (out_of_memory) {
+        status = 1;
+    } else if (filename == NULL && !stop) {
+        fprintf(out, "\033[31mError: the request names no file\n\033[0m");
+        status = 1;
+    } else if (filename != NULL) {
+        CompilerStats stats;
+        init_compiler_stats(&stats);
+        size_t nodes = ast_node_count();
+
+        begin_phase(&stats, PHASE_PARSE);
+        NgpStatus compiled = ngp_compile_program(context, filename, *store);
+        const NgpProgramStats* program = ngp_program_stats(context);
+        stats.files = program->files;
+        stats.source_bytes = program->bytes;
+        stats.tokens = program->tokens;
+        stats.nodes = ast_node_count() - nodes;
+        end_phase(&stats);
+
+        for (size_t i = 0; i < ngp_diagnostic_count(context); i++) {
+            ngp_print_diagnostic(ngp_get_diagnostic(context, i), out);
+        }
+        out_of_memory = compiled == NGP_ERROR_MEMORY;
+        status = compiled == NGP_OK ? 0 : 1;
+
+        if (time_report && !out_of_memory) {
+            print_time_report(&stats, out);
+            fprintf(out, "Modules: %zu reused, %zu parsed, %zu in the store\n",
+                    program->reused, program->parsed, ngp_store_size(*store));
+        }
+    }
+    if (out_of_memory) {
+        fprintf(out, "\033[31mError: out of memory\n\033[0m");
+    }
+
+    // The store holds the shared tables on its own
+    ngp_destroy_context(context);
+    if (out_of_memory || (*store != NULL && symbol_count() > STORE_SYMBOL_LIMIT)) {
+        drop_store(store);
+    }
+    mem_free(request);
+
+    finish_response(out, status);
+    return !stop;
+}
+
+// Serves compile requests on a Unix domain socket until a request stops it
+// The parsed modules stay in memory between requests, a module is only lexed
+// and parsed again once its file changes. Returns -1 if the socket cannot be
+// set up.
+int run_server(const ServerOptions* options) {
+    struct sockaddr_un address;
+    if (socket_address(options->socket_path, &address) != 0) {
+        return -1;
+    }
+
+    // A client that goes away must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fprintf(stderr, "\033[31mError: could not create a socket\n\033[0m");
+        return -1;
+    }
+
+    // A socket left behind by a server that did not stop is taken over
+    struct stat info;
+    if (stat(options->socket_path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(options->socket_path);
+    }
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SERVER_BACKLOG) != 0) {
+        fprintf(stderr, "\033[31mError: could not listen on %s\n\033[0m", options->socket_path);
+        close(listener);
+        return -1;
+    }
+
+    // Created by the first request, and again after a request dropped it
+    NgpStore* store = NULL;
+
+    int status = 0;
+    int running = 1;
+    while (running) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0 && errno == EINTR) {
+            continue;
+        }
+        if (client < 0) {
+            fprintf(stderr, "\033[31mError: could not accept a connection on %s\n\033[0m", options->socket_path);
+            status = -1;
+            break;
+        }
+
+        struct timeval timeout = {CLIENT_TIMEOUT, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        running = serve_request(options, &store, client);
+    }
+
+    close(listener);
+    unlink(options->socket_path);
+    ngp_destroy_store(store);
+    return status;
+}
+
+// Writes a path of the request on a line of its own, relative paths are made
+// absolute as the server runs in a directory of its own
+static int write_path(int fd, const char* path) {
+    if (path[0] != '/') {
+        char directory[4096];
+        if (getcwd(directory, sizeof(directory)) == NULL ||
+            write_all(fd, directory, strlen(directory)) != 0 || write_all(fd, "/", 1) != 0) {
+            return -1;
+        }
+    }
+    if (write_all(fd, path, strlen(path)) != 0 || write_all(fd, "\n", 1) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Writes the request for the file, or the one that stops the server if filename
+// is NULL, up to the first write that fails
+static void write_request(int fd, const char* filename, char** search_paths, size_t search_path_count, int time_report) {
+    for (size_t i = 0; i < search_path_count; i++) {
+        if (write_all(fd, "-L\n", 3) != 0 || write_path(fd, search_paths[i]) != 0) {
+            return;
+        }
+    }
+    if (time_report && write_all(fd, "--time-report\n", 14) != 0) {
+        return;
+    }
+    if (filename != NULL ? write_path(fd, filename) != 0 : write_all(fd, "--stop\n", 7) != 0) {
+        return;
+    }
+    write_all(fd, "\n", 1);
+}
+
+// Compiles the file and the modules it imports on the server, or stops the
+// server once the requests before are done if filename is NULL
+// Prints what the server reported and returns the exit status of the request,
+// or -1 if the server cannot be reached.
+int request_compile(const char* socket_path, const char* filename, char** search_paths, size_t search_path_count, int time_report) {
+    struct sockaddr_un address;
+    if (socket_address(socket_path, &address) != 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "\033[31mError: could not connect to the compile server at %s\n\033[0m", socket_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    // A server that cannot take a request answers before it read all of it, so
+    // the answer is read even if the request was cut off
+    signal(SIGPIPE, SIG_IGN);
+    write_request(fd, filename, search_paths, search_path_count, time_report);
+
+    size_t size = 0;
+    char* response = read_all(fd, SIZE_MAX, NULL, &size);
+    int out_of_memory = response == NULL && errno == ENOMEM;
+    close(fd);
+    if (out_of_memory) {
+        fprintf(stderr, "\033[31mError: out of memory\n\033[0m");
+        return -1;
+    }
+
+    // The status follows the last NUL byte
+    size_t end = size;
+    while (response != NULL && end > 0 && response[end - 1] != '\0') {
+        end--;
+    }
+    if (response == NULL || end == 0) {
+        fprintf(stderr, "\033[31mError: the compile server at %s did not answer\n\033[0m", socket_path);
+        mem_free(response);
+        return -1;
+    }
+
+    fwrite(response, 1, end - 1, stderr);
+    int status = atoi(response + end);
+    mem_free(response);
+    return status;
+}
+
+#endif
+
+// Stops the server once it answered the requests before
+int request_stop(const char* socket_path) {
+    return request_compile(socket_path, NULL, NULL, 0, 0);
+}
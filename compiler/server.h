@@ -0,0 +1,20 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+// Structure to hold how the compile server runs
+typedef struct {
+    const char* socket_path;
+    char** search_paths;      // Searched by every request, after the ones it adds
+    size_t search_path_count;
+    size_t jobs;              // Modules a request lexes and parses at a time
+} ServerOptions;
+
+// Function declarations
+void init_server_options(ServerOptions* options);
+int run_server(const ServerOptions* options);
+int request_compile(const char* socket_path, const char* filename, char** search_paths, size_t search_path_count, int time_report);
+int request_stop(const char* socket_path);
+
+#endif // SERVER_H
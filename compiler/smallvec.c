@@ -0,0 +1,83 @@
+#include "smallvec.h"
+#include "utils.h"
+#include <string.h>
+
+void init_small_vec(SmallVec* vec, size_t item_size) {
+    vec->heap = NULL;
+    vec->scratch = NULL;
+    vec->count = 0;
+    vec->capacity = SMALL_VEC_INLINE_SIZE / item_size;
+    vec->item_size = item_size;
+}
+
+// Like init_small_vec, but the list spills into the scratch arena
+void init_scratch_vec(SmallVec* vec, size_t item_size, Arena* scratch) {
+    init_small_vec(vec, item_size);
+    vec->scratch = scratch;
+}
+
+// The items are looked up on every access instead of being pointed to, so a
+// small vector can be moved around like any other struct
+void* small_vec_items(SmallVec* vec) {
+    return vec->heap != NULL ? vec->heap : vec->inline_items;
+}
+
+// Appends a copy of the item, returns -1 if the list could not grow
+int small_vec_push(SmallVec* vec, const void* item) {
+    if (vec->count == vec->capacity) {
+        size_t capacity = vec->capacity == 0 ? 4 : vec->capacity * 2;
+        unsigned char* grown;
+        if (vec->scratch != NULL) {
+            // The old items stay behind in the arena until it is rewound
+            grown = arena_alloc(vec->scratch, capacity * vec->item_size);
+            if (grown == NULL) {
+                return -1;
+            }
+            memcpy(grown, small_vec_items(vec), vec->count * vec->item_size);
+        } else {
+            grown = mem_realloc(vec->heap, capacity * vec->item_size);
+            if (grown == NULL) {
+                return -1;
+            }
+
+            // Leaving the inline storage, bring the items along
+            if (vec->heap == NULL) {
+                memcpy(grown, vec->inline_items, vec->count * vec->item_size);
+            }
+        }
+        vec->heap = grown;
+        vec->capacity = capacity;
+    }
+
+    memcpy((unsigned char*)small_vec_items(vec) + vec->count * vec->item_size, item, vec->item_size);
+    vec->count++;
+    return 0;
+}
+
+// Removes the last item and copies it out, returns 0 if the list was empty
+int small_vec_pop(SmallVec* vec, void* item) {
+    if (vec->count == 0) {
+        return 0;
+    }
+
+    vec->count--;
+    memcpy(item, (unsigned char*)small_vec_items(vec) + vec->count * vec->item_size, vec->item_size);
+    return 1;
+}
+
+// Copies the items into the arena, exactly sized, and releases the vector
+// Returns NULL for an empty list.
+void* small_vec_finish(SmallVec* vec, Arena* arena) {
+    void* items = arena_copy(arena, small_vec_items(vec), vec->count * vec->item_size);
+    free_small_vec(vec);
+    return items;
+}
+
+void free_small_vec(SmallVec* vec) {
+    if (vec->scratch == NULL) {
+        mem_free(vec->heap);
+    }
+    vec->heap = NULL;
+    vec->count = 0;
+    vec->capacity = SMALL_VEC_INLINE_SIZE / vec->item_size;
+}
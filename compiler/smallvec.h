@@ -0,0 +1,36 @@
+#ifndef SMALLVEC_H
+#define SMALLVEC_H
+
+#include "arena.h"
+#include <stddef.h>
+
+// Bytes of items a small vector holds before it moves to the heap
+#define SMALL_VEC_INLINE_SIZE 64
+
+// Structure to hold a growable list that starts out in place
+// The first items are stored inline, so the short lists that make up most of
+// the tree (arguments, parameters, small blocks) are built without touching the
+// heap. Larger lists grow geometrically. Once complete a list is moved into an
+// arena with small_vec_finish, which leaves exactly count items.
+// A list may spill into a scratch arena instead of the heap. Nothing is freed
+// when it grows or finishes then, the owner of the arena rewinds it, so a list
+// abandoned on a parse error does not leak.
+typedef struct {
+    unsigned char* heap; // NULL while the items are inline
+    Arena* scratch;      // Where the items spill to, NULL for the heap
+    size_t count;
+    size_t capacity;
+    size_t item_size;
+    _Alignas(max_align_t) unsigned char inline_items[SMALL_VEC_INLINE_SIZE];
+} SmallVec;
+
+// Function declarations
+void init_small_vec(SmallVec* vec, size_t item_size);
+void init_scratch_vec(SmallVec* vec, size_t item_size, Arena* scratch);
+void* small_vec_items(SmallVec* vec);
+int small_vec_push(SmallVec* vec, const void* item);
+int small_vec_pop(SmallVec* vec, void* item);
+void* small_vec_finish(SmallVec* vec, Arena* arena);
+void free_small_vec(SmallVec* vec);
+
+#endif // SMALLVEC_H
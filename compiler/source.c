@@ -0,0 +1,547 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "source.h"
+#include "scan.h"
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define READ_CHUNK_SIZE 65536
+
+// Files are stored in pages that never move, so that a file can be read while
+// other threads add theirs
+#define FILE_PAGE_BITS 8
+#define FILE_PAGE_SIZE ((size_t)1 << FILE_PAGE_BITS)
+#define FILE_PAGE_COUNT (((size_t)INVALID_FILE_ID + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE)
+
+// The process wide file table, indexed by FileId
+// Adding and releasing files and building line indexes take the lock, reading
+// a file does not: a file is filled in before file_count is raised past it.
+// The ids of released files are handed out again, a file belongs to whoever
+// added it until it is released.
+static SourceFile* file_pages[FILE_PAGE_COUNT];
+static atomic_size_t file_count = 0;
+static FileId* free_files = NULL;
+static size_t free_file_count = 0;
+static size_t free_file_capacity = 0;
+static mtx_t file_lock;
+static once_flag file_lock_once = ONCE_FLAG_INIT;
+
+static void init_file_lock() {
+    mtx_init(&file_lock, mtx_plain);
+}
+
+// Returns the file, or NULL if the id was never handed out
+static SourceFile* get_file(FileId file) {
+    if (file >= atomic_load_explicit(&file_count, memory_order_acquire)) {
+        return NULL;
+    }
+    return &file_pages[file >> FILE_PAGE_BITS][file & (FILE_PAGE_SIZE - 1)];
+}
+
+// Reads the entire stream into a heap buffer, used for pipes and stdin
+// where the size is not known up front and the data cannot be mapped
+static int read_source_stream(FILE* file, SourceBuffer* source) {
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t size = 0;
+    char* data = mem_alloc(capacity);
+    if (data == NULL) {
+        return -1;
+    }
+
+    while (1) {
+        if (size == capacity) {
+            capacity *= 2;
+            char* grown = mem_realloc(data, capacity);
+            if (grown == NULL) {
+                mem_free(data);
+                return -1;
+            }
+            data = grown;
+        }
+
+        size_t read = fread(data + size, 1, capacity - size, file);
+        size += read;
+        if (read == 0) {
+            break;
+        }
+    }
+
+    if (ferror(file)) {
+        mem_free(data);
+        return -1;
+    }
+
+    source->data = data;
+    source->size = size;
+    source->is_mapped = 0;
+    return 0;
+}
+
+static int read_source_fallback(const char* filename, SourceBuffer* source) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    int result = read_source_stream(file, source);
+    fclose(file);
+    return result;
+}
+
+#ifdef _WIN32
+static int map_source_file(const char* filename, SourceBuffer* source) {
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || GetFileType(file) != FILE_TYPE_DISK) {
+        CloseHandle(file);
+        return -1;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return -1;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    // The view keeps the mapping alive, so the handles can be closed right away
+    CloseHandle(mapping);
+    CloseHandle(file);
+
+    if (data == NULL) {
+        return -1;
+    }
+
+    source->data = data;
+    source->size = (size_t)size.QuadPart;
+    source->is_mapped = 1;
+    return 0;
+}
+#else
+static int map_source_file(const char* filename, SourceBuffer* source) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    // The lexer walks the file front to back exactly once
+    posix_madvise(data, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+
+    source->data = data;
+    source->size = (size_t)info.st_size;
+    source->is_mapped = 1;
+    return 0;
+}
+#endif
+
+// Loads a source file, "-" reads from stdin
+// Regular files are memory mapped, anything else (pipes, devices, empty
+// files) is streamed into a heap buffer instead.
+int load_source_file(const char* filename, SourceBuffer* source) {
+    source->data = NULL;
+    source->size = 0;
+    source->is_mapped = 0;
+
+    if (strcmp(filename, "-") == 0) {
+        return read_source_stream(stdin, source);
+    }
+
+    if (map_source_file(filename, source) == 0) {
+        return 0;
+    }
+
+    return read_source_fallback(filename, source);
+}
+
+void free_source_file(SourceBuffer* source) {
+    if (source->data == NULL) {
+        return;
+    }
+
+#ifdef _WIN32
+    if (source->is_mapped) {
+        UnmapViewOfFile(source->data);
+    } else {
+        mem_free((void*)source->data);
+    }
+#else
+    if (source->is_mapped) {
+        munmap((void*)source->data, source->size);
+    } else {
+        mem_free((void*)source->data);
+    }
+#endif
+
+    source->data = NULL;
+    source->size = 0;
+}
+
+// Returns a free slot of the file table, called with the lock held
+static FileId take_file_slot() {
+    if (free_file_count > 0) {
+        return free_files[--free_file_count];
+    }
+
+    size_t count = atomic_load_explicit(&file_count, memory_order_relaxed);
+    if (count >= INVALID_FILE_ID) {
+        return INVALID_FILE_ID;
+    }
+
+    SourceFile** page = &file_pages[count >> FILE_PAGE_BITS];
+    if (*page == NULL) {
+        *page = mem_calloc(FILE_PAGE_SIZE, sizeof(SourceFile));
+        if (*page == NULL) {
+            return INVALID_FILE_ID;
+        }
+    }
+    return (FileId)count;
+}
+
+static FileId add_file_entry(const char* filename, SourceBuffer buffer, int owns_buffer) {
+    // Token offsets are 32-bit
+    char* name = buffer.size <= UINT32_MAX ? strdup_c(filename) : NULL;
+    if (name == NULL) {
+        if (owns_buffer) {
+            free_source_file(&buffer);
+        }
+        return INVALID_FILE_ID;
+    }
+
+    call_once(&file_lock_once, init_file_lock);
+    mtx_lock(&file_lock);
+    FileId id = take_file_slot();
+    if (id != INVALID_FILE_ID) {
+        SourceFile* file = &file_pages[id >> FILE_PAGE_BITS][id & (FILE_PAGE_SIZE - 1)];
+        file->filename = name;
+        file->buffer = buffer;
+        file->owns_buffer = owns_buffer;
+        file->line_starts = NULL;
+        file->line_count = 0;
+        if (id == atomic_load_explicit(&file_count, memory_order_relaxed)) {
+            atomic_store_explicit(&file_count, (size_t)id + 1, memory_order_release);
+        }
+    }
+    mtx_unlock(&file_lock);
+
+    if (id == INVALID_FILE_ID) {
+        mem_free(name);
+        if (owns_buffer) {
+            free_source_file(&buffer);
+        }
+    }
+    return id;
+}
+
+// Loads a file into the file table, see load_source_file
+// Returns INVALID_FILE_ID when the file cannot be read.
+FileId add_source_file(const char* filename) {
+    SourceBuffer buffer;
+    if (load_source_file(filename, &buffer) != 0) {
+        return INVALID_FILE_ID;
+    }
+
+    return add_file_entry(filename, buffer, 1);
+}
+
+// Adds an in-memory buffer to the file table
+// The buffer is not copied, and has to outlive the file table.
+FileId add_source_buffer(const char* filename, const char* data, size_t size) {
+    SourceBuffer buffer;
+    buffer.data = data;
+    buffer.size = size;
+    buffer.is_mapped = 0;
+    return add_file_entry(filename, buffer, 0);
+}
+
+// Adds a copy of an in-memory buffer to the file table, the copy is freed with
+// the file
+FileId add_source_copy(const char* filename, const char* data, size_t size) {
+    // Always allocate at least one byte, so an empty file still has a buffer
+    char* copy = mem_alloc(size + 1);
+    if (copy == NULL) {
+        return INVALID_FILE_ID;
+    }
+    if (size > 0) {
+        memcpy(copy, data, size);
+    }
+
+    SourceBuffer buffer;
+    buffer.data = copy;
+    buffer.size = size;
+    buffer.is_mapped = 0;
+    return add_file_entry(filename, buffer, 1);
+}
+
+const SourceFile* get_source_file(FileId file) {
+    return get_file(file);
+}
+
+const char* source_filename(FileId file) {
+    SourceFile* source = get_file(file);
+    if (source == NULL || source->filename == NULL) {
+        return "<unknown>";
+    }
+    return source->filename;
+}
+
+// Builds the offsets at which every line of the file starts
+static void build_line_index(SourceFile* file) {
+    const char* data = file->buffer.data;
+    size_t size = file->buffer.size;
+
+    size_t capacity = 64;
+    uint32_t* line_starts = mem_alloc(capacity * sizeof(uint32_t));
+    if (line_starts == NULL) {
+        return;
+    }
+
+    size_t line_count = 0;
+    line_starts[line_count++] = 0;
+
+    size_t offset = scan_line(data, size);
+    while (offset < size) {
+        if (line_count == capacity) {
+            capacity *= 2;
+            uint32_t* grown = mem_realloc(line_starts, capacity * sizeof(uint32_t));
+            if (grown == NULL) {
+                mem_free(line_starts);
+                return;
+            }
+            line_starts = grown;
+        }
+
+        // Skip past the '\n'
+        offset++;
+        line_starts[line_count++] = (uint32_t)offset;
+        offset += scan_line(data + offset, size - offset);
+    }
+
+    file->line_starts = line_starts;
+    file->line_count = line_count;
+}
+
+// Returns the index of the last line that starts at or before the offset
+static size_t find_line(const SourceFile* file, size_t offset) {
+    size_t low = 0;
+    size_t high = file->line_count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (file->line_starts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Resolves an offset into a 1-based line and column
+// The line index of the file is built on first use, after that every
+// lookup is a binary search. Workers report errors in the same file at the
+// same time, so the index is built and read under the file lock.
+void source_location(FileId file, uint32_t offset, size_t* line, size_t* column) {
+    *line = 0;
+    *column = 0;
+
+    SourceFile* source = get_file(file);
+    if (source == NULL || source->filename == NULL) {
+        return;
+    }
+
+    init_scan_kernels();
+    call_once(&file_lock_once, init_file_lock);
+    mtx_lock(&file_lock);
+    if (source->line_starts == NULL) {
+        build_line_index(source);
+    }
+    if (source->line_starts != NULL) {
+        size_t index = find_line(source, offset);
+        *line = index + 1;
+        *column = offset - source->line_starts[index] + 1;
+    }
+    mtx_unlock(&file_lock);
+}
+
+// Patches the line index of the file for an edit, instead of rebuilding it
+// Lines that started inside the removed range are dropped, the lines of the
+// new text are added and every later line start is shifted.
+static int patch_line_index(SourceFile* file, size_t offset, size_t removed_length, const char* text, size_t text_length) {
+    size_t removed_end = offset + removed_length;
+
+    // Lines [first, last) started inside the removed range
+    size_t first = find_line(file, offset) + 1;
+    size_t last = find_line(file, removed_end) + 1;
+
+    size_t added = 0;
+    for (size_t i = 0; i < text_length; i++) {
+        if (text[i] == '\n') {
+            added++;
+        }
+    }
+
+    // The index is only reallocated when it grows, since the later lines
+    // still have to be moved out of the way when it shrinks
+    size_t line_count = file->line_count - (last - first) + added;
+    uint32_t* line_starts = file->line_starts;
+    if (line_count > file->line_count) {
+        line_starts = mem_realloc(line_starts, line_count * sizeof(uint32_t));
+        if (line_starts == NULL) {
+            return -1;
+        }
+    }
+
+    // Move the later lines into place and shift them
+    memmove(&line_starts[first + added], &line_starts[last], (file->line_count - last) * sizeof(uint32_t));
+    for (size_t i = first + added; i < line_count; i++) {
+        line_starts[i] = (uint32_t)(line_starts[i] - removed_length + text_length);
+    }
+
+    size_t index = first;
+    for (size_t i = 0; i < text_length; i++) {
+        if (text[i] == '\n') {
+            line_starts[index++] = (uint32_t)(offset + i + 1);
+        }
+    }
+
+    file->line_starts = line_starts;
+    file->line_count = line_count;
+    return 0;
+}
+
+// Replaces removed_length bytes at offset with the given text
+// The file gets a new heap buffer with the edit applied, so any pointer into
+// the old contents is invalidated. Returns -1 if the edit is out of range.
+int edit_source_file(FileId file, size_t offset, size_t removed_length, const char* text, size_t text_length) {
+    SourceFile* source = get_file(file);
+    if (source == NULL || source->filename == NULL) {
+        return -1;
+    }
+
+    size_t size = source->buffer.size;
+    if (offset > size || removed_length > size - offset) {
+        return -1;
+    }
+
+    size_t new_size = size - removed_length + text_length;
+    if (new_size > UINT32_MAX) {
+        return -1;
+    }
+
+    // Always allocate at least one byte, so an empty file still has a buffer
+    char* data = mem_alloc(new_size + 1);
+    if (data == NULL) {
+        return -1;
+    }
+
+    memcpy(data, source->buffer.data, offset);
+    memcpy(data + offset, text, text_length);
+    memcpy(data + offset + text_length, source->buffer.data + offset + removed_length, size - offset - removed_length);
+
+    call_once(&file_lock_once, init_file_lock);
+    mtx_lock(&file_lock);
+    if (source->line_starts != NULL && patch_line_index(source, offset, removed_length, text, text_length) != 0) {
+        mem_free(source->line_starts);
+        source->line_starts = NULL;
+        source->line_count = 0;
+    }
+    mtx_unlock(&file_lock);
+
+    if (source->owns_buffer) {
+        free_source_file(&source->buffer);
+    }
+
+    source->buffer.data = data;
+    source->buffer.size = new_size;
+    source->buffer.is_mapped = 0;
+    source->owns_buffer = 1;
+    return 0;
+}
+
+static void clear_file(SourceFile* file) {
+    mem_free(file->filename);
+    mem_free(file->line_starts);
+    if (file->owns_buffer) {
+        free_source_file(&file->buffer);
+    }
+    memset(file, 0, sizeof(SourceFile));
+}
+
+// Frees a file and hands its id back to the table, the id must not be used after
+void release_source_file(FileId file) {
+    SourceFile* source = get_file(file);
+    if (source == NULL || source->filename == NULL) {
+        return;
+    }
+
+    call_once(&file_lock_once, init_file_lock);
+    mtx_lock(&file_lock);
+    clear_file(source);
+    if (free_file_count == free_file_capacity) {
+        size_t capacity = free_file_capacity == 0 ? 16 : free_file_capacity * 2;
+        FileId* grown = mem_realloc(free_files, capacity * sizeof(FileId));
+        if (grown == NULL) {
+            // The id is simply not handed out again
+            mtx_unlock(&file_lock);
+            return;
+        }
+        free_files = grown;
+        free_file_capacity = capacity;
+    }
+    free_files[free_file_count++] = file;
+    mtx_unlock(&file_lock);
+}
+
+// Frees every file, no other thread may use the table while it runs
+void free_source_files() {
+    size_t count = atomic_load(&file_count);
+    for (size_t i = 0; i < count; i++) {
+        clear_file(&file_pages[i >> FILE_PAGE_BITS][i & (FILE_PAGE_SIZE - 1)]);
+    }
+    for (size_t i = 0; i < FILE_PAGE_COUNT; i++) {
+        mem_free(file_pages[i]);
+        file_pages[i] = NULL;
+    }
+
+    mem_free(free_files);
+    free_files = NULL;
+    free_file_count = 0;
+    free_file_capacity = 0;
+    atomic_store(&file_count, 0);
+}
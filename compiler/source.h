@@ -0,0 +1,47 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Structure to hold the contents of a source file
+// The data is either mapped directly from disk or, when mapping is not
+// possible (pipes, stdin, empty files), read into a heap buffer.
+// Note that the data is NOT null terminated, always use size.
+typedef struct {
+    const char* data;
+    size_t size;
+    int is_mapped;
+} SourceBuffer;
+
+// Files are identified by their index in the file table
+typedef uint16_t FileId;
+
+#define INVALID_FILE_ID UINT16_MAX
+
+// Structure to hold a file in the file table
+// The line index holds the offset at which every line starts, it is only
+// built once a location in the file is actually needed.
+typedef struct {
+    char* filename;
+    SourceBuffer buffer;
+    int owns_buffer;
+    uint32_t* line_starts;
+    size_t line_count;
+} SourceFile;
+
+// Function declarations
+int load_source_file(const char* filename, SourceBuffer* source);
+void free_source_file(SourceBuffer* source);
+
+FileId add_source_file(const char* filename);
+FileId add_source_buffer(const char* filename, const char* data, size_t size);
+FileId add_source_copy(const char* filename, const char* data, size_t size);
+const SourceFile* get_source_file(FileId file);
+const char* source_filename(FileId file);
+void source_location(FileId file, uint32_t offset, size_t* line, size_t* column);
+int edit_source_file(FileId file, size_t offset, size_t removed_length, const char* text, size_t text_length);
+void release_source_file(FileId file);
+void free_source_files();
+
+#endif // SOURCE_H
@@ -0,0 +1,170 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "stats.h"
+#include "utils.h"
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+static double wall_time() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static double cpu_time() {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+// Returns the peak resident set of the process so far, 0 if it is unknown
+static size_t peak_rss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return (size_t)counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+void init_compiler_stats(CompilerStats* stats) {
+    memset(stats, 0, sizeof(CompilerStats));
+}
+
+// Starts timing a phase, the phase that is running is ended first
+void begin_phase(CompilerStats* stats, CompilerPhase phase) {
+    if (stats->running) {
+        end_phase(stats);
+    }
+
+    AllocationStats allocation = get_allocation_stats();
+    stats->current = phase;
+    stats->running = 1;
+    stats->bytes_start = allocation.bytes;
+    stats->allocations_start = allocation.allocations + allocation.reallocations;
+    stats->cpu_start = cpu_time();
+    stats->wall_start = wall_time();
+}
+
+void end_phase(CompilerStats* stats) {
+    if (!stats->running) {
+        return;
+    }
+
+    double wall = wall_time();
+    double cpu = cpu_time();
+    AllocationStats allocation = get_allocation_stats();
+
+    PhaseStats* phase = &stats->phases[stats->current];
+    phase->ran = 1;
+    phase->wall_seconds += wall - stats->wall_start;
+    phase->cpu_seconds += cpu - stats->cpu_start;
+    phase->bytes += allocation.bytes - stats->bytes_start;
+    phase->allocations += allocation.allocations + allocation.reallocations - stats->allocations_start;
+    phase->peak_rss = peak_rss();
+    stats->running = 0;
+}
+
+const char* phase_to_str(CompilerPhase phase) {
+    switch (phase) {
+        case PHASE_READ: return "read";
+        case PHASE_LEX: return "lex";
+        case PHASE_PARSE: return "parse";
+        case PHASE_BODIES: return "bodies";
+        case PHASE_RESOLVE: return "resolve";
+        case PHASE_CACHE: return "cache";
+        case PHASE_PRINT: return "print";
+        case PHASE_FREE: return "free";
+        default: return "Invalid";
+    }
+}
+
+static PhaseStats total_stats(const CompilerStats* stats) {
+    PhaseStats total;
+    memset(&total, 0, sizeof(PhaseStats));
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseStats* phase = &stats->phases[i];
+        total.wall_seconds += phase->wall_seconds;
+        total.cpu_seconds += phase->cpu_seconds;
+        total.bytes += phase->bytes;
+        total.allocations += phase->allocations;
+        if (phase->peak_rss > total.peak_rss) {
+            total.peak_rss = phase->peak_rss;
+        }
+    }
+    return total;
+}
+
+// Tokens are counted by the lexer, which runs as part of the parse when it
+// is not run up front
+static double tokens_per_second(const CompilerStats* stats) {
+    double seconds = stats->phases[PHASE_LEX].ran ? stats->phases[PHASE_LEX].wall_seconds : stats->phases[PHASE_PARSE].wall_seconds;
+    return seconds > 0 ? (double)stats->tokens / seconds : 0;
+}
+
+static void print_phase_row(FILE* out, const char* name, const PhaseStats* phase) {
+    fprintf(out, "%-8s %10.3f %10.3f %14zu %12zu %12.1f\n", name,
+            phase->wall_seconds * 1000, phase->cpu_seconds * 1000,
+            phase->bytes, phase->allocations, (double)phase->peak_rss / (1024 * 1024));
+}
+
+// Prints a table of the phases that ran, followed by the counters
+void print_time_report(const CompilerStats* stats, FILE* out) {
+    fprintf(out, "%-8s %10s %10s %14s %12s %12s\n", "Phase", "Wall ms", "CPU ms", "Bytes", "Allocations", "Peak RSS MB");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (stats->phases[i].ran) {
+            print_phase_row(out, phase_to_str((CompilerPhase)i), &stats->phases[i]);
+        }
+    }
+
+    PhaseStats total = total_stats(stats);
+    print_phase_row(out, "total", &total);
+
+    fprintf(out, "Files: %zu, source bytes: %zu\n", stats->files, stats->source_bytes);
+    fprintf(out, "Tokens: %zu (%.0f tokens/s)\n", stats->tokens, tokens_per_second(stats));
+    fprintf(out, "Nodes: %zu\n", stats->nodes);
+}
+
+static void write_phase_json(FILE* out, const PhaseStats* phase) {
+    fprintf(out, "{\"wall_seconds\": %.9f, \"cpu_seconds\": %.9f, \"bytes\": %zu, \"allocations\": %zu, \"peak_rss\": %zu}",
+            phase->wall_seconds, phase->cpu_seconds, phase->bytes, phase->allocations, phase->peak_rss);
+}
+
+// Writes the same numbers as print_time_report as a single JSON object
+// Phases that did not run are left out, sizes are in bytes and times in seconds.
+void write_stats_json(const CompilerStats* stats, FILE* out) {
+    fprintf(out, "{\"phases\": {");
+    int first = 1;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (!stats->phases[i].ran) {
+            continue;
+        }
+        fprintf(out, "%s\"%s\": ", first ? "" : ", ", phase_to_str((CompilerPhase)i));
+        write_phase_json(out, &stats->phases[i]);
+        first = 0;
+    }
+
+    PhaseStats total = total_stats(stats);
+    fprintf(out, "}, \"total\": ");
+    write_phase_json(out, &total);
+    fprintf(out, ", \"files\": %zu, \"source_bytes\": %zu, \"tokens\": %zu, \"tokens_per_second\": %.1f, \"nodes\": %zu}\n",
+            stats->files, stats->source_bytes, stats->tokens, tokens_per_second(stats), stats->nodes);
+}
@@ -0,0 +1,56 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Phases of a compiler run, in the order they run in
+typedef enum {
+    PHASE_READ,   // Loading the sources
+    PHASE_LEX,    // Lexing up front, an on-demand lexer is part of the parse
+    PHASE_PARSE,
+    PHASE_BODIES, // Parsing skimmed function bodies, or taking them from the cache
+    PHASE_RESOLVE, // Resolving names to their declarations
+    PHASE_CACHE,  // Reading and writing the module cache
+    PHASE_PRINT,
+    PHASE_FREE,
+    PHASE_COUNT   // Number of phases, not a phase
+} CompilerPhase;
+
+// Structure to hold what one phase cost
+// A phase can run several times, the numbers add up.
+typedef struct {
+    int ran;
+    double wall_seconds;
+    double cpu_seconds;
+    size_t bytes;       // Requested from the allocator
+    size_t allocations;
+    size_t peak_rss;    // Peak resident set of the process when the phase ended, in bytes
+} PhaseStats;
+
+// Structure to hold the numbers behind --time-report and --stats-json
+typedef struct {
+    PhaseStats phases[PHASE_COUNT];
+    CompilerPhase current;
+    int running;
+    double wall_start;
+    double cpu_start;
+    size_t bytes_start;
+    size_t allocations_start;
+
+    // Counters filled in by the driver
+    size_t files;
+    size_t source_bytes;
+    size_t tokens;
+    size_t nodes;
+} CompilerStats;
+
+// Function declarations
+void init_compiler_stats(CompilerStats* stats);
+void begin_phase(CompilerStats* stats, CompilerPhase phase);
+void end_phase(CompilerStats* stats);
+const char* phase_to_str(CompilerPhase phase);
+void print_time_report(const CompilerStats* stats, FILE* out);
+void write_stats_json(const CompilerStats* stats, FILE* out);
+
+#endif // STATS_H
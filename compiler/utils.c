@@ -2,16 +2,25 @@
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#include "utils.h"
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Counters behind get_allocation_stats, atomic since the parser allocates from
+// several threads at once
+static atomic_size_t allocations = 0;
+static atomic_size_t reallocations = 0;
+static atomic_size_t frees = 0;
+static atomic_size_t bytes = 0;
+
 char* strndup(const char* str, size_t n) {
     size_t len = 0;
     while (len < n && str[len] != '\0') {
         len++;
     }
 
-    char* result = (char*)malloc(len + 1);
+    char* result = (char*)mem_alloc(len + 1);
     if (!result) {
         return NULL;
     }
@@ -26,10 +35,50 @@ char* strndup(const char* str, size_t n) {
 
 char* strdup_c(const char* str) {
     size_t len = strlen(str);
-    char* new_str = malloc(len + 1);
+    char* new_str = mem_alloc(len + 1);
     if (new_str == NULL) {
         return NULL;
     }
     strcpy(new_str, str);
     return new_str;
 }
+
+// Thin wrappers around the C allocator that count every call, all heap
+// memory of the compiler goes through these
+void* mem_alloc(size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes, size, memory_order_relaxed);
+    return malloc(size);
+}
+
+void* mem_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes, count * size, memory_order_relaxed);
+    return calloc(count, size);
+}
+
+void* mem_realloc(void* memory, size_t size) {
+    if (memory == NULL) {
+        atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&reallocations, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&bytes, size, memory_order_relaxed);
+    return realloc(memory, size);
+}
+
+void mem_free(void* memory) {
+    if (memory != NULL) {
+        atomic_fetch_add_explicit(&frees, 1, memory_order_relaxed);
+    }
+    free(memory);
+}
+
+AllocationStats get_allocation_stats() {
+    AllocationStats stats;
+    stats.allocations = atomic_load(&allocations);
+    stats.reallocations = atomic_load(&reallocations);
+    stats.frees = atomic_load(&frees);
+    stats.bytes = atomic_load(&bytes);
+    return stats;
+}
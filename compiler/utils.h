@@ -1,7 +1,23 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+
+// Structure to hold the allocation counters of the mem_* functions
+typedef struct {
+    size_t allocations;   // mem_alloc, mem_calloc and mem_realloc of NULL
+    size_t reallocations; // mem_realloc of an existing block
+    size_t frees;
+    size_t bytes;         // Requested by every allocation and reallocation
+} AllocationStats;
+
 char* strndup(const char* str, size_t n);
 char* strdup_c(const char* str);
 
+void* mem_alloc(size_t size);
+void* mem_calloc(size_t count, size_t size);
+void* mem_realloc(void* memory, size_t size);
+void mem_free(void* memory);
+AllocationStats get_allocation_stats();
+
 #endif // UTILS_H
@@ -0,0 +1,199 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "writer.h"
+#include "utils.h"
+#include <string.h>
+
+// Large enough that a dump of a big file takes few writes
+#define WRITER_CAPACITY (256 * 1024)
+
+static const char spaces[] = "                                                                ";
+
+void init_writer(Writer* writer, FILE* file) {
+    writer->file = file;
+    writer->data = mem_alloc(WRITER_CAPACITY);
+    writer->used = 0;
+    writer->capacity = writer->data != NULL ? WRITER_CAPACITY : 0;
+    writer->failed = 0;
+}
+
+static void write_out(Writer* writer, const char* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, writer->file) != size) {
+        writer->failed = 1;
+    }
+}
+
+void write_bytes(Writer* writer, const char* data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    if (writer->used + size > writer->capacity) {
+        write_out(writer, writer->data, writer->used);
+        writer->used = 0;
+
+        // Anything that does not fit in the buffer goes straight to the file
+        if (size > writer->capacity) {
+            write_out(writer, data, size);
+            return;
+        }
+    }
+
+    memcpy(writer->data + writer->used, data, size);
+    writer->used += size;
+}
+
+void write_cstr(Writer* writer, const char* text) {
+    write_bytes(writer, text, strlen(text));
+}
+
+void write_char(Writer* writer, char c) {
+    if (writer->used < writer->capacity) {
+        writer->data[writer->used++] = c;
+    } else {
+        write_bytes(writer, &c, 1);
+    }
+}
+
+// Formats the digits back to front into a small buffer, returns where they start
+static char* format_uint(char* end, uint64_t value) {
+    char* start = end;
+    do {
+        *--start = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return start;
+}
+
+void write_uint(Writer* writer, uint64_t value) {
+    char digits[20];
+    char* start = format_uint(digits + sizeof(digits), value);
+    write_bytes(writer, start, (size_t)(digits + sizeof(digits) - start));
+}
+
+void write_int(Writer* writer, int64_t value) {
+    if (value < 0) {
+        write_char(writer, '-');
+        write_uint(writer, (uint64_t)0 - (uint64_t)value);
+    } else {
+        write_uint(writer, (uint64_t)value);
+    }
+}
+
+void write_padding(Writer* writer, size_t count) {
+    while (count > 0) {
+        size_t size = count < sizeof(spaces) - 1 ? count : sizeof(spaces) - 1;
+        write_bytes(writer, spaces, size);
+        count -= size;
+    }
+}
+
+// Writes the text left aligned in a field of width characters, like "%-*.*s"
+// Text longer than the field is written whole.
+void write_padded(Writer* writer, const char* data, size_t size, size_t width) {
+    write_bytes(writer, data, size);
+    if (size < width) {
+        write_padding(writer, width - size);
+    }
+}
+
+void write_padded_uint(Writer* writer, uint64_t value, size_t width) {
+    char digits[20];
+    char* start = format_uint(digits + sizeof(digits), value);
+    write_padded(writer, start, (size_t)(digits + sizeof(digits) - start), width);
+}
+
+// Returns the length of the UTF-8 sequence at the start of data, 0 if it is invalid
+static size_t utf8_sequence_length(const unsigned char* data, size_t size) {
+    size_t length;
+    if (data[0] >= 0xc2 && data[0] <= 0xdf) {
+        length = 2;
+    } else if (data[0] >= 0xe0 && data[0] <= 0xef) {
+        length = 3;
+    } else if (data[0] >= 0xf0 && data[0] <= 0xf4) {
+        length = 4;
+    } else {
+        return 0;
+    }
+    if (length > size) {
+        return 0;
+    }
+
+    // Overlong forms, surrogates and code points past U+10FFFF are invalid too
+    if ((data[0] == 0xe0 && data[1] < 0xa0) || (data[0] == 0xed && data[1] > 0x9f) ||
+        (data[0] == 0xf0 && data[1] < 0x90) || (data[0] == 0xf4 && data[1] > 0x8f)) {
+        return 0;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if ((data[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+// Writes the text as a quoted JSON string, escaping what JSON does not allow
+// Bytes that are not valid UTF-8 are replaced with U+FFFD.
+void write_json_string(Writer* writer, const char* data, size_t size) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    write_char(writer, '"');
+    size_t start = 0;
+    size_t i = 0;
+    while (i < size) {
+        unsigned char c = bytes[i];
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            i++;
+            continue;
+        }
+        if (c >= 0x80) {
+            size_t length = utf8_sequence_length(bytes + i, size - i);
+            if (length != 0) {
+                i += length;
+                continue;
+            }
+        }
+
+        // Runs of plain characters are copied at once
+        write_bytes(writer, data + start, i - start);
+        switch (c) {
+            case '"': write_bytes(writer, "\\\"", 2); break;
+            case '\\': write_bytes(writer, "\\\\", 2); break;
+            case '\n': write_bytes(writer, "\\n", 2); break;
+            case '\r': write_bytes(writer, "\\r", 2); break;
+            case '\t': write_bytes(writer, "\\t", 2); break;
+            default:
+                if (c >= 0x80) {
+                    write_bytes(writer, "\\ufffd", 6);
+                } else {
+                    char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                    write_bytes(writer, escape, sizeof(escape));
+                }
+                break;
+        }
+        i++;
+        start = i;
+    }
+    write_bytes(writer, data + start, size - start);
+    write_char(writer, '"');
+}
+
+// Hands everything buffered to the file, returns -1 if any write failed
+int flush_writer(Writer* writer) {
+    write_out(writer, writer->data, writer->used);
+    writer->used = 0;
+    if (fflush(writer->file) != 0) {
+        writer->failed = 1;
+    }
+    return writer->failed ? -1 : 0;
+}
+
+void free_writer(Writer* writer) {
+    mem_free(writer->data);
+    writer->data = NULL;
+    writer->used = 0;
+    writer->capacity = 0;
+}
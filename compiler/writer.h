@@ -0,0 +1,39 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Formats the dumps can be written in
+typedef enum {
+    DUMP_TEXT, // The tables and trees meant to be read
+    DUMP_JSON  // One JSON object per line, meant to be streamed by tools
+} DumpFormat;
+
+// Structure to hold a buffered output stream
+// Output is gathered in one large buffer and handed to the file when it is
+// full, numbers are formatted by hand rather than through printf.
+typedef struct {
+    FILE* file;
+    char* data;      // NULL if the buffer could not be allocated, writes go to the file directly
+    size_t used;
+    size_t capacity;
+    int failed;      // Set once a write to the file failed
+} Writer;
+
+// Function declarations
+void init_writer(Writer* writer, FILE* file);
+void write_bytes(Writer* writer, const char* data, size_t size);
+void write_cstr(Writer* writer, const char* text);
+void write_char(Writer* writer, char c);
+void write_uint(Writer* writer, uint64_t value);
+void write_int(Writer* writer, int64_t value);
+void write_padding(Writer* writer, size_t count);
+void write_padded(Writer* writer, const char* data, size_t size, size_t width);
+void write_padded_uint(Writer* writer, uint64_t value, size_t width);
+void write_json_string(Writer* writer, const char* data, size_t size);
+int flush_writer(Writer* writer);
+void free_writer(Writer* writer);
+
+#endif // WRITER_H